@@ -33,10 +33,23 @@
 #include <unistd.h>
 #include <getopt.h>
 
+#include "hexbinhex.h"
+#include "hbh_io.h"
+#include "hbh_batch.h"
+#include "hbh_range.h"
+
 void display_usage() {
-fprintf(stderr,"Usage: 012bin [-h][-B][-L][-o <out filename>] [filename]\n");
+fprintf(stderr,"Usage: 012bin [-h][-v][-K kernel][-B][-L][--offset n][--length n][-o <out filename>] [filename]\n");
 fprintf(stderr,"  -B         Treats bits as big endian\n");
 fprintf(stderr,"  -L         Treats bits as little endian (default)\n");
+fprintf(stderr,"  -v         Report throughput to stderr\n");
+fprintf(stderr,"  -K name    Use the scalar, sse4, avx2 or avx512 kernels\n");
+fprintf(stderr,"  --offset n Start from byte n of the binary\n");
+fprintf(stderr,"  --length n Convert n bytes at most\n");
+fprintf(stderr,"  --batch <glob|@list> Convert each matching or listed file to its own file\n");
+fprintf(stderr,"  --batch-out <template> Output path of each, default %%d/%%b.%%e\n");
+fprintf(stderr,"  --batch-jobs <n> Convert the batch on n threads (default one per CPU)\n");
+fprintf(stderr,"  -o filename Output to file filename instead of stdout\n");
 fprintf(stderr,"Convert ascii binary (01001001) to binary data.\n");
 fprintf(stderr,"  Author: David Johnston, dj@deadhat.com\n");
 fprintf(stderr,"\n");
@@ -49,35 +62,46 @@ fprintf(stderr,"\n");
 int main(int argc, char** argv)
 {
     int opt;
-	int i;
 	
-	FILE *ifp;
-	FILE *ofp;
+	FILE *ofp = NULL;
 	int using_outfile;
-	int using_infile;
+	int using_infile = 0;
 	char filename[1000];
 	char infilename[1000];
+    char batch[1000];
+    char batchout[1000];
+    int jobs = 0;
 	
     int littleendian = 1;
     int gotB = 0;
     int gotL = 0;    
-    int abyte;
-    //int verbose = 0;
+    int verbose = 0;
+    uint64_t first = 0;
+    uint64_t count = UINT64_MAX;
     
 	/* Defaults */
 	using_outfile = 0;       /* use stdout instead of outputfile*/
 
     filename[0] = (char)0;
 	infilename[0] = (char)0;
+    batch[0] = (char)0;
+    strcpy(batchout, HBH_BATCH_OUT);
 
 	/* get the options and arguments */
     int longIndex;
 
-    char optString[] = "o:BLh";
+    char optString[] = "o:BLK:vh";
     static const struct option longOpts[] = {
-    { "output", no_argument, NULL, 'o' },
+    { "output", required_argument, NULL, 'o' },
     { "bigendian", no_argument, NULL, 'B' },
     { "littleendian", no_argument, NULL, 'L' },
+    { "verbose", no_argument, NULL, 'v' },
+    { "kernel", required_argument, NULL, 'K' },
+    { "offset", required_argument, NULL, 'F' },
+    { "length", required_argument, NULL, 'N' },
+    { "batch", required_argument, NULL, 'A' },
+    { "batch-out", required_argument, NULL, 'O' },
+    { "batch-jobs", required_argument, NULL, 'J' },
     { "help", no_argument, NULL, 'h' },
     { NULL, no_argument, NULL, 0 }
     };
@@ -97,6 +121,46 @@ int main(int argc, char** argv)
                 littleendian = 1;
                 gotL = 1;
                 break;
+            case 'v':
+                verbose=1;
+                break;
+            case 'K':
+                if (hbh_kernel_set(hbh_kernel_parse(optarg)) != 0) {
+                    fprintf(stderr,"Error: kernel %s is unknown or not supported by this CPU\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'F':
+                if (hbh_parse_count(optarg, &first) != 0) {
+                    fprintf(stderr,"Error: --offset %s is not a byte count\n", optarg);
+                    display_usage();
+                    exit(1);
+                }
+                break;
+            case 'N':
+                if (hbh_parse_count(optarg, &count) != 0) {
+                    fprintf(stderr,"Error: --length %s is not a byte count\n", optarg);
+                    display_usage();
+                    exit(1);
+                }
+                break;
+            case 'A':
+                if (strlen(optarg) >= sizeof(batch)) {
+                    fprintf(stderr,"Error: batch file list too long\n");
+                    exit(1);
+                }
+                strcpy(batch,optarg);
+                break;
+            case 'O':
+                if (strlen(optarg) >= sizeof(batchout)) {
+                    fprintf(stderr,"Error: batch output template too long\n");
+                    exit(1);
+                }
+                strcpy(batchout,optarg);
+                break;
+            case 'J':
+                jobs = atoi(optarg);
+                break;
             case 'h':   /* fall-through is intentional */
             case '?':
                 display_usage();
@@ -122,6 +186,17 @@ int main(int argc, char** argv)
         
 	/* Range check the var args */
 
+    /* Batch mode converts each listed file to a file of its own */
+    if (batch[0] != 0) {
+        hbh_format from = { HBH_BITS, 32, 0, 0, 0, !littleendian };
+        hbh_format to = { HBH_BIN };
+
+        if ((using_outfile==1) || (using_infile==1) || (first != 0) || (count != UINT64_MAX)) {
+            fprintf(stderr,"Error: --batch names its own files, so takes no -o, filename, --offset or --length\n");
+            exit(1);
+        }
+        exit((hbh_batch_run("012bin", batch, batchout, &from, &to, 0, jobs, verbose) == 0) ? 0 : 1);
+    }
 
 	/* open the output file if needed */
 
@@ -134,85 +209,77 @@ int main(int argc, char** argv)
 		}
 	}
 
-	/* open the input file if needed */
-	if (using_infile==1)
-	{
-        ifp =  fopen(infilename, "r");
-		    
-		if (ifp == NULL) {
-			perror("failed to open input file for reading");
-			exit(1);
-		}
-	}
+    /* open the input, memory mapping it if it is a regular file */
+    hbh_input input;
 
-    unsigned char buffer[2048];
-    unsigned char outbuffer[256];
-    int outindex = 0;
-    int bitcount = 0;
-    int done=0;
-    size_t len;
-    char binch;
-    int remainder=0;
+    if (hbh_input_open(&input, (using_infile==1) ? infilename : NULL) != 0) {
+        perror("failed to open input file for reading");
+        exit(1);
+    }
 
-    do {
+    const unsigned char *buffer;
+    unsigned char *outbuffer;
+    size_t outsize;
+    size_t outindex;
+    hbh_output output;
+    long len;
+    hbh_bits_decoder state;
+    hbh_range range;
+    int ranged = (first != 0) || (count != UINT64_MAX);
 
-        // Tricky offset of the left over bits from the previous
-        // block by pulling in 512 new bits (as chars) but putting
-        // the location just after the remainder. 
-        // The end of this routine moves the new remainder to
-        // the start of the buffer.
-        // The buffer is bigger than 512, so there is space.
+    /* A range starts from the checkpoint before it */
+    if (ranged==1) {
+        hbh_format from = { HBH_BITS, 32, 0, 0, 0, !littleendian };
 
-        if (using_infile==1)
-            len = remainder+fread(buffer+remainder, 1, 512 , ifp);
-        else
-            len = remainder+fread(buffer+remainder, 1, 512 , stdin);
-            
-        // We can't turn less than 8 bits into a byte.
-        if (len < 8) {
-            done = 1;
-            break;
+        if (hbh_range_open(&range, &input, (using_infile==1) ? infilename : NULL, &from, first, count, HBH_RANGE_STEP) != 0) {
+            perror("failed to index input");
+            exit(1);
         }
+        if (verbose==1) hbh_range_report("012bin", &range);
+    }
 
-        abyte = 0;
-        int skip;
-
-        for (i=0;i<len;i++) {
-            binch = (char)buffer[i];
-            skip=0;
-
-            if (littleendian==1) {
-                if (binch=='0') abyte = (abyte >> 1) & 0xff;
-                else if (binch=='1') abyte = ((abyte >> 1) & 0xff) | 0x80;
-                else skip=1;
-            } else {
-                if (binch=='0') abyte = (abyte << 1) & 0xff;
-                else if (binch=='1') abyte = ((abyte << 1) & 0xff) | 0x01;
-                else skip=1;
-            }
-            
-            if (skip==0) {
-                bitcount +=1;
-                if (bitcount == 8) {
-                    outbuffer[outindex] = abyte;
-                    outindex += 1;
-                    bitcount = 0;
-                }
-            }
+    if (hbh_bits_decode_init(&state, littleendian) != 0) {
+        fprintf(stderr,"Error: invalid conversion parameters\n");
+        exit(1);
+    }
+    outsize = (ranged==1) ? hbh_range_bound(&range, HBH_SLAB_SIZE) : hbh_bits_decode_bound(&state, HBH_SLAB_SIZE);
+    if (outsize < HBH_FINISH_BOUND) outsize = HBH_FINISH_BOUND;
+    if (hbh_output_open(&output, (using_outfile==1) ? ofp : stdout, outsize) != 0) {
+        perror("failed to allocate output buffer");
+        exit(1);
+    }
+
+    do {
+        if ((ranged==1) && (range.left == 0))
+            len = 0;
+        else
+            len = hbh_input_next(&input, &buffer, HBH_SLAB_SIZE);
+        if (len < 0) {
+            perror("failed to read input");
+            exit(1);
         }
 
-        if (outindex > 0) {
-            if (using_outfile==1) {
-                fwrite(outbuffer,1,outindex,ofp);
-            } else {
-                fwrite(outbuffer,1,outindex,stdout);
-            }
-            outindex = 0;
+        outbuffer = hbh_output_space(&output);
+        if (ranged==1)
+            outindex = (len == 0) ? hbh_range_finish(&range, outbuffer) : hbh_range_update(&range, buffer, (size_t)len, outbuffer);
+        else if (len == 0)
+            outindex = hbh_bits_decode_finish(&state, outbuffer);
+        else
+            outindex = hbh_bits_decode_update(&state, buffer, (size_t)len, outbuffer);
+
+        if (hbh_output_commit(&output, outindex) != 0) {
+            perror("failed to write output");
+            exit(1);
         }
-      
-    } while (done==0);
-    
-    
+
+    } while (len != 0);
+
+    if (hbh_output_close(&output) != 0) {
+        perror("failed to write output");
+        exit(1);
+    }
+    if (verbose==1) hbh_report_throughput("012bin", &input, &output);
+    hbh_input_close(&input);
     if (using_outfile==1) fclose(ofp);
 
     return 0;    
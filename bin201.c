@@ -28,35 +28,179 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <errno.h>
 #include <sys/stat.h>
 #include <stdint.h>
 #include <unistd.h>
 #include <getopt.h>
 
+#include "hexbinhex.h"
+#include "hbh_io.h"
+#include "hbh_batch.h"
+#include "hbh_thread.h"
+
+/* Input is handed to the threads of -j in chunks of this size */
+#define CHUNK_SIZE (1024*1024)
+
 void display_usage() {
-fprintf(stderr,"Usage: bin201 [-w <width>][-b][-h][-o <out filename>] [filename]\n");
+fprintf(stderr,"Usage: bin201 [-w <width>][-B|-L][-s][-h][-v][-K kernel][-j threads][--offset n][--length n][-o <out filename>] [filename]\n");
 fprintf(stderr,"  -w <width> Sets the number of bits per output line\n");
 fprintf(stderr,"  -B         Reverses the order of bits in each byte to big endian\n");
 fprintf(stderr,"  -L         Outputs bits as little endian (default)\n");
 fprintf(stderr,"  -s         Add a space between every 8 bits\n");
+fprintf(stderr,"  -j n       Encode on n threads, 1 to 256\n");
+fprintf(stderr,"  -v         Report throughput to stderr\n");
+fprintf(stderr,"  -K name    Use the scalar, sse4, avx2 or avx512 kernels\n");
+fprintf(stderr,"  --offset n Start from byte n\n");
+fprintf(stderr,"  --length n Convert n bytes at most\n");
+fprintf(stderr,"  --batch <glob|@list> Convert each matching or listed file to its own file\n");
+fprintf(stderr,"  --batch-out <template> Output path of each, default %%d/%%b.%%e\n");
+fprintf(stderr,"  --batch-jobs <n> Convert the batch on n threads (default one per CPU)\n");
+fprintf(stderr,"  -o filename Output to file filename instead of stdout\n");
 fprintf(stderr,"Convert binary data to ascii binary (01001001).\n");
 fprintf(stderr,"  Author: David Johnston, dj@deadhat.com\n");
 fprintf(stderr,"\n");
 }
 
-void printsample(unsigned char *thesample)
-{
-    int tempindex;
-    int j;
+/* One chunk of the input for -j, with the place its output goes */
+typedef struct {
+    const unsigned char *in;
+    size_t len;
+    uint64_t pos;
+    size_t outlen;
+    off_t offset;
+    unsigned char *out;
+} chunk;
+
+typedef struct {
+    chunk *chunks;
+    const hbh_bits_encoder *proto;  /* encoder set up with the tool's options */
+    int fd;             /* pwrite() target, or -1 to write in order afterwards */
+    int failed;         /* errno of a failed pwrite(), 0 if none */
+} job;
+
+static void encode_chunk(void *arg, int i) {
+    job *j = arg;
+    chunk *c = &j->chunks[i];
+    hbh_bits_encoder state = *j->proto;
+
+    hbh_bits_encode_seek(&state, c->pos);
+    c->outlen = hbh_bits_encode_update(&state, c->in, c->len, c->out);
+    if ((j->fd >= 0) && (hbh_pwrite_all(j->fd, c->out, c->outlen, c->offset) != 0))
+        __atomic_store_n(&j->failed, (errno != 0) ? errno : EIO, __ATOMIC_RELAXED);
+}
+
+/* Write out a round's chunks in order */
+static void write_chunks(hbh_output *out, const chunk *chunks, int count) {
     int i;
-   tempindex = 0;
-    for (j=0;j<16;j++)
-    {
-            for (i=0;i<16;i++) printf("%02X",thesample[tempindex++]);
-            printf("\n");
+
+    for (i=0;i<count;i++) {
+        if (hbh_output_write(out, chunks[i].out, chunks[i].outlen) != 0) {
+            perror("failed to write output");
+            exit(1);
+        }
     }
 }
 
+/* Encode the input on threads threads, a chunk per thread at a time.
+ * Every chunk's output offset follows from its position in the input, so
+ * output to a regular file is written in place by the threads. Anything
+ * else is written in order by this thread while the next round encodes,
+ * from the other of two sets of chunks. Exits on a read or write error.
+ */
+static void encode_parallel(hbh_input *input, const hbh_bits_encoder *proto, int threads, hbh_output *out) {
+    const unsigned char *data;
+    hbh_bits_encoder state = *proto;
+    unsigned char tail[HBH_FINISH_BOUND];
+    hbh_pool *pool;
+    chunk *chunks;
+    chunk *set;
+    job j;
+    off_t base;
+    uint64_t pos = 0;
+    uint64_t total;
+    size_t outsize;
+    size_t n;
+    long len;
+    int count;
+    int last = 0;   /* chunks in the round waiting to be written */
+    int round = 0;
+    int i;
+
+    fflush(out->fp);
+    j.fd = out->fd;
+    base = out->spliced ? -1 : hbh_output_offset(j.fd);
+    if (base < 0) j.fd = -1;
+
+    outsize = hbh_bits_encode_bound(&state, CHUNK_SIZE);
+    chunks = calloc((size_t)threads*2, sizeof(chunk));
+    pool = hbh_pool_start(threads);
+    if ((chunks == NULL) || (pool == NULL)) {
+        perror("failed to allocate chunks");
+        exit(1);
+    }
+    for (i=0;i<threads*2;i++) {
+        chunks[i].out = malloc(outsize);
+        if (chunks[i].out == NULL) {
+            perror("failed to allocate output buffer");
+            exit(1);
+        }
+    }
+    j.proto = proto;
+    j.failed = 0;
+
+    while ((len = hbh_input_next_block(input, &data, (size_t)threads*CHUNK_SIZE)) > 0) {
+        set = chunks + (round & 1)*threads;
+        j.chunks = set;
+        count = 0;
+        while (len > 0) {
+            set[count].in = data;
+            set[count].len = (len > CHUNK_SIZE) ? CHUNK_SIZE : (size_t)len;
+            set[count].pos = pos;
+            set[count].offset = base + (off_t)hbh_bits_encode_seek(&state, pos);
+            data += set[count].len;
+            len -= (long)set[count].len;
+            pos += set[count].len;
+            count++;
+        }
+        hbh_pool_post(pool, count, encode_chunk, &j);
+        if (j.fd < 0) write_chunks(out, chunks + ((round + 1) & 1)*threads, last);
+        hbh_pool_wait(pool);
+
+        if (j.failed != 0) {
+            errno = j.failed;
+            perror("failed to write output");
+            exit(1);
+        }
+        last = count;
+        round++;
+    }
+    if (len < 0) {
+        perror("failed to read input");
+        exit(1);
+    }
+    if (j.fd < 0) write_chunks(out, chunks + ((round + 1) & 1)*threads, last);
+    hbh_pool_stop(pool);
+
+    /* The end of the output follows the last chunk */
+    total = hbh_bits_encode_seek(&state, pos);
+    n = hbh_bits_encode_finish(&state, tail);
+    if (j.fd >= 0) {
+        if (hbh_pwrite_all(j.fd, tail, n, base + (off_t)total) != 0) {
+            perror("failed to write output");
+            exit(1);
+        }
+        lseek(j.fd, base + (off_t)(total + n), SEEK_SET);
+        out->bytes_out += total + n;
+    } else if (hbh_output_write(out, tail, n) != 0) {
+        perror("failed to write output");
+        exit(1);
+    }
+
+    for (i=0;i<threads*2;i++) free(chunks[i].out);
+    free(chunks);
+}
+
 /********
 * main() is mostly about parsing and qualifying the command line options.
 */
@@ -64,41 +208,52 @@ void printsample(unsigned char *thesample)
 int main(int argc, char** argv)
 {
     int opt;
-	int i;
-    int j;
 	
-	FILE *ifp;
-	FILE *ofp;
+	FILE *ofp = NULL;
 	int using_outfile;
-	int using_infile;
+	int using_infile = 0;
 	char filename[1000];
 	char infilename[1000];
+    char batch[1000];
+    char batchout[1000];
+    int jobs = 0;
 	
     int width=32;
     int littleendian = 1;
     int gotB = 0;
     int gotL = 0;    
-    int abyte;
     int spaces = 0;
     int verbose = 0;
+    uint64_t first = 0;
+    uint64_t count = UINT64_MAX;
+    int threads = 1;
     
 	/* Defaults */
 	using_outfile = 0;       /* use stdout instead of outputfile*/
 
     filename[0] = (char)0;
 	infilename[0] = (char)0;
+    batch[0] = (char)0;
+    strcpy(batchout, HBH_BATCH_OUT);
 
 	/* get the options and arguments */
     int longIndex;
 
-    char optString[] = "o:k:w:BLsvh";
+    char optString[] = "o:k:w:BLsj:K:vh";
     static const struct option longOpts[] = {
-    { "output", no_argument, NULL, 'o' },
+    { "output", required_argument, NULL, 'o' },
     { "width", required_argument, NULL, 'w' },
     { "bigendian", no_argument, NULL, 'B' },
     { "littleendian", no_argument, NULL, 'L' },
     { "spacebetweenbytes", no_argument, NULL, 's'},
+    { "threads", required_argument, NULL, 'j' },
     { "verbose", no_argument, NULL, 'v' },
+    { "kernel", required_argument, NULL, 'K' },
+    { "offset", required_argument, NULL, 'F' },
+    { "length", required_argument, NULL, 'N' },
+    { "batch", required_argument, NULL, 'A' },
+    { "batch-out", required_argument, NULL, 'O' },
+    { "batch-jobs", required_argument, NULL, 'J' },
     { "help", no_argument, NULL, 'h' },
     { NULL, no_argument, NULL, 0 }
     };
@@ -129,9 +284,53 @@ int main(int argc, char** argv)
             case 's':
                 spaces = 1;
                 break;
+            case 'j':
+                threads = atoi(optarg);
+                if ((threads < 1) || (threads > HBH_MAX_THREADS)) {
+                    fprintf(stderr,"Error: -j takes 1 to %d threads\n", HBH_MAX_THREADS);
+                    exit(1);
+                }
+                break;
             case 'v':
                 verbose = 1;
                 break;
+            case 'K':
+                if (hbh_kernel_set(hbh_kernel_parse(optarg)) != 0) {
+                    fprintf(stderr,"Error: kernel %s is unknown or not supported by this CPU\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'F':
+                if (hbh_parse_count(optarg, &first) != 0) {
+                    fprintf(stderr,"Error: --offset %s is not a byte count\n", optarg);
+                    display_usage();
+                    exit(1);
+                }
+                break;
+            case 'N':
+                if (hbh_parse_count(optarg, &count) != 0) {
+                    fprintf(stderr,"Error: --length %s is not a byte count\n", optarg);
+                    display_usage();
+                    exit(1);
+                }
+                break;
+            case 'A':
+                if (strlen(optarg) >= sizeof(batch)) {
+                    fprintf(stderr,"Error: batch file list too long\n");
+                    exit(1);
+                }
+                strcpy(batch,optarg);
+                break;
+            case 'O':
+                if (strlen(optarg) >= sizeof(batchout)) {
+                    fprintf(stderr,"Error: batch output template too long\n");
+                    exit(1);
+                }
+                strcpy(batchout,optarg);
+                break;
+            case 'J':
+                jobs = atoi(optarg);
+                break;
             case 'h':   /* fall-through is intentional */
             case '?':
                 display_usage();
@@ -170,6 +369,21 @@ int main(int argc, char** argv)
 
 	/* Range check the var args */
 
+    /* Batch mode converts each listed file to a file of its own */
+    if (batch[0] != 0) {
+        hbh_format from = { HBH_BIN };
+        hbh_format to = { HBH_BITS, width, 0, spaces, 0, !littleendian };
+
+        if ((using_outfile==1) || (using_infile==1) || (first != 0) || (count != UINT64_MAX)) {
+            fprintf(stderr,"Error: --batch names its own files, so takes no -o, filename, --offset or --length\n");
+            exit(1);
+        }
+        if (threads != 1) {
+            fprintf(stderr,"Error: --batch converts a file per thread, so takes --batch-jobs rather than -j\n");
+            exit(1);
+        }
+        exit((hbh_batch_run("bin201", batch, batchout, &from, &to, 0, jobs, verbose) == 0) ? 0 : 1);
+    }
 
 	/* open the output file if needed */
 
@@ -182,94 +396,67 @@ int main(int argc, char** argv)
 		}
 	}
 
-	/* open the input file if needed */
-	if (using_infile==1)
-	{
-        ifp =  fopen(infilename, "rb");
-		    
-		if (ifp == NULL) {
-			perror("failed to open input file for reading");
-			exit(1);
-		}
-	}
+    /* open the input, memory mapping it if it is a regular file */
+    hbh_input input;
 
-    unsigned char buffer[2048];
-    unsigned char outbuffer[10000];
-    int outindex = 0;
-    int bitcount = 0;
-    int done=0;
-    size_t len;
-    int lastcharnl = 0;
-    char binch;
-    int first = 1;
-
-    do {
-        if (using_infile==1)
-            len = fread(buffer, 1, 512 , ifp);
-        else
-            len = fread(buffer, 1, 512 , stdin);
-            
-        if (len == 0) break;
-        
-        for (i=0;i<len;i++) {
-            abyte = buffer[i];
-            for (j=0;j<8;j++) {
-                if (littleendian == 1) {
-                    if (((abyte >> j) & 0x01) == 0) {
-                        binch = '0';
-                    } else {
-                        binch = '1';
-                    }
-                } else {
-                    if (((abyte >> (7-j)) & 0x01) == 0) {
-                        binch = '0';
-                    } else {
-                        binch = '1';
-                    }
-                }
-                bitcount++;
-
-                sprintf((char *)&((outbuffer[outindex])),"%c",binch);  
-                outindex+=1;
-                
-                if (bitcount==width) {
-                    sprintf((char *)&(outbuffer[outindex]),"\n");
-                    outindex++;
-                    bitcount=0;
-                    lastcharnl = 1;
-                    first = 1;
-                }
-                else {
-                    lastcharnl = 0;
-                    if ((spaces==1) && ((bitcount % 8)==0) && (bitcount > 1) && (first==0)) {
-                        sprintf((char *)&((outbuffer[outindex]))," ");  
-                        outindex++;
-                    }
-                    else
-                    {
-                        first = 0;
-                    }
-                }
+    if (hbh_input_open(&input, (using_infile==1) ? infilename : NULL) != 0) {
+        perror("failed to open input file for reading");
+        exit(1);
+    }
+
+    /* --offset and --length are in bytes, so go straight to the first */
+    hbh_input_skip(&input, first);
+    hbh_input_limit(&input, count);
+
+    const unsigned char *buffer;
+    unsigned char *outbuffer;
+    size_t outsize;
+    size_t outindex;
+    hbh_output output;
+    long len;
+    hbh_bits_encoder state;
+
+    if (hbh_bits_encode_init(&state, width, spaces, littleendian) != 0) {
+        fprintf(stderr,"Error: invalid conversion parameters\n");
+        exit(1);
+    }
+    outsize = hbh_bits_encode_bound(&state, HBH_SLAB_SIZE);
+    if (outsize < HBH_FINISH_BOUND) outsize = HBH_FINISH_BOUND;
+    if (hbh_output_open(&output, (using_outfile==1) ? ofp : stdout, outsize) != 0) {
+        perror("failed to allocate output buffer");
+        exit(1);
+    }
+
+    if (threads > 1) {
+        encode_parallel(&input, &state, threads, &output);
+    } else {
+        do {
+            len = hbh_input_next(&input, &buffer, HBH_SLAB_SIZE);
+            if (len < 0) {
+                perror("failed to read input");
+                exit(1);
             }
-        }
-        
-        if (using_outfile)
-            fwrite(outbuffer, outindex,1,ofp);
-        else
-            fwrite(outbuffer, outindex,1,stdout);
-        
-        outindex = 0;
-      
-        
-    } while (done==0);
-    
-    if (lastcharnl==0) {
-        if (using_outfile)
-            fprintf(ofp,"\n");
-        else
-            printf("\n");
+
+            outbuffer = hbh_output_space(&output);
+            if (len == 0)
+                outindex = hbh_bits_encode_finish(&state, outbuffer);
+            else
+                outindex = hbh_bits_encode_update(&state, buffer, (size_t)len, outbuffer);
+
+            if (hbh_output_commit(&output, outindex) != 0) {
+                perror("failed to write output");
+                exit(1);
+            }
+
+        } while (len != 0);
     }
-    
+
+    if (hbh_output_close(&output) != 0) {
+        perror("failed to write output");
+        exit(1);
+    }
+    if (verbose==1) hbh_report_throughput("bin201", &input, &output);
+    hbh_input_close(&input);
     if (using_outfile==1) fclose(ofp);
 
     return 0;    
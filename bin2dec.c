@@ -23,7 +23,7 @@
     Contact. David Johnston dj@deadhat.com
 */
 /* make isnan() visible */
-#define _BSD_SOURCE 
+#define _DEFAULT_SOURCE
 
 #include <stdio.h>
 #include <string.h>
@@ -34,11 +34,22 @@
 #include <unistd.h>
 #include <getopt.h>
 
+#include "hexbinhex.h"
+#include "hbh_io.h"
+#include "hbh_batch.h"
+
 void display_usage() {
-fprintf(stderr,"Usage: bin2dec [-b][-w <width>][-h][-o <out filename>] [filename]\n");
+fprintf(stderr,"Usage: bin2dec [-b][-w <width>][-h][-v][-K kernel][--offset n][--length n][-o <out filename>] [filename]\n");
 fprintf(stderr,"       -w <width>        : Set the number of bytes for each number, 1-8 (default 4)\n");
 fprintf(stderr,"       -b                : Use big endian order (Default little endian)\n");
 fprintf(stderr,"       -o <out filename> : send output to a file (default stdout)\n");
+fprintf(stderr,"       -v                : Report throughput to stderr\n");
+fprintf(stderr,"       -K <name>         : Use the scalar, sse4, avx2 or avx512 kernels\n");
+fprintf(stderr,"       --offset n        : Start from number n\n");
+fprintf(stderr,"       --length n        : Convert n numbers at most\n");
+fprintf(stderr,"       --batch <glob|@list> : Convert each matching or listed file to its own file\n");
+fprintf(stderr,"       --batch-out <template> : Output path of each, default %%d/%%b.%%e\n");
+fprintf(stderr,"       --batch-jobs <n>  : Convert the batch on n threads (default one per CPU)\n");
 fprintf(stderr,"       -h                : Print this help\n"); 
 fprintf(stderr,"\n");
 fprintf(stderr,"Convert binary data to decimal.\n");
@@ -53,15 +64,18 @@ fprintf(stderr,"\n");
 int main(int argc, char** argv)
 {
     int opt;
-	int i;
-	int j;
 	
-	FILE *ifp;
-	FILE *ofp;
+	FILE *ofp = NULL;
 	int using_outfile;
-	int using_infile;
+	int using_infile = 0;
+	int verbose = 0;
+    uint64_t first = 0;
+    uint64_t count = UINT64_MAX;
 	char filename[1000];
 	char infilename[1000];
+    char batch[1000];
+    char batchout[1000];
+    int jobs = 0;
 	
 	//int linewidth;
     int width;
@@ -75,15 +89,24 @@ int main(int argc, char** argv)
     
     filename[0] = (char)0;
 	infilename[0] = (char)0;
+    batch[0] = (char)0;
+    strcpy(batchout, HBH_BATCH_OUT);
 
 	/* get the options and arguments */
     int longIndex;
 
-    char optString[] = "bo:k:w:h";
+    char optString[] = "bo:k:w:K:vh";
     static const struct option longOpts[] = {
-    { "output", no_argument, NULL, 'o' },
+    { "output", required_argument, NULL, 'o' },
     { "width", required_argument, NULL, 'w' },
     { "bigendian", no_argument, NULL, 'b' },
+    { "verbose", no_argument, NULL, 'v' },
+    { "kernel", required_argument, NULL, 'K' },
+    { "offset", required_argument, NULL, 'F' },
+    { "length", required_argument, NULL, 'N' },
+    { "batch", required_argument, NULL, 'A' },
+    { "batch-out", required_argument, NULL, 'O' },
+    { "batch-jobs", required_argument, NULL, 'J' },
     { "help", no_argument, NULL, 'h' },
     { NULL, no_argument, NULL, 0 }
     };
@@ -106,6 +129,46 @@ int main(int argc, char** argv)
                 strcpy(infilename,optarg);
                 break;
                 
+            case 'v':
+                verbose=1;
+                break;
+            case 'K':
+                if (hbh_kernel_set(hbh_kernel_parse(optarg)) != 0) {
+                    fprintf(stderr,"Error: kernel %s is unknown or not supported by this CPU\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'F':
+                if (hbh_parse_count(optarg, &first) != 0) {
+                    fprintf(stderr,"Error: --offset %s is not a count of numbers\n", optarg);
+                    display_usage();
+                    exit(1);
+                }
+                break;
+            case 'N':
+                if (hbh_parse_count(optarg, &count) != 0) {
+                    fprintf(stderr,"Error: --length %s is not a count of numbers\n", optarg);
+                    display_usage();
+                    exit(1);
+                }
+                break;
+            case 'A':
+                if (strlen(optarg) >= sizeof(batch)) {
+                    fprintf(stderr,"Error: batch file list too long\n");
+                    exit(1);
+                }
+                strcpy(batch,optarg);
+                break;
+            case 'O':
+                if (strlen(optarg) >= sizeof(batchout)) {
+                    fprintf(stderr,"Error: batch output template too long\n");
+                    exit(1);
+                }
+                strcpy(batchout,optarg);
+                break;
+            case 'J':
+                jobs = atoi(optarg);
+                break;
             case 'h':   /* fall-through is intentional */
             case '?':
                 display_usage();
@@ -130,6 +193,18 @@ int main(int argc, char** argv)
         exit(1);
     }
 
+    /* Batch mode converts each listed file to a file of its own */
+    if (batch[0] != 0) {
+        hbh_format from = { HBH_BIN };
+        hbh_format to = { HBH_DEC, width, 0, 0, 0, bigendian };
+
+        if ((using_outfile==1) || (using_infile==1) || (first != 0) || (count != UINT64_MAX)) {
+            fprintf(stderr,"Error: --batch names its own files, so takes no -o, filename, --offset or --length\n");
+            exit(1);
+        }
+        exit((hbh_batch_run("bin2dec", batch, batchout, &from, &to, 0, jobs, verbose) == 0) ? 0 : 1);
+    }
+
 	/* open the output file if needed */
 
 	if (using_outfile==1)
@@ -141,65 +216,63 @@ int main(int argc, char** argv)
 		}
 	}
 
-	/* open the input file if needed */
-	if (using_infile==1)
-	{
-        ifp =  fopen(infilename, "rb");
-		    
-		if (ifp == NULL) {
-			perror("failed to open input file for reading");
-			exit(1);
-		}
-	}
+    /* open the input, memory mapping it if it is a regular file */
+    hbh_input input;
 
-    unsigned char buffer[2048];
-    size_t len;
-    
-    // Get an integer number of bytes less than or equal to 2048
-    int read_size = 0;
-    read_size = (int)(2048/width);
-    
-    unsigned char *bufptr;
-    unsigned char word[8];
-    uint64_t *wordptr;
-    wordptr = (uint64_t *)word;
+    if (hbh_input_open(&input, (using_infile==1) ? infilename : NULL) != 0) {
+        perror("failed to open input file for reading");
+        exit(1);
+    }
+
+    /* Every number takes width bytes, so go straight to the first */
+    hbh_input_skip(&input, first*(uint64_t)width);
+    hbh_input_limit(&input, (count > UINT64_MAX/(uint64_t)width) ? UINT64_MAX : count*(uint64_t)width);
+
+    const unsigned char *buffer;
+    unsigned char *outbuffer;
+    size_t outsize;
+    size_t outindex;
+    hbh_output output;
+    long len;
+    hbh_dec_encoder state;
+
+    if (hbh_dec_encode_init(&state, width, bigendian) != 0) {
+        fprintf(stderr,"Error: invalid conversion parameters\n");
+        exit(1);
+    }
+    outsize = hbh_dec_encode_bound(&state, HBH_SLAB_SIZE);
+    if (outsize < HBH_FINISH_BOUND) outsize = HBH_FINISH_BOUND;
+    if (hbh_output_open(&output, (using_outfile==1) ? ofp : stdout, outsize) != 0) {
+        perror("failed to allocate output buffer");
+        exit(1);
+    }
 
     do {
-        if (using_infile==1) {
-            len = fread(buffer, width, read_size , ifp);
+        len = hbh_input_next(&input, &buffer, HBH_SLAB_SIZE);
+        if (len < 0) {
+            perror("failed to read input");
+            exit(1);
         }
-        else {
-            len = fread(buffer, width, read_size , stdin);
-        }
-            
-        if (len == 0) {
-            exit(0);
-        }
-        
-        bufptr = buffer;
-
-        for(i=0;i<len;i++) {
 
-            *wordptr = 0;
-            if (bigendian==0) {
-                for (j=0;j<width;j++) {
-                    word[j] = *bufptr++; 
-                }
-            } else {
-                for (j=0;j<width;j++) {
-                    word[width-j-1] = *bufptr++; 
-                }
-            }
+        outbuffer = hbh_output_space(&output);
+        if (len == 0)
+            outindex = hbh_dec_encode_finish(&state, outbuffer);
+        else
+            outindex = hbh_dec_encode_update(&state, buffer, (size_t)len, outbuffer);
 
-            if (using_outfile==1) {
-                fprintf(ofp, "%" PRIu64 "\n",*wordptr); 
-            } else {
-                fprintf(stdout, "%" PRIu64 "\n",*wordptr); 
-            }
+        if (hbh_output_commit(&output, outindex) != 0) {
+            perror("failed to write output");
+            exit(1);
         }
-        
-    } while (1);
-    
+
+    } while (len != 0);
+
+    if (hbh_output_close(&output) != 0) {
+        perror("failed to write output");
+        exit(1);
+    }
+    if (verbose==1) hbh_report_throughput("bin2dec", &input, &output);
+    hbh_input_close(&input);
     if (using_outfile==1) fclose(ofp);
     
 }
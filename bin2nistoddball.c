@@ -33,13 +33,36 @@
 #include <unistd.h>
 #include <getopt.h>
 
+#include "hexbinhex.h"
+#include "hbh_io.h"
+#include "hbh_batch.h"
+
 void display_usage() {
-fprintf(stderr,"Usage: bin2nistoddball [-l <bits_per_symbol 1-8>][-B|-L][-v][-h][-o <out filename>] [filename]\n");
-fprintf(stderr,"       -l , --length <bits_per_symbol 1-8> Set the number of bits to encode in eat output byte\n");
+fprintf(stderr,"Usage: bin2nistoddball [-l <bits_per_symbol 1-32>][-r][-B|-L][-b][-v][-K kernel][--bits n,n..|--lsb][--stride k][--stats[=file]][--packed [--index[=MB]]][--offset n][--length n][-h][-o <out filename>] [filename]\n");
+fprintf(stderr,"       -l , --bits_per_symbol <1-32>       Set the number of bits to encode in each output byte\n");
+fprintf(stderr,"                                           or, over 8 bits, in each 2 or 4 byte output word\n");
 fprintf(stderr,"       -r , --reverse                      Interpret input binary data as big endian (MSB first) (default is little endian)\n");
 fprintf(stderr,"       -B , --bigendian                    Unpack output multi-bit symbols as big-endian (msb first)\n");
 fprintf(stderr,"       -L , --littleendian                 Unpack output multi-bit symbols as little-endian (lsb first) (default)\n");
+fprintf(stderr,"       -b , --bigwords                     Write symbols over 8 bits as big-endian words (default little-endian)\n");
 fprintf(stderr,"       -v , --verbose                      Output information to stderr\n");
+fprintf(stderr,"       -K , --kernel <name>                Use the scalar, sse4, avx2 or avx512 kernels\n");
+fprintf(stderr,"            --bits n,n..                   Keep only bits n (0 is the lsb, 7 the msb) of each input\n");
+fprintf(stderr,"                                           byte and make the symbols from those\n");
+fprintf(stderr,"            --lsb                          Keep only the lsb of each input byte, as --bits 0\n");
+fprintf(stderr,"            --stride k                     Write only every k-th symbol, starting with the first\n");
+fprintf(stderr,"            --offset n                     Start from symbol n\n");
+fprintf(stderr,"            --length n                     Convert n symbols at most\n");
+fprintf(stderr,"            --batch <glob|@list>           Convert each matching or listed file to its own file\n");
+fprintf(stderr,"            --batch-out <template>         Output path of each, default %%d/%%b.%%e\n");
+fprintf(stderr,"            --batch-jobs <n>               Convert the batch on n threads (default one per CPU)\n");
+fprintf(stderr,"            --stats[=file]                 Write symbol counts, runs and an MCV min-entropy estimate\n");
+fprintf(stderr,"                                           as JSON to stderr, or to file. Symbols of 1-8 bits only\n");
+fprintf(stderr,"            --packed                       Write the symbols bit packed, after a header recording\n");
+fprintf(stderr,"                                           -l, -r, -B and -b, for nistoddball2bin to read\n");
+fprintf(stderr,"            --index[=MB]                   With --packed and -o, write an index of the symbol at\n");
+fprintf(stderr,"                                           every MB (default 1) of the output to <out filename>.idx\n");
+fprintf(stderr,"       -o , --output <filename>            Output to file filename instead of stdout\n");
 fprintf(stderr,"       -h , --help                         Output this information\n");
 fprintf(stderr,"\n");
 fprintf(stderr,"Convert binary data to NIST Oddball SP800-90B one-symbol-per-byte format.\n");
@@ -47,17 +70,91 @@ fprintf(stderr,"  Author: David Johnston, dj@deadhat.com\n");
 fprintf(stderr,"\n");
 }
 
-void printsample(unsigned char *thesample)
-{
-    int tempindex;
-    int j;
+/* Symbols are counted in pieces this many input bytes long, so they
+ * are still in cache when the statistics read them back. */
+#define STATS_PIECE (16*1024)
+
+void write_stats(FILE *fp, const hbh_stats *s) {
     int i;
-   tempindex = 0;
-    for (j=0;j<16;j++)
-    {
-            for (i=0;i<16;i++) printf("%02X",thesample[tempindex++]);
-            printf("\n");
+
+    fprintf(fp,"{\n  \"bits_per_symbol\": %d,\n  \"symbols\": %llu,\n  \"counts\": [", s->bps, (unsigned long long)s->symbols);
+    for (i=0;i<(1 << s->bps);i++) {
+        fprintf(fp,"%s%llu", (i==0) ? "" : ", ", (unsigned long long)s->count[i]);
+    }
+    fprintf(fp,"],\n  \"transitions\": %llu,\n", (unsigned long long)s->transitions);
+    fprintf(fp,"  \"longest_run\": %llu,\n", (unsigned long long)s->longest_run);
+    fprintf(fp,"  \"most_common\": %d,\n", s->most_common);
+    if (s->symbols > 1) {
+        fprintf(fp,"  \"mcv_min_entropy_per_symbol\": %.6f,\n", s->min_entropy);
+        fprintf(fp,"  \"mcv_min_entropy_per_bit\": %.6f\n}\n", s->min_entropy/s->bps);
+    } else {
+        fprintf(fp,"  \"mcv_min_entropy_per_symbol\": null,\n  \"mcv_min_entropy_per_bit\": null\n}\n");
+    }
+}
+
+/* --bits takes bit positions from 0, the lsb, to 7 separated by commas.
+ * Returns the mask of them, or -1. */
+int parse_bits(const char *list) {
+    int mask = 0;
+    char *end;
+    long b;
+
+    for (;;) {
+        b = strtol(list, &end, 10);
+        if ((end == list) || (b < 0) || (b > 7)) return -1;
+        mask |= 1 << b;
+        if (*end == 0) return mask;
+        if (*end != ',') return -1;
+        list = end + 1;
+    }
+}
+
+/* The sidecar index of a packed file gives the symbol starting each
+ * interval of the payload, rounded back to a group of 8, and its offset
+ * in the file, then the end. The packing makes this arithmetic, so it is
+ * for tools that would rather not know the layout. It is written to a
+ * temporary file next to name and renamed over it, so a reader never
+ * sees half an index. Returns 0, or -1 with errno set. */
+int write_index(const char *name, int bps, int reverse, int littleendian, int bigwords,
+                uint64_t interval, uint64_t payload) {
+    uint64_t at;
+    uint64_t off;
+    char *tmp;
+    FILE *fp;
+    int fd;
+    int ok;
+
+    tmp = malloc(strlen(name) + 8);
+    if (tmp == NULL) return -1;
+    sprintf(tmp, "%s.XXXXXX", name);
+    fd = mkstemp(tmp);
+    if (fd < 0) {
+        free(tmp);
+        return -1;
     }
+    fp = NULL;
+    if (fchmod(fd, 0644) == 0) fp = fdopen(fd, "w");
+    if (fp == NULL) {
+        close(fd);
+        unlink(tmp);
+        free(tmp);
+        return -1;
+    }
+    fprintf(fp,"hbhpack index 2\n");
+    fprintf(fp,"bps %d reverse %d bigendian %d bigwords %d interval %llu\n", bps, reverse, !littleendian,
+            bigwords, (unsigned long long)interval);
+    for (at=0;at<payload;at+=interval) {
+        off = hbh_pack_offset(bps, hbh_pack_symbols(bps, at));
+        fprintf(fp,"%llu %llu\n", (unsigned long long)(8*(off/bps)), (unsigned long long)(HBH_PACK_HEADER + off));
+    }
+    fprintf(fp,"end %llu %llu\n", (unsigned long long)hbh_pack_symbols(bps, payload),
+            (unsigned long long)(HBH_PACK_HEADER + payload));
+    ok = (fflush(fp) == 0) && (ferror(fp) == 0);
+    if (fclose(fp) != 0) ok = 0;
+    if (ok) ok = (rename(tmp, name) == 0);
+    if (!ok) unlink(tmp);
+    free(tmp);
+    return ok ? 0 : -1;
 }
 
 /********
@@ -67,39 +164,67 @@ void printsample(unsigned char *thesample)
 int main(int argc, char** argv)
 {
     int opt;
-	int i;
 	
-	FILE *ifp;
-	FILE *ofp;
+	FILE *ofp = NULL;
 	int using_outfile = 0;  /* use stdout instead of outputfile*/
-	int using_infile;
+	int using_infile = 0;
 	char filename[1000];
 	char infilename[1000];
+    char batch[1000];
+    char batchout[1000];
+    int jobs = 0;
 	
     int bps = 1;   
-    int abyte;
     
     int littleendian=1;
+    int bigwords=0;
     int gotL=0;
     int gotB=0;
     int verbose = 0;
     int reverse = 0;
+    int stats = 0;
+    char statsname[1000];
+    int packed = 0;
+    long indexmb = 0;
+    uint64_t first = 0;
+    uint64_t count = UINT64_MAX;
+    int mask = 0xFF;
+    int gotbits = 0;
+    int gotlsb = 0;
+    int stride = 1;
+    int sampling = 0;
 
 	/* Zero out the strings */    
     filename[0] = (char)0;
 	infilename[0] = (char)0;
+    batch[0] = (char)0;
+    strcpy(batchout, HBH_BATCH_OUT);
+	statsname[0] = (char)0;
 
 	/* get the options and arguments */
     int longIndex;
 
-    char optString[] = "o:k:l:w:BLrvh";
+    char optString[] = "o:k:l:w:BLbrK:vh";
     static const struct option longOpts[] = {
-    { "output", no_argument, NULL, 'o' },
+    { "output", required_argument, NULL, 'o' },
     { "reverse", no_argument, NULL, 'r' },
     { "bigendian", no_argument, NULL, 'B' },
     { "littleendian", no_argument, NULL, 'L' },
+    { "bigwords", no_argument, NULL, 'b' },
     { "bits_per_symbol", required_argument, NULL, 'l' },
     { "verbose", no_argument, NULL, 'v' },
+    { "kernel", required_argument, NULL, 'K' },
+    { "offset", required_argument, NULL, 'F' },
+    { "length", required_argument, NULL, 'N' },
+    { "stats", optional_argument, NULL, 'S' },
+    { "packed", no_argument, NULL, 'P' },
+    { "index", optional_argument, NULL, 'I' },
+    { "bits", required_argument, NULL, 'M' },
+    { "lsb", no_argument, NULL, 'Z' },
+    { "stride", required_argument, NULL, 'T' },
+    { "batch", required_argument, NULL, 'A' },
+    { "batch-out", required_argument, NULL, 'O' },
+    { "batch-jobs", required_argument, NULL, 'J' },
     { "help", no_argument, NULL, 'h' },
     { NULL, no_argument, NULL, 0 }
     };
@@ -113,8 +238,8 @@ int main(int argc, char** argv)
                 break;
             case 'l':
                 bps = atoi(optarg);
-                if ((bps < 1) || (bps > 8)) {
-                    perror("Error, bits per symbol bust be between 1 and 8");
+                if ((bps < 1) || (bps > 32)) {
+                    perror("Error, bits per symbol bust be between 1 and 32");
                     display_usage();
                     exit(-1);
                 };
@@ -130,10 +255,89 @@ int main(int argc, char** argv)
                 littleendian=0;
                 gotB=1;
                 break;
+            case 'b':
+                bigwords=1;
+                break;
             case 'v':
                 verbose=1;
                 break;
                                 
+            case 'K':
+                if (hbh_kernel_set(hbh_kernel_parse(optarg)) != 0) {
+                    fprintf(stderr,"Error: kernel %s is unknown or not supported by this CPU\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'S':
+                stats=1;
+                if (optarg != NULL) {
+                    if (strlen(optarg) >= sizeof(statsname)) {
+                        fprintf(stderr,"Error: stats filename too long\n");
+                        exit(1);
+                    }
+                    strcpy(statsname,optarg);
+                }
+                break;
+            case 'P':
+                packed=1;
+                break;
+            case 'I':
+                indexmb = (optarg != NULL) ? atol(optarg) : 1;
+                if (indexmb < 1) {
+                    fprintf(stderr,"Error: the index interval must be at least 1 MB\n");
+                    exit(1);
+                }
+                break;
+            case 'F':
+                if (hbh_parse_count(optarg, &first) != 0) {
+                    fprintf(stderr,"Error: --offset %s is not a symbol count\n", optarg);
+                    display_usage();
+                    exit(1);
+                }
+                break;
+            case 'N':
+                if (hbh_parse_count(optarg, &count) != 0) {
+                    fprintf(stderr,"Error: --length %s is not a symbol count\n", optarg);
+                    display_usage();
+                    exit(1);
+                }
+                break;
+            case 'M':
+                mask = parse_bits(optarg);
+                if (mask < 0) {
+                    fprintf(stderr,"Error: --bits takes bit positions 0 to 7 separated by commas\n");
+                    exit(1);
+                }
+                gotbits=1;
+                break;
+            case 'Z':
+                mask = 0x01;
+                gotlsb=1;
+                break;
+            case 'T':
+                stride = atoi(optarg);
+                if (stride < 1) {
+                    fprintf(stderr,"Error: the stride must be at least 1\n");
+                    exit(1);
+                }
+                break;
+            case 'A':
+                if (strlen(optarg) >= sizeof(batch)) {
+                    fprintf(stderr,"Error: batch file list too long\n");
+                    exit(1);
+                }
+                strcpy(batch,optarg);
+                break;
+            case 'O':
+                if (strlen(optarg) >= sizeof(batchout)) {
+                    fprintf(stderr,"Error: batch output template too long\n");
+                    exit(1);
+                }
+                strcpy(batchout,optarg);
+                break;
+            case 'J':
+                jobs = atoi(optarg);
+                break;
             case 'h':   /* fall-through is intentional */
             case '?':
                 display_usage();
@@ -147,6 +351,12 @@ int main(int argc, char** argv)
         opt = getopt_long( argc, argv, optString, longOpts, &longIndex );
     } // end while
     
+    if (gotbits==1 && gotlsb==1) {
+        fprintf(stderr,"Error: --lsb is --bits 0, so give one or the other\n");
+        exit(1);
+    }
+    sampling = (mask != 0xFF) || (stride != 1);
+
     if (gotB==1 && gotL==1) {
         fprintf(stderr,"ERROR, Can't be both big endian (-B) and little endian (-L) at the same time\n");
         exit(-1);
@@ -156,12 +366,35 @@ int main(int argc, char** argv)
         strcpy(infilename,argv[optind]);
         using_infile = 1;
     }
+
+    if ((indexmb > 0) && ((packed==0) || (using_outfile==0))) {
+        fprintf(stderr,"Error: --index needs --packed and an output file (-o)\n");
+        exit(1);
+    }
+    if ((stats==1) && (bps > 8)) {
+        fprintf(stderr,"Error: --stats counts symbols of 8 bits or fewer\n");
+        exit(1);
+    }
+    if ((packed==1) && ((first != 0) || (count != UINT64_MAX))) {
+        fprintf(stderr,"Error: --packed takes the whole input, so no --offset or --length\n");
+        exit(1);
+    }
+    if ((sampling==1) && ((packed==1) || (first != 0) || (count != UINT64_MAX))) {
+        fprintf(stderr,"Error: --packed, --offset and --length take the input as it is, so no --bits, --lsb or --stride\n");
+        exit(1);
+    }
+    if (strlen(filename) + 5 > sizeof(filename)) {
+        fprintf(stderr,"Error: output filename too long\n");
+        exit(1);
+    }
         
     if (verbose==1) {
         fprintf(stderr,"Verbose mode enabled\n");
         if (reverse==1) fprintf(stderr, "Input data interpreted as big-endian (msb first)\n");
         if (littleendian==0) fprintf(stderr, "Output multi-bit symbols encoded as big endian (MSB first)\n");
         if (littleendian==1) fprintf(stderr, "Output multi-bit symbols encoded as little endian (LSB first) (default)\n");
+        if (bps > 8) fprintf(stderr, "Output symbols written as %d byte %s endian words\n", (bps > 16) ? 4 : 2,
+                             (bigwords==1) ? "big" : "little");
         if (((gotB==1) || (gotL==1)) && (bps > 1)){
             printf("Warning: -L and -B arguments have so effect with 1 bit output symbols\n"); 
         }
@@ -172,11 +405,31 @@ int main(int argc, char** argv)
             fprintf(stderr,"Writing NIST 1 symbol per byte data to file: %s\n", filename);
         }
         fprintf(stderr,"Bits per symbol = %d\n",bps); 
+        if (stats==1) {
+            fprintf(stderr,"Writing symbol statistics to %s\n", (statsname[0] != 0) ? statsname : "stderr");
+        }
+        if (mask != 0xFF) fprintf(stderr,"Keeping bits 0x%02X of each input byte\n", mask);
+        if (stride != 1) fprintf(stderr,"Keeping every %d-th symbol\n", stride);
+        if (packed==1) fprintf(stderr,"Writing symbols bit packed\n");
+        if (indexmb > 0) fprintf(stderr,"Writing an index every %ld MB to %s.idx\n", indexmb, filename);
     }
     
 
 	/* Range check the var args */
 
+    /* Batch mode converts each listed file to a file of its own */
+    if (batch[0] != 0) {
+        hbh_format from = { HBH_BIN };
+        hbh_format to = { HBH_ODDBALL, 0, bps, 0, reverse, !littleendian, bigwords };
+
+        if ((using_outfile==1) || (using_infile==1) || (stats==1) || (packed==1) || (first != 0) || (count != UINT64_MAX) ||
+            (sampling==1)) {
+            fprintf(stderr,"Error: --batch names its own files, so takes no -o, filename, --stats, --packed, --offset, --length,\n");
+            fprintf(stderr,"       --bits, --lsb or --stride\n");
+            exit(1);
+        }
+        exit((hbh_batch_run("bin2nistoddball", batch, batchout, &from, &to, 0, jobs, verbose) == 0) ? 0 : 1);
+    }
 
 	/* open the output file if needed */
 
@@ -189,106 +442,168 @@ int main(int argc, char** argv)
 		}
 	}
 
-	/* open the input file if needed */
-	if (using_infile==1)
-	{
-        ifp =  fopen(infilename, "rb");
-		    
-		if (ifp == NULL) {
-			perror("failed to open input file for reading");
-			exit(1);
-		}
-	}
+    /* open the input, memory mapping it if it is a regular file */
+    hbh_input input;
+
+    if (hbh_input_open(&input, (using_infile==1) ? infilename : NULL) != 0) {
+        perror("failed to open input file for reading");
+        exit(1);
+    }
+
+    const unsigned char *buffer;
+    unsigned char *outbuffer;
+    size_t outsize;
+    size_t outindex;
+    hbh_output output;
+    long len;
+    hbh_oddball_encoder state;
+    hbh_stats symstats;
+    size_t off;
+    size_t piece;
+    size_t n;
+    unsigned char header[HBH_PACK_HEADER];
+    unsigned char *scratch = NULL;
+    hbh_pack_reader range;
+    hbh_sampler sampler;
+    int ranged = (first != 0) || (count != UINT64_MAX);
+
+    if (hbh_oddball_encode_init_words(&state, bps, reverse, littleendian, bigwords) != 0) {
+        fprintf(stderr,"Error: invalid conversion parameters\n");
+        exit(1);
+    }
+    if ((sampling==1) && (hbh_sample_init(&sampler, bps, reverse, littleendian, bigwords, mask, stride) != 0)) {
+        fprintf(stderr,"Error: invalid sampling parameters\n");
+        exit(1);
+    }
+    if (stats==1) hbh_stats_init(&symstats, bps);
+    if (sampling==1) outsize = hbh_sample_bound(&sampler, HBH_SLAB_SIZE);
+    else outsize = hbh_oddball_encode_bound(&state, HBH_SLAB_SIZE);
+    if (outsize < HBH_FINISH_BOUND) outsize = HBH_FINISH_BOUND;
+    if (hbh_output_open(&output, (using_outfile==1) ? ofp : stdout, outsize) != 0) {
+        perror("failed to allocate output buffer");
+        exit(1);
+    }
+
+    /* Packed output is the input itself after the header, so symbols are
+     * only made for the statistics, in scratch */
+    if (packed==1) {
+        scratch = malloc(hbh_oddball_encode_bound(&state, STATS_PIECE) + HBH_FINISH_BOUND);
+        if (scratch == NULL) {
+            perror("failed to allocate symbol buffer");
+            exit(1);
+        }
+        hbh_pack_header(header, bps, reverse, littleendian, bigwords);
+        if (hbh_output_write(&output, header, HBH_PACK_HEADER) != 0) {
+            perror("failed to write output");
+            exit(1);
+        }
+    }
+
+    /* The input is the payload of a packed file without the header, so
+     * the packed reader goes straight to the byte and bit the first
+     * symbol wanted starts at */
+    if (ranged==1) {
+        hbh_pack_header(header, bps, reverse, littleendian, bigwords);
+        hbh_pack_reader_init(&range, header, first, count);
+        hbh_input_skip(&input, hbh_pack_offset(bps, first));
+    }
 
-    unsigned char buffer[2048];
-
-    #define BITFIFO_SIZE 20000
-    unsigned char bitfifo[BITFIFO_SIZE];
-    int bitfifo_head = 0;
-    int bitfifo_tail = 0;
-    int bitfifo_entries = 0;
-
-    unsigned char outbuffer[20000];
-    int outindex = 0;
-    int done=0;
-    size_t len;
-    unsigned char abit;
-
-    int symbol_count;
-    int j;
-    int runcount = 0;
-    int last_abyte = -1;
-    int max_runcount = 0;
     do {
-        if (using_infile==1)
-            len = fread(buffer, 1, 2048 , ifp);
+        if ((ranged==1) && (range.left == 0))
+            len = 0;
         else
-            len = fread(buffer, 1, 2048 , stdin);
-            
-        if (len == 0) break;
-
-        // Read in buffer bytes into the FIFO of bits. One bit per byte.        
-        for (i=0;i<len;i++) {
-            abyte = buffer[i];
-            for(j=0;j<8;j++) {
-                if (reverse==0) {
-                    abit = (abyte & 0x01);
-                    abyte = abyte >> 1;
-                } else {
-                    abit = (abyte & 0x80) >> 7;
-                    abyte = abyte << 1;
-                }
-
-                bitfifo_head = (bitfifo_head +1) % BITFIFO_SIZE;
-                bitfifo_entries++;
-                bitfifo[bitfifo_head] = abit;
-            }
+            len = hbh_input_next(&input, &buffer, HBH_SLAB_SIZE);
+        if (len < 0) {
+            perror("failed to read input");
+            exit(1);
         }
 
-        // Work out how many full symbols are in the FIFO.
-        symbol_count = bitfifo_entries / bps;
-
-        //Pull bits from the FIFO and Write out the symbols (of 1 to 8 bits) as bytes;
-        for (i=0;i<symbol_count;i++) {
-            abyte = 0;
-            // Read the bits of one symbol and put into an output byte.
-            for (j=0;j<bps;j++) {
-                bitfifo_tail = (bitfifo_tail +1) % BITFIFO_SIZE;
-                bitfifo_entries--;
-                abit = bitfifo[bitfifo_tail];
-                
-                if (littleendian==1) {
-                    abyte = abyte | (abit << j);
-                } else {
-                    abyte = (abyte << 1) | abit;
+        outbuffer = hbh_output_space(&output);
+        if (ranged==1) {
+            if (len == 0)
+                outindex = hbh_pack_reader_finish(&range, outbuffer);
+            else
+                outindex = hbh_pack_reader_update(&range, buffer, (size_t)len, outbuffer);
+            if (stats==1) hbh_stats_update(&symstats, outbuffer, outindex);
+        } else if ((sampling==1) && (len == 0)) {
+            outindex = hbh_sample_finish(&sampler, outbuffer);
+            if (stats==1) hbh_stats_update(&symstats, outbuffer, outindex);
+        } else if (sampling==1) {
+            /* Bits, symbols, stride and statistics all in one pass */
+            outindex = 0;
+            for (off=0;off<(size_t)len;off+=piece) {
+                piece = ((stats==1) && ((size_t)len - off > STATS_PIECE)) ? STATS_PIECE : (size_t)len - off;
+                n = hbh_sample_update(&sampler, buffer+off, piece, outbuffer+outindex);
+                if (stats==1) hbh_stats_update(&symstats, outbuffer+outindex, n);
+                outindex += n;
+            }
+        } else if (len == 0) {
+            outindex = hbh_oddball_encode_finish(&state, (packed==1) ? scratch : outbuffer);
+            if (stats==1) hbh_stats_update(&symstats, (packed==1) ? scratch : outbuffer, outindex);
+            if (packed==1) outindex = 0;
+        } else if (stats==1) {
+            outindex = 0;
+            for (off=0;off<(size_t)len;off+=piece) {
+                piece = ((size_t)len - off > STATS_PIECE) ? STATS_PIECE : (size_t)len - off;
+                /* 1 bit symbols are counted straight from the packed input */
+                if (bps == 1) hbh_stats_update_bits(&symstats, buffer+off, piece, reverse);
+                if (packed==1) {
+                    if (bps > 1) hbh_stats_update(&symstats, scratch, hbh_oddball_encode_update(&state, buffer+off, piece, scratch));
+                    continue;
                 }
+                n = hbh_oddball_encode_update(&state, buffer+off, piece, outbuffer+outindex);
+                if (bps > 1) hbh_stats_update(&symstats, outbuffer+outindex, n);
+                outindex += n;
+            }
+            if (packed==1) {
+                memcpy(outbuffer, buffer, (size_t)len);
+                outindex = (size_t)len;
             }
+        } else if (packed==1) {
+            memcpy(outbuffer, buffer, (size_t)len);
+            outindex = (size_t)len;
+        } else {
+            outindex = hbh_oddball_encode_update(&state, buffer, (size_t)len, outbuffer);
+        }
 
-            outbuffer[outindex] = abyte;
-            outindex += 1;
+        if (hbh_output_commit(&output, outindex) != 0) {
+            perror("failed to write output");
+            exit(1);
+        }
 
-            if (abyte==last_abyte) {
-                runcount++;
-                if (runcount > max_runcount) {
-                    max_runcount = runcount;
-                }
-            } else {
-                runcount = 1;
-                last_abyte = abyte;
+    } while (len != 0);
+
+    if (hbh_output_close(&output) != 0) {
+        perror("failed to write output");
+        exit(1);
+    }
+    if (verbose==1) hbh_report_throughput("bin2nistoddball", &input, &output);
+    free(scratch);
+
+    if (indexmb > 0) {
+        strcat(filename, ".idx");
+        if (write_index(filename, bps, reverse, littleendian, bigwords, (uint64_t)indexmb << 20, input.bytes_in) != 0) {
+            perror("failed to write index file");
+            exit(1);
+        }
+    }
+
+    if (stats==1) {
+        FILE *sfp = stderr;
+
+        hbh_stats_finish(&symstats);
+        if (statsname[0] != 0) {
+            sfp = fopen(statsname, "w");
+            if (sfp == NULL) {
+                perror("failed to open stats file for writing");
+                exit(1);
             }
         }
-        
-        if (using_outfile)
-            fwrite(outbuffer, outindex,1,ofp);
-        else
-            fwrite(outbuffer, outindex,1,stdout);
-        
-        outindex = 0;
-        
-    } while (done==0);
-    
+        write_stats(sfp, &symstats);
+        if (sfp != stderr) fclose(sfp);
+    }
+    hbh_input_close(&input);
     if (using_outfile==1) fclose(ofp);
-    //fprintf(stderr,"max_runcount = %d\n",max_runcount);
 }
 
 
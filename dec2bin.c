@@ -23,7 +23,7 @@
     Contact. David Johnston dj@deadhat.com
 */
 /* make isnan() visible */
-#define _BSD_SOURCE 
+#define _DEFAULT_SOURCE
 
 #include <stdio.h>
 #include <string.h>
@@ -34,68 +34,31 @@
 #include <unistd.h>
 #include <getopt.h>
 
+#include "hexbinhex.h"
+#include "hbh_io.h"
+#include "hbh_batch.h"
+#include "hbh_range.h"
+
 void display_usage() {
-    fprintf(stderr,"Usage: dec2bin [-b][-w <width>][-h][-o <out filename>] [filename]\n");
+    fprintf(stderr,"Usage: dec2bin [-b][-w <width>][-h][-v][-K kernel][--offset n][--length n][-o <out filename>] [filename]\n");
     fprintf(stderr,"  -w <width> gives size of binary output numbers in bytes,\n");
     fprintf(stderr,"             default 4 bytes. Must be from 1 to 8.\n");
     fprintf(stderr,"  -b Output numbers as big-endian binary.\n");
     fprintf(stderr,"             Default is little endian\n");
+    fprintf(stderr,"  -v Report throughput to stderr\n");
+    fprintf(stderr,"  -K <name> Use the scalar, sse4, avx2 or avx512 kernels\n");
+    fprintf(stderr,"  --offset n Start from number n\n");
+    fprintf(stderr,"  --length n Convert n numbers at most\n");
+    fprintf(stderr,"  --batch <glob|@list> Convert each matching or listed file to its own file\n");
+    fprintf(stderr,"  --batch-out <template> Output path of each, default %%d/%%b.%%e\n");
+    fprintf(stderr,"  --batch-jobs <n> Convert the batch on n threads (default one per CPU)\n");
+    fprintf(stderr,"  -o <out filename> Output to a file instead of stdout\n");
     fprintf(stderr,"\n");
-    fprintf(stderr,"Convert binary data to decimal.\n");
+    fprintf(stderr,"Convert decimal numbers to binary data.\n");
     fprintf(stderr,"  Author: David Johnston, dj@deadhat.com\n");
     fprintf(stderr,"\n");
 }
 
-void new_digits(char *digits, int *digitcount) {
-    *digitcount = 0;
-};
-
-void add_digit(char ch, char *digits, int *digitcount) {
-    int i;
-    i = *digitcount;
-    digits[i] = ch;
-    i++;
-    *digitcount = i;
-};
-
-// The digits if any in the digits buffer should be all the digits for a given number
-// because it was followed by a non digit or it got to the end of a file.
-// So we convert the number to binary and output it.
-void finish_digits(char *digits, int *digitcount, int *using_outfile, FILE *ofp, int *bwidth, int *bigendian) {
-    uint64_t thenumber;
-    unsigned char outbytes[16];
-    unsigned char *numberptr;
-    int result;
-    int i;
-
-    if (*digitcount > 0) {
-        digits[*digitcount]=0x00;
-        result = sscanf(digits,"%" SCNu64 ,&thenumber);
-       
-        if (result) {
-            numberptr = (unsigned char *)(&thenumber);
-
-            if (*bigendian == 1) {
-                for (i=0; i<*bwidth; i++) {
-                    outbytes[i] = numberptr[*bwidth-i-1];
-                }
-            } else {
-                for (i=0; i<*bwidth; i++) {
-                    outbytes[i] = numberptr[i];
-                }
-            }
-
-            if (*using_outfile == 1) {
-                fwrite(outbytes, 1, *bwidth, ofp);
-            } else {
-                fwrite(outbytes, 1, *bwidth, stdout);
-            }
-        }
-    }
-    *digitcount = 0;
-
-};
-
 /********
 * main() is mostly about parsing and qualifying the command line options.
 */
@@ -103,14 +66,18 @@ void finish_digits(char *digits, int *digitcount, int *using_outfile, FILE *ofp,
 int main(int argc, char** argv)
 {
     int opt;
-	int i;
 	
-	FILE *ifp;
-	FILE *ofp;
+	FILE *ofp = NULL;
 	int using_outfile;
-	int using_infile;
+	int using_infile = 0;
+	int verbose = 0;
+    uint64_t first = 0;
+    uint64_t count = UINT64_MAX;
 	char filename[1000];
 	char infilename[1000];
+    char batch[1000];
+    char batchout[1000];
+    int jobs = 0;
 	
 	//int linewidth;
     int bwidth=4;
@@ -121,15 +88,24 @@ int main(int argc, char** argv)
 
     filename[0] = (char)0;
 	infilename[0] = (char)0;
+    batch[0] = (char)0;
+    strcpy(batchout, HBH_BATCH_OUT);
 
 	/* get the options and arguments */
     int longIndex;
 
-    char optString[] = "bo:k:w:h";
+    char optString[] = "bo:k:w:K:vh";
     static const struct option longOpts[] = {
     { "output", required_argument, NULL, 'o' },
     { "width", required_argument, NULL, 'w' },
     { "bigendian", no_argument, NULL, 'b' },
+    { "verbose", no_argument, NULL, 'v' },
+    { "kernel", required_argument, NULL, 'K' },
+    { "offset", required_argument, NULL, 'F' },
+    { "length", required_argument, NULL, 'N' },
+    { "batch", required_argument, NULL, 'A' },
+    { "batch-out", required_argument, NULL, 'O' },
+    { "batch-jobs", required_argument, NULL, 'J' },
     { "help", no_argument, NULL, 'h' },
     { NULL, no_argument, NULL, 0 }
     };
@@ -156,6 +132,46 @@ int main(int argc, char** argv)
                 strcpy(infilename,optarg);
                 break;
                 
+            case 'v':
+                verbose=1;
+                break;
+            case 'K':
+                if (hbh_kernel_set(hbh_kernel_parse(optarg)) != 0) {
+                    fprintf(stderr,"Error: kernel %s is unknown or not supported by this CPU\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'F':
+                if (hbh_parse_count(optarg, &first) != 0) {
+                    fprintf(stderr,"Error: --offset %s is not a count of numbers\n", optarg);
+                    display_usage();
+                    exit(1);
+                }
+                break;
+            case 'N':
+                if (hbh_parse_count(optarg, &count) != 0) {
+                    fprintf(stderr,"Error: --length %s is not a count of numbers\n", optarg);
+                    display_usage();
+                    exit(1);
+                }
+                break;
+            case 'A':
+                if (strlen(optarg) >= sizeof(batch)) {
+                    fprintf(stderr,"Error: batch file list too long\n");
+                    exit(1);
+                }
+                strcpy(batch,optarg);
+                break;
+            case 'O':
+                if (strlen(optarg) >= sizeof(batchout)) {
+                    fprintf(stderr,"Error: batch output template too long\n");
+                    exit(1);
+                }
+                strcpy(batchout,optarg);
+                break;
+            case 'J':
+                jobs = atoi(optarg);
+                break;
             case 'h':   /* fall-through is intentional */
             case '?':
                 display_usage();
@@ -176,6 +192,17 @@ int main(int argc, char** argv)
 
 	/* Range check the var args */
 
+    /* Batch mode converts each listed file to a file of its own */
+    if (batch[0] != 0) {
+        hbh_format from = { HBH_DEC, bwidth, 0, 0, 0, bigendian };
+        hbh_format to = { HBH_BIN };
+
+        if ((using_outfile==1) || (using_infile==1) || (first != 0) || (count != UINT64_MAX)) {
+            fprintf(stderr,"Error: --batch names its own files, so takes no -o, filename, --offset or --length\n");
+            exit(1);
+        }
+        exit((hbh_batch_run("dec2bin", batch, batchout, &from, &to, 0, jobs, verbose) == 0) ? 0 : 1);
+    }
 
 	/* open the output file if needed */
 
@@ -188,70 +215,77 @@ int main(int argc, char** argv)
 		}
 	}
 
-	/* open the input file if needed */
-	if (using_infile==1)
-	{
-        ifp =  fopen(infilename, "rb");
-		    
-		if (ifp == NULL) {
-			perror("failed to open input file for reading");
-			exit(1);
-		}
-	}
+    /* open the input, memory mapping it if it is a regular file */
+    hbh_input input;
 
-    char buffer[2048];
-    char *bufferptr;
-    char digits[256];
-    //unsigned char outbuffer[10000];
-    //int outindex = 0;
-    //int bytecount = 0;
-    int done=0;
-    //int decimalval=0;
-    //unsigned char c=0;
-    //size_t len;
-    char ch;
-    int gotten;
-    int digitcount;
-    int lastone_adigit = 1;
-
-    //int lastcharnl = 0;
-    digitcount = 0;
-    new_digits(digits, &digitcount);
+    if (hbh_input_open(&input, (using_infile==1) ? infilename : NULL) != 0) {
+        perror("failed to open input file for reading");
+        exit(1);
+    }
+
+    const unsigned char *buffer;
+    unsigned char *outbuffer;
+    size_t outsize;
+    size_t outindex;
+    hbh_output output;
+    long len;
+    hbh_dec_decoder state;
+    hbh_range range;
+    int ranged = (first != 0) || (count != UINT64_MAX);
+
+    /* A range starts from the checkpoint before it */
+    if (ranged==1) {
+        hbh_format from = { HBH_DEC, bwidth, 0, 0, 0, bigendian };
+
+        if (hbh_range_open(&range, &input, (using_infile==1) ? infilename : NULL, &from, first*(uint64_t)bwidth, (count > UINT64_MAX/(uint64_t)bwidth) ? UINT64_MAX : count*(uint64_t)bwidth, HBH_RANGE_STEP) != 0) {
+            perror("failed to index input");
+            exit(1);
+        }
+        if (verbose==1) hbh_range_report("dec2bin", &range);
+    }
+
+    if (hbh_dec_decode_init(&state, bwidth, bigendian) != 0) {
+        fprintf(stderr,"Error: invalid conversion parameters\n");
+        exit(1);
+    }
+    outsize = (ranged==1) ? hbh_range_bound(&range, HBH_SLAB_SIZE) : hbh_dec_decode_bound(&state, HBH_SLAB_SIZE);
+    if (outsize < HBH_FINISH_BOUND) outsize = HBH_FINISH_BOUND;
+    if (hbh_output_open(&output, (using_outfile==1) ? ofp : stdout, outsize) != 0) {
+        perror("failed to allocate output buffer");
+        exit(1);
+    }
 
     do {
-        if (using_infile==1)
-            gotten = fread(buffer, 1, sizeof(buffer), ifp);
+        if ((ranged==1) && (range.left == 0))
+            len = 0;
         else
-            gotten = fread(buffer, 1, sizeof(buffer), stdin);
-            
-        if (gotten == 0) {
-            finish_digits(digits, &digitcount, &using_outfile, ofp, &bwidth, &bigendian);  // mop up any last number 
-            done = 1;
-            break;
+            len = hbh_input_next(&input, &buffer, HBH_SLAB_SIZE);
+        if (len < 0) {
+            perror("failed to read input");
+            exit(1);
         }
 
-        bufferptr = buffer;
-        
-        for (i=0; i<gotten; i++) {
-            ch = *bufferptr++;
-
-            if  ((ch > 0x2F) && (ch < 0x3a)) { // while it's a digit
-                if (lastone_adigit==0) {
-                    new_digits(digits, &digitcount); // A new number if it
-                }                                    //  follows a non number
-                add_digit(ch, digits, &digitcount);  // Add the digit to the number
-                lastone_adigit=1;              // and remember that it was a number
-            }
-            else {
-                if (digitcount > 0) {
-                    finish_digits(digits, &digitcount, &using_outfile, ofp, &bwidth, &bigendian);  // If we didn't get a digit char
-                }
-                lastone_adigit=0;                    // then finish up any numbers we
-            }                                            // already collected
+        outbuffer = hbh_output_space(&output);
+        if (ranged==1)
+            outindex = (len == 0) ? hbh_range_finish(&range, outbuffer) : hbh_range_update(&range, buffer, (size_t)len, outbuffer);
+        else if (len == 0)
+            outindex = hbh_dec_decode_finish(&state, outbuffer);
+        else
+            outindex = hbh_dec_decode_update(&state, buffer, (size_t)len, outbuffer);
+
+        if (hbh_output_commit(&output, outindex) != 0) {
+            perror("failed to write output");
+            exit(1);
         }
 
-    } while (done==0);
+    } while (len != 0);
 
+    if (hbh_output_close(&output) != 0) {
+        perror("failed to write output");
+        exit(1);
+    }
+    if (verbose==1) hbh_report_throughput("dec2bin", &input, &output);
+    hbh_input_close(&input);
     if (using_outfile==1) fclose(ofp);
     
 }
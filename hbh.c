@@ -0,0 +1,258 @@
+
+/*
+    hbh - Convert between any of the hexbinhex formats in one pass.
+    
+    Copyright (C) 2024  David Johnston
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    -----
+    
+    Contact. David Johnston dj@deadhat.com
+*/
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "hexbinhex.h"
+#include "hbh_io.h"
+#include "hbh_batch.h"
+
+void display_usage() {
+fprintf(stderr,"Usage: hbh -f <format> -t <format> [-v][-K kernel][-h][-o <out filename>] [filename]\n");
+fprintf(stderr,"       -f , --from <format>     Format of the input\n");
+fprintf(stderr,"       -t , --to <format>       Format of the output\n");
+fprintf(stderr,"       -o , --output filename   Output to file filename instead of stdout\n");
+fprintf(stderr,"       -v , --verbose           Report throughput to stderr\n");
+fprintf(stderr,"       -K , --kernel <name>     Use the scalar, sse4, avx2 or avx512 kernels\n");
+fprintf(stderr,"            --batch <glob|@list> Convert each matching or listed file to its own file\n");
+fprintf(stderr,"            --batch-out <template> Output path of each, default %%d/%%b.%%e\n");
+fprintf(stderr,"            --batch-jobs <n>    Convert the batch on n threads (default one per CPU)\n");
+fprintf(stderr,"       -h , --help              Output this information\n");
+fprintf(stderr,"\n");
+fprintf(stderr,"Formats:\n");
+fprintf(stderr,"       bin                      Binary\n");
+fprintf(stderr,"       hex[:width]              Hex, width bytes per line (default 32)\n");
+fprintf(stderr,"       01[:width][:s][:be]      ASCII binary, width bits per line (default 32),\n");
+fprintf(stderr,"                                :s adds a space every 8 bits, :be is msb first\n");
+fprintf(stderr,"       oddball:bps[:r][:be][:bw] NIST SP800-90B one symbol per byte, bps of 1-32 bits,\n");
+fprintf(stderr,"                                :r takes bytes msb first, :be puts symbols msb first,\n");
+fprintf(stderr,"                                symbols over 8 bits take 2 or 4 byte words, :bw big endian\n");
+fprintf(stderr,"       dec[:width][:be]         Decimal numbers of width bytes (default 4),\n");
+fprintf(stderr,"                                :be is big endian\n");
+fprintf(stderr,"\n");
+fprintf(stderr,"Convert between any of the hexbinhex formats in one pass.\n");
+fprintf(stderr,"  Author: David Johnston, dj@deadhat.com\n");
+fprintf(stderr,"\n");
+}
+
+/********
+* main() is mostly about parsing and qualifying the command line options.
+*/
+
+int main(int argc, char** argv)
+{
+    int opt;
+
+    FILE *ofp = NULL;
+    int using_outfile = 0;
+    int using_infile = 0;
+    int verbose = 0;
+    char filename[1000];
+    char infilename[1000];
+    char batch[1000];
+    char batchout[1000];
+    int jobs = 0;
+
+    hbh_format from;
+    hbh_format to;
+    int gotfrom = 0;
+    int gotto = 0;
+
+    filename[0] = (char)0;
+    infilename[0] = (char)0;
+    batch[0] = (char)0;
+    strcpy(batchout, HBH_BATCH_OUT);
+
+    /* get the options and arguments */
+    int longIndex;
+
+    char optString[] = "f:t:o:K:vh";
+    static const struct option longOpts[] = {
+    { "from", required_argument, NULL, 'f' },
+    { "to", required_argument, NULL, 't' },
+    { "output", required_argument, NULL, 'o' },
+    { "verbose", no_argument, NULL, 'v' },
+    { "kernel", required_argument, NULL, 'K' },
+    { "batch", required_argument, NULL, 'A' },
+    { "batch-out", required_argument, NULL, 'O' },
+    { "batch-jobs", required_argument, NULL, 'J' },
+    { "help", no_argument, NULL, 'h' },
+    { NULL, no_argument, NULL, 0 }
+    };
+
+    opt = getopt_long( argc, argv, optString, longOpts, &longIndex );
+    while( opt != -1 ) {
+        switch( opt ) {
+            case 'f':
+                if (hbh_format_parse(&from, optarg) != 0) {
+                    fprintf(stderr,"Error: unknown input format %s\n", optarg);
+                    exit(1);
+                }
+                gotfrom = 1;
+                break;
+            case 't':
+                if (hbh_format_parse(&to, optarg) != 0) {
+                    fprintf(stderr,"Error: unknown output format %s\n", optarg);
+                    exit(1);
+                }
+                gotto = 1;
+                break;
+            case 'o':
+                using_outfile = 1;
+                strcpy(filename,optarg);
+                break;
+            case 'v':
+                verbose=1;
+                break;
+            case 'K':
+                if (hbh_kernel_set(hbh_kernel_parse(optarg)) != 0) {
+                    fprintf(stderr,"Error: kernel %s is unknown or not supported by this CPU\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'A':
+                if (strlen(optarg) >= sizeof(batch)) {
+                    fprintf(stderr,"Error: batch file list too long\n");
+                    exit(1);
+                }
+                strcpy(batch,optarg);
+                break;
+            case 'O':
+                if (strlen(optarg) >= sizeof(batchout)) {
+                    fprintf(stderr,"Error: batch output template too long\n");
+                    exit(1);
+                }
+                strcpy(batchout,optarg);
+                break;
+            case 'J':
+                jobs = atoi(optarg);
+                break;
+            case 'h':   /* fall-through is intentional */
+            case '?':
+                display_usage();
+                exit(0);
+
+            default:
+                /* You won't actually get here. */
+                break;
+        }
+
+        opt = getopt_long( argc, argv, optString, longOpts, &longIndex );
+    } // end while
+
+    if ((gotfrom==0) || (gotto==0)) {
+        fprintf(stderr,"Error: both an input format (-f) and an output format (-t) are needed\n");
+        display_usage();
+        exit(1);
+    }
+
+    if (optind < argc) {
+        strcpy(infilename,argv[optind]);
+        using_infile = 1;
+    }
+
+    /* Batch mode converts each listed file to a file of its own */
+    if (batch[0] != 0) {
+        if ((using_outfile==1) || (using_infile==1)) {
+            fprintf(stderr,"Error: --batch names its own files, so takes no -o or filename\n");
+            exit(1);
+        }
+        exit((hbh_batch_run("hbh", batch, batchout, &from, &to, 0, jobs, verbose) == 0) ? 0 : 1);
+    }
+
+    /* open the output file if needed */
+
+    if (using_outfile==1)
+    {
+        ofp = fopen(filename, "wb");
+        if (ofp == NULL) {
+            perror("failed to open output file for writing");
+            exit(1);
+        }
+    }
+
+    /* open the input, memory mapping it if it is a regular file */
+    hbh_input input;
+
+    if (hbh_input_open(&input, (using_infile==1) ? infilename : NULL) != 0) {
+        perror("failed to open input file for reading");
+        exit(1);
+    }
+
+    const unsigned char *buffer;
+    unsigned char *outbuffer;
+    size_t outsize;
+    size_t outindex;
+    hbh_output output;
+    long len;
+    hbh_converter state;
+
+    if (hbh_convert_init(&state, &from, &to) != 0) {
+        fprintf(stderr,"Error: invalid conversion parameters\n");
+        exit(1);
+    }
+    outsize = hbh_convert_bound(&state, HBH_SLAB_SIZE);
+    if (hbh_output_open(&output, (using_outfile==1) ? ofp : stdout, outsize) != 0) {
+        perror("failed to allocate output buffer");
+        exit(1);
+    }
+
+    do {
+        len = hbh_input_next(&input, &buffer, HBH_SLAB_SIZE);
+        if (len < 0) {
+            perror("failed to read input");
+            exit(1);
+        }
+
+        outbuffer = hbh_output_space(&output);
+        if (len == 0)
+            outindex = hbh_convert_finish(&state, outbuffer);
+        else
+            outindex = hbh_convert_update(&state, buffer, (size_t)len, outbuffer);
+
+        if (hbh_output_commit(&output, outindex) != 0) {
+            perror("failed to write output");
+            exit(1);
+        }
+
+    } while (len != 0);
+
+    if (hbh_output_close(&output) != 0) {
+        perror("failed to write output");
+        exit(1);
+    }
+    if (verbose==1) hbh_report_throughput("hbh", &input, &output);
+    hbh_input_close(&input);
+    if (using_outfile==1) fclose(ofp);
+
+    return 0;
+}
@@ -0,0 +1,458 @@
+/*
+    hbh_batch.c - Batch conversion of many files by the hexbinhex tools.
+
+    Copyright (C) 2017  David Johnston
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    -----
+
+    Contact. David Johnston dj@deadhat.com
+*/
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <glob.h>
+#include <sys/stat.h>
+
+#include "hexbinhex.h"
+#include "hbh_io.h"
+#include "hbh_thread.h"
+#include "hbh_batch.h"
+
+typedef struct {
+    char *in;
+    char *out;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    double secs;
+    int failed;
+} batch_file;
+
+typedef struct {
+    const char *tool;
+    const hbh_format *from;
+    const hbh_format *to;
+    int skip;
+    batch_file *files;
+    int count;
+    int size;
+    int next;                   /* next file to hand out */
+    unsigned char **bufs;       /* an output buffer per worker */
+    size_t bufsize;
+} batch;
+
+static int add_file(batch *b, const char *path) {
+    batch_file *grown;
+
+    if (b->count == b->size) {
+        b->size = (b->size == 0) ? 64 : 2*b->size;
+        grown = realloc(b->files, (size_t)b->size*sizeof(batch_file));
+        if (grown == NULL) return -1;
+        b->files = grown;
+    }
+    memset(&b->files[b->count], 0, sizeof(batch_file));
+    b->files[b->count].in = strdup(path);
+    if (b->files[b->count].in == NULL) return -1;
+    b->count++;
+    return 0;
+}
+
+/* One path per line. Blank lines and lines starting with # are skipped. */
+static int list_manifest(batch *b, const char *name) {
+    FILE *fp;
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t n;
+    int result = 0;
+
+    fp = (strcmp(name, "-") == 0) ? stdin : fopen(name, "r");
+    if (fp == NULL) return -1;
+    while ((n = getline(&line, &cap, fp)) > 0) {
+        while ((n > 0) && ((line[n-1] == '\n') || (line[n-1] == '\r'))) line[--n] = 0;
+        if ((n == 0) || (line[0] == '#')) continue;
+        if (add_file(b, line) != 0) {
+            result = -1;
+            break;
+        }
+    }
+    if (ferror(fp)) result = -1;
+    free(line);
+    if (fp != stdin) fclose(fp);
+    return result;
+}
+
+static int list_glob(batch *b, const char *pattern) {
+    glob_t g;
+    size_t i;
+    int result;
+
+    result = glob(pattern, 0, NULL, &g);
+    if (result == GLOB_NOMATCH) return 0;
+    if (result != 0) {
+        errno = (result == GLOB_NOSPACE) ? ENOMEM : EIO;
+        return -1;
+    }
+    for (i=0;i<g.gl_pathc;i++) {
+        if (add_file(b, g.gl_pathv[i]) != 0) {
+            result = -1;
+            break;
+        }
+    }
+    globfree(&g);
+    return result;
+}
+
+static const char *extension(int format) {
+    switch (format) {
+        case HBH_BIN:     return "bin";
+        case HBH_HEX:     return "hex";
+        case HBH_BITS:    return "01";
+        case HBH_ODDBALL: return "nist";
+        default:          return "dec";
+    }
+}
+
+/* Fill in the output path template for one input. Returns a malloc()ed
+ * path, or NULL with errno set for an unknown % or no memory. */
+static char *expand(const char *template, const char *path, const char *ext) {
+    const char *slash = strrchr(path, '/');
+    const char *name = (slash == NULL) ? path : slash + 1;
+    const char *dot = strrchr(name, '.');
+    int dirlen = ((slash == NULL) || (slash == path)) ? 1 : (int)(slash - path);
+    int baselen = ((dot == NULL) || (dot == name)) ? (int)strlen(name) : (int)(dot - name);
+    const char *p;
+    char *out = NULL;
+    size_t outlen = 0;
+    FILE *fp;
+    int bad = 0;
+
+    fp = open_memstream(&out, &outlen);
+    if (fp == NULL) return NULL;
+    for (p=template;*p!=0;p++) {
+        if (*p != '%') {
+            fputc(*p, fp);
+            continue;
+        }
+        switch (*++p) {
+            case 'd': fprintf(fp, "%.*s", dirlen, (slash == NULL) ? "." : (slash == path) ? "/" : path); break;
+            case 'f': fputs(name, fp); break;
+            case 'b': fprintf(fp, "%.*s", baselen, name); break;
+            case 'e': fputs(ext, fp); break;
+            case '%': fputc('%', fp); break;
+            default:  bad = 1; break;
+        }
+        if (bad || (*p == 0)) break;
+    }
+    if (fclose(fp) != 0) bad = 1;
+    if (bad || (*p != 0)) {
+        free(out);
+        errno = EINVAL;
+        return NULL;
+    }
+    return out;
+}
+
+/* mkdir -p for the directory part of path */
+static int make_dirs(const char *path) {
+    char *dir = strdup(path);
+    char *p;
+    int result = 0;
+
+    if (dir == NULL) return -1;
+    for (p=dir+1;*p!=0;p++) {
+        if (*p != '/') continue;
+        *p = 0;
+        if ((mkdir(dir, 0777) != 0) && (errno != EEXIST)) {
+            result = -1;
+            break;
+        }
+        *p = '/';
+    }
+    free(dir);
+    return result;
+}
+
+/* Outputs are sorted by name, then those that already exist by device and
+ * inode, so two spellings of one file are caught as well as one name. */
+static const batch *sorting;
+
+static int by_name(const void *x, const void *y) {
+    return strcmp(sorting->files[*(const int *)x].out, sorting->files[*(const int *)y].out);
+}
+
+typedef struct {
+    dev_t dev;
+    ino_t ino;
+    int index;
+} file_id;
+
+static int by_id(const void *x, const void *y) {
+    const file_id *a = x;
+    const file_id *c = y;
+
+    if (a->dev != c->dev) return (a->dev < c->dev) ? -1 : 1;
+    if (a->ino != c->ino) return (a->ino < c->ino) ? -1 : 1;
+    return 0;
+}
+
+static void clash(batch *b, int i, int j) {
+    if (!b->files[i].failed)
+        fprintf(stderr,"%s: %s: output %s is also the output of %s\n", b->tool, b->files[i].in, b->files[i].out, b->files[j].in);
+    b->files[i].failed = 1;
+}
+
+/* Two inputs written to one output would overwrite each other, or with
+ * two workers on it interleave, so both are failed before any start.
+ * Returns -1 if there isn't the memory to check. */
+static int check_outputs(batch *b) {
+    struct stat st;
+    file_id *ids;
+    int *order;
+    int n = 0;
+    int i;
+
+    if (b->count < 2) return 0;
+    order = malloc((size_t)b->count*sizeof(int));
+    ids = malloc((size_t)b->count*sizeof(file_id));
+    if ((order == NULL) || (ids == NULL)) {
+        free(order);
+        free(ids);
+        return -1;
+    }
+    for (i=0;i<b->count;i++) order[i] = i;
+    sorting = b;
+    qsort(order, (size_t)b->count, sizeof(int), by_name);
+    for (i=1;i<b->count;i++) {
+        if (strcmp(b->files[order[i-1]].out, b->files[order[i]].out) != 0) continue;
+        clash(b, order[i-1], order[i]);
+        clash(b, order[i], order[i-1]);
+    }
+
+    for (i=0;i<b->count;i++) {
+        if (stat(b->files[i].out, &st) != 0) continue;
+        ids[n].dev = st.st_dev;
+        ids[n].ino = st.st_ino;
+        ids[n].index = i;
+        n++;
+    }
+    qsort(ids, (size_t)n, sizeof(file_id), by_id);
+    for (i=1;i<n;i++) {
+        if (by_id(&ids[i-1], &ids[i]) != 0) continue;
+        clash(b, ids[i-1].index, ids[i].index);
+        clash(b, ids[i].index, ids[i-1].index);
+    }
+    free(order);
+    free(ids);
+    return 0;
+}
+
+static void fail(batch *b, batch_file *f, const char *what) {
+    f->failed = 1;
+    fprintf(stderr,"%s: %s: failed to %s: %s\n", b->tool, f->in, what, strerror(errno));
+}
+
+static void convert_file(batch *b, batch_file *f, unsigned char *out) {
+    hbh_converter state;
+    hbh_input input;
+    const unsigned char *buffer;
+    struct stat ist;
+    struct stat ost;
+    size_t outindex;
+    long len;
+    int fd;
+
+    if (f->failed) return;
+    if (hbh_input_open(&input, f->in) != 0) {
+        fail(b, f, "open input file for reading");
+        return;
+    }
+    /* Writing over the input as it is read would lose it */
+    if ((fstat(input.fd, &ist) == 0) && (stat(f->out, &ost) == 0) &&
+        (ist.st_dev == ost.st_dev) && (ist.st_ino == ost.st_ino)) {
+        f->failed = 1;
+        fprintf(stderr,"%s: %s: output %s is the input\n", b->tool, f->in, f->out);
+        hbh_input_close(&input);
+        return;
+    }
+    if (make_dirs(f->out) != 0) {
+        fail(b, f, "make output directory");
+        hbh_input_close(&input);
+        return;
+    }
+    fd = open(f->out, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        fail(b, f, "open output file for writing");
+        hbh_input_close(&input);
+        return;
+    }
+
+    hbh_convert_init(&state, b->from, b->to);
+    if (b->skip > 0) hbh_input_skip_lines(&input, b->skip);
+    do {
+        len = hbh_input_next(&input, &buffer, HBH_SLAB_SIZE);
+        if (len < 0) {
+            fail(b, f, "read input");
+            break;
+        }
+        if (len == 0)
+            outindex = hbh_convert_finish(&state, out);
+        else
+            outindex = hbh_convert_update(&state, buffer, (size_t)len, out);
+
+        if (hbh_write_all(fd, out, outindex) != 0) {
+            fail(b, f, "write output");
+            break;
+        }
+        f->bytes_out += outindex;
+    } while (len != 0);
+
+    if ((close(fd) != 0) && !f->failed) fail(b, f, "write output");
+    f->bytes_in = input.bytes_in;
+    f->secs = hbh_input_elapsed(&input);
+    hbh_input_close(&input);
+}
+
+/* Each worker takes the next file until there are none left */
+static void worker(void *arg, int index) {
+    batch *b = arg;
+    int i;
+
+    while ((i = __atomic_fetch_add(&b->next, 1, __ATOMIC_RELAXED)) < b->count)
+        convert_file(b, &b->files[i], b->bufs[index]);
+}
+
+static double now_secs(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec + (double)t.tv_nsec/1e9;
+}
+
+static void report(const batch *b, int jobs, double secs) {
+    uint64_t in = 0;
+    uint64_t out = 0;
+    double fsecs;
+    int failed = 0;
+    int i;
+
+    for (i=0;i<b->count;i++) {
+        const batch_file *f = &b->files[i];
+
+        if (f->failed) {
+            failed++;
+            continue;
+        }
+        in += f->bytes_in;
+        out += f->bytes_out;
+        fsecs = (f->secs > 0.0) ? f->secs : 1e-9;
+        fprintf(stderr,"%s: %s -> %s: read %llu bytes, wrote %llu bytes in %.3f s, %.1f MB/s in\n",
+                b->tool, f->in, f->out, (unsigned long long)f->bytes_in,
+                (unsigned long long)f->bytes_out, f->secs, (double)f->bytes_in/fsecs/1e6);
+    }
+    if (secs <= 0.0) secs = 1e-9;
+    fprintf(stderr,"%s: %d files (%d failed) on %d threads, read %llu bytes, wrote %llu bytes in %.3f s\n",
+            b->tool, b->count, failed, jobs, (unsigned long long)in, (unsigned long long)out, secs);
+    fprintf(stderr,"%s: %.1f MB/s in, %.1f MB/s out, %.1f files/s\n",
+            b->tool, (double)in/secs/1e6, (double)out/secs/1e6, (double)b->count/secs);
+    fprintf(stderr,"%s: %s kernels, best on this CPU %s\n",
+            b->tool, hbh_kernel_name(hbh_kernel_level()), hbh_kernel_name(hbh_kernel_detect()));
+}
+
+int hbh_batch_run(const char *tool, const char *spec, const char *template,
+                  const hbh_format *from, const hbh_format *to, int skip, int jobs, int verbose) {
+    hbh_converter state;
+    batch b;
+    double start = now_secs();
+    int failed = 0;
+    int result = 0;
+    int i;
+
+    memset(&b, 0, sizeof(b));
+    b.tool = tool;
+    b.from = from;
+    b.to = to;
+    b.skip = skip;
+
+    if (hbh_convert_init(&state, from, to) != 0) {
+        fprintf(stderr,"Error: invalid conversion parameters\n");
+        return -1;
+    }
+    b.bufsize = hbh_convert_bound(&state, HBH_SLAB_SIZE);
+
+    if (((spec[0] == '@') ? list_manifest(&b, spec + 1) : list_glob(&b, spec)) != 0) {
+        fprintf(stderr,"%s: failed to list %s: %s\n", tool, spec, strerror(errno));
+        result = -1;
+        goto done;
+    }
+    if (b.count == 0) {
+        fprintf(stderr,"%s: no files in %s\n", tool, spec);
+        result = -1;
+        goto done;
+    }
+    for (i=0;i<b.count;i++) {
+        b.files[i].out = expand(template, b.files[i].in, extension(to->format));
+        if (b.files[i].out == NULL) {
+            fprintf(stderr,"%s: bad output template %s: %s\n", tool, template, strerror(errno));
+            result = -1;
+            goto done;
+        }
+    }
+    if (check_outputs(&b) != 0) {
+        perror("failed to check output names");
+        result = -1;
+        goto done;
+    }
+
+    if (jobs <= 0) jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (jobs <= 0) jobs = 1;
+    if (jobs > b.count) jobs = b.count;
+    b.bufs = calloc((size_t)jobs, sizeof(unsigned char *));
+    if (b.bufs == NULL) {
+        perror("failed to allocate output buffers");
+        result = -1;
+        goto done;
+    }
+    for (i=0;i<jobs;i++) {
+        b.bufs[i] = malloc(b.bufsize);
+        if (b.bufs[i] == NULL) {
+            perror("failed to allocate output buffers");
+            result = -1;
+            goto done;
+        }
+    }
+
+    hbh_parallel_for(jobs, jobs, worker, &b);
+
+    for (i=0;i<b.count;i++) failed += b.files[i].failed;
+    if (verbose) report(&b, jobs, now_secs() - start);
+    result = failed;
+
+done:
+    if (b.bufs != NULL) {
+        for (i=0;i<jobs;i++) free(b.bufs[i]);
+        free(b.bufs);
+    }
+    for (i=0;i<b.count;i++) {
+        free(b.files[i].in);
+        free(b.files[i].out);
+    }
+    free(b.files);
+    return result;
+}
@@ -0,0 +1,57 @@
+/*
+    hbh_batch.h - Batch conversion of many files by the hexbinhex tools.
+
+    Copyright (C) 2017  David Johnston
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    -----
+
+    Contact. David Johnston dj@deadhat.com
+*/
+
+/*
+ * Batch mode converts many files in one process, so that a run of small
+ * captures doesn't pay for a fork, exec and option parse per file. The
+ * files are handed out one at a time to worker threads, each of which
+ * takes the next unconverted file when it finishes one and keeps its
+ * converter and output buffer from file to file.
+ */
+
+#ifndef HBH_BATCH_H
+#define HBH_BATCH_H
+
+#include "hexbinhex.h"
+
+/* Output path used when none is given */
+#define HBH_BATCH_OUT "%d/%b.%e"
+
+/* Convert every file named by spec from one format to the other. spec is
+ * a glob, or @ and a file (- for stdin) listing one path per line. Each
+ * output path comes from template, in which %d is the input's directory,
+ * %f its name, %b its name less any extension, %e the usual extension of
+ * the output format and %% a %. Missing directories are made. The first
+ * skip lines of each input are skipped, for hex2bin -s.
+ *
+ * Inputs whose outputs would be the same file fail without being
+ * converted. jobs is the number of threads, or 0 for one per CPU. Failures are
+ * reported to stderr as they happen and the batch carries on. With
+ * verbose, the throughput of each file and of the whole batch follow.
+ * Returns the number of files that failed, or -1 if the batch couldn't
+ * be started. */
+int hbh_batch_run(const char *tool, const char *spec, const char *template,
+                  const hbh_format *from, const hbh_format *to, int skip, int jobs, int verbose);
+
+#endif
@@ -0,0 +1,487 @@
+
+/*
+    hbh_bench - Throughput benchmark for the hexbinhex converters.
+
+    Copyright (C) 2024  David Johnston
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    -----
+
+    Contact. David Johnston dj@deadhat.com
+*/
+
+/*
+ * Every tool and option combination is run two ways: through the library
+ * in-process, and as the tool itself reading a file and writing to
+ * /dev/null. The input is the same pseudo-random binary every run,
+ * encoded into whatever format the tool reads. Results go to stdout as
+ * JSON. Cycles and instructions come from perf_event_open() and are
+ * null where the counters can't be opened.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <linux/perf_event.h>
+
+#include "hexbinhex.h"
+
+#define SLAB (1024*1024)
+
+/* Each library run repeats until it has taken at least this long */
+#define MIN_SECONDS 0.25
+
+typedef struct {
+    char tool[32];
+    char args[64];      /* options as given to the tool */
+    char from[32];      /* the same conversion as hbh formats */
+    char to[32];
+    int mask;           /* bin2nistoddball --bits and --stride, 0 if not used */
+    int stride;
+    int kernel;         /* kernel level of -K, -1 for the best */
+} bench_case;
+
+typedef struct {
+    double seconds;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    int counted;
+    uint64_t cycles;
+    uint64_t instructions;
+} measurement;
+
+static bench_case cases[512];
+static int ncases = 0;
+
+static void add_case(const char *tool, const char *args, const char *from, const char *to) {
+    bench_case *c = &cases[ncases++];
+    snprintf(c->tool, sizeof(c->tool), "%s", tool);
+    snprintf(c->args, sizeof(c->args), "%s", args);
+    snprintf(c->from, sizeof(c->from), "%s", from);
+    snprintf(c->to, sizeof(c->to), "%s", to);
+    c->mask = 0;
+    c->stride = 0;
+    c->kernel = -1;
+}
+
+/* A case run at one kernel level, in the library and with -K */
+static void add_kernel_case(const char *tool, const char *from, const char *to, int level) {
+    char args[64];
+
+    snprintf(args, sizeof(args), "-K %s", hbh_kernel_name(level));
+    add_case(tool, args, from, to);
+    cases[ncases-1].kernel = level;
+}
+
+static void add_sample_case(const char *args, const char *to, int mask, int stride) {
+    add_case("bin2nistoddball", args, "bin", to);
+    cases[ncases-1].mask = mask;
+    cases[ncases-1].stride = stride;
+}
+
+/* The option sweep */
+static void build_cases(void) {
+    static const char *oddopts[4][2] = { {"", ""}, {" -r", ":r"}, {" -B", ":be"}, {" -r -B", ":r:be"} };
+    static const int bitwidths[3] = { 8, 32, 64 };
+    static const int widesyms[6] = { 10, 12, 16, 20, 24, 32 };
+    char args[64];
+    char fmt[32];
+    int i, j, s, b, k;
+
+    add_case("bin2hex", "", "bin", "hex");
+    add_case("bin2hex", "-w 1", "bin", "hex:1");
+    add_case("hex2bin", "", "hex", "bin");
+    /* The hex decoder meets a line break inside most blocks, at a place
+     * that depends on the line width, so decode the default width and
+     * bin2hex -w 16 output at each kernel level */
+    for (k=HBH_KERNEL_SCALAR;k<=HBH_KERNEL_AVX2;k++) {
+        add_kernel_case("hex2bin", "hex", "bin", k);
+        add_kernel_case("hex2bin", "hex:16", "bin", k);
+    }
+
+    for (i=0;i<3;i++) for (s=0;s<2;s++) for (b=0;b<2;b++) {
+        snprintf(args, sizeof(args), "-w %d%s%s", bitwidths[i], s ? " -s" : "", b ? " -B" : "");
+        snprintf(fmt, sizeof(fmt), "01:%d%s%s", bitwidths[i], s ? ":s" : "", b ? ":be" : "");
+        add_case("bin201", args, "bin", fmt);
+    }
+    add_case("012bin", "", "01", "bin");
+    add_case("012bin", "-B", "01:be", "bin");
+
+    for (i=1;i<=8;i++) for (j=0;j<4;j++) {
+        snprintf(args, sizeof(args), "-l %d%s", i, oddopts[j][0]);
+        snprintf(fmt, sizeof(fmt), "oddball:%d%s", i, oddopts[j][1]);
+        add_case("bin2nistoddball", args, "bin", fmt);
+        add_case("nistoddball2bin", args, fmt, "bin");
+    }
+    for (i=0;i<6;i++) for (b=0;b<2;b++) {
+        snprintf(args, sizeof(args), "-l %d%s", widesyms[i], b ? " -b" : "");
+        snprintf(fmt, sizeof(fmt), "oddball:%d%s", widesyms[i], b ? ":bw" : "");
+        add_case("bin2nistoddball", args, "bin", fmt);
+        add_case("nistoddball2bin", args, fmt, "bin");
+    }
+    add_sample_case("-l 1 --lsb", "oddball:1", 0x01, 1);
+    add_sample_case("-l 1 -r --lsb", "oddball:1:r", 0x01, 1);
+    add_sample_case("-l 3 --bits 0,1,5", "oddball:3", 0x23, 1);
+    add_sample_case("-l 8 --stride 2", "oddball:8", 0xFF, 2);
+    add_sample_case("-l 8 --stride 3", "oddball:8", 0xFF, 3);
+    add_sample_case("-l 1 --stride 4", "oddball:1", 0xFF, 4);
+    add_sample_case("-l 12 --stride 4", "oddball:12", 0xFF, 4);
+    add_sample_case("-l 4 --bits 0,1,2,3 --stride 2", "oddball:4", 0x0F, 2);
+    for (i=1;i<=8;i++) {
+        snprintf(args, sizeof(args), "-l %d", i);
+        snprintf(fmt, sizeof(fmt), "oddball:%d", i);
+        add_case("hex2nistoddball", args, "hex", fmt);
+        add_case("nistoddball2hex", args, fmt, "hex");
+    }
+
+    for (i=1;i<=8;i++) for (b=0;b<2;b++) {
+        snprintf(args, sizeof(args), "-w %d%s", i, b ? " -b" : "");
+        snprintf(fmt, sizeof(fmt), "dec:%d%s", i, b ? ":be" : "");
+        add_case("bin2dec", args, "bin", fmt);
+        add_case("dec2bin", args, fmt, "bin");
+    }
+}
+
+/* Same input every run */
+static void fill_random(unsigned char *buf, size_t len) {
+    uint64_t x = 0x9E3779B97F4A7C15ULL;
+    size_t i;
+
+    for (i=0;i<len;i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        buf[i] = (unsigned char)(x >> 32);
+    }
+}
+
+/* Run a whole buffer through a converter a slab at a time */
+static uint64_t convert_all(hbh_converter *c, const unsigned char *in, size_t len, unsigned char *out, FILE *fp) {
+    uint64_t total = 0;
+    size_t n;
+    size_t m;
+
+    while (len > 0) {
+        n = (len > SLAB) ? SLAB : len;
+        m = hbh_convert_update(c, in, n, out);
+        if (fp != NULL) fwrite(out, 1, m, fp);
+        total += m;
+        in += n;
+        len -= n;
+    }
+    m = hbh_convert_finish(c, out);
+    if (fp != NULL) fwrite(out, 1, m, fp);
+    return total + m;
+}
+
+static int perf_open(uint64_t config) {
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = config;
+    attr.disabled = 1;
+    attr.inherit = 1;           /* count the tools run as children too */
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static int cycles_fd = -1;
+static int instructions_fd = -1;
+
+static void counters_start(void) {
+    if ((cycles_fd < 0) || (instructions_fd < 0)) return;
+    ioctl(cycles_fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(instructions_fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(cycles_fd, PERF_EVENT_IOC_ENABLE, 0);
+    ioctl(instructions_fd, PERF_EVENT_IOC_ENABLE, 0);
+}
+
+static void counters_stop(measurement *m) {
+    m->counted = 0;
+    if ((cycles_fd < 0) || (instructions_fd < 0)) return;
+    ioctl(cycles_fd, PERF_EVENT_IOC_DISABLE, 0);
+    ioctl(instructions_fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(cycles_fd, &m->cycles, 8) != 8) return;
+    if (read(instructions_fd, &m->instructions, 8) != 8) return;
+    m->counted = 1;
+}
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec + (double)t.tv_nsec/1e9;
+}
+
+static int bench_library(const bench_case *bc, const unsigned char *in, size_t len, measurement *m) {
+    hbh_format from, to;
+    hbh_converter c;
+    unsigned char *out;
+    double start;
+
+    if ((hbh_format_parse(&from, bc->from) != 0) || (hbh_format_parse(&to, bc->to) != 0)) return -1;
+    if ((bc->kernel >= 0) && (hbh_kernel_set(bc->kernel) != 0)) return -1;
+    if (hbh_convert_init(&c, &from, &to) != 0) return -1;
+    out = malloc(hbh_convert_bound(&c, SLAB));
+    if (out == NULL) return -1;
+
+    memset(m, 0, sizeof(*m));
+    counters_start();
+    start = now();
+    do {
+        hbh_convert_init(&c, &from, &to);
+        m->bytes_out += convert_all(&c, in, len, out, NULL);
+        m->bytes_in += len;
+        m->seconds = now() - start;
+    } while (m->seconds < MIN_SECONDS);
+    counters_stop(m);
+
+    free(out);
+    hbh_kernel_set(hbh_kernel_detect());
+    return 0;
+}
+
+/* The sampler in place of the converter, in slabs as convert_all() goes */
+static int bench_sampler(const bench_case *bc, const unsigned char *in, size_t len, measurement *m) {
+    hbh_format to;
+    hbh_sampler s;
+    unsigned char *out;
+    double start;
+    size_t off;
+    size_t n;
+
+    if (hbh_format_parse(&to, bc->to) != 0) return -1;
+    if (hbh_sample_init(&s, to.bps, to.reverse, !to.bigendian, to.bigwords, bc->mask, bc->stride) != 0) return -1;
+    out = malloc(hbh_sample_bound(&s, SLAB) + HBH_FINISH_BOUND);
+    if (out == NULL) return -1;
+
+    memset(m, 0, sizeof(*m));
+    counters_start();
+    start = now();
+    do {
+        hbh_sample_init(&s, to.bps, to.reverse, !to.bigendian, to.bigwords, bc->mask, bc->stride);
+        for (off=0;off<len;off+=n) {
+            n = (len - off > SLAB) ? SLAB : len - off;
+            m->bytes_out += hbh_sample_update(&s, in + off, n, out);
+        }
+        m->bytes_out += hbh_sample_finish(&s, out);
+        m->bytes_in += len;
+        m->seconds = now() - start;
+    } while (m->seconds < MIN_SECONDS);
+    counters_stop(m);
+
+    free(out);
+    return 0;
+}
+
+static int bench_tool(const bench_case *bc, const char *tooldir, const char *infile, size_t len, measurement *m) {
+    char path[1100];
+    char args[64];
+    char *argv[16];
+    int argc = 0;
+    char *tok;
+    pid_t pid;
+    int status;
+    int fd;
+    double start;
+
+    snprintf(path, sizeof(path), "%s/%s", tooldir, bc->tool);
+    if (access(path, X_OK) != 0) return -1;
+
+    snprintf(args, sizeof(args), "%s", bc->args);
+    argv[argc++] = path;
+    for (tok = strtok(args, " "); (tok != NULL) && (argc < 14); tok = strtok(NULL, " "))
+        argv[argc++] = tok;
+    argv[argc++] = (char *)infile;
+    argv[argc] = NULL;
+
+    memset(m, 0, sizeof(*m));
+    counters_start();
+    start = now();
+    pid = fork();
+    if (pid < 0) return -1;
+    if (pid == 0) {
+        fd = open("/dev/null", O_WRONLY);
+        if (fd >= 0) dup2(fd, STDOUT_FILENO);
+        execv(path, argv);
+        _exit(127);
+    }
+    if ((waitpid(pid, &status, 0) != pid) || !WIFEXITED(status) || (WEXITSTATUS(status) != 0)) return -1;
+    m->seconds = now() - start;
+    counters_stop(m);
+    m->bytes_in = len;
+    return 0;
+}
+
+static void print_result(const bench_case *bc, const char *mode, const measurement *m, int first) {
+    double secs = (m->seconds > 0.0) ? m->seconds : 1e-9;
+
+    printf("%s    {\"tool\": \"%s\", \"options\": \"%s\", \"input\": \"%s\", \"mode\": \"%s\", ",
+           first ? "" : ",\n", bc->tool, bc->args, bc->from, mode);
+    printf("\"bytes_in\": %llu, \"seconds\": %.6f, \"mb_per_s\": %.1f, ",
+           (unsigned long long)m->bytes_in, m->seconds, (double)m->bytes_in/secs/1e6);
+    if (m->counted && (m->bytes_in > 0))
+        printf("\"cycles_per_byte\": %.3f, \"instructions_per_byte\": %.3f}",
+               (double)m->cycles/(double)m->bytes_in, (double)m->instructions/(double)m->bytes_in);
+    else
+        printf("\"cycles_per_byte\": null, \"instructions_per_byte\": null}");
+}
+
+void display_usage() {
+fprintf(stderr,"Usage: hbh_bench [-s <MB>][-d <tool directory>][-t <tool>][-L][-T][-v][-h]\n");
+fprintf(stderr,"       -s n          Size of the binary input to encode or decode, in MB (default 8)\n");
+fprintf(stderr,"       -d dir        Where to find the tools (default .)\n");
+fprintf(stderr,"       -t tool       Only benchmark this tool\n");
+fprintf(stderr,"       -L            Only benchmark the library\n");
+fprintf(stderr,"       -T            Only benchmark the tools\n");
+fprintf(stderr,"       -v            Report progress to stderr\n");
+fprintf(stderr,"\n");
+fprintf(stderr,"Benchmark the hexbinhex converters, writing JSON to stdout.\n");
+fprintf(stderr,"  Author: David Johnston, dj@deadhat.com\n");
+fprintf(stderr,"\n");
+}
+
+int main(int argc, char** argv)
+{
+    int opt;
+    int megabytes = 8;
+    char tooldir[1000];
+    char only[32];
+    int library = 1;
+    int tools = 1;
+    int verbose = 0;
+
+    strcpy(tooldir, ".");
+    only[0] = (char)0;
+
+    while ((opt = getopt(argc, argv, "s:d:t:LTvh")) != -1) {
+        switch (opt) {
+            case 's':
+                megabytes = atoi(optarg);
+                if (megabytes < 1) megabytes = 1;
+                break;
+            case 'd':
+                snprintf(tooldir, sizeof(tooldir), "%s", optarg);
+                break;
+            case 't':
+                snprintf(only, sizeof(only), "%s", optarg);
+                break;
+            case 'L':
+                tools = 0;
+                break;
+            case 'T':
+                library = 0;
+                break;
+            case 'v':
+                verbose = 1;
+                break;
+            default:
+                display_usage();
+                exit(0);
+        }
+    }
+
+    size_t binlen = (size_t)megabytes*1024*1024;
+    unsigned char *bin = malloc(binlen);
+    if (bin == NULL) {
+        perror("failed to allocate input");
+        exit(1);
+    }
+    fill_random(bin, binlen);
+
+    char tmpdir[] = "/tmp/hbh_bench.XXXXXX";
+    if (tools && (mkdtemp(tmpdir) == NULL)) {
+        perror("failed to make a directory for the inputs");
+        exit(1);
+    }
+
+    cycles_fd = perf_open(PERF_COUNT_HW_CPU_CYCLES);
+    instructions_fd = perf_open(PERF_COUNT_HW_INSTRUCTIONS);
+
+    build_cases();
+
+    printf("{\n  \"version\": %d, \"input_mb\": %d, \"perf_counters\": %s,\n  \"results\": [\n",
+           hbh_version(), megabytes, ((cycles_fd >= 0) && (instructions_fd >= 0)) ? "true" : "false");
+
+    int first = 1;
+    int i;
+    for (i=0;i<ncases;i++) {
+        const bench_case *bc = &cases[i];
+        hbh_format from, binfmt;
+        hbh_converter enc;
+        measurement m;
+        unsigned char *in;
+        size_t inlen;
+        char infile[1100];
+        FILE *fp;
+
+        if ((only[0] != 0) && (strcmp(only, bc->tool) != 0)) continue;
+        if (verbose) fprintf(stderr, "%s %s\n", bc->tool, bc->args);
+
+        /* Encode the binary into the format the tool reads */
+        hbh_format_parse(&binfmt, "bin");
+        hbh_format_parse(&from, bc->from);
+        hbh_convert_init(&enc, &binfmt, &from);
+        fp = open_memstream((char **)&in, &inlen);
+        if (fp == NULL) {
+            perror("failed to encode input");
+            exit(1);
+        }
+        unsigned char *scratch = malloc(hbh_convert_bound(&enc, SLAB));
+        convert_all(&enc, bin, binlen, scratch, fp);
+        fclose(fp);
+        free(scratch);
+
+        if (library && (((bc->stride != 0) ? bench_sampler(bc, in, inlen, &m) : bench_library(bc, in, inlen, &m)) == 0)) {
+            print_result(bc, "library", &m, first);
+            first = 0;
+        }
+        if (tools) {
+            snprintf(infile, sizeof(infile), "%s/input", tmpdir);
+            fp = fopen(infile, "wb");
+            if ((fp == NULL) || (fwrite(in, 1, inlen, fp) != inlen)) {
+                perror("failed to write input file");
+                exit(1);
+            }
+            fclose(fp);
+            if (bench_tool(bc, tooldir, infile, inlen, &m) == 0) {
+                print_result(bc, "tool", &m, first);
+                first = 0;
+            } else if (verbose) {
+                fprintf(stderr, "  could not run %s/%s\n", tooldir, bc->tool);
+            }
+            unlink(infile);
+        }
+        free(in);
+    }
+    printf("\n  ]\n}\n");
+
+    if (tools) rmdir(tmpdir);
+    free(bin);
+    return 0;
+}
@@ -0,0 +1,364 @@
+/*
+    hbh_bits.c - ASCII binary (01001001) encoder and decoder.
+
+    Copyright (C) 2017  David Johnston
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    -----
+
+    Contact. David Johnston dj@deadhat.com
+*/
+
+#include "hexbinhex.h"
+#include "hbh_internal.h"
+
+/* The 8 characters '0'/'1' for each byte value, lsb first and msb first */
+static unsigned char bits_le[256][8];
+static unsigned char bits_be[256][8];
+
+HBH_CONSTRUCTOR static void init_bittables(void) {
+    int i;
+    int j;
+    for (i=0;i<256;i++) {
+        for (j=0;j<8;j++) {
+            bits_le[i][j] = '0' + ((i >> j) & 0x01);
+            bits_be[i][j] = '0' + ((i >> (7-j)) & 0x01);
+        }
+    }
+}
+
+/* Expand len bytes into 8*len '0'/'1' characters */
+static void expand_bits_lut(const unsigned char *in, size_t len, unsigned char *out, int littleendian) {
+    unsigned char (*table)[8] = (littleendian==1) ? bits_le : bits_be;
+    size_t i;
+    for (i=0;i<len;i++) {
+        memcpy(out, table[in[i]], 8);
+        out += 8;
+    }
+}
+
+#ifdef HBH_X86
+
+/* The vector expanders copy each byte across 8 lanes, test each lane
+ * against its own bit and turn the all-ones compare result into '1' by
+ * subtracting it from '0'.
+ */
+__attribute__((target("ssse3")))
+static void expand_bits_ssse3(const unsigned char *in, size_t len, unsigned char *out, int littleendian) {
+    const __m128i spread = _mm_setr_epi8(0,0,0,0,0,0,0,0,1,1,1,1,1,1,1,1);
+    const __m128i bitsle = _mm_setr_epi8(1,2,4,8,16,32,64,-128,1,2,4,8,16,32,64,-128);
+    const __m128i bitsbe = _mm_setr_epi8(-128,64,32,16,8,4,2,1,-128,64,32,16,8,4,2,1);
+    const __m128i bits = (littleendian==1) ? bitsle : bitsbe;
+    const __m128i zero = _mm_set1_epi8('0');
+    __m128i v;
+    uint16_t two;
+    size_t i;
+
+    for (i=0;i+2<=len;i+=2) {
+        memcpy(&two, in+i, 2);
+        v = _mm_shuffle_epi8(_mm_cvtsi32_si128(two), spread);
+        v = _mm_cmpeq_epi8(_mm_and_si128(v, bits), bits);
+        _mm_storeu_si128((__m128i *)(out+8*i), _mm_sub_epi8(zero, v));
+    }
+    expand_bits_lut(in+i, len-i, out+8*i, littleendian);
+}
+
+__attribute__((target("avx2")))
+static void expand_bits_avx2(const unsigned char *in, size_t len, unsigned char *out, int littleendian) {
+    const __m256i spread = _mm256_setr_epi8(0,0,0,0,0,0,0,0,1,1,1,1,1,1,1,1,
+                                            2,2,2,2,2,2,2,2,3,3,3,3,3,3,3,3);
+    const __m256i bitsle = _mm256_setr_epi8(1,2,4,8,16,32,64,-128,1,2,4,8,16,32,64,-128,
+                                            1,2,4,8,16,32,64,-128,1,2,4,8,16,32,64,-128);
+    const __m256i bitsbe = _mm256_setr_epi8(-128,64,32,16,8,4,2,1,-128,64,32,16,8,4,2,1,
+                                            -128,64,32,16,8,4,2,1,-128,64,32,16,8,4,2,1);
+    const __m256i bits = (littleendian==1) ? bitsle : bitsbe;
+    const __m256i zero = _mm256_set1_epi8('0');
+    __m256i v;
+    int32_t four;
+    size_t i;
+
+    for (i=0;i+4<=len;i+=4) {
+        memcpy(&four, in+i, 4);
+        /* pshufb can't cross lanes, so broadcast the 4 bytes to both */
+        v = _mm256_shuffle_epi8(_mm256_set1_epi32(four), spread);
+        v = _mm256_cmpeq_epi8(_mm256_and_si256(v, bits), bits);
+        _mm256_storeu_si256((__m256i *)(out+8*i), _mm256_sub_epi8(zero, v));
+    }
+    expand_bits_ssse3(in+i, len-i, out+8*i, littleendian);
+}
+
+/* With a mask register the compare can pick '0' or '1' directly */
+__attribute__((target("avx512f,avx512bw")))
+static void expand_bits_avx512(const unsigned char *in, size_t len, unsigned char *out, int littleendian) {
+    const uint64_t c = 0x0101010101010101ULL;
+    const __m512i spread = _mm512_setr_epi64(0*c, 1*c, 2*c, 3*c, 4*c, 5*c, 6*c, 7*c);
+    const __m512i bits = _mm512_set1_epi64((littleendian==1) ? 0x8040201008040201LL : 0x0102040810204080LL);
+    const __m512i zero = _mm512_set1_epi8('0');
+    const __m512i one  = _mm512_set1_epi8('1');
+    __m512i v;
+    uint64_t eight;
+    size_t i;
+
+    for (i=0;i+8<=len;i+=8) {
+        memcpy(&eight, in+i, 8);
+        /* every lane holds all 8 bytes, and picks out its own two */
+        v = _mm512_shuffle_epi8(_mm512_set1_epi64((long long)eight), spread);
+        _mm512_storeu_si512((void *)(out+8*i), _mm512_mask_blend_epi8(_mm512_test_epi8_mask(v, bits), zero, one));
+    }
+    expand_bits_avx2(in+i, len-i, out+8*i, littleendian);
+}
+#endif
+
+typedef void (*expand_bits_fn)(const unsigned char *in, size_t len, unsigned char *out, int littleendian);
+
+/* Pick the expander for the kernel level */
+static expand_bits_fn select_expander(void) {
+#ifdef HBH_X86
+    switch (hbh_kernel_level()) {
+        case HBH_KERNEL_AVX512: return expand_bits_avx512;
+        case HBH_KERNEL_AVX2:   return expand_bits_avx2;
+        case HBH_KERNEL_SSE4:   return expand_bits_ssse3;
+    }
+#endif
+    return expand_bits_lut;
+}
+
+/* Bits are gathered first bit lowest in a 64 bit accumulator, which is
+ * little endian order. Big endian bytes are bit reversed on the way out.
+ * Whole bytes are written out, fewer than 8 bits are left in *acc and
+ * *nacc for next time. out must have 8 bytes of room.
+ */
+static inline unsigned char *flush_bits(unsigned char *out, uint64_t *acc, int *nacc, int littleendian) {
+    uint64_t w = *acc;
+    int nbytes = *nacc >> 3;
+
+    if (littleendian==0) w = reverse_bits_in_bytes(w);
+    memcpy(out, &w, 8);
+    *acc = (nbytes==8) ? 0 : *acc >> (8*nbytes);
+    *nacc -= 8*nbytes;
+    return out + nbytes;
+}
+
+/* Take '0' and '1' characters one at a time, skipping anything else.
+ * Returns the number of bytes written. */
+static size_t parse_bits_scalar(const unsigned char *in, size_t len, unsigned char *out,
+                                int littleendian, uint64_t *acc, int *nacc) {
+    unsigned char *outp = out;
+    size_t i;
+
+    for (i=0;i<len;i++) {
+        if ((in[i]=='0') || (in[i]=='1')) {
+            *acc |= (uint64_t)(in[i]-'0') << *nacc;
+            *nacc += 1;
+            if (*nacc == 8) outp = flush_bits(outp, acc, nacc, littleendian);
+        }
+    }
+    return (size_t)(outp - out);
+}
+
+#if defined(__x86_64__)
+
+/* The vector parsers compare a block of characters against '0' and '1'
+ * and use pmovmskb to turn the '1' lanes straight into bits. Blocks that
+ * contain separators fall back to the scalar parser, or with BMI2 have
+ * the separator lanes squeezed out of the bit mask with pext.
+ */
+__attribute__((target("sse2")))
+static size_t parse_bits_sse2(const unsigned char *in, size_t len, unsigned char *out,
+                              int littleendian, uint64_t *acc, int *nacc) {
+    const __m128i zero = _mm_set1_epi8('0');
+    const __m128i one  = _mm_set1_epi8('1');
+    unsigned char *outp = out;
+    unsigned int ones, valid;
+    __m128i v, is1;
+    size_t i;
+
+    for (i=0;i+16<=len;i+=16) {
+        v = _mm_loadu_si128((const __m128i *)(in+i));
+        is1 = _mm_cmpeq_epi8(v, one);
+        ones = (unsigned int)_mm_movemask_epi8(is1);
+        valid = (unsigned int)_mm_movemask_epi8(_mm_or_si128(is1, _mm_cmpeq_epi8(v, zero)));
+        if (valid != 0xFFFF) {
+            outp += parse_bits_scalar(in+i, 16, outp, littleendian, acc, nacc);
+            continue;
+        }
+        *acc |= (uint64_t)ones << *nacc;
+        *nacc += 16;
+        outp = flush_bits(outp, acc, nacc, littleendian);
+    }
+    outp += parse_bits_scalar(in+i, len-i, outp, littleendian, acc, nacc);
+    return (size_t)(outp - out);
+}
+
+__attribute__((target("avx2,bmi2")))
+static size_t parse_bits_avx2(const unsigned char *in, size_t len, unsigned char *out,
+                              int littleendian, uint64_t *acc, int *nacc) {
+    const __m256i zero = _mm256_set1_epi8('0');
+    const __m256i one  = _mm256_set1_epi8('1');
+    unsigned char *outp = out;
+    unsigned int ones, valid;
+    __m256i v, is1;
+    size_t i;
+
+    for (i=0;i+32<=len;i+=32) {
+        v = _mm256_loadu_si256((const __m256i *)(in+i));
+        is1 = _mm256_cmpeq_epi8(v, one);
+        ones = (unsigned int)_mm256_movemask_epi8(is1);
+        valid = (unsigned int)_mm256_movemask_epi8(_mm256_or_si256(is1, _mm256_cmpeq_epi8(v, zero)));
+        if (valid == 0xFFFFFFFF) {
+            *acc |= (uint64_t)ones << *nacc;
+            *nacc += 32;
+        } else {
+            *acc |= (uint64_t)_pext_u32(ones, valid) << *nacc;
+            *nacc += __builtin_popcount(valid);
+        }
+        outp = flush_bits(outp, acc, nacc, littleendian);
+    }
+    outp += parse_bits_sse2(in+i, len-i, outp, littleendian, acc, nacc);
+    return (size_t)(outp - out);
+}
+#endif
+
+typedef size_t (*parse_bits_fn)(const unsigned char *in, size_t len, unsigned char *out,
+                                int littleendian, uint64_t *acc, int *nacc);
+
+/* Pick the parser for the kernel level. SSE2 is part of x86-64, so only
+ * the scalar level goes without. */
+static parse_bits_fn select_parser(void) {
+#if defined(__x86_64__)
+    switch (hbh_kernel_level()) {
+        case HBH_KERNEL_AVX512:
+        case HBH_KERNEL_AVX2:   return parse_bits_avx2;
+        case HBH_KERNEL_SSE4:   return parse_bits_sse2;
+    }
+#endif
+    return parse_bits_scalar;
+}
+
+/* Bytes expanded per step, bounded by the stack buffer of characters */
+#define EXPAND_CHUNK 2048
+
+int hbh_bits_encode_init(hbh_bits_encoder *e, int width, int spaces, int littleendian) {
+    if (width < 1) return -1;
+    e->width = width;
+    e->spaces = spaces;
+    e->littleendian = littleendian;
+    e->bitcount = 0;
+    e->lastcharnl = 0;
+    e->kernel = select_expander();
+    return 0;
+}
+
+/* A newline or a space per bit at worst */
+size_t hbh_bits_encode_bound(const hbh_bits_encoder *e, size_t len) {
+    return 16*len + 1;
+}
+
+/* Expand the bits, then lay them out as lines of width bits with a space
+ * after every 8th bit of a line when spaces is set. Runs of characters
+ * are copied up to the next space or newline. bitcount is the number of
+ * bits already on the current line and is carried between calls.
+ */
+size_t hbh_bits_encode_update(hbh_bits_encoder *e, const unsigned char *in, size_t len, unsigned char *out) {
+    unsigned char bits[8*EXPAND_CHUNK];
+    const unsigned char *bitp;
+    unsigned char *outp = out;
+    size_t chunk;
+    size_t nbits;
+    size_t run;
+
+    if (len == 0) return 0;
+    while (len > 0) {
+        chunk = (len > EXPAND_CHUNK) ? EXPAND_CHUNK : len;
+        e->kernel(in, chunk, bits, e->littleendian);
+        in += chunk;
+        len -= chunk;
+
+        bitp = bits;
+        nbits = 8*chunk;
+        while (nbits > 0) {
+            run = (size_t)(e->width - e->bitcount);
+            if ((e->spaces==1) && (run > (size_t)(8 - (e->bitcount % 8)))) run = 8 - (e->bitcount % 8);
+            if (run > nbits) run = nbits;
+
+            memcpy(outp, bitp, run);
+            outp += run;
+            bitp += run;
+            nbits -= run;
+            e->bitcount += (int)run;
+
+            if (e->bitcount == e->width) {
+                *outp++ = '\n';
+                e->bitcount = 0;
+            }
+            else if ((e->spaces==1) && ((e->bitcount % 8)==0)) {
+                *outp++ = ' ';
+            }
+        }
+    }
+    e->lastcharnl = (e->bitcount == 0);
+    return (size_t)(outp - out);
+}
+
+/* Every full line has width bits, a newline and a space after each 8th
+ * bit short of the end. A part line has its bits and a space after each
+ * 8th of them.
+ */
+uint64_t hbh_bits_encode_seek(hbh_bits_encoder *e, uint64_t pos) {
+    uint64_t width = (uint64_t)e->width;
+    uint64_t nbits = 8*pos;
+    uint64_t lines = nbits/width;
+    uint64_t rest = nbits%width;
+    uint64_t n;
+
+    n = nbits + lines;
+    if (e->spaces==1) n += lines*((width-1)/8) + rest/8;
+    e->bitcount = (int)rest;
+    e->lastcharnl = (pos > 0) && (rest == 0);
+    return n;
+}
+
+/* The output always ends with a newline */
+size_t hbh_bits_encode_finish(hbh_bits_encoder *e, unsigned char *out) {
+    if (e->lastcharnl == 0) {
+        out[0] = '\n';
+        return 1;
+    }
+    return 0;
+}
+
+int hbh_bits_decode_init(hbh_bits_decoder *d, int littleendian) {
+    d->littleendian = littleendian;
+    d->acc = 0;
+    d->nacc = 0;
+    d->kernel = select_parser();
+    return 0;
+}
+
+size_t hbh_bits_decode_bound(const hbh_bits_decoder *d, size_t len) {
+    return len/8 + 1 + 8;
+}
+
+size_t hbh_bits_decode_update(hbh_bits_decoder *d, const unsigned char *in, size_t len, unsigned char *out) {
+    return d->kernel(in, len, out, d->littleendian, &d->acc, &d->nacc);
+}
+
+/* Bits left over at the end that can't make a byte are dropped */
+size_t hbh_bits_decode_finish(hbh_bits_decoder *d, unsigned char *out) {
+    d->acc = 0;
+    d->nacc = 0;
+    return 0;
+}
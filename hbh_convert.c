@@ -0,0 +1,242 @@
+/*
+    hbh_convert.c - Any format to any other, behind hbh.
+
+    Copyright (C) 2017  David Johnston
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    -----
+
+    Contact. David Johnston dj@deadhat.com
+*/
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "hexbinhex.h"
+#include "hbh_internal.h"
+
+/* Text is decoded into a buffer this size and re-encoded from there while
+ * it is still in L1, as the fused converters do */
+#define CONVERT_BLOCK 4096
+
+/* Parse a number after a ':' and step past it */
+static int parse_number(const char **p, int *value) {
+    char *end;
+    long v = strtol(*p, &end, 10);
+
+    if ((end == *p) || (v < 1) || (v > 1000000)) return -1;
+    *value = (int)v;
+    *p = end;
+    return 0;
+}
+
+int hbh_format_parse(hbh_format *f, const char *name) {
+    const char *p;
+    int numbers = 0;
+
+    memset(f, 0, sizeof(*f));
+    if (strncmp(name, "bin", 3) == 0) {
+        f->format = HBH_BIN;
+        p = name + 3;
+    } else if (strncmp(name, "hex", 3) == 0) {
+        f->format = HBH_HEX;
+        f->width = 32;
+        p = name + 3;
+    } else if (strncmp(name, "01", 2) == 0) {
+        f->format = HBH_BITS;
+        f->width = 32;
+        p = name + 2;
+    } else if (strncmp(name, "oddball", 7) == 0) {
+        f->format = HBH_ODDBALL;
+        f->bps = 0;
+        p = name + 7;
+    } else if (strncmp(name, "dec", 3) == 0) {
+        f->format = HBH_DEC;
+        f->width = 4;
+        p = name + 3;
+    } else {
+        return -1;
+    }
+
+    /* Then any of :<number>, :s, :r, :be and :bw, as the format allows */
+    while (*p == ':') {
+        p++;
+        if ((*p >= '0') && (*p <= '9')) {
+            if ((f->format == HBH_BIN) || (numbers++ > 0)) return -1;
+            if (parse_number(&p, (f->format == HBH_ODDBALL) ? &f->bps : &f->width) != 0) return -1;
+        } else if ((p[0] == 's') && ((p[1] == ':') || (p[1] == 0)) && (f->format == HBH_BITS)) {
+            f->spaces = 1;
+            p++;
+        } else if ((p[0] == 'r') && ((p[1] == ':') || (p[1] == 0)) && (f->format == HBH_ODDBALL)) {
+            f->reverse = 1;
+            p++;
+        } else if ((strncmp(p, "be", 2) == 0) && ((p[2] == ':') || (p[2] == 0)) &&
+                   ((f->format == HBH_BITS) || (f->format == HBH_ODDBALL) || (f->format == HBH_DEC))) {
+            f->bigendian = 1;
+            p += 2;
+        } else if ((strncmp(p, "bw", 2) == 0) && ((p[2] == ':') || (p[2] == 0)) && (f->format == HBH_ODDBALL)) {
+            f->bigwords = 1;
+            p += 2;
+        } else {
+            return -1;
+        }
+    }
+    if (*p != 0) return -1;
+
+    if ((f->format == HBH_ODDBALL) && ((f->bps < 1) || (f->bps > 32))) return -1;
+    if ((f->format == HBH_DEC) && (f->width > 8)) return -1;
+    return 0;
+}
+
+static int decoder_init(hbh_converter *c) {
+    const hbh_format *f = &c->from;
+
+    switch (f->format) {
+        case HBH_HEX:     return hbh_hex_decode_init(&c->decoder.hex);
+        case HBH_BITS:    return hbh_bits_decode_init(&c->decoder.bits, !f->bigendian);
+        case HBH_ODDBALL: return hbh_oddball_decode_init_words(&c->decoder.oddball, f->bps, f->reverse, !f->bigendian, f->bigwords);
+        case HBH_DEC:     return hbh_dec_decode_init(&c->decoder.dec, f->width, f->bigendian);
+        default:          return 0;
+    }
+}
+
+static int encoder_init(hbh_converter *c) {
+    const hbh_format *f = &c->to;
+
+    switch (f->format) {
+        case HBH_HEX:     return hbh_hex_encode_init(&c->encoder.hex, f->width);
+        case HBH_BITS:    return hbh_bits_encode_init(&c->encoder.bits, f->width, f->spaces, !f->bigendian);
+        case HBH_ODDBALL: return hbh_oddball_encode_init_words(&c->encoder.oddball, f->bps, f->reverse, !f->bigendian, f->bigwords);
+        case HBH_DEC:     return hbh_dec_encode_init(&c->encoder.dec, f->width, f->bigendian);
+        default:          return 0;
+    }
+}
+
+static size_t decode_bound(const hbh_converter *c, size_t len) {
+    switch (c->from.format) {
+        case HBH_HEX:     return hbh_hex_decode_bound(&c->decoder.hex, len);
+        case HBH_BITS:    return hbh_bits_decode_bound(&c->decoder.bits, len);
+        case HBH_ODDBALL: return hbh_oddball_decode_bound(&c->decoder.oddball, len);
+        case HBH_DEC:     return hbh_dec_decode_bound(&c->decoder.dec, len);
+        default:          return len;
+    }
+}
+
+static size_t encode_bound(const hbh_converter *c, size_t len) {
+    switch (c->to.format) {
+        case HBH_HEX:     return hbh_hex_encode_bound(&c->encoder.hex, len);
+        case HBH_BITS:    return hbh_bits_encode_bound(&c->encoder.bits, len);
+        case HBH_ODDBALL: return hbh_oddball_encode_bound(&c->encoder.oddball, len);
+        case HBH_DEC:     return hbh_dec_encode_bound(&c->encoder.dec, len);
+        default:          return len;
+    }
+}
+
+static size_t decode(hbh_converter *c, const unsigned char *in, size_t len, unsigned char *out) {
+    switch (c->from.format) {
+        case HBH_HEX:     return hbh_hex_decode_update(&c->decoder.hex, in, len, out);
+        case HBH_BITS:    return hbh_bits_decode_update(&c->decoder.bits, in, len, out);
+        case HBH_ODDBALL: return hbh_oddball_decode_update(&c->decoder.oddball, in, len, out);
+        case HBH_DEC:     return hbh_dec_decode_update(&c->decoder.dec, in, len, out);
+        default:
+            memcpy(out, in, len);
+            return len;
+    }
+}
+
+static size_t encode(hbh_converter *c, const unsigned char *in, size_t len, unsigned char *out) {
+    switch (c->to.format) {
+        case HBH_HEX:     return hbh_hex_encode_update(&c->encoder.hex, in, len, out);
+        case HBH_BITS:    return hbh_bits_encode_update(&c->encoder.bits, in, len, out);
+        case HBH_ODDBALL: return hbh_oddball_encode_update(&c->encoder.oddball, in, len, out);
+        case HBH_DEC:     return hbh_dec_encode_update(&c->encoder.dec, in, len, out);
+        default:
+            memcpy(out, in, len);
+            return len;
+    }
+}
+
+static size_t decode_finish(hbh_converter *c, unsigned char *out) {
+    switch (c->from.format) {
+        case HBH_HEX:     return hbh_hex_decode_finish(&c->decoder.hex, out);
+        case HBH_BITS:    return hbh_bits_decode_finish(&c->decoder.bits, out);
+        case HBH_ODDBALL: return hbh_oddball_decode_finish(&c->decoder.oddball, out);
+        case HBH_DEC:     return hbh_dec_decode_finish(&c->decoder.dec, out);
+        default:          return 0;
+    }
+}
+
+static size_t encode_finish(hbh_converter *c, unsigned char *out) {
+    switch (c->to.format) {
+        case HBH_HEX:     return hbh_hex_encode_finish(&c->encoder.hex, out);
+        case HBH_BITS:    return hbh_bits_encode_finish(&c->encoder.bits, out);
+        case HBH_ODDBALL: return hbh_oddball_encode_finish(&c->encoder.oddball, out);
+        case HBH_DEC:     return hbh_dec_encode_finish(&c->encoder.dec, out);
+        default:          return 0;
+    }
+}
+
+int hbh_convert_init(hbh_converter *c, const hbh_format *from, const hbh_format *to) {
+    c->from = *from;
+    c->to = *to;
+    if (decoder_init(c) != 0) return -1;
+    if (encoder_init(c) != 0) return -1;
+
+    /* Decimal can decode to four times its length */
+    c->block = CONVERT_BLOCK;
+    while (decode_bound(c, c->block) > CONVERT_BLOCK + 64) c->block /= 2;
+    return 0;
+}
+
+/* The decoded binary of len bytes, encoded, plus the slack the last block
+ * and finish() can store past that */
+size_t hbh_convert_bound(const hbh_converter *c, size_t len) {
+    return encode_bound(c, decode_bound(c, len)) + encode_bound(c, decode_bound(c, c->block)) +
+           encode_bound(c, HBH_FINISH_BOUND) + HBH_FINISH_BOUND;
+}
+
+/* With binary on one side there is only one half to run. Otherwise the
+ * text is decoded a block at a time and each block re-encoded at once. */
+size_t hbh_convert_update(hbh_converter *c, const unsigned char *in, size_t len, unsigned char *out) {
+    unsigned char bin[CONVERT_BLOCK + 64];
+    unsigned char *outp = out;
+    size_t n;
+    size_t m;
+
+    if (c->from.format == HBH_BIN) return encode(c, in, len, out);
+    if (c->to.format == HBH_BIN) return decode(c, in, len, out);
+
+    while (len > 0) {
+        n = (len > c->block) ? c->block : len;
+        m = decode(c, in, n, bin);
+        outp += encode(c, bin, m, outp);
+        in += n;
+        len -= n;
+    }
+    return (size_t)(outp - out);
+}
+
+size_t hbh_convert_finish(hbh_converter *c, unsigned char *out) {
+    unsigned char bin[HBH_FINISH_BOUND];
+    size_t m;
+    size_t n;
+
+    if (c->to.format == HBH_BIN) return decode_finish(c, out);
+    m = decode_finish(c, bin);
+    n = encode(c, bin, m, out);
+    return n + encode_finish(c, out + n);
+}
@@ -0,0 +1,337 @@
+/*
+    hbh_dec.c - Decimal encoder and decoder.
+
+    Copyright (C) 2023  David Johnston
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    -----
+
+    Contact. David Johnston dj@deadhat.com
+*/
+
+#include "hexbinhex.h"
+#include "hbh_internal.h"
+
+/* "00" "01" ... "99" */
+static char digitpairs[200];
+
+HBH_CONSTRUCTOR static void init_digitpairs(void) {
+    int i;
+    for (i=0;i<100;i++) {
+        digitpairs[2*i]   = '0' + i/10;
+        digitpairs[2*i+1] = '0' + i%10;
+    }
+}
+
+static const uint64_t pow10[20] = {
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+    10000000ULL, 100000000ULL, 1000000000ULL, 10000000000ULL,
+    100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+    100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+    100000000000000000ULL, 1000000000000000000ULL, 10000000000000000000ULL
+};
+
+/* Number of decimal digits in v. log10(2) ~= 1233/4096 gives a guess
+ * from the bit length that is at most one too small. */
+static inline int count_decimal_digits(uint64_t v) {
+    int t = ((64 - __builtin_clzll(v | 1)) * 1233) >> 12;
+    return t - ((v | 1) < pow10[t]) + 1;
+}
+
+/* Write v as decimal followed by a newline, two digits at a time from
+ * the right. Returns the number of characters written. */
+static inline int format_u64(uint64_t v, char *out) {
+    int n = count_decimal_digits(v);
+    char *p = out + n;
+
+    *p = '\n';
+    while (v >= 100) {
+        p -= 2;
+        memcpy(p, &digitpairs[2*(v % 100)], 2);
+        v /= 100;
+    }
+    if (v >= 10) {
+        p -= 2;
+        memcpy(p, &digitpairs[2*v], 2);
+    } else {
+        *--p = (char)('0' + v);
+    }
+    return n + 1;
+}
+
+/* "0\n" to "255\n" padded to 4 bytes, and their lengths, for 1 byte words */
+static char bytestrings[256][4];
+static int bytestring_len[256];
+
+HBH_CONSTRUCTOR static void init_bytestrings(void) {
+    char tmp[8];
+    int i;
+    for (i=0;i<256;i++) {
+        bytestring_len[i] = format_u64(i, tmp);
+        memcpy(bytestrings[i], tmp, 4);
+    }
+}
+
+/* Read one width byte word. Widths 1, 2, 4 and 8 are plain unaligned
+ * loads. Widths 3, 5, 6 and 7 load 8 bytes and mask, so the input must
+ * be readable for 8 bytes past the last word. */
+static inline uint64_t load_word(const unsigned char *p, const int width, const int bigendian) {
+    uint64_t w;
+    uint16_t w16;
+    uint32_t w32;
+
+    switch (width) {
+        case 1:
+            return p[0];
+        case 2:
+            memcpy(&w16, p, 2);
+            return bigendian ? __builtin_bswap16(w16) : w16;
+        case 4:
+            memcpy(&w32, p, 4);
+            return bigendian ? __builtin_bswap32(w32) : w32;
+        case 8:
+            memcpy(&w, p, 8);
+            return bigendian ? __builtin_bswap64(w) : w;
+        default:
+            memcpy(&w, p, 8);
+            if (bigendian) return __builtin_bswap64(w) >> (64 - 8*width);
+            return w & ((1ULL << (8*width)) - 1);
+    }
+}
+
+/* One formatting loop per width and byte order, so the loads are fixed */
+#define FORMAT_KERNEL(WIDTH, BIGENDIAN) \
+static size_t format_words_##WIDTH##_##BIGENDIAN(const unsigned char *in, size_t count, char *out) { \
+    char *outp = out; \
+    size_t i; \
+    uint64_t v; \
+    for (i=0;i<count;i++) { \
+        v = load_word(in, WIDTH, BIGENDIAN); \
+        if (WIDTH == 1) { \
+            memcpy(outp, bytestrings[v], 4); \
+            outp += bytestring_len[v]; \
+        } else { \
+            outp += format_u64(v, outp); \
+        } \
+        in += WIDTH; \
+    } \
+    return (size_t)(outp - out); \
+}
+
+#define FORMAT_KERNELS(WIDTH) FORMAT_KERNEL(WIDTH, 0) FORMAT_KERNEL(WIDTH, 1)
+
+FORMAT_KERNELS(1) FORMAT_KERNELS(2) FORMAT_KERNELS(3) FORMAT_KERNELS(4)
+FORMAT_KERNELS(5) FORMAT_KERNELS(6) FORMAT_KERNELS(7) FORMAT_KERNELS(8)
+
+typedef size_t (*format_fn)(const unsigned char *in, size_t count, char *out);
+
+/* Indexed by [width][bigendian] */
+static const format_fn format_words[9][2] = {
+    { NULL, NULL },
+    { format_words_1_0, format_words_1_1 }, { format_words_2_0, format_words_2_1 },
+    { format_words_3_0, format_words_3_1 }, { format_words_4_0, format_words_4_1 },
+    { format_words_5_0, format_words_5_1 }, { format_words_6_0, format_words_6_1 },
+    { format_words_7_0, format_words_7_1 }, { format_words_8_0, format_words_8_1 }
+};
+
+/* Number of leading decimal digits in the 8 characters of w, 0 to 8 */
+static inline int count_digits8(uint64_t w) {
+    uint64_t hi, lo, bad;
+    hi = (w & 0xF0F0F0F0F0F0F0F0ULL) ^ 0x3030303030303030ULL;  /* not 0x3? */
+    lo = ((w & 0x0F0F0F0F0F0F0F0FULL) + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL; /* 0x?A-0x?F */
+    bad = hi | lo;
+    /* set the top bit of each non-zero byte without carrying between bytes */
+    bad = (bad | ((bad & 0x7F7F7F7F7F7F7F7FULL) + 0x7F7F7F7F7F7F7F7FULL)) & 0x8080808080808080ULL;
+    if (bad == 0) return 8;
+    return __builtin_ctzll(bad) >> 3;
+}
+
+/* Value of the first n (1 to 8) digit characters of w. The digits are
+ * shifted up so the missing ones read as leading zeros, then combined
+ * pairwise: 8 x 1 digit -> 4 x 2 digits -> 2 x 4 digits -> 8 digits. */
+static inline uint64_t swar_digits8(uint64_t w, int n) {
+    w = (w - 0x3030303030303030ULL) << (8*(8-n));
+    w = (w * 10 + (w >> 8)) & 0x00FF00FF00FF00FFULL;
+    w = (w * 100 + (w >> 16)) & 0x0000FFFF0000FFFFULL;
+    w = (w * 10000 + (w >> 32)) & 0x00000000FFFFFFFFULL;
+    return w;
+}
+
+/* value = value*10^n + digits. Values saturate at UINT64_MAX on overflow,
+ * as sscanf("%" SCNu64) does. */
+static inline uint64_t accumulate(uint64_t value, uint64_t digits, int n) {
+    uint64_t t;
+    if (__builtin_mul_overflow(value, pow10[n], &t) || __builtin_add_overflow(t, digits, &t))
+        return UINT64_MAX;
+    return t;
+}
+
+/* Write the low bwidth bytes of thenumber to out in the requested byte
+ * order. Always stores 8 bytes, so out needs 8 bytes of room. */
+static inline unsigned char *put_number(unsigned char *out, uint64_t thenumber, int bwidth, int bigendian) {
+    if (bigendian == 1) {
+        thenumber = __builtin_bswap64(thenumber << (8*(8-bwidth)));
+    }
+    memcpy(out, &thenumber, 8);
+    return out + bwidth;
+}
+
+// Numbers are runs of decimal digits separated by anything else. The
+// number being collected when the buffer runs out is carried over to the
+// next call in *value and *innumber, so numbers can straddle reads.
+// Digits are consumed up to 16 at a time where the buffer allows.
+// Returns the number of bytes written to out.
+static size_t parse_decimal(const char *in, size_t len, unsigned char *out,
+                            int bwidth, int bigendian, uint64_t *value, int *innumber) {
+    const char *p = in;
+    const char *end = in + len;
+    unsigned char *outp = out;
+    uint64_t v = *value;
+    int num = *innumber;
+    uint64_t w, digits;
+    int n, n2;
+
+    while (p < end) {
+        if ((unsigned char)(*p - '0') > 9) {
+            if (num) {                      // A non digit finishes the number
+                outp = put_number(outp, v, bwidth, bigendian);
+                v = 0;
+                num = 0;
+            }
+            p++;
+            continue;
+        }
+
+        num = 1;
+        if (end - p >= 8) {
+            w = load64(p);
+            n = count_digits8(w);
+            digits = swar_digits8(w, n);
+            if ((n == 8) && (end - p >= 16)) {
+                w = load64(p+8);
+                n2 = count_digits8(w);
+                if (n2 > 0) {
+                    digits = digits*pow10[n2] + swar_digits8(w, n2);
+                    n += n2;
+                }
+            }
+            v = accumulate(v, digits, n);
+            p += n;
+        } else {
+            v = accumulate(v, (uint64_t)(*p - '0'), 1);
+            p++;
+        }
+    }
+
+    *value = v;
+    *innumber = num;
+    return (size_t)(outp - out);
+}
+
+/* Longest decimal number for each word width, plus its newline */
+static const int max_line[9] = { 0, 4, 6, 9, 11, 14, 16, 18, 21 };
+
+int hbh_dec_encode_init(hbh_dec_encoder *e, int width, int bigendian) {
+    if ((width < 1) || (width > 8)) return -1;
+    e->width = width;
+    e->bigendian = bigendian;
+    e->ncarry = 0;
+    e->kernel = format_words[width][bigendian];
+    return 0;
+}
+
+/* 1 byte words are copied 4 characters at a time */
+size_t hbh_dec_encode_bound(const hbh_dec_encoder *e, size_t len) {
+    return ((len + e->width - 1)/e->width) * max_line[e->width] + 4;
+}
+
+/* Widths 3, 5, 6 and 7 load 8 bytes per word, so the last few words of a
+ * caller's buffer are staged through a local buffer rather than read
+ * past its end. A partial word carries over to the next update().
+ */
+size_t hbh_dec_encode_update(hbh_dec_encoder *e, const unsigned char *in, size_t len, unsigned char *out) {
+    unsigned char stage[16] = {0};
+    char *outp = (char *)out;
+    size_t width = (size_t)e->width;
+    size_t n;
+    size_t count;
+
+    if (e->ncarry > 0) {
+        n = width - e->ncarry;
+        if (n > len) n = len;
+        memcpy(e->carry + e->ncarry, in, n);
+        e->ncarry += (int)n;
+        in += n;
+        len -= n;
+        if (e->ncarry < e->width) return 0;
+        memcpy(stage, e->carry, width);
+        outp += e->kernel(stage, 1, outp);
+        e->ncarry = 0;
+    }
+
+    if (len >= 8) {
+        count = (len - 8)/width + 1;
+        outp += e->kernel(in, count, outp);
+        in += count*width;
+        len -= count*width;
+    }
+
+    count = len/width;
+    if (count > 0) {
+        memcpy(stage, in, count*width);
+        outp += e->kernel(stage, count, outp);
+        in += count*width;
+        len -= count*width;
+    }
+
+    memcpy(e->carry, in, len);
+    e->ncarry = (int)len;
+    return (size_t)(outp - (char *)out);
+}
+
+/* A partial word at the end of the input is dropped */
+size_t hbh_dec_encode_finish(hbh_dec_encoder *e, unsigned char *out) {
+    e->ncarry = 0;
+    return 0;
+}
+
+int hbh_dec_decode_init(hbh_dec_decoder *d, int width, int bigendian) {
+    if ((width < 1) || (width > 8)) return -1;
+    d->width = width;
+    d->bigendian = bigendian;
+    d->value = 0;
+    d->innumber = 0;
+    return 0;
+}
+
+/* A number takes at least a digit and a separator, and put_number()
+ * always stores 8 bytes */
+size_t hbh_dec_decode_bound(const hbh_dec_decoder *d, size_t len) {
+    return 8*(len/2 + 2);
+}
+
+size_t hbh_dec_decode_update(hbh_dec_decoder *d, const unsigned char *in, size_t len, unsigned char *out) {
+    return parse_decimal((const char *)in, len, out, d->width, d->bigendian, &d->value, &d->innumber);
+}
+
+/* The last number may run up to the end of the input */
+size_t hbh_dec_decode_finish(hbh_dec_decoder *d, unsigned char *out) {
+    size_t n = 0;
+    if (d->innumber) n = put_number(out, d->value, d->width, d->bigendian) - out;
+    d->value = 0;
+    d->innumber = 0;
+    return n;
+}
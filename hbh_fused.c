@@ -0,0 +1,97 @@
+/*
+    hbh_fused.c - Hex straight to and from NIST one-symbol-per-byte.
+
+    Copyright (C) 2017  David Johnston
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    -----
+
+    Contact. David Johnston dj@deadhat.com
+*/
+
+
+#include "hexbinhex.h"
+#include "hbh_internal.h"
+
+/* The binary between the two halves of a fused conversion goes through
+ * a buffer this size, decoded and re-encoded while it is still in L1 */
+#define FUSE_BLOCK 4096
+
+int hbh_hex_oddball_init(hbh_hex_oddball *c, int bps, int reverse, int littleendian) {
+    if (hbh_hex_decode_init(&c->hex) != 0) return -1;
+    return hbh_oddball_encode_init(&c->oddball, bps, reverse, littleendian);
+}
+
+size_t hbh_hex_oddball_bound(const hbh_hex_oddball *c, size_t len) {
+    return hbh_oddball_encode_bound(&c->oddball, len/2 + 1);
+}
+
+size_t hbh_hex_oddball_update(hbh_hex_oddball *c, const unsigned char *in, size_t len, unsigned char *out) {
+    unsigned char bin[FUSE_BLOCK/2 + 64];
+    unsigned char *outp = out;
+    size_t n;
+    size_t m;
+
+    while (len > 0) {
+        n = (len > FUSE_BLOCK) ? FUSE_BLOCK : len;
+        m = hbh_hex_decode_update(&c->hex, in, n, bin);
+        outp += hbh_oddball_encode_update(&c->oddball, bin, m, outp);
+        in += n;
+        len -= n;
+    }
+    return (size_t)(outp - out);
+}
+
+size_t hbh_hex_oddball_finish(hbh_hex_oddball *c, unsigned char *out) {
+    unsigned char bin[HBH_FINISH_BOUND];
+    size_t m = hbh_hex_decode_finish(&c->hex, bin);
+    size_t n = hbh_oddball_encode_update(&c->oddball, bin, m, out);
+
+    return n + hbh_oddball_encode_finish(&c->oddball, out + n);
+}
+
+int hbh_oddball_hex_init(hbh_oddball_hex *c, int bps, int reverse, int littleendian, int width) {
+    if (hbh_oddball_decode_init(&c->oddball, bps, reverse, littleendian) != 0) return -1;
+    return hbh_hex_encode_init(&c->hex, width);
+}
+
+size_t hbh_oddball_hex_bound(const hbh_oddball_hex *c, size_t len) {
+    return hbh_hex_encode_bound(&c->hex, hbh_oddball_decode_bound(&c->oddball, len));
+}
+
+size_t hbh_oddball_hex_update(hbh_oddball_hex *c, const unsigned char *in, size_t len, unsigned char *out) {
+    unsigned char bin[FUSE_BLOCK + 64];
+    unsigned char *outp = out;
+    size_t n;
+    size_t m;
+
+    while (len > 0) {
+        n = (len > FUSE_BLOCK) ? FUSE_BLOCK : len;
+        m = hbh_oddball_decode_update(&c->oddball, in, n, bin);
+        outp += hbh_hex_encode_update(&c->hex, bin, m, outp);
+        in += n;
+        len -= n;
+    }
+    return (size_t)(outp - out);
+}
+
+size_t hbh_oddball_hex_finish(hbh_oddball_hex *c, unsigned char *out) {
+    unsigned char bin[HBH_FINISH_BOUND];
+    size_t m = hbh_oddball_decode_finish(&c->oddball, bin);
+    size_t n = hbh_hex_encode_update(&c->hex, bin, m, out);
+
+    return n + hbh_hex_encode_finish(&c->hex, out + n);
+}
@@ -0,0 +1,520 @@
+/*
+    hbh_hex.c - Hex encoder and decoder.
+
+    Copyright (C) 2017  David Johnston
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    -----
+
+    Contact. David Johnston dj@deadhat.com
+*/
+
+#include "hexbinhex.h"
+#include "hbh_internal.h"
+
+/* "000102...FEFF". Two output characters for each possible byte */
+static char hexpairs[512];
+
+HBH_CONSTRUCTOR static void init_hexpairs(void) {
+    const char digits[] = "0123456789ABCDEF";
+    int i;
+    for (i=0;i<256;i++) {
+        hexpairs[2*i]   = digits[i >> 4];
+        hexpairs[2*i+1] = digits[i & 0x0f];
+    }
+}
+
+/* Encode len bytes as 2*len upper case hex characters. */
+static void encode_hex_scalar(const unsigned char *in, size_t len, unsigned char *out) {
+    size_t i;
+    for (i=0;i<len;i++) {
+        memcpy(out, &hexpairs[2*in[i]], 2);
+        out += 2;
+    }
+}
+
+#ifdef HBH_X86
+
+/* The vector encoders split each byte into nibbles, map the nibbles to
+ * characters with a pshufb lookup and interleave the high and low
+ * characters back into order.
+ */
+__attribute__((target("ssse3")))
+static void encode_hex_ssse3(const unsigned char *in, size_t len, unsigned char *out) {
+    const __m128i digits = _mm_setr_epi8('0','1','2','3','4','5','6','7',
+                                         '8','9','A','B','C','D','E','F');
+    const __m128i lownibble = _mm_set1_epi8(0x0f);
+    __m128i v, hi, lo;
+    size_t i = 0;
+
+    for (i=0;i+16<=len;i+=16) {
+        v = _mm_loadu_si128((const __m128i *)(in+i));
+        hi = _mm_shuffle_epi8(digits, _mm_and_si128(_mm_srli_epi16(v, 4), lownibble));
+        lo = _mm_shuffle_epi8(digits, _mm_and_si128(v, lownibble));
+        _mm_storeu_si128((__m128i *)(out+2*i),    _mm_unpacklo_epi8(hi, lo));
+        _mm_storeu_si128((__m128i *)(out+2*i+16), _mm_unpackhi_epi8(hi, lo));
+    }
+    encode_hex_scalar(in+i, len-i, out+2*i);
+}
+
+__attribute__((target("avx2")))
+static void encode_hex_avx2(const unsigned char *in, size_t len, unsigned char *out) {
+    const __m256i digits = _mm256_setr_epi8('0','1','2','3','4','5','6','7',
+                                            '8','9','A','B','C','D','E','F',
+                                            '0','1','2','3','4','5','6','7',
+                                            '8','9','A','B','C','D','E','F');
+    const __m256i lownibble = _mm256_set1_epi8(0x0f);
+    __m256i v, hi, lo, first, second;
+    size_t i = 0;
+
+    for (i=0;i+32<=len;i+=32) {
+        v = _mm256_loadu_si256((const __m256i *)(in+i));
+        hi = _mm256_shuffle_epi8(digits, _mm256_and_si256(_mm256_srli_epi16(v, 4), lownibble));
+        lo = _mm256_shuffle_epi8(digits, _mm256_and_si256(v, lownibble));
+        /* unpack works within 128 bit lanes, so swap the middle
+         * quarters back into order */
+        first  = _mm256_unpacklo_epi8(hi, lo);
+        second = _mm256_unpackhi_epi8(hi, lo);
+        _mm256_storeu_si256((__m256i *)(out+2*i),    _mm256_permute2x128_si256(first, second, 0x20));
+        _mm256_storeu_si256((__m256i *)(out+2*i+32), _mm256_permute2x128_si256(first, second, 0x31));
+    }
+    encode_hex_ssse3(in+i, len-i, out+2*i);
+}
+
+/* Unpacking leaves each 128 bit lane's first and last 8 pairs in separate
+ * registers, so the quarters are put back in order across the two. */
+__attribute__((target("avx512f,avx512bw")))
+static void encode_hex_avx512(const unsigned char *in, size_t len, unsigned char *out) {
+    const __m512i digits = _mm512_broadcast_i32x4(_mm_setr_epi8('0','1','2','3','4','5','6','7',
+                                                                '8','9','A','B','C','D','E','F'));
+    const __m512i lownibble = _mm512_set1_epi8(0x0f);
+    const __m512i lowhalf  = _mm512_setr_epi64(0, 1, 8, 9, 2, 3, 10, 11);
+    const __m512i highhalf = _mm512_setr_epi64(4, 5, 12, 13, 6, 7, 14, 15);
+    __m512i v, hi, lo, first, second;
+    size_t i = 0;
+
+    for (i=0;i+64<=len;i+=64) {
+        v = _mm512_loadu_si512((const void *)(in+i));
+        hi = _mm512_shuffle_epi8(digits, _mm512_and_si512(_mm512_srli_epi16(v, 4), lownibble));
+        lo = _mm512_shuffle_epi8(digits, _mm512_and_si512(v, lownibble));
+        first  = _mm512_unpacklo_epi8(hi, lo);
+        second = _mm512_unpackhi_epi8(hi, lo);
+        _mm512_storeu_si512((void *)(out+2*i),    _mm512_permutex2var_epi64(first, lowhalf, second));
+        _mm512_storeu_si512((void *)(out+2*i+64), _mm512_permutex2var_epi64(first, highhalf, second));
+    }
+    encode_hex_avx2(in+i, len-i, out+2*i);
+}
+#endif
+
+typedef void (*encode_hex_fn)(const unsigned char *in, size_t len, unsigned char *out);
+
+/* Pick the encoder for the kernel level */
+static encode_hex_fn select_encoder(void) {
+#ifdef HBH_X86
+    switch (hbh_kernel_level()) {
+        case HBH_KERNEL_AVX512: return encode_hex_avx512;
+        case HBH_KERNEL_AVX2:   return encode_hex_avx2;
+        case HBH_KERNEL_SSE4:   return encode_hex_ssse3;
+    }
+#endif
+    return encode_hex_scalar;
+}
+
+/* Nibble value of each character, or -1 if it is not a hex digit. */
+static signed char hexval[256];
+
+HBH_CONSTRUCTOR static void init_hexval(void) {
+    int i;
+    for (i=0;i<256;i++) hexval[i] = -1;
+    for (i=0;i<10;i++) hexval['0'+i] = i;
+    for (i=0;i<6;i++) {
+        hexval['A'+i] = 10+i;
+        hexval['a'+i] = 10+i;
+    }
+}
+
+/* Scalar decoder. Picks up hex characters in pairs, discarding trash.
+ * A '0' followed by an 'x' before its partner arrives is a 0x prefix and
+ * is dropped. *pending holds the value of an unpaired nibble carried over
+ * between calls, or -1 if there is none. Returns the number of bytes written.
+ */
+static size_t decode_hex_scalar(const unsigned char *in, size_t len, unsigned char *out, int *pending) {
+    unsigned char *outp = out;
+    int p = *pending;
+    int v;
+    size_t i;
+
+    for (i=0;i<len;i++) {
+        v = hexval[in[i]];
+        if (v >= 0) {
+            if (p < 0) {
+                p = v;
+            } else {
+                *outp++ = (unsigned char)((p << 4) | v);
+                p = -1;
+            }
+        }
+        else if ((in[i]=='x') && (p==0)) {
+            p = -1; /* skip 0x prefixes */
+        }
+    }
+    *pending = p;
+    return (size_t)(outp - out);
+}
+
+#ifdef HBH_X86
+
+/* The vector decoders turn 16 or 32 hex characters into nibbles, check they
+ * were all hex and pack the pairs into bytes with pmaddubsw. A block that
+ * contains anything else has its leading run of hex pairs stored from the
+ * vector. If the rest is no more than a line break, the scalar decoder
+ * takes the odd digit before it and the break, and whole blocks carry on
+ * from after it; otherwise the scalar decoder takes the rest of the block.
+ * A nibble left pending, or a block that would start on something other
+ * than a digit, goes to the scalar decoder a character at a time until
+ * whole blocks can carry on.
+ * The output buffer must have 16 bytes of slack past the decoded length.
+ */
+__attribute__((target("sse4.1")))
+static size_t decode_hex_sse41(const unsigned char *in, size_t len, unsigned char *out, int *pending) {
+    const __m128i ascii0 = _mm_set1_epi8('0');
+    const __m128i asciia = _mm_set1_epi8('a');
+    const __m128i nine   = _mm_set1_epi8(9);
+    const __m128i five   = _mm_set1_epi8(5);
+    const __m128i ten    = _mm_set1_epi8(10);
+    const __m128i lower  = _mm_set1_epi8(0x20);
+    const __m128i weights = _mm_set1_epi16(0x0110);
+    unsigned char *outp = out;
+    size_t i = 0;
+    __m128i v, d, a, isdigit, isalpha, nibbles, packed;
+    unsigned int mask;
+    unsigned int junk;
+    int sparse = 0;
+    int k;
+    int n;
+
+    while (i + 16 <= len) {
+        if ((*pending >= 0) || (hexval[in[i]] < 0)) {
+            /* After a block full of separators the next is likely to be
+             * too, so it goes to the scalar decoder whole */
+            n = sparse ? 16 : 1;
+            outp += decode_hex_scalar(in+i, (size_t)n, outp, pending);
+            i += (size_t)n;
+            continue;
+        }
+        v = _mm_loadu_si128((const __m128i *)(in+i));
+        d = _mm_sub_epi8(v, ascii0);
+        a = _mm_sub_epi8(_mm_or_si128(v, lower), asciia);
+        isdigit = _mm_cmpeq_epi8(_mm_min_epu8(d, nine), d);
+        isalpha = _mm_cmpeq_epi8(_mm_min_epu8(a, five), a);
+        nibbles = _mm_blendv_epi8(_mm_add_epi8(a, ten), d, isdigit);
+        packed = _mm_maddubs_epi16(nibbles, weights);
+        packed = _mm_packus_epi16(packed, packed);
+        _mm_storel_epi64((__m128i *)outp, packed);
+
+        mask = (unsigned int)_mm_movemask_epi8(_mm_or_si128(isdigit, isalpha));
+        if (mask == 0xFFFF) {
+            sparse = 0;
+            outp += 8;
+            i += 16;
+            continue;
+        }
+        /* Keep the whole pairs ahead of the first non-hex character */
+        k = __builtin_ctz(~mask);
+        n = k & ~1;
+        outp += n/2;
+        /* At most two non-hex characters, as in a line break */
+        junk = ~mask & 0xFFFF;
+        junk &= junk - 1;
+        sparse = ((junk & (junk - 1)) != 0);
+        if (!sparse) {
+            outp += decode_hex_scalar(in+i+n, (size_t)(k+1-n), outp, pending);
+            i += (size_t)k+1;
+        } else {
+            outp += decode_hex_scalar(in+i+n, (size_t)(16-n), outp, pending);
+            i += 16;
+        }
+    }
+    outp += decode_hex_scalar(in+i, len-i, outp, pending);
+    return (size_t)(outp - out);
+}
+
+__attribute__((target("avx2")))
+static size_t decode_hex_avx2(const unsigned char *in, size_t len, unsigned char *out, int *pending) {
+    const __m256i ascii0 = _mm256_set1_epi8('0');
+    const __m256i asciia = _mm256_set1_epi8('a');
+    const __m256i nine   = _mm256_set1_epi8(9);
+    const __m256i five   = _mm256_set1_epi8(5);
+    const __m256i ten    = _mm256_set1_epi8(10);
+    const __m256i lower  = _mm256_set1_epi8(0x20);
+    const __m256i weights = _mm256_set1_epi16(0x0110);
+    unsigned char *outp = out;
+    size_t i = 0;
+    __m256i v, d, a, isdigit, isalpha, nibbles, packed;
+    unsigned int mask;
+    unsigned int junk;
+    int sparse = 0;
+    int k;
+    int n;
+
+    while (i + 32 <= len) {
+        if ((*pending >= 0) || (hexval[in[i]] < 0)) {
+            /* After a block full of separators the next is likely to be
+             * too, so it goes to the scalar decoder whole */
+            n = sparse ? 32 : 1;
+            outp += decode_hex_scalar(in+i, (size_t)n, outp, pending);
+            i += (size_t)n;
+            continue;
+        }
+        v = _mm256_loadu_si256((const __m256i *)(in+i));
+        d = _mm256_sub_epi8(v, ascii0);
+        a = _mm256_sub_epi8(_mm256_or_si256(v, lower), asciia);
+        isdigit = _mm256_cmpeq_epi8(_mm256_min_epu8(d, nine), d);
+        isalpha = _mm256_cmpeq_epi8(_mm256_min_epu8(a, five), a);
+        nibbles = _mm256_blendv_epi8(_mm256_add_epi8(a, ten), d, isdigit);
+        packed = _mm256_maddubs_epi16(nibbles, weights);
+        /* packus works within each 128 bit lane, so gather the two
+         * low quadwords together before storing */
+        packed = _mm256_packus_epi16(packed, packed);
+        packed = _mm256_permute4x64_epi64(packed, 0xD8);
+        _mm_storeu_si128((__m128i *)outp, _mm256_castsi256_si128(packed));
+
+        mask = (unsigned int)_mm256_movemask_epi8(_mm256_or_si256(isdigit, isalpha));
+        if (mask == 0xFFFFFFFF) {
+            sparse = 0;
+            outp += 16;
+            i += 32;
+            continue;
+        }
+        k = __builtin_ctz(~mask);
+        n = k & ~1;
+        outp += n/2;
+        /* At most two non-hex characters, as in a line break */
+        junk = ~mask;
+        junk &= junk - 1;
+        sparse = ((junk & (junk - 1)) != 0);
+        if (!sparse) {
+            outp += decode_hex_scalar(in+i+n, (size_t)(k+1-n), outp, pending);
+            i += (size_t)k+1;
+        } else {
+            outp += decode_hex_scalar(in+i+n, (size_t)(32-n), outp, pending);
+            i += 32;
+        }
+    }
+    outp += decode_hex_sse41(in+i, len-i, outp, pending);
+    return (size_t)(outp - out);
+}
+#endif
+
+typedef size_t (*decode_hex_fn)(const unsigned char *in, size_t len, unsigned char *out, int *pending);
+
+/* Pick the decoder for the kernel level */
+static decode_hex_fn select_decoder(void) {
+#ifdef HBH_X86
+    switch (hbh_kernel_level()) {
+        case HBH_KERNEL_AVX512:
+        case HBH_KERNEL_AVX2:   return decode_hex_avx2;
+        case HBH_KERNEL_SSE4:   return decode_hex_sse41;
+    }
+#endif
+    return decode_hex_scalar;
+}
+
+/* Scanning for parallel decoding. Three decoders are run side by side,
+ * one for each state a block could start in: no nibble pending, a 0
+ * pending and some other nibble pending. The other nibble is stood in for
+ * by ENTRY_NIBBLE, which is left in p[2] if nothing in the block moves it.
+ * Nothing is written, only the bytes each decoder would write are counted.
+ */
+#define ENTRY_NIBBLE 16
+
+static void scan_hex_scalar(const unsigned char *in, size_t len, size_t *bytes, int *p) {
+    size_t i;
+    int v, s;
+
+    for (i=0;i<len;i++) {
+        v = hexval[in[i]];
+        if (v >= 0) {
+            for (s=0;s<3;s++) {
+                if (p[s] < 0) {
+                    p[s] = v;
+                } else {
+                    bytes[s]++;
+                    p[s] = -1;
+                }
+            }
+        }
+        else if (in[i]=='x') {
+            for (s=0;s<3;s++)
+                if (p[s]==0) p[s] = -1;
+        }
+    }
+}
+
+#ifdef HBH_X86
+/* Without an 'x' in a block, each decoder just pairs up the pending
+ * nibble and the block's hex characters, so a popcount is enough. Blocks
+ * holding an 'x' go through the scalar scan.
+ */
+__attribute__((target("avx2,popcnt")))
+static void scan_hex_avx2(const unsigned char *in, size_t len, size_t *bytes, int *p) {
+    const __m256i ascii0 = _mm256_set1_epi8('0');
+    const __m256i asciia = _mm256_set1_epi8('a');
+    const __m256i asciix = _mm256_set1_epi8('x');
+    const __m256i nine   = _mm256_set1_epi8(9);
+    const __m256i five   = _mm256_set1_epi8(5);
+    const __m256i lower  = _mm256_set1_epi8(0x20);
+    __m256i v, d, a, ishex;
+    unsigned int mask;
+    size_t i = 0;
+    int k, last, n, s;
+
+    while (i + 32 <= len) {
+        v = _mm256_loadu_si256((const __m256i *)(in+i));
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, asciix)) != 0) {
+            scan_hex_scalar(in+i, 32, bytes, p);
+            i += 32;
+            continue;
+        }
+        d = _mm256_sub_epi8(v, ascii0);
+        a = _mm256_sub_epi8(_mm256_or_si256(v, lower), asciia);
+        ishex = _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_min_epu8(d, nine), d),
+                                _mm256_cmpeq_epi8(_mm256_min_epu8(a, five), a));
+        mask = (unsigned int)_mm256_movemask_epi8(ishex);
+        if (mask != 0) {
+            k = __builtin_popcount(mask);
+            last = hexval[in[i + 31 - __builtin_clz(mask)]];
+            for (s=0;s<3;s++) {
+                n = k + (p[s] >= 0);
+                bytes[s] += (size_t)(n/2);
+                p[s] = (n & 1) ? last : -1;
+            }
+        }
+        i += 32;
+    }
+    scan_hex_scalar(in+i, len-i, bytes, p);
+}
+#endif
+
+typedef void (*scan_hex_fn)(const unsigned char *in, size_t len, size_t *bytes, int *p);
+
+static scan_hex_fn select_scanner(void) {
+#ifdef HBH_X86
+    if (hbh_kernel_level() >= HBH_KERNEL_AVX2) return scan_hex_avx2;
+#endif
+    return scan_hex_scalar;
+}
+
+int hbh_hex_encode_init(hbh_hex_encoder *e, int width) {
+    if (width < 1) return -1;
+    e->width = width;
+    e->bytecount = 0;
+    e->lastcharnl = 0;
+    e->kernel = select_encoder();
+    return 0;
+}
+
+size_t hbh_hex_encode_bound(const hbh_hex_encoder *e, size_t len) {
+    return 2*len + len/e->width + 1;
+}
+
+/* Encode a buffer as lines of width bytes. bytecount is the number of
+ * bytes already on the current line and is carried between calls.
+ */
+size_t hbh_hex_encode_update(hbh_hex_encoder *e, const unsigned char *in, size_t len, unsigned char *out) {
+    unsigned char *outp = out;
+    size_t n;
+
+    if (len == 0) return 0;
+    while (len > 0) {
+        n = (size_t)(e->width - e->bytecount);
+        if (n > len) n = len;
+        e->kernel(in, n, outp);
+        in += n;
+        outp += 2*n;
+        len -= n;
+        e->bytecount += (int)n;
+        if (e->bytecount == e->width) {
+            *outp++ = '\n';
+            e->bytecount = 0;
+        }
+    }
+    e->lastcharnl = (e->bytecount == 0);
+    return (size_t)(outp - out);
+}
+
+/* Lines are a whole number of bytes, so where a byte of input lands in
+ * the output depends only on its position.
+ */
+uint64_t hbh_hex_encode_seek(hbh_hex_encoder *e, uint64_t pos) {
+    e->bytecount = (int)(pos % (uint64_t)e->width);
+    e->lastcharnl = (pos > 0) && (e->bytecount == 0);
+    return 2*pos + pos/(uint64_t)e->width;
+}
+
+/* The output always ends with a newline */
+size_t hbh_hex_encode_finish(hbh_hex_encoder *e, unsigned char *out) {
+    if (e->lastcharnl == 0) {
+        out[0] = '\n';
+        return 1;
+    }
+    return 0;
+}
+
+int hbh_hex_decode_init(hbh_hex_decoder *d) {
+    d->pending = -1;
+    d->kernel = select_decoder();
+    return 0;
+}
+
+size_t hbh_hex_decode_bound(const hbh_hex_decoder *d, size_t len) {
+    return len/2 + 1 + 32;
+}
+
+size_t hbh_hex_decode_update(hbh_hex_decoder *d, const unsigned char *in, size_t len, unsigned char *out) {
+    return d->kernel(in, len, out, &d->pending);
+}
+
+/* An unpaired nibble at the end is dropped */
+size_t hbh_hex_decode_finish(hbh_hex_decoder *d, unsigned char *out) {
+    d->pending = -1;
+    return 0;
+}
+
+int hbh_hex_decode_init_pending(hbh_hex_decoder *d, int pending) {
+    if ((pending < -1) || (pending > 15)) return -1;
+    hbh_hex_decode_init(d);
+    d->pending = pending;
+    return 0;
+}
+
+void hbh_hex_decode_scan(const unsigned char *in, size_t len, hbh_hex_span *span) {
+    span->bytes[0] = 0;
+    span->bytes[1] = 0;
+    span->bytes[2] = 0;
+    span->pending[0] = -1;
+    span->pending[1] = 0;
+    span->pending[2] = ENTRY_NIBBLE;
+    select_scanner()(in, len, span->bytes, span->pending);
+}
+
+int hbh_hex_span_chain(const hbh_hex_span *span, int pending, size_t *bytes) {
+    int s = (pending < 0) ? 0 : ((pending == 0) ? 1 : 2);
+
+    *bytes += span->bytes[s];
+    if (span->pending[s] == ENTRY_NIBBLE) return pending;
+    return span->pending[s];
+}
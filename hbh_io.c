@@ -0,0 +1,773 @@
+/*
+    hbh_io.c - Input and output handling shared by the hexbinhex tools.
+
+    Copyright (C) 2017  David Johnston
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    -----
+
+    Contact. David Johnston dj@deadhat.com
+*/
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <pthread.h>
+
+#include "hexbinhex.h"
+#include "hbh_io.h"
+
+/* Map the whole of a regular file, starting from the current offset so a
+ * redirected stdin that has already been read from carries on in place. */
+static int map_input(hbh_input *in) {
+    struct stat st;
+    off_t offset;
+    void *map;
+
+    if (fstat(in->fd, &st) != 0) return -1;
+    if (!S_ISREG(st.st_mode) || (st.st_size == 0)) return -1;
+    offset = lseek(in->fd, 0, SEEK_CUR);
+    if (offset < 0) offset = 0;
+
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, in->fd, 0);
+    if (map == MAP_FAILED) return -1;
+
+    /* Hints only, so failures don't matter */
+    madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+    madvise(map, (size_t)st.st_size, MADV_HUGEPAGE);
+#endif
+
+    in->map = map;
+    in->maplen = (size_t)st.st_size;
+    in->pos = (offset < st.st_size) ? (size_t)offset : in->maplen;
+    in->mapped = 1;
+    return 0;
+}
+
+/* Mappings are kept this far ahead of the caller with MADV_WILLNEED,
+ * advised in steps of half as much */
+#define READ_AHEAD (8*HBH_SLAB_SIZE)
+
+/* got[] for a block the reader thread has yet to fill */
+#define AHEAD_EMPTY (-2)
+
+static int async_off(void) {
+    return getenv("HBH_NO_ASYNC") != NULL;
+}
+
+int hbh_input_open(hbh_input *in, const char *filename) {
+    struct stat st;
+
+    memset(in, 0, sizeof(*in));
+    in->left = UINT64_MAX;
+    clock_gettime(CLOCK_MONOTONIC, &in->start);
+
+    if ((filename == NULL) || (filename[0] == 0)) {
+        in->fd = STDIN_FILENO;
+    } else {
+        in->fd = open(filename, O_RDONLY);
+        if (in->fd < 0) return -1;
+        in->close_fd = 1;
+    }
+
+    if (map_input(in) == 0) return 0;
+
+    /* A bigger pipe means fewer, larger reads. Not everyone may grow it. */
+    if ((fstat(in->fd, &st) == 0) && S_ISFIFO(st.st_mode)) {
+        in->piped = 1;
+        fcntl(in->fd, F_SETPIPE_SZ, HBH_SLAB_SIZE);
+    }
+
+    in->slot = -1;
+    in->bufsize = HBH_SLAB_SIZE;
+    in->buf = malloc(in->bufsize);
+    if (in->buf == NULL) {
+        if (in->close_fd) close(in->fd);
+        errno = ENOMEM;
+        return -1;
+    }
+    return 0;
+}
+
+/* Refill the block buffer. Returns the bytes read, 0 at EOF, -1 on error. */
+static long fill_block(hbh_input *in) {
+    ssize_t got;
+
+    do {
+        got = read(in->fd, in->buf, in->bufsize);
+    } while ((got < 0) && (errno == EINTR));
+    if (got < 0) return -1;
+    in->buflen = (size_t)got;
+    in->pos = 0;
+    return (long)got;
+}
+
+/* Ask for the next part of the mapping to be read in while the caller
+ * converts this one. */
+static void advise_ahead(hbh_input *in, size_t end) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t from;
+    size_t to;
+
+    if (in->advised >= end + READ_AHEAD/2) return;
+    from = (in->advised > end) ? in->advised : end;
+    from &= ~(page - 1);
+    to = end + READ_AHEAD;
+    if (to > in->maplen) to = in->maplen;
+    if (to > from) madvise((void *)(in->map + from), to - from, MADV_WILLNEED);
+    in->advised = to;
+}
+
+/* The reader thread fills buf and ahead in turn, each once the caller has
+ * handed it back. Cancellation is only let in while it sits in read(). */
+static void *reader_main(void *arg) {
+    hbh_input *in = arg;
+    unsigned char *block;
+    ssize_t got;
+    int slot = 0;
+    int stop;
+
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+    for (;;) {
+        pthread_mutex_lock(&in->lock);
+        while ((in->got[slot] != AHEAD_EMPTY) && (in->stop == 0))
+            pthread_cond_wait(&in->cond, &in->lock);
+        stop = in->stop;
+        pthread_mutex_unlock(&in->lock);
+        if (stop) break;
+
+        block = (slot == 0) ? in->buf : in->ahead;
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+        do {
+            got = read(in->fd, block, in->bufsize);
+        } while ((got < 0) && (errno == EINTR));
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+        pthread_mutex_lock(&in->lock);
+        if (got < 0) in->readerrno = errno;
+        in->got[slot] = (long)got;
+        pthread_cond_broadcast(&in->cond);
+        pthread_mutex_unlock(&in->lock);
+        if (got <= 0) break;
+        slot ^= 1;
+    }
+    return NULL;
+}
+
+static int start_reader(hbh_input *in) {
+    in->ahead = malloc(in->bufsize);
+    if (in->ahead == NULL) return -1;
+    in->got[0] = AHEAD_EMPTY;
+    in->got[1] = AHEAD_EMPTY;
+    pthread_mutex_init(&in->lock, NULL);
+    pthread_cond_init(&in->cond, NULL);
+    if (pthread_create(&in->reader, NULL, reader_main, in) != 0) {
+        pthread_mutex_destroy(&in->lock);
+        pthread_cond_destroy(&in->cond);
+        free(in->ahead);
+        in->ahead = NULL;
+        return -1;
+    }
+    in->async = 1;
+    return 0;
+}
+
+/* Hand the block in use back to the reader thread and wait for the next.
+ * Returns the bytes in it, 0 at EOF, -1 on error. The reader thread is
+ * started by the first call, so anything hbh_input_skip_lines() left in
+ * buf is used up first. */
+static long next_ahead(hbh_input *in) {
+    long got;
+
+    /* slot is -2 once the thread is known not to be wanted or to start */
+    if (in->slot == -2) return fill_block(in);
+    if ((in->async == 0) && (async_off() || (start_reader(in) != 0))) {
+        in->slot = -2;
+        return fill_block(in);
+    }
+
+    pthread_mutex_lock(&in->lock);
+    /* The reader thread has stopped at the end, or an error, so that is
+     * what every later call gets too */
+    if ((in->slot >= 0) && (in->got[in->slot] <= 0)) {
+        got = in->got[in->slot];
+        if (got < 0) errno = in->readerrno;
+        pthread_mutex_unlock(&in->lock);
+        return got;
+    }
+    if (in->slot >= 0) {
+        in->got[in->slot] = AHEAD_EMPTY;
+        pthread_cond_broadcast(&in->cond);
+        in->slot ^= 1;
+    } else {
+        in->slot = 0;
+    }
+    while (in->got[in->slot] == AHEAD_EMPTY) pthread_cond_wait(&in->cond, &in->lock);
+    got = in->got[in->slot];
+    if (got < 0) errno = in->readerrno;
+    pthread_mutex_unlock(&in->lock);
+    if (got <= 0) return got;
+
+    in->buflen = (size_t)got;
+    in->pos = 0;
+    return got;
+}
+
+long hbh_input_next(hbh_input *in, const unsigned char **data, size_t max) {
+    const unsigned char *block;
+    size_t n;
+    long got;
+
+    if (in->left == 0) return 0;
+    if (max > in->left) max = (size_t)in->left;
+    if (in->mapped) {
+        n = in->maplen - in->pos;
+        if (n > max) n = max;
+        *data = in->map + in->pos;
+        advise_ahead(in, in->pos + n);
+    } else {
+        if (in->pos == in->buflen) {
+            got = next_ahead(in);
+            if (got <= 0) return got;
+        }
+        block = (in->slot == 1) ? in->ahead : in->buf;
+        n = in->buflen - in->pos;
+        if (n > max) n = max;
+        *data = block + in->pos;
+    }
+    in->pos += n;
+    in->bytes_in += n;
+    in->left -= n;
+    return (long)n;
+}
+
+long hbh_input_next_block(hbh_input *in, const unsigned char **data, size_t size) {
+    unsigned char *grown;
+    ssize_t got;
+    size_t n;
+
+    if (in->mapped) return hbh_input_next(in, data, size);
+    if (in->async) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (size > in->left) size = (size_t)in->left;
+    if (size == 0) return 0;
+
+    /* Keep whatever an earlier call left in the block */
+    if (in->pos > 0) {
+        memmove(in->buf, in->buf + in->pos, in->buflen - in->pos);
+        in->buflen -= in->pos;
+        in->pos = 0;
+    }
+    if (in->bufsize < size) {
+        grown = realloc(in->buf, size);
+        if (grown == NULL) return -1;
+        in->buf = grown;
+        in->bufsize = size;
+    }
+    while (in->buflen < size) {
+        got = read(in->fd, in->buf + in->buflen, size - in->buflen);
+        if ((got < 0) && (errno == EINTR)) continue;
+        if (got < 0) return -1;
+        if (got == 0) break;
+        in->buflen += (size_t)got;
+    }
+    n = (in->buflen < size) ? in->buflen : size;
+    *data = in->buf;
+    in->pos = n;
+    in->bytes_in += n;
+    in->left -= n;
+    return (long)n;
+}
+
+long hbh_input_peek(hbh_input *in, const unsigned char **data, size_t n) {
+    ssize_t got;
+
+    if (in->mapped) {
+        *data = in->map + in->pos;
+        return (long)((in->maplen - in->pos < n) ? in->maplen - in->pos : n);
+    }
+    if (in->async || (n > in->bufsize)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (in->pos > 0) {
+        memmove(in->buf, in->buf + in->pos, in->buflen - in->pos);
+        in->buflen -= in->pos;
+        in->pos = 0;
+    }
+    while (in->buflen < n) {
+        got = read(in->fd, in->buf + in->buflen, in->bufsize - in->buflen);
+        if ((got < 0) && (errno == EINTR)) continue;
+        if (got < 0) return -1;
+        if (got == 0) break;
+        in->buflen += (size_t)got;
+    }
+    *data = in->buf;
+    return (long)((in->buflen < n) ? in->buflen : n);
+}
+
+/* Mappings are skipped over without touching the pages in between */
+uint64_t hbh_input_skip(hbh_input *in, uint64_t n) {
+    const unsigned char *data;
+    uint64_t skipped = 0;
+    size_t take;
+    long got;
+
+    if (in->mapped) {
+        if (n > in->maplen - in->pos) n = in->maplen - in->pos;
+        in->pos += (size_t)n;
+        return n;
+    }
+
+    /* Before the reader thread starts, read in place as
+     * hbh_input_skip_lines() does, so hbh_input_next_block() can follow */
+    while ((skipped < n) && (in->async == 0)) {
+        if ((in->pos == in->buflen) && (fill_block(in) <= 0)) return skipped;
+        take = in->buflen - in->pos;
+        if (take > n - skipped) take = (size_t)(n - skipped);
+        in->pos += take;
+        in->bytes_in += take;
+        skipped += take;
+    }
+    while (skipped < n) {
+        got = hbh_input_next(in, &data, (n - skipped > HBH_SLAB_SIZE) ? HBH_SLAB_SIZE : (size_t)(n - skipped));
+        if (got <= 0) break;
+        skipped += (uint64_t)got;
+    }
+    return skipped;
+}
+
+void hbh_input_limit(hbh_input *in, uint64_t n) {
+    in->left = n;
+}
+
+int hbh_input_skip_lines(hbh_input *in, int lines) {
+    const unsigned char *base;
+    const unsigned char *nl;
+    size_t len;
+    int skipped = 0;
+
+    while (skipped < lines) {
+        if (in->mapped) {
+            base = in->map;
+            len = in->maplen;
+        } else {
+            if ((in->pos == in->buflen) && (fill_block(in) <= 0)) break;
+            base = in->buf;
+            len = in->buflen;
+        }
+        if (in->pos == len) break;
+
+        nl = memchr(base + in->pos, '\n', len - in->pos);
+        if (nl == NULL) {
+            in->bytes_in += len - in->pos;
+            in->pos = len;
+            continue;
+        }
+        in->bytes_in += (size_t)(nl + 1 - (base + in->pos));
+        in->pos = (size_t)(nl + 1 - base);
+        skipped++;
+    }
+    return skipped;
+}
+
+/* The reader thread may be waiting for a block back or blocked in read()
+ * on a pipe that won't be written to again. Either way it is stopped. */
+static void stop_reader(hbh_input *in) {
+    pthread_mutex_lock(&in->lock);
+    in->stop = 1;
+    pthread_cond_broadcast(&in->cond);
+    pthread_mutex_unlock(&in->lock);
+    pthread_cancel(in->reader);
+    pthread_join(in->reader, NULL);
+    pthread_mutex_destroy(&in->lock);
+    pthread_cond_destroy(&in->cond);
+    free(in->ahead);
+    in->ahead = NULL;
+    in->async = 0;
+}
+
+void hbh_input_close(hbh_input *in) {
+    if (in->async) stop_reader(in);
+    if (in->mapped) munmap((void *)in->map, in->maplen);
+    free(in->buf);
+    if (in->close_fd) close(in->fd);
+    in->mapped = 0;
+    in->buf = NULL;
+    in->close_fd = 0;
+}
+
+/* Buffers hold this many pipe loads, plus room for one more write */
+#define SPLICE_UNITS 8
+
+static double now_secs(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec + (double)t.tv_nsec/1e9;
+}
+
+/* Use vmsplice() if the output is a pipe. Only whole pipe loads are
+ * spliced. A page given to the pipe is never written again, as the reader
+ * may resize the pipe or splice the page on elsewhere and hold it for as
+ * long as it likes, so each buffer is mapped afresh before it is refilled
+ * and the old pages are left to the pipe.
+ */
+static unsigned char *splice_buffer(size_t size) {
+    void *p = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+
+    if (p == MAP_FAILED) return NULL;
+#ifdef MADV_HUGEPAGE
+    /* Faulting in 4K pages one at a time costs more than copying them */
+    madvise(p, size, MADV_HUGEPAGE);
+#endif
+    return p;
+}
+
+static int open_splice(hbh_output *out) {
+    struct stat st;
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    int size;
+    int i;
+
+    if (getenv("HBH_NO_VMSPLICE") != NULL) return -1;
+    if ((fstat(out->fd, &st) != 0) || !S_ISFIFO(st.st_mode)) return -1;
+
+    fcntl(out->fd, F_SETPIPE_SZ, HBH_SLAB_SIZE);
+    size = fcntl(out->fd, F_GETPIPE_SZ);
+    if ((size <= 0) || ((size_t)size % page != 0)) return -1;
+    out->unit = (size_t)size;
+    out->bufsize = (SPLICE_UNITS*out->unit + out->reserve + page - 1) & ~(page - 1);
+
+    for (i=0;i<2;i++) {
+        out->buf[i] = splice_buffer(out->bufsize);
+        if (out->buf[i] == NULL) {
+            if (i == 1) munmap(out->buf[0], out->bufsize);
+            return -1;
+        }
+    }
+    fflush(out->fp);
+    out->spliced = 1;
+    return 0;
+}
+
+static int splice_all(int fd, unsigned char *p, size_t len) {
+    struct iovec iov;
+    ssize_t done;
+
+    while (len > 0) {
+        iov.iov_base = p;
+        iov.iov_len = len;
+        done = vmsplice(fd, &iov, 1, SPLICE_F_GIFT);
+        if ((done < 0) && (errno == EINTR)) continue;
+        if (done <= 0) return -1;
+        p += done;
+        len -= (size_t)done;
+    }
+    return 0;
+}
+
+int hbh_write_all(int fd, const unsigned char *p, size_t len) {
+    ssize_t done;
+
+    while (len > 0) {
+        done = write(fd, p, len);
+        if ((done < 0) && (errno == EINTR)) continue;
+        if (done <= 0) return -1;
+        p += done;
+        len -= (size_t)done;
+    }
+    return 0;
+}
+
+/* The writer thread writes out whichever buffer is posted to it, while
+ * the caller fills the other. */
+static void *writer_main(void *arg) {
+    hbh_output *out = arg;
+    const unsigned char *p;
+    size_t len;
+    double start;
+    int err;
+
+    for (;;) {
+        pthread_mutex_lock(&out->lock);
+        while ((out->posted == 0) && (out->stop == 0)) pthread_cond_wait(&out->cond, &out->lock);
+        if (out->posted == 0) {
+            pthread_mutex_unlock(&out->lock);
+            break;
+        }
+        p = out->buf[out->cur ^ 1];
+        len = out->postlen;
+        err = out->writeerrno;
+        pthread_mutex_unlock(&out->lock);
+
+        /* After an error, throw the rest away so that the caller finds out
+         * at its next hand over rather than waiting for ever */
+        start = now_secs();
+        if ((err == 0) && (hbh_write_all(out->fd, p, len) != 0)) err = errno;
+
+        pthread_mutex_lock(&out->lock);
+        out->write_secs += now_secs() - start;
+        out->writeerrno = err;
+        out->posted = 0;
+        pthread_cond_broadcast(&out->cond);
+        pthread_mutex_unlock(&out->lock);
+    }
+    return NULL;
+}
+
+/* Write files and anything else that isn't a terminal from a thread, in
+ * buffers big enough to keep the writes few and large. */
+static int open_async(hbh_output *out) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    void *p;
+    int i;
+
+    if (async_off() || isatty(out->fd)) return -1;
+    out->bufsize = (HBH_WRITE_SIZE + out->reserve + page - 1) & ~(page - 1);
+    for (i=0;i<2;i++) {
+        p = mmap(NULL, out->bufsize, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            if (i == 1) munmap(out->buf[0], out->bufsize);
+            return -1;
+        }
+        out->buf[i] = p;
+    }
+    pthread_mutex_init(&out->lock, NULL);
+    pthread_cond_init(&out->cond, NULL);
+    if (pthread_create(&out->writer, NULL, writer_main, out) != 0) {
+        pthread_mutex_destroy(&out->lock);
+        pthread_cond_destroy(&out->cond);
+        munmap(out->buf[0], out->bufsize);
+        munmap(out->buf[1], out->bufsize);
+        return -1;
+    }
+    fflush(out->fp);
+    out->async = 1;
+    return 0;
+}
+
+/* Post what is in the current buffer to the writer thread and switch to
+ * the other, once the writer has finished with it. */
+static int post_buffer(hbh_output *out) {
+    int err;
+
+    pthread_mutex_lock(&out->lock);
+    while (out->posted) pthread_cond_wait(&out->cond, &out->lock);
+    err = out->writeerrno;
+    if ((err == 0) && (out->fill > 0)) {
+        out->cur ^= 1;
+        out->postlen = out->fill;
+        out->posted = 1;
+        out->fill = 0;
+        pthread_cond_broadcast(&out->cond);
+    }
+    pthread_mutex_unlock(&out->lock);
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+static int close_async(hbh_output *out) {
+    int result = post_buffer(out);
+
+    pthread_mutex_lock(&out->lock);
+    out->stop = 1;
+    pthread_cond_broadcast(&out->cond);
+    pthread_mutex_unlock(&out->lock);
+    pthread_join(out->writer, NULL);
+    if ((result == 0) && (out->writeerrno != 0)) {
+        errno = out->writeerrno;
+        result = -1;
+    }
+    pthread_mutex_destroy(&out->lock);
+    pthread_cond_destroy(&out->cond);
+    munmap(out->buf[0], out->bufsize);
+    munmap(out->buf[1], out->bufsize);
+    return result;
+}
+
+int hbh_output_open(hbh_output *out, FILE *fp, size_t reserve) {
+    memset(out, 0, sizeof(*out));
+    out->fp = fp;
+    out->fd = fileno(fp);
+    out->reserve = reserve;
+
+    if (open_splice(out) == 0) return 0;
+    if (open_async(out) == 0) return 0;
+
+    out->bufsize = reserve;
+    out->buf[0] = malloc(reserve);
+    if (out->buf[0] == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    return 0;
+}
+
+unsigned char *hbh_output_space(hbh_output *out) {
+    if (out->spliced || out->async) return out->buf[out->cur] + out->fill;
+    return out->buf[0];
+}
+
+int hbh_output_commit(hbh_output *out, size_t n) {
+    unsigned char *other;
+    double start;
+
+    out->bytes_out += n;
+    if (out->async) {
+        /* Time is spent writing on the writer thread, which counts it */
+        out->fill += n;
+        if (out->bufsize - out->fill < out->reserve) return post_buffer(out);
+        return 0;
+    }
+    start = now_secs();
+    if (!out->spliced) {
+        if (fwrite(out->buf[0], 1, n, out->fp) != n) return -1;
+    } else {
+        out->fill += n;
+        while (out->fill - out->sent >= out->unit) {
+            if (splice_all(out->fd, out->buf[out->cur] + out->sent, out->unit) != 0) return -1;
+            out->sent += out->unit;
+        }
+        /* Out of room, carry the part load over to the other buffer */
+        if (out->bufsize - out->fill < out->reserve) {
+            other = out->buf[out->cur ^ 1];
+            if (out->gifted) {
+                munmap(other, out->bufsize);
+                other = splice_buffer(out->bufsize);
+                out->buf[out->cur ^ 1] = other;
+                if (other == NULL) return -1;
+            }
+            memcpy(other, out->buf[out->cur] + out->sent, out->fill - out->sent);
+            out->gifted = (out->sent > 0);
+            out->fill -= out->sent;
+            out->sent = 0;
+            out->cur ^= 1;
+        }
+    }
+    out->write_secs += now_secs() - start;
+    return 0;
+}
+
+int hbh_output_write(hbh_output *out, const unsigned char *data, size_t len) {
+    size_t n;
+
+    if (!out->spliced && !out->async) {
+        out->bytes_out += len;
+        return (fwrite(data, 1, len, out->fp) == len) ? 0 : -1;
+    }
+    while (len > 0) {
+        n = (len > out->reserve) ? out->reserve : len;
+        memcpy(hbh_output_space(out), data, n);
+        if (hbh_output_commit(out, n) != 0) return -1;
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int hbh_output_close(hbh_output *out) {
+    int result = 0;
+
+    if (out->async) {
+        result = close_async(out);
+    } else if (out->spliced) {
+        /* The last part load is written, not spliced */
+        result = hbh_write_all(out->fd, out->buf[out->cur] + out->sent, out->fill - out->sent);
+        munmap(out->buf[0], out->bufsize);
+        munmap(out->buf[1], out->bufsize);
+    } else {
+        free(out->buf[0]);
+    }
+    out->buf[0] = NULL;
+    out->buf[1] = NULL;
+    return result;
+}
+
+off_t hbh_output_offset(int fd) {
+    struct stat st;
+    int flags;
+
+    if ((fstat(fd, &st) != 0) || !S_ISREG(st.st_mode)) return -1;
+    flags = fcntl(fd, F_GETFL);
+    if ((flags < 0) || (flags & O_APPEND)) return -1;
+    return lseek(fd, 0, SEEK_CUR);
+}
+
+int hbh_pwrite_all(int fd, const void *buf, size_t len, off_t offset) {
+    const unsigned char *p = buf;
+    ssize_t done;
+
+    while (len > 0) {
+        done = pwrite(fd, p, len, offset);
+        if ((done < 0) && (errno == EINTR)) continue;
+        if (done <= 0) return -1;
+        p += done;
+        len -= (size_t)done;
+        offset += done;
+    }
+    return 0;
+}
+
+double hbh_input_elapsed(const hbh_input *in) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - in->start.tv_sec) + (double)(now.tv_nsec - in->start.tv_nsec)/1e9;
+}
+
+void hbh_report_throughput(const char *tool, const hbh_input *in, const hbh_output *out) {
+    double secs = hbh_input_elapsed(in);
+    double wsecs = out->write_secs;
+
+    if (secs <= 0.0) secs = 1e-9;
+    if (wsecs <= 0.0) wsecs = 1e-9;
+    fprintf(stderr,"%s: read %llu bytes (%s), wrote %llu bytes (%s) in %.3f s\n",
+            tool, (unsigned long long)in->bytes_in,
+            in->mapped ? "mmap" : (in->async ? "reader thread" : (in->piped ? "pipe read" : "read")),
+            (unsigned long long)out->bytes_out,
+            out->spliced ? "vmsplice" : (out->async ? "writer thread" : "stdio"), secs);
+    fprintf(stderr,"%s: %.1f MB/s in, %.1f MB/s out\n",
+            tool, (double)in->bytes_in/secs/1e6, (double)out->bytes_out/secs/1e6);
+    fprintf(stderr,"%s: %.3f s writing, %.1f MB/s through the output path\n",
+            tool, out->write_secs, (double)out->bytes_out/wsecs/1e6);
+    fprintf(stderr,"%s: %s kernels, best on this CPU %s\n",
+            tool, hbh_kernel_name(hbh_kernel_level()), hbh_kernel_name(hbh_kernel_detect()));
+}
+
+int hbh_parse_count(const char *s, uint64_t *v) {
+    char *end;
+    unsigned long long n;
+
+    while ((*s == ' ') || (*s == '\t')) s++;
+    if ((*s < '0') || (*s > '9')) return -1;
+    errno = 0;
+    n = strtoull(s, &end, 10);
+    if ((errno == ERANGE) || (*end != '\0')) return -1;
+    *v = (uint64_t)n;
+    return 0;
+}
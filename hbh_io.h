@@ -0,0 +1,181 @@
+/*
+    hbh_io.h - Input handling shared by the hexbinhex tools.
+
+    Copyright (C) 2017  David Johnston
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    -----
+
+    Contact. David Johnston dj@deadhat.com
+*/
+
+/*
+ * Regular files, named or redirected to stdin, are memory mapped and
+ * handed out in slabs straight from the mapping. Pipes, terminals and
+ * anything that can't be mapped are read in large blocks instead.
+ *
+ * Output to a pipe is built in page aligned buffers whose pages are given
+ * to the pipe with vmsplice() rather than copied into it, and never
+ * written again once given. Setting HBH_NO_VMSPLICE in the environment
+ * turns vmsplice() off, to compare.
+ *
+ * Reading, converting and writing overlap. Mappings are read ahead a slab
+ * at a time with madvise(). Unmapped input is read into two blocks by a
+ * reader thread, one block being filled while the caller converts the
+ * other. Output other than to a pipe or terminal is built in two large
+ * page aligned buffers, one written by a writer thread while the caller
+ * fills the other. Setting HBH_NO_ASYNC in the environment turns the
+ * threads off, reading in place and writing through stdio instead.
+ */
+
+#ifndef HBH_IO_H
+#define HBH_IO_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+/* Default slab size handed to the conversion kernels */
+#define HBH_SLAB_SIZE (1024*1024)
+
+/* Output the writer thread is handed at a time */
+#define HBH_WRITE_SIZE (4*1024*1024)
+
+typedef struct {
+    int fd;
+    int close_fd;               /* we opened it */
+    int mapped;                 /* reading from a mapping */
+    const unsigned char *map;
+    size_t maplen;
+    size_t pos;                 /* next byte of the mapping or block */
+    unsigned char *buf;         /* block buffer when not mapped */
+    size_t bufsize;
+    size_t buflen;
+    uint64_t bytes_in;
+    int piped;                  /* reading from a pipe */
+    struct timespec start;
+    size_t advised;             /* mapping read ahead up to here */
+    int async;                  /* reader thread running */
+    unsigned char *ahead;       /* second block for the reader thread */
+    pthread_t reader;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    long got[2];                /* bytes read into buf and ahead */
+    int readerrno;
+    int slot;                   /* block handed out, -1 none yet, -2 no thread */
+    int stop;
+    uint64_t left;              /* most still to hand out, from hbh_input_limit() */
+} hbh_input;
+
+typedef struct {
+    FILE *fp;
+    int fd;
+    int spliced;                /* giving pages to a pipe with vmsplice() */
+    size_t reserve;             /* most a caller writes into the space at once */
+    unsigned char *buf[2];
+    size_t bufsize;
+    int cur;                    /* buffer being filled */
+    size_t fill;                /* bytes in it */
+    size_t sent;                /* bytes of it already spliced */
+    size_t unit;                /* pipe capacity, the size of each splice */
+    int gifted;                 /* other buffer has pages in the pipe */
+    uint64_t bytes_out;
+    double write_secs;          /* time spent writing */
+    int async;                  /* writer thread running */
+    pthread_t writer;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int posted;                 /* the other buffer is waiting or being written */
+    size_t postlen;
+    int writeerrno;
+    int stop;
+} hbh_output;
+
+/* Open filename, or stdin when filename is NULL or empty. Returns 0, or
+ * -1 with errno set. */
+int hbh_input_open(hbh_input *in, const char *filename);
+
+/* Point *data at up to max bytes of input. Returns the number of bytes,
+ * 0 at end of file or -1 on a read error. The bytes stay valid until the
+ * next call. */
+long hbh_input_next(hbh_input *in, const unsigned char **data, size_t max);
+
+/* Like hbh_input_next() but keeps reading until there are size bytes or
+ * the input ends, growing the block buffer to suit. For handing large
+ * blocks out to worker threads. It reads in place, so is not for mixing
+ * with hbh_input_next(). */
+long hbh_input_next_block(hbh_input *in, const unsigned char **data, size_t size);
+
+/* Point data at up to the next n bytes, n no more than a slab, without
+ * using them up. Before any hbh_input_next(). Returns how many there
+ * are, fewer only at the end of the input, or -1 on error. */
+long hbh_input_peek(hbh_input *in, const unsigned char **data, size_t n);
+
+/* Use up the next n bytes unseen. Returns how many there were. */
+uint64_t hbh_input_skip(hbh_input *in, uint64_t n);
+
+/* Hand out no more than the next n bytes, as though the input ended
+ * there. Together with hbh_input_skip() this picks out a range. */
+void hbh_input_limit(hbh_input *in, uint64_t n);
+
+/* Skip past the next lines newlines, before any hbh_input_next().
+ * Returns the number skipped. */
+int hbh_input_skip_lines(hbh_input *in, int lines);
+
+void hbh_input_close(hbh_input *in);
+
+/* Set up output to fp for a caller that writes up to reserve bytes at a
+ * time. Returns 0, or -1 with errno set. */
+int hbh_output_open(hbh_output *out, FILE *fp, size_t reserve);
+
+/* Where to put the next reserve or fewer bytes of output */
+unsigned char *hbh_output_space(hbh_output *out);
+
+/* Send the n bytes just put in the space. Returns 0, or -1 on error. */
+int hbh_output_commit(hbh_output *out, size_t n);
+
+/* Send a buffer of output, copying it through the space if need be */
+int hbh_output_write(hbh_output *out, const unsigned char *data, size_t len);
+
+/* Send anything still buffered and release the buffers. Returns 0 or -1. */
+int hbh_output_close(hbh_output *out);
+
+/* File offset to pwrite() output to fd at, or -1 if fd can't take
+ * positional writes (pipes, terminals and files opened for append). */
+off_t hbh_output_offset(int fd);
+
+/* write() all of len bytes, carrying on after short writes. Returns 0 or -1. */
+int hbh_write_all(int fd, const unsigned char *p, size_t len);
+
+/* pwrite() all of buf, carrying on after short writes. Returns 0 or -1. */
+int hbh_pwrite_all(int fd, const void *buf, size_t len, off_t offset);
+
+/* Parse s as a decimal count for --offset or --length, in whatever unit
+ * the tool counts, into *v. Returns 0, or -1 if s is empty, negative,
+ * not all digits or too big. */
+int hbh_parse_count(const char *s, uint64_t *v);
+
+/* Seconds since the input was opened */
+double hbh_input_elapsed(const hbh_input *in);
+
+/* Write "<tool>: read ... wrote ..." throughput figures, and the kernels
+ * in use, to stderr */
+void hbh_report_throughput(const char *tool, const hbh_input *in, const hbh_output *out);
+
+#endif
@@ -0,0 +1,780 @@
+/*
+    hbh_oddball.c - NIST SP800-90B one-symbol-per-byte encoder and decoder.
+
+    Copyright (C) 2017  David Johnston
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    -----
+
+    Contact. David Johnston dj@deadhat.com
+*/
+
+#include "hexbinhex.h"
+#include "hbh_internal.h"
+
+/* Low bps bits set in each byte of a word, indexed by bps */
+static const uint64_t symbol_mask[9] = {
+    0x0000000000000000ULL, 0x0101010101010101ULL, 0x0303030303030303ULL,
+    0x0707070707070707ULL, 0x0F0F0F0F0F0F0F0FULL, 0x1F1F1F1F1F1F1F1FULL,
+    0x3F3F3F3F3F3F3F3FULL, 0x7F7F7F7F7F7F7F7FULL, 0xFFFFFFFFFFFFFFFFULL
+};
+
+/* Symbols of up to 8 bits take a byte, 9 to 16 bits a 2 byte word and
+ * 17 to 32 bits a 4 byte word */
+static inline int symbol_size(int bps) {
+    return (bps <= 8) ? 1 : (bps <= 16) ? 2 : 4;
+}
+
+/* How far past the start of a group of 8 symbols the unpackers read */
+static inline size_t load_span(int bps) {
+    return (bps <= 8) ? 8 : (size_t)(7*bps)/8 + 8;
+}
+
+/* The low bps bits of sym in the opposite order */
+static inline uint32_t reverse_symbol(uint32_t sym, int bps) {
+    return __builtin_bswap32((uint32_t)reverse_bits_in_bytes(sym)) >> (32-bps);
+}
+
+static inline void store_symbol(unsigned char *out, uint32_t sym, int size, int bigwords) {
+    uint16_t w16;
+    uint32_t w32;
+
+    if (size == 1) {
+        out[0] = (unsigned char)sym;
+    } else if (size == 2) {
+        w16 = bigwords ? __builtin_bswap16((uint16_t)sym) : (uint16_t)sym;
+        memcpy(out, &w16, 2);
+    } else {
+        w32 = bigwords ? __builtin_bswap32(sym) : sym;
+        memcpy(out, &w32, 4);
+    }
+}
+
+static inline uint32_t load_symbol(const unsigned char *in, int size, int bigwords) {
+    uint16_t w16;
+    uint32_t w32;
+
+    if (size == 1) return in[0];
+    if (size == 2) {
+        memcpy(&w16, in, 2);
+        return bigwords ? __builtin_bswap16(w16) : w16;
+    }
+    memcpy(&w32, in, 4);
+    return bigwords ? __builtin_bswap32(w32) : w32;
+}
+
+/* Swap the bytes of each 16 bit lane of a word */
+static inline uint64_t swap_bytes_in_lanes(uint64_t w) {
+    return ((w >> 8) & 0x00FF00FF00FF00FFULL) | ((w & 0x00FF00FF00FF00FFULL) << 8);
+}
+
+/* Spread the low 8*bps bits of x into 8 fields of bps bits, one per byte.
+ * This is what pdep does with symbol_mask[bps]. */
+static inline uint64_t deposit_symbols(uint64_t x, const int bps) {
+    uint64_t y = 0;
+    int k;
+    for (k=0;k<8;k++) {
+        y |= ((x >> (k*bps)) & ((1ULL << bps)-1)) << (8*k);
+    }
+    return y;
+}
+
+#define DEPOSIT_SHIFT(x, bps) deposit_symbols(x, bps)
+#define DEPOSIT_PDEP(x, bps)  _pdep_u64(x, symbol_mask[bps])
+
+/* Every group of bps input bytes holds exactly 8 symbols. A kernel unpacks
+ * whole groups with a 64 bit load, turning -r input into lsb first order
+ * by reversing the bits in each byte, depositing the symbols into bytes
+ * and for -B output reversing the bits of each symbol.
+ * One kernel is built for each combination of bps, -r and -L/-B so the
+ * shifts and masks are all constants. The input must be readable for 8
+ * bytes past the last group.
+ */
+#define UNPACK_KERNEL(NAME, ATTR, DEPOSIT, BPS, REV, LE) \
+ATTR static void NAME(const unsigned char *in, size_t groups, unsigned char *out) { \
+    uint64_t x, y; \
+    size_t g; \
+    for (g=0;g<groups;g++) { \
+        x = load64(in); \
+        if (REV) x = reverse_bits_in_bytes(x); \
+        y = DEPOSIT(x, BPS); \
+        if (!LE) y = (reverse_bits_in_bytes(y) >> (8-BPS)) & symbol_mask[BPS]; \
+        memcpy(out, &y, 8); \
+        in += BPS; \
+        out += 8; \
+    } \
+}
+
+typedef void (*unpack_fn)(const unsigned char *in, size_t groups, unsigned char *out);
+
+#define UNPACK_KERNELS(BPS) \
+    UNPACK_KERNEL(unpack_shift_##BPS##_0_0, , DEPOSIT_SHIFT, BPS, 0, 0) \
+    UNPACK_KERNEL(unpack_shift_##BPS##_0_1, , DEPOSIT_SHIFT, BPS, 0, 1) \
+    UNPACK_KERNEL(unpack_shift_##BPS##_1_0, , DEPOSIT_SHIFT, BPS, 1, 0) \
+    UNPACK_KERNEL(unpack_shift_##BPS##_1_1, , DEPOSIT_SHIFT, BPS, 1, 1)
+
+UNPACK_KERNELS(1) UNPACK_KERNELS(2) UNPACK_KERNELS(3) UNPACK_KERNELS(4)
+UNPACK_KERNELS(5) UNPACK_KERNELS(6) UNPACK_KERNELS(7) UNPACK_KERNELS(8)
+
+#define UNPACK_ROW(PREFIX, BPS) \
+    {{ PREFIX##_##BPS##_0_0, PREFIX##_##BPS##_0_1 }, { PREFIX##_##BPS##_1_0, PREFIX##_##BPS##_1_1 }}
+
+/* Indexed by [bps][reverse][littleendian] */
+static const unpack_fn unpack_shift[9][2][2] = {
+    {{ NULL, NULL }, { NULL, NULL }},
+    UNPACK_ROW(unpack_shift, 1), UNPACK_ROW(unpack_shift, 2),
+    UNPACK_ROW(unpack_shift, 3), UNPACK_ROW(unpack_shift, 4),
+    UNPACK_ROW(unpack_shift, 5), UNPACK_ROW(unpack_shift, 6),
+    UNPACK_ROW(unpack_shift, 7), UNPACK_ROW(unpack_shift, 8)
+};
+
+#if defined(__x86_64__)
+
+#define UNPACK_KERNELS_BMI2(BPS) \
+    UNPACK_KERNEL(unpack_pdep_##BPS##_0_0, __attribute__((target("bmi2"))), DEPOSIT_PDEP, BPS, 0, 0) \
+    UNPACK_KERNEL(unpack_pdep_##BPS##_0_1, __attribute__((target("bmi2"))), DEPOSIT_PDEP, BPS, 0, 1) \
+    UNPACK_KERNEL(unpack_pdep_##BPS##_1_0, __attribute__((target("bmi2"))), DEPOSIT_PDEP, BPS, 1, 0) \
+    UNPACK_KERNEL(unpack_pdep_##BPS##_1_1, __attribute__((target("bmi2"))), DEPOSIT_PDEP, BPS, 1, 1)
+
+UNPACK_KERNELS_BMI2(1) UNPACK_KERNELS_BMI2(2) UNPACK_KERNELS_BMI2(3) UNPACK_KERNELS_BMI2(4)
+UNPACK_KERNELS_BMI2(5) UNPACK_KERNELS_BMI2(6) UNPACK_KERNELS_BMI2(7) UNPACK_KERNELS_BMI2(8)
+
+static const unpack_fn unpack_pdep[9][2][2] = {
+    {{ NULL, NULL }, { NULL, NULL }},
+    UNPACK_ROW(unpack_pdep, 1), UNPACK_ROW(unpack_pdep, 2),
+    UNPACK_ROW(unpack_pdep, 3), UNPACK_ROW(unpack_pdep, 4),
+    UNPACK_ROW(unpack_pdep, 5), UNPACK_ROW(unpack_pdep, 6),
+    UNPACK_ROW(unpack_pdep, 7), UNPACK_ROW(unpack_pdep, 8)
+};
+#endif
+
+/* Wider symbols work the same way. A group of 8 symbols of bps bits is
+ * still bps input bytes, and each symbol is picked out of a 64 bit load
+ * at the byte it starts in, which covers it whatever its offset.
+ * The loop has constant bounds, so each kernel unrolls into 8 loads,
+ * shifts and stores with no variable shift counts.
+ */
+static inline __attribute__((always_inline))
+void unpack_wide_group(const unsigned char *in, unsigned char *out, const int bps,
+                       const int reverse, const int littleendian, const int bigwords) {
+    const int size = symbol_size(bps);
+    uint64_t x;
+    uint32_t sym;
+    int k;
+
+#pragma GCC unroll 8
+    for (k=0;k<8;k++) {
+        x = load64(in + (k*bps)/8);
+        if (reverse) x = reverse_bits_in_bytes(x);
+        sym = (uint32_t)((x >> ((k*bps)%8)) & ((1ULL << bps)-1));
+        if (!littleendian) sym = reverse_symbol(sym, bps);
+        store_symbol(out + k*size, sym, size, bigwords);
+    }
+}
+
+#define UNPACK_WIDE_KERNEL(NAME, ATTR, GROUP, BPS, REV, LE, BIG) \
+ATTR static void NAME(const unsigned char *in, size_t groups, unsigned char *out) { \
+    size_t g; \
+    for (g=0;g<groups;g++) { \
+        GROUP(in, out, BPS, REV, LE, BIG); \
+        in += BPS; \
+        out += 8*symbol_size(BPS); \
+    } \
+}
+
+#define UNPACK_WIDE_KERNELS(PREFIX, ATTR, GROUP, BPS) \
+    UNPACK_WIDE_KERNEL(PREFIX##_##BPS##_0_0_0, ATTR, GROUP, BPS, 0, 0, 0) \
+    UNPACK_WIDE_KERNEL(PREFIX##_##BPS##_0_0_1, ATTR, GROUP, BPS, 0, 0, 1) \
+    UNPACK_WIDE_KERNEL(PREFIX##_##BPS##_0_1_0, ATTR, GROUP, BPS, 0, 1, 0) \
+    UNPACK_WIDE_KERNEL(PREFIX##_##BPS##_0_1_1, ATTR, GROUP, BPS, 0, 1, 1) \
+    UNPACK_WIDE_KERNEL(PREFIX##_##BPS##_1_0_0, ATTR, GROUP, BPS, 1, 0, 0) \
+    UNPACK_WIDE_KERNEL(PREFIX##_##BPS##_1_0_1, ATTR, GROUP, BPS, 1, 0, 1) \
+    UNPACK_WIDE_KERNEL(PREFIX##_##BPS##_1_1_0, ATTR, GROUP, BPS, 1, 1, 0) \
+    UNPACK_WIDE_KERNEL(PREFIX##_##BPS##_1_1_1, ATTR, GROUP, BPS, 1, 1, 1)
+
+#define UNPACK_WIDE_SHIFT(BPS) UNPACK_WIDE_KERNELS(unpack_wide, , unpack_wide_group, BPS)
+
+UNPACK_WIDE_SHIFT(9)  UNPACK_WIDE_SHIFT(10) UNPACK_WIDE_SHIFT(11) UNPACK_WIDE_SHIFT(12)
+UNPACK_WIDE_SHIFT(13) UNPACK_WIDE_SHIFT(14) UNPACK_WIDE_SHIFT(15) UNPACK_WIDE_SHIFT(16)
+UNPACK_WIDE_SHIFT(17) UNPACK_WIDE_SHIFT(18) UNPACK_WIDE_SHIFT(19) UNPACK_WIDE_SHIFT(20)
+UNPACK_WIDE_SHIFT(21) UNPACK_WIDE_SHIFT(22) UNPACK_WIDE_SHIFT(23) UNPACK_WIDE_SHIFT(24)
+UNPACK_WIDE_SHIFT(25) UNPACK_WIDE_SHIFT(26) UNPACK_WIDE_SHIFT(27) UNPACK_WIDE_SHIFT(28)
+UNPACK_WIDE_SHIFT(29) UNPACK_WIDE_SHIFT(30) UNPACK_WIDE_SHIFT(31) UNPACK_WIDE_SHIFT(32)
+
+#define WIDE_ROW(PREFIX, BPS) \
+    {{{ PREFIX##_##BPS##_0_0_0, PREFIX##_##BPS##_0_0_1 }, { PREFIX##_##BPS##_0_1_0, PREFIX##_##BPS##_0_1_1 }}, \
+     {{ PREFIX##_##BPS##_1_0_0, PREFIX##_##BPS##_1_0_1 }, { PREFIX##_##BPS##_1_1_0, PREFIX##_##BPS##_1_1_1 }}}
+
+/* Indexed by [bps-9][reverse][littleendian][bigwords] */
+static const unpack_fn unpack_wide[24][2][2][2] = {
+    WIDE_ROW(unpack_wide, 9),  WIDE_ROW(unpack_wide, 10), WIDE_ROW(unpack_wide, 11),
+    WIDE_ROW(unpack_wide, 12), WIDE_ROW(unpack_wide, 13), WIDE_ROW(unpack_wide, 14),
+    WIDE_ROW(unpack_wide, 15), WIDE_ROW(unpack_wide, 16), WIDE_ROW(unpack_wide, 17),
+    WIDE_ROW(unpack_wide, 18), WIDE_ROW(unpack_wide, 19), WIDE_ROW(unpack_wide, 20),
+    WIDE_ROW(unpack_wide, 21), WIDE_ROW(unpack_wide, 22), WIDE_ROW(unpack_wide, 23),
+    WIDE_ROW(unpack_wide, 24), WIDE_ROW(unpack_wide, 25), WIDE_ROW(unpack_wide, 26),
+    WIDE_ROW(unpack_wide, 27), WIDE_ROW(unpack_wide, 28), WIDE_ROW(unpack_wide, 29),
+    WIDE_ROW(unpack_wide, 30), WIDE_ROW(unpack_wide, 31), WIDE_ROW(unpack_wide, 32)
+};
+
+/* 16 bit symbols from little endian input to little endian words are
+ * the input as it is */
+static void unpack_copy16(const unsigned char *in, size_t groups, unsigned char *out) {
+    memcpy(out, in, 16*groups);
+}
+
+#if defined(__x86_64__)
+
+/* From 9 to 16 bits, 4 symbols fit in one 64 bit load and pdep spreads
+ * them into the 4 16 bit lanes of a word, so a group is two pdeps. */
+static inline __attribute__((always_inline, target("bmi2")))
+void unpack_pdep16_group(const unsigned char *in, unsigned char *out, const int bps,
+                         const int reverse, const int littleendian, const int bigwords) {
+    const uint64_t lanes = ((1ULL << bps)-1) * 0x0001000100010001ULL;
+    uint64_t x0 = load64(in);
+    uint64_t x1 = load64(in + (4*bps)/8);
+    uint64_t y0, y1;
+
+    if (reverse) {
+        x0 = reverse_bits_in_bytes(x0);
+        x1 = reverse_bits_in_bytes(x1);
+    }
+    y0 = _pdep_u64(x0, lanes);
+    y1 = _pdep_u64(x1 >> ((4*bps)%8), lanes);
+    if (!littleendian) {
+        y0 = (swap_bytes_in_lanes(reverse_bits_in_bytes(y0)) >> (16-bps)) & lanes;
+        y1 = (swap_bytes_in_lanes(reverse_bits_in_bytes(y1)) >> (16-bps)) & lanes;
+    }
+    if (bigwords) {
+        y0 = swap_bytes_in_lanes(y0);
+        y1 = swap_bytes_in_lanes(y1);
+    }
+    memcpy(out, &y0, 8);
+    memcpy(out+8, &y1, 8);
+}
+
+#define UNPACK_WIDE_PDEP(BPS) UNPACK_WIDE_KERNELS(unpack_pdep16, __attribute__((target("bmi2"))), unpack_pdep16_group, BPS)
+
+UNPACK_WIDE_PDEP(9)  UNPACK_WIDE_PDEP(10) UNPACK_WIDE_PDEP(11) UNPACK_WIDE_PDEP(12)
+UNPACK_WIDE_PDEP(13) UNPACK_WIDE_PDEP(14) UNPACK_WIDE_PDEP(15) UNPACK_WIDE_PDEP(16)
+
+static const unpack_fn unpack_pdep16[8][2][2][2] = {
+    WIDE_ROW(unpack_pdep16, 9),  WIDE_ROW(unpack_pdep16, 10), WIDE_ROW(unpack_pdep16, 11),
+    WIDE_ROW(unpack_pdep16, 12), WIDE_ROW(unpack_pdep16, 13), WIDE_ROW(unpack_pdep16, 14),
+    WIDE_ROW(unpack_pdep16, 15), WIDE_ROW(unpack_pdep16, 16)
+};
+
+/* 12 bit samples are common enough to have their own vector kernel for
+ * lsb first input and symbols. Two groups, 24 bytes, go into the two
+ * lanes of a register, pshufb puts the two bytes each symbol spans in
+ * its 16 bit lane and the odd symbols are shifted down a nibble. */
+static inline __attribute__((always_inline, target("avx2,bmi2")))
+void unpack_avx2_12(const unsigned char *in, size_t groups, unsigned char *out, const int bigwords) {
+    const __m256i spread = _mm256_setr_epi8(0,1,1,2,3,4,4,5,6,7,7,8,9,10,10,11,
+                                            0,1,1,2,3,4,4,5,6,7,7,8,9,10,10,11);
+    const __m256i swap = _mm256_setr_epi8(1,0,3,2,5,4,7,6,9,8,11,10,13,12,15,14,
+                                          1,0,3,2,5,4,7,6,9,8,11,10,13,12,15,14);
+    const __m256i mask = _mm256_set1_epi16(0x0FFF);
+    __m256i v;
+    size_t g;
+
+    for (g=0;g+2<=groups;g+=2) {
+        v = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)in)),
+                                    _mm_loadu_si128((const __m128i *)(in+12)), 1);
+        v = _mm256_shuffle_epi8(v, spread);
+        v = _mm256_blend_epi16(_mm256_and_si256(v, mask), _mm256_srli_epi16(v, 4), 0xAA);
+        if (bigwords) v = _mm256_shuffle_epi8(v, swap);
+        _mm256_storeu_si256((__m256i *)out, v);
+        in += 24;
+        out += 32;
+    }
+    if (g < groups) unpack_pdep16_group(in, out, 12, 0, 1, bigwords);
+}
+
+__attribute__((target("avx2,bmi2")))
+static void unpack_avx2_12_le(const unsigned char *in, size_t groups, unsigned char *out) {
+    unpack_avx2_12(in, groups, out, 0);
+}
+
+__attribute__((target("avx2,bmi2")))
+static void unpack_avx2_12_be(const unsigned char *in, size_t groups, unsigned char *out) {
+    unpack_avx2_12(in, groups, out, 1);
+}
+#endif
+
+/* Pick the unpacker for the width and kernel level */
+static unpack_fn select_unpacker(int bps, int reverse, int littleendian, int bigwords) {
+    if ((bps == 16) && (reverse == 0) && (littleendian == 1) && (bigwords == 0)) return unpack_copy16;
+#if defined(__x86_64__)
+    if (hbh_kernel_level() >= HBH_KERNEL_AVX2) {
+        if ((bps == 12) && (reverse == 0) && (littleendian == 1)) return (bigwords == 1) ? unpack_avx2_12_be : unpack_avx2_12_le;
+        if (bps <= 8) return unpack_pdep[bps][reverse][littleendian];
+        if (bps <= 16) return unpack_pdep16[bps-9][reverse][littleendian][bigwords];
+    }
+#endif
+    if (bps <= 8) return unpack_shift[bps][reverse][littleendian];
+    return unpack_wide[bps-9][reverse][littleendian][bigwords];
+}
+
+/* Unpack the fewer than bps bytes left at the end of the input, a byte
+ * at a time into an accumulator that bps bits at a time are taken from.
+ * Bits that don't make up a whole symbol are dropped. Returns the number
+ * of bytes written.
+ */
+static size_t unpack_tail(const unsigned char *in, size_t len, unsigned char *out,
+                          int bps, int reverse, int littleendian, int bigwords) {
+    const int size = symbol_size(bps);
+    uint64_t acc = 0;
+    uint32_t sym;
+    int nbits = 0;
+    size_t i;
+    size_t count = 0;
+
+    for (i=0;i<len;i++) {
+        acc |= (uint64_t)((reverse==1) ? reverse_bits_in_bytes(in[i]) & 0xff : in[i]) << nbits;
+        for (nbits+=8; nbits>=bps; nbits-=bps) {
+            sym = (uint32_t)(acc & ((1ULL << bps)-1));
+            acc = acc >> bps;
+            if (littleendian==0) sym = reverse_symbol(sym, bps);
+            store_symbol(out + count, sym, size, bigwords);
+            count += size;
+        }
+    }
+    return count;
+}
+
+/* Gather the low bps bits of each byte of x into the low 8*bps bits.
+ * This is what pext does with symbol_mask[bps]. */
+static inline uint64_t extract_symbols(uint64_t x, const int bps) {
+    uint64_t y = 0;
+    int k;
+    for (k=0;k<8;k++) {
+        y |= ((x >> (8*k)) & ((1ULL << bps)-1)) << (k*bps);
+    }
+    return y;
+}
+
+#define EXTRACT_SHIFT(x, bps) extract_symbols(x, bps)
+#define EXTRACT_PEXT(x, bps)  _pext_u64(x, symbol_mask[bps])
+
+/* Every 8 symbols pack into exactly bps output bytes. A kernel packs whole
+ * groups from a 64 bit load, turning -B symbols lsb first by reversing
+ * their bits, gathering the symbol bits together and for -r output
+ * reversing the bits in each output byte.
+ * One kernel is built for each combination of bps, -L/-B and -r so the
+ * shifts and masks are all constants. The output must be writable for 8
+ * bytes past the last group.
+ */
+#define PACK_KERNEL(NAME, ATTR, EXTRACT, BPS, LE, REV) \
+ATTR static void NAME(const unsigned char *in, size_t groups, unsigned char *out) { \
+    uint64_t x, y; \
+    size_t g; \
+    for (g=0;g<groups;g++) { \
+        x = load64(in); \
+        if (!LE) x = reverse_bits_in_bytes(x) >> (8-BPS); \
+        y = EXTRACT(x, BPS); \
+        if (REV) y = reverse_bits_in_bytes(y); \
+        memcpy(out, &y, 8); \
+        in += 8; \
+        out += BPS; \
+    } \
+}
+
+typedef void (*pack_fn)(const unsigned char *in, size_t groups, unsigned char *out);
+
+#define PACK_KERNELS(BPS) \
+    PACK_KERNEL(pack_shift_##BPS##_0_0, , EXTRACT_SHIFT, BPS, 0, 0) \
+    PACK_KERNEL(pack_shift_##BPS##_0_1, , EXTRACT_SHIFT, BPS, 0, 1) \
+    PACK_KERNEL(pack_shift_##BPS##_1_0, , EXTRACT_SHIFT, BPS, 1, 0) \
+    PACK_KERNEL(pack_shift_##BPS##_1_1, , EXTRACT_SHIFT, BPS, 1, 1)
+
+PACK_KERNELS(1) PACK_KERNELS(2) PACK_KERNELS(3) PACK_KERNELS(4)
+PACK_KERNELS(5) PACK_KERNELS(6) PACK_KERNELS(7) PACK_KERNELS(8)
+
+#define PACK_ROW(PREFIX, BPS) \
+    {{ PREFIX##_##BPS##_0_0, PREFIX##_##BPS##_0_1 }, { PREFIX##_##BPS##_1_0, PREFIX##_##BPS##_1_1 }}
+
+/* Indexed by [bps][littleendian][reverse] */
+static const pack_fn pack_shift[9][2][2] = {
+    {{ NULL, NULL }, { NULL, NULL }},
+    PACK_ROW(pack_shift, 1), PACK_ROW(pack_shift, 2),
+    PACK_ROW(pack_shift, 3), PACK_ROW(pack_shift, 4),
+    PACK_ROW(pack_shift, 5), PACK_ROW(pack_shift, 6),
+    PACK_ROW(pack_shift, 7), PACK_ROW(pack_shift, 8)
+};
+
+#if defined(__x86_64__)
+
+#define PACK_KERNELS_BMI2(BPS) \
+    PACK_KERNEL(pack_pext_##BPS##_0_0, __attribute__((target("bmi2"))), EXTRACT_PEXT, BPS, 0, 0) \
+    PACK_KERNEL(pack_pext_##BPS##_0_1, __attribute__((target("bmi2"))), EXTRACT_PEXT, BPS, 0, 1) \
+    PACK_KERNEL(pack_pext_##BPS##_1_0, __attribute__((target("bmi2"))), EXTRACT_PEXT, BPS, 1, 0) \
+    PACK_KERNEL(pack_pext_##BPS##_1_1, __attribute__((target("bmi2"))), EXTRACT_PEXT, BPS, 1, 1)
+
+PACK_KERNELS_BMI2(1) PACK_KERNELS_BMI2(2) PACK_KERNELS_BMI2(3) PACK_KERNELS_BMI2(4)
+PACK_KERNELS_BMI2(5) PACK_KERNELS_BMI2(6) PACK_KERNELS_BMI2(7) PACK_KERNELS_BMI2(8)
+
+static const pack_fn pack_pext[9][2][2] = {
+    {{ NULL, NULL }, { NULL, NULL }},
+    PACK_ROW(pack_pext, 1), PACK_ROW(pack_pext, 2),
+    PACK_ROW(pack_pext, 3), PACK_ROW(pack_pext, 4),
+    PACK_ROW(pack_pext, 5), PACK_ROW(pack_pext, 6),
+    PACK_ROW(pack_pext, 7), PACK_ROW(pack_pext, 8)
+};
+#endif
+
+/* Wider symbols are loaded a word each and gathered into a 64 bit
+ * accumulator that 32 bits at a time are stored from, with what is left
+ * at the end of the group, a whole number of bytes, stored last. Each
+ * kernel writes exactly bps bytes per group.
+ */
+static inline __attribute__((always_inline))
+void pack_wide_group(const unsigned char *in, unsigned char *out, const int bps,
+                     const int littleendian, const int reverse, const int bigwords) {
+    const int size = symbol_size(bps);
+    uint64_t acc = 0;
+    uint32_t sym;
+    uint32_t v;
+    int nacc = 0;
+    int k;
+
+#pragma GCC unroll 8
+    for (k=0;k<8;k++) {
+        sym = load_symbol(in + k*size, size, bigwords) & (uint32_t)((1ULL << bps)-1);
+        if (!littleendian) sym = reverse_symbol(sym, bps);
+        acc |= (uint64_t)sym << nacc;
+        nacc += bps;
+        if (nacc >= 32) {
+            v = (uint32_t)acc;
+            if (reverse) v = (uint32_t)reverse_bits_in_bytes(v);
+            memcpy(out, &v, 4);
+            out += 4;
+            acc = acc >> 32;
+            nacc -= 32;
+        }
+    }
+    if (reverse) acc = reverse_bits_in_bytes(acc);
+    memcpy(out, &acc, nacc/8);
+}
+
+#define PACK_WIDE_KERNEL(NAME, ATTR, GROUP, BPS, LE, REV, BIG) \
+ATTR static void NAME(const unsigned char *in, size_t groups, unsigned char *out) { \
+    size_t g; \
+    for (g=0;g<groups;g++) { \
+        GROUP(in, out, BPS, LE, REV, BIG); \
+        in += 8*symbol_size(BPS); \
+        out += BPS; \
+    } \
+}
+
+#define PACK_WIDE_KERNELS(PREFIX, ATTR, GROUP, BPS) \
+    PACK_WIDE_KERNEL(PREFIX##_##BPS##_0_0_0, ATTR, GROUP, BPS, 0, 0, 0) \
+    PACK_WIDE_KERNEL(PREFIX##_##BPS##_0_0_1, ATTR, GROUP, BPS, 0, 0, 1) \
+    PACK_WIDE_KERNEL(PREFIX##_##BPS##_0_1_0, ATTR, GROUP, BPS, 0, 1, 0) \
+    PACK_WIDE_KERNEL(PREFIX##_##BPS##_0_1_1, ATTR, GROUP, BPS, 0, 1, 1) \
+    PACK_WIDE_KERNEL(PREFIX##_##BPS##_1_0_0, ATTR, GROUP, BPS, 1, 0, 0) \
+    PACK_WIDE_KERNEL(PREFIX##_##BPS##_1_0_1, ATTR, GROUP, BPS, 1, 0, 1) \
+    PACK_WIDE_KERNEL(PREFIX##_##BPS##_1_1_0, ATTR, GROUP, BPS, 1, 1, 0) \
+    PACK_WIDE_KERNEL(PREFIX##_##BPS##_1_1_1, ATTR, GROUP, BPS, 1, 1, 1)
+
+#define PACK_WIDE_SHIFT(BPS) PACK_WIDE_KERNELS(pack_wide, , pack_wide_group, BPS)
+
+PACK_WIDE_SHIFT(9)  PACK_WIDE_SHIFT(10) PACK_WIDE_SHIFT(11) PACK_WIDE_SHIFT(12)
+PACK_WIDE_SHIFT(13) PACK_WIDE_SHIFT(14) PACK_WIDE_SHIFT(15) PACK_WIDE_SHIFT(16)
+PACK_WIDE_SHIFT(17) PACK_WIDE_SHIFT(18) PACK_WIDE_SHIFT(19) PACK_WIDE_SHIFT(20)
+PACK_WIDE_SHIFT(21) PACK_WIDE_SHIFT(22) PACK_WIDE_SHIFT(23) PACK_WIDE_SHIFT(24)
+PACK_WIDE_SHIFT(25) PACK_WIDE_SHIFT(26) PACK_WIDE_SHIFT(27) PACK_WIDE_SHIFT(28)
+PACK_WIDE_SHIFT(29) PACK_WIDE_SHIFT(30) PACK_WIDE_SHIFT(31) PACK_WIDE_SHIFT(32)
+
+/* Indexed by [bps-9][littleendian][reverse][bigwords] */
+static const pack_fn pack_wide[24][2][2][2] = {
+    WIDE_ROW(pack_wide, 9),  WIDE_ROW(pack_wide, 10), WIDE_ROW(pack_wide, 11),
+    WIDE_ROW(pack_wide, 12), WIDE_ROW(pack_wide, 13), WIDE_ROW(pack_wide, 14),
+    WIDE_ROW(pack_wide, 15), WIDE_ROW(pack_wide, 16), WIDE_ROW(pack_wide, 17),
+    WIDE_ROW(pack_wide, 18), WIDE_ROW(pack_wide, 19), WIDE_ROW(pack_wide, 20),
+    WIDE_ROW(pack_wide, 21), WIDE_ROW(pack_wide, 22), WIDE_ROW(pack_wide, 23),
+    WIDE_ROW(pack_wide, 24), WIDE_ROW(pack_wide, 25), WIDE_ROW(pack_wide, 26),
+    WIDE_ROW(pack_wide, 27), WIDE_ROW(pack_wide, 28), WIDE_ROW(pack_wide, 29),
+    WIDE_ROW(pack_wide, 30), WIDE_ROW(pack_wide, 31), WIDE_ROW(pack_wide, 32)
+};
+
+static void pack_copy16(const unsigned char *in, size_t groups, unsigned char *out) {
+    memcpy(out, in, 16*groups);
+}
+
+#if defined(__x86_64__)
+
+/* From 9 to 16 bits, pext gathers the symbols in the 4 lanes of a 64 bit
+ * load into 4*bps bits, and the two halves of a group are joined in 128
+ * bits. Each group stores 16 bytes, up to 7 past its bps. */
+static inline __attribute__((always_inline, target("bmi2")))
+void pack_pext16_group(const unsigned char *in, unsigned char *out, const int bps,
+                       const int littleendian, const int reverse, const int bigwords) {
+    const uint64_t lanes = ((1ULL << bps)-1) * 0x0001000100010001ULL;
+    uint64_t x0 = load64(in);
+    uint64_t x1 = load64(in+8);
+    unsigned __int128 y;
+    uint64_t y0, y1;
+
+    if (bigwords) {
+        x0 = swap_bytes_in_lanes(x0);
+        x1 = swap_bytes_in_lanes(x1);
+    }
+    if (!littleendian) {
+        x0 = swap_bytes_in_lanes(reverse_bits_in_bytes(x0)) >> (16-bps);
+        x1 = swap_bytes_in_lanes(reverse_bits_in_bytes(x1)) >> (16-bps);
+    }
+    y = (unsigned __int128)_pext_u64(x0, lanes) | ((unsigned __int128)_pext_u64(x1, lanes) << (4*bps));
+    y0 = (uint64_t)y;
+    y1 = (uint64_t)(y >> 64);
+    if (reverse) {
+        y0 = reverse_bits_in_bytes(y0);
+        y1 = reverse_bits_in_bytes(y1);
+    }
+    memcpy(out, &y0, 8);
+    memcpy(out+8, &y1, 8);
+}
+
+#define PACK_WIDE_PEXT(BPS) PACK_WIDE_KERNELS(pack_pext16, __attribute__((target("bmi2"))), pack_pext16_group, BPS)
+
+PACK_WIDE_PEXT(9)  PACK_WIDE_PEXT(10) PACK_WIDE_PEXT(11) PACK_WIDE_PEXT(12)
+PACK_WIDE_PEXT(13) PACK_WIDE_PEXT(14) PACK_WIDE_PEXT(15) PACK_WIDE_PEXT(16)
+
+static const pack_fn pack_pext16[8][2][2][2] = {
+    WIDE_ROW(pack_pext16, 9),  WIDE_ROW(pack_pext16, 10), WIDE_ROW(pack_pext16, 11),
+    WIDE_ROW(pack_pext16, 12), WIDE_ROW(pack_pext16, 13), WIDE_ROW(pack_pext16, 14),
+    WIDE_ROW(pack_pext16, 15), WIDE_ROW(pack_pext16, 16)
+};
+
+/* And back: pmaddwd joins each pair of 12 bit symbols into 24 bits of a
+ * 32 bit lane and pshufb packs the 3 byte pairs together in each 128
+ * bit lane. The second lane's store covers the first one's 4 spare
+ * bytes, and writes 4 past the 24 bytes of two groups. */
+static inline __attribute__((always_inline, target("avx2,bmi2")))
+void pack_avx2_12(const unsigned char *in, size_t groups, unsigned char *out, const int bigwords) {
+    const __m256i swap = _mm256_setr_epi8(1,0,3,2,5,4,7,6,9,8,11,10,13,12,15,14,
+                                          1,0,3,2,5,4,7,6,9,8,11,10,13,12,15,14);
+    const __m256i gather = _mm256_setr_epi8(0,1,2,4,5,6,8,9,10,12,13,14,-1,-1,-1,-1,
+                                            0,1,2,4,5,6,8,9,10,12,13,14,-1,-1,-1,-1);
+    const __m256i mask = _mm256_set1_epi16(0x0FFF);
+    const __m256i join = _mm256_set1_epi32(0x10000001);
+    __m256i v;
+    size_t g;
+
+    for (g=0;g+2<=groups;g+=2) {
+        v = _mm256_loadu_si256((const __m256i *)in);
+        if (bigwords) v = _mm256_shuffle_epi8(v, swap);
+        v = _mm256_madd_epi16(_mm256_and_si256(v, mask), join);
+        v = _mm256_shuffle_epi8(v, gather);
+        _mm_storeu_si128((__m128i *)out, _mm256_castsi256_si128(v));
+        _mm_storeu_si128((__m128i *)(out+12), _mm256_extracti128_si256(v, 1));
+        in += 32;
+        out += 24;
+    }
+    if (g < groups) pack_pext16_group(in, out, 12, 1, 0, bigwords);
+}
+
+__attribute__((target("avx2,bmi2")))
+static void pack_avx2_12_le(const unsigned char *in, size_t groups, unsigned char *out) {
+    pack_avx2_12(in, groups, out, 0);
+}
+
+__attribute__((target("avx2,bmi2")))
+static void pack_avx2_12_be(const unsigned char *in, size_t groups, unsigned char *out) {
+    pack_avx2_12(in, groups, out, 1);
+}
+#endif
+
+/* Pick the packer for the width and kernel level */
+static pack_fn select_packer(int bps, int littleendian, int reverse, int bigwords) {
+    if ((bps == 16) && (littleendian == 1) && (reverse == 0) && (bigwords == 0)) return pack_copy16;
+#if defined(__x86_64__)
+    if (hbh_kernel_level() >= HBH_KERNEL_AVX2) {
+        if ((bps == 12) && (littleendian == 1) && (reverse == 0)) return (bigwords == 1) ? pack_avx2_12_be : pack_avx2_12_le;
+        if (bps <= 8) return pack_pext[bps][littleendian][reverse];
+        if (bps <= 16) return pack_pext16[bps-9][littleendian][reverse][bigwords];
+    }
+#endif
+    if (bps <= 8) return pack_shift[bps][littleendian][reverse];
+    return pack_wide[bps-9][littleendian][reverse][bigwords];
+}
+
+/* Pack the fewer than 8 symbols left at the end of the input into a 64 bit
+ * accumulator, writing out bytes as they fill. Bits that don't make up a
+ * whole byte, and bytes that don't make up a whole symbol, are dropped.
+ * Returns the number of bytes written.
+ */
+static size_t pack_tail(const unsigned char *in, size_t len, unsigned char *out,
+                        int bps, int littleendian, int reverse, int bigwords) {
+    const int size = symbol_size(bps);
+    uint64_t acc = 0;
+    uint32_t sym;
+    int nbits = 0;
+    size_t i;
+    size_t count = 0;
+
+    for (i=0;i+size<=len;i+=size) {
+        sym = load_symbol(in+i, size, bigwords) & (uint32_t)((1ULL << bps)-1);
+        if (littleendian==0) sym = reverse_symbol(sym, bps);
+        acc |= (uint64_t)sym << nbits;
+        for (nbits+=bps; nbits>=8; nbits-=8) {
+            out[count++] = (unsigned char)((reverse==1) ? reverse_bits_in_bytes(acc) : acc);
+            acc = acc >> 8;
+        }
+    }
+    return count;
+}
+
+/* The kernels read and write whole 64 bit words, so the last few groups
+ * of a caller's buffer are staged through a local buffer rather than
+ * touch memory past the end. Bytes short of a whole group carry over to
+ * the next update().
+ */
+
+int hbh_oddball_encode_init(hbh_oddball_encoder *e, int bps, int reverse, int littleendian) {
+    return hbh_oddball_encode_init_words(e, bps, reverse, littleendian, 0);
+}
+
+int hbh_oddball_encode_init_words(hbh_oddball_encoder *e, int bps, int reverse, int littleendian, int bigwords) {
+    if ((bps < 1) || (bps > 32)) return -1;
+    e->bps = bps;
+    e->reverse = reverse;
+    e->littleendian = littleendian;
+    e->bigwords = bigwords;
+    e->size = symbol_size(bps);
+    e->ncarry = 0;
+    e->kernel = select_unpacker(bps, reverse, littleendian, bigwords);
+    return 0;
+}
+
+size_t hbh_oddball_encode_bound(const hbh_oddball_encoder *e, size_t len) {
+    return 8*(size_t)e->size*((len + e->bps - 1)/e->bps);
+}
+
+size_t hbh_oddball_encode_update(hbh_oddball_encoder *e, const unsigned char *in, size_t len, unsigned char *out) {
+    unsigned char stage[80] = {0};  /* twice the longest load span */
+    unsigned char *outp = out;
+    size_t bps = (size_t)e->bps;
+    size_t span = load_span(e->bps);
+    size_t step = 8*(size_t)e->size;
+    size_t n;
+    size_t groups;
+
+    /* Complete the carried group first */
+    if (e->ncarry > 0) {
+        n = bps - e->ncarry;
+        if (n > len) n = len;
+        memcpy(e->carry + e->ncarry, in, n);
+        e->ncarry += (int)n;
+        in += n;
+        len -= n;
+        if (e->ncarry < e->bps) return 0;
+        memcpy(stage, e->carry, bps);
+        e->kernel(stage, 1, outp);
+        outp += step;
+        e->ncarry = 0;
+    }
+
+    /* Groups that have all their loads in the input */
+    if (len >= span) {
+        groups = (len - span)/bps + 1;
+        e->kernel(in, groups, outp);
+        in += groups*bps;
+        len -= groups*bps;
+        outp += step*groups;
+    }
+
+    /* That leaves less than a span */
+    groups = len/bps;
+    if (groups > 0) {
+        memcpy(stage, in, groups*bps);
+        e->kernel(stage, groups, outp);
+        in += groups*bps;
+        len -= groups*bps;
+        outp += step*groups;
+    }
+
+    memcpy(e->carry, in, len);
+    e->ncarry = (int)len;
+    return (size_t)(outp - out);
+}
+
+size_t hbh_oddball_encode_finish(hbh_oddball_encoder *e, unsigned char *out) {
+    size_t n = unpack_tail(e->carry, e->ncarry, out, e->bps, e->reverse, e->littleendian, e->bigwords);
+    e->ncarry = 0;
+    return n;
+}
+
+int hbh_oddball_decode_init(hbh_oddball_decoder *d, int bps, int reverse, int littleendian) {
+    return hbh_oddball_decode_init_words(d, bps, reverse, littleendian, 0);
+}
+
+int hbh_oddball_decode_init_words(hbh_oddball_decoder *d, int bps, int reverse, int littleendian, int bigwords) {
+    if ((bps < 1) || (bps > 32)) return -1;
+    d->bps = bps;
+    d->reverse = reverse;
+    d->littleendian = littleendian;
+    d->bigwords = bigwords;
+    d->size = symbol_size(bps);
+    d->ncarry = 0;
+    d->kernel = select_packer(bps, littleendian, reverse, bigwords);
+    return 0;
+}
+
+/* A group can store up to 7 bytes past its end, so there are 8 bytes of
+ * slack */
+size_t hbh_oddball_decode_bound(const hbh_oddball_decoder *d, size_t len) {
+    size_t step = 8*(size_t)d->size;
+
+    return d->bps*((len + step - 1)/step) + 8;
+}
+
+size_t hbh_oddball_decode_update(hbh_oddball_decoder *d, const unsigned char *in, size_t len, unsigned char *out) {
+    unsigned char *outp = out;
+    size_t bps = (size_t)d->bps;
+    size_t step = 8*(size_t)d->size;
+    size_t n;
+    size_t groups;
+
+    if (d->ncarry > 0) {
+        n = step - d->ncarry;
+        if (n > len) n = len;
+        memcpy(d->carry + d->ncarry, in, n);
+        d->ncarry += (int)n;
+        in += n;
+        len -= n;
+        if ((size_t)d->ncarry < step) return 0;
+        d->kernel(d->carry, 1, outp);
+        outp += bps;
+        d->ncarry = 0;
+    }
+
+    groups = len/step;
+    d->kernel(in, groups, outp);
+    in += groups*step;
+    len -= groups*step;
+    outp += bps*groups;
+
+    memcpy(d->carry, in, len);
+    d->ncarry = (int)len;
+    return (size_t)(outp - out);
+}
+
+size_t hbh_oddball_decode_finish(hbh_oddball_decoder *d, unsigned char *out) {
+    size_t n = pack_tail(d->carry, d->ncarry, out, d->bps, d->littleendian, d->reverse, d->bigwords);
+    d->ncarry = 0;
+    return n;
+}
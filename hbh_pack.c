@@ -0,0 +1,99 @@
+/*
+    hbh_pack.c - Packed oddball container for the hexbinhex tools.
+
+    Copyright (C) 2017  David Johnston
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    -----
+
+    Contact. David Johnston dj@deadhat.com
+*/
+
+#include <string.h>
+
+#include "hexbinhex.h"
+
+static const unsigned char magic[8] = { 'H', 'B', 'H', 'P', 'A', 'C', 'K', '1' };
+
+void hbh_pack_header(unsigned char *out, int bps, int reverse, int littleendian, int bigwords) {
+    memset(out, 0, HBH_PACK_HEADER);
+    memcpy(out, magic, sizeof(magic));
+    out[8] = (unsigned char)bps;
+    out[9] = (unsigned char)((reverse ? 1 : 0) | (littleendian ? 0 : 2) | (bigwords ? 4 : 0));
+}
+
+/* Returns 0 if in starts with a header, filling in what it records */
+int hbh_pack_parse(const unsigned char *in, size_t len, int *bps, int *reverse, int *littleendian, int *bigwords) {
+    int i;
+
+    if ((len < HBH_PACK_HEADER) || (memcmp(in, magic, sizeof(magic)) != 0)) return -1;
+    if ((in[8] < 1) || (in[8] > 32) || ((in[9] & ~7) != 0)) return -1;
+    for (i=10;i<HBH_PACK_HEADER;i++) if (in[i] != 0) return -1;
+    *bps = in[8];
+    *reverse = in[9] & 1;
+    *littleendian = !(in[9] & 2);
+    *bigwords = (in[9] & 4) ? 1 : 0;
+    return 0;
+}
+
+/* Trailing bits short of a symbol are not one */
+uint64_t hbh_pack_symbols(int bps, uint64_t payload) {
+    return 8*payload/(uint64_t)bps;
+}
+
+/* The group of 8 symbols that symbol is in starts on a byte */
+uint64_t hbh_pack_offset(int bps, uint64_t symbol) {
+    return (symbol/8)*(uint64_t)bps;
+}
+
+int hbh_pack_reader_init(hbh_pack_reader *r, const unsigned char *header, uint64_t first, uint64_t count) {
+    if (hbh_pack_parse(header, HBH_PACK_HEADER, &r->bps, &r->reverse, &r->littleendian, &r->bigwords) != 0) return -1;
+    if (hbh_oddball_encode_init_words(&r->unpack, r->bps, r->reverse, r->littleendian, r->bigwords) != 0) return -1;
+    r->skip = first % 8;
+    r->left = count;
+    return 0;
+}
+
+size_t hbh_pack_reader_bound(const hbh_pack_reader *r, size_t len) {
+    return hbh_oddball_encode_bound(&r->unpack, len);
+}
+
+/* Drop what comes before the first symbol and after the last. n is in
+ * bytes, which is symbols times the size of one. */
+static size_t trim(hbh_pack_reader *r, unsigned char *out, size_t n) {
+    size_t size = (size_t)r->unpack.size;
+    size_t drop = (r->skip < n/size) ? (size_t)r->skip : n/size;
+
+    n = n/size;
+    if (drop > 0) {
+        memmove(out, out + drop*size, (n - drop)*size);
+        n -= drop;
+        r->skip -= drop;
+    }
+    if (n > r->left) n = (size_t)r->left;
+    r->left -= n;
+    return n*size;
+}
+
+size_t hbh_pack_reader_update(hbh_pack_reader *r, const unsigned char *in, size_t len, unsigned char *out) {
+    if (r->left == 0) return 0;
+    return trim(r, out, hbh_oddball_encode_update(&r->unpack, in, len, out));
+}
+
+size_t hbh_pack_reader_finish(hbh_pack_reader *r, unsigned char *out) {
+    if (r->left == 0) return 0;
+    return trim(r, out, hbh_oddball_encode_finish(&r->unpack, out));
+}
@@ -0,0 +1,324 @@
+/*
+    hbh_range.c - Picking a range out of text input for the hexbinhex tools.
+
+    Copyright (C) 2017  David Johnston
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    -----
+
+    Contact. David Johnston dj@deadhat.com
+*/
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "hexbinhex.h"
+#include "hbh_io.h"
+#include "hbh_range.h"
+
+/* A place decoding can start from */
+typedef struct {
+    uint64_t text;          /* offset in the file */
+    uint64_t bin;           /* binary the text before it decodes to */
+    uint64_t state[2];      /* the decoder's state there */
+} checkpoint;
+
+/* The index of one file. Everything before points has to match the
+ * file and the options for a cached index to be used. */
+typedef struct {
+    int format;
+    int width;
+    int bigendian;
+    uint64_t size;
+    long long mtime;
+    long mtime_nsec;
+    uint64_t base;          /* where the text starts, after hex2bin -s */
+    uint64_t step;
+    checkpoint *points;
+    size_t count;
+    size_t alloc;
+} text_index;
+
+/* The decoder state is a few plain numbers whatever the format */
+static void save_state(const hbh_converter *c, uint64_t *state) {
+    state[0] = 0;
+    state[1] = 0;
+    switch (c->from.format) {
+        case HBH_HEX:
+            state[0] = (uint64_t)(int64_t)c->decoder.hex.pending;
+            break;
+        case HBH_BITS:
+            state[0] = c->decoder.bits.acc;
+            state[1] = (uint64_t)c->decoder.bits.nacc;
+            break;
+        case HBH_DEC:
+            state[0] = c->decoder.dec.value;
+            state[1] = (uint64_t)c->decoder.dec.innumber;
+            break;
+    }
+}
+
+static void restore_state(hbh_converter *c, const uint64_t *state) {
+    switch (c->from.format) {
+        case HBH_HEX:
+            c->decoder.hex.pending = (int)(int64_t)state[0];
+            break;
+        case HBH_BITS:
+            c->decoder.bits.acc = state[0];
+            c->decoder.bits.nacc = (int)state[1];
+            break;
+        case HBH_DEC:
+            c->decoder.dec.value = state[0];
+            c->decoder.dec.innumber = (int)state[1];
+            break;
+    }
+}
+
+static int add_point(text_index *idx, uint64_t text, uint64_t bin, const uint64_t *state) {
+    checkpoint *grown;
+
+    if (idx->count == idx->alloc) {
+        idx->alloc = (idx->alloc == 0) ? 256 : 2*idx->alloc;
+        grown = realloc(idx->points, idx->alloc*sizeof(checkpoint));
+        if (grown == NULL) return -1;
+        idx->points = grown;
+    }
+    idx->points[idx->count].text = text;
+    idx->points[idx->count].bin = bin;
+    idx->points[idx->count].state[0] = state[0];
+    idx->points[idx->count].state[1] = state[1];
+    idx->count++;
+    return 0;
+}
+
+/* Decode the whole mapping from the base on, a checkpoint per step */
+static int build_index(text_index *idx, const hbh_input *in, const hbh_format *from) {
+    hbh_format bin = { HBH_BIN };
+    hbh_converter conv;
+    unsigned char *out;
+    uint64_t state[2];
+    uint64_t text = idx->base;
+    uint64_t total = 0;
+    size_t n;
+
+    hbh_convert_init(&conv, from, &bin);
+    out = malloc(hbh_convert_bound(&conv, (size_t)idx->step));
+    if (out == NULL) return -1;
+    for (;;) {
+        save_state(&conv, state);
+        if (add_point(idx, text, total, state) != 0) {
+            free(out);
+            return -1;
+        }
+        if (text == in->maplen) break;
+        n = (in->maplen - text > idx->step) ? (size_t)idx->step : (size_t)(in->maplen - text);
+        total += hbh_convert_update(&conv, in->map + text, n, out);
+        text += n;
+    }
+    free(out);
+    return 0;
+}
+
+/* Returns 0 if name holds an index of the file idx describes */
+static int read_index(text_index *idx, const char *name) {
+    text_index got;
+    unsigned long long size;
+    unsigned long long base;
+    unsigned long long step;
+    unsigned long long v[4];
+    uint64_t state[2];
+    size_t count;
+    size_t i;
+    FILE *fp;
+    int ok;
+
+    fp = fopen(name, "r");
+    if (fp == NULL) return -1;
+    ok = (fscanf(fp, "hbh text index 1 format %d %d %d file %llu %lld %ld base %llu step %llu points %zu",
+                 &got.format, &got.width, &got.bigendian, &size, &got.mtime, &got.mtime_nsec,
+                 &base, &step, &count) == 9) &&
+         (got.format == idx->format) && (got.width == idx->width) && (got.bigendian == idx->bigendian) &&
+         (size == idx->size) && (got.mtime == idx->mtime) && (got.mtime_nsec == idx->mtime_nsec) &&
+         (base == idx->base) && (step > 0) && (count > 0);
+    for (i=0;ok && (i<count);i++) {
+        ok = (fscanf(fp, "%llu %llu %llu %llu", &v[0], &v[1], &v[2], &v[3]) == 4) && (v[0] <= size) &&
+             ((i == 0) ? (v[0] == base) && (v[1] == 0) : (v[0] > idx->points[i-1].text) && (v[1] >= idx->points[i-1].bin));
+        state[0] = v[2];
+        state[1] = v[3];
+        if (ok) ok = (add_point(idx, v[0], v[1], state) == 0);
+    }
+    fclose(fp);
+    if (!ok) {
+        free(idx->points);
+        idx->points = NULL;
+        idx->count = 0;
+        idx->alloc = 0;
+        return -1;
+    }
+    idx->step = step;
+    return 0;
+}
+
+/* Written to a temporary file next to name and renamed over it, so a
+ * reader never sees half an index */
+static int write_index(const text_index *idx, const char *name) {
+    char *tmp;
+    FILE *fp;
+    size_t i;
+    int fd;
+    int ok;
+
+    tmp = malloc(strlen(name) + 8);
+    if (tmp == NULL) return -1;
+    sprintf(tmp, "%s.XXXXXX", name);
+    fd = mkstemp(tmp);
+    if (fd < 0) {
+        free(tmp);
+        return -1;
+    }
+    fp = NULL;
+    if (fchmod(fd, 0644) == 0) fp = fdopen(fd, "w");
+    if (fp == NULL) {
+        close(fd);
+        unlink(tmp);
+        free(tmp);
+        return -1;
+    }
+    fprintf(fp, "hbh text index 1\nformat %d %d %d\nfile %llu %lld %ld\nbase %llu step %llu points %zu\n",
+            idx->format, idx->width, idx->bigendian, (unsigned long long)idx->size, idx->mtime, idx->mtime_nsec,
+            (unsigned long long)idx->base, (unsigned long long)idx->step, idx->count);
+    for (i=0;i<idx->count;i++) {
+        fprintf(fp, "%llu %llu %llu %llu\n", (unsigned long long)idx->points[i].text,
+                (unsigned long long)idx->points[i].bin, (unsigned long long)idx->points[i].state[0],
+                (unsigned long long)idx->points[i].state[1]);
+    }
+    ok = (fflush(fp) == 0) && (ferror(fp) == 0);
+    if (fclose(fp) != 0) ok = 0;
+    if (ok) ok = (rename(tmp, name) == 0);
+    if (!ok) unlink(tmp);
+    free(tmp);
+    return ok ? 0 : -1;
+}
+
+int hbh_range_open(hbh_range *r, hbh_input *in, const char *filename, const hbh_format *from,
+                   uint64_t first, uint64_t count, size_t step) {
+    hbh_format bin = { HBH_BIN };
+    text_index idx;
+    struct stat st;
+    const checkpoint *p;
+    char *name;
+    size_t lo;
+    size_t hi;
+    size_t mid;
+
+    if (((from->format != HBH_HEX) && (from->format != HBH_BITS) && (from->format != HBH_DEC)) ||
+        (hbh_convert_init(&r->conv, from, &bin) != 0) || (step == 0)) {
+        errno = EINVAL;
+        return -1;
+    }
+    r->skip = first;
+    r->left = count;
+    r->indexed = 0;
+    r->from = in->mapped ? in->pos : in->bytes_in;
+
+    /* Without a file to keep an index next to, or with nothing to skip,
+     * the text is decoded from where it is */
+    if (!in->mapped || (filename == NULL) || (filename[0] == 0) || (first == 0)) return 0;
+    if (fstat(in->fd, &st) != 0) return -1;
+
+    memset(&idx, 0, sizeof(idx));
+    idx.format = from->format;
+    idx.width = from->width;
+    idx.bigendian = from->bigendian;
+    idx.size = in->maplen;
+    idx.mtime = (long long)st.st_mtim.tv_sec;
+    idx.mtime_nsec = st.st_mtim.tv_nsec;
+    idx.base = in->pos;
+    idx.step = step;
+
+    name = malloc(strlen(filename) + 8);
+    if (name == NULL) return -1;
+    sprintf(name, "%s.hbhidx", filename);
+    if (read_index(&idx, name) == 0) {
+        r->indexed = 1;
+    } else {
+        if (build_index(&idx, in, from) != 0) {
+            free(name);
+            free(idx.points);
+            return -1;
+        }
+        /* The index is only a cache, so not being able to keep it is fine */
+        write_index(&idx, name);
+        r->indexed = 2;
+    }
+    free(name);
+
+    /* The last checkpoint at or before the first byte wanted */
+    lo = 0;
+    hi = idx.count;
+    while (hi - lo > 1) {
+        mid = lo + (hi - lo)/2;
+        if (idx.points[mid].bin <= first) lo = mid;
+        else hi = mid;
+    }
+    p = &idx.points[lo];
+    restore_state(&r->conv, p->state);
+    hbh_input_skip(in, p->text - in->pos);
+    r->skip = first - p->bin;
+    r->from = p->text;
+    free(idx.points);
+    return 0;
+}
+
+size_t hbh_range_bound(const hbh_range *r, size_t len) {
+    return hbh_convert_bound(&r->conv, len);
+}
+
+/* Drop what comes before the first byte and after the last */
+static size_t trim(hbh_range *r, unsigned char *out, size_t n) {
+    size_t drop = (r->skip < n) ? (size_t)r->skip : n;
+
+    if (drop > 0) {
+        memmove(out, out + drop, n - drop);
+        n -= drop;
+        r->skip -= drop;
+    }
+    if (n > r->left) n = (size_t)r->left;
+    r->left -= n;
+    return n;
+}
+
+size_t hbh_range_update(hbh_range *r, const unsigned char *in, size_t len, unsigned char *out) {
+    if (r->left == 0) return 0;
+    return trim(r, out, hbh_convert_update(&r->conv, in, len, out));
+}
+
+size_t hbh_range_finish(hbh_range *r, unsigned char *out) {
+    if (r->left == 0) return 0;
+    return trim(r, out, hbh_convert_finish(&r->conv, out));
+}
+
+void hbh_range_report(const char *tool, const hbh_range *r) {
+    static const char *how[] = { "no index", "index read from the cache", "index built and cached" };
+
+    fprintf(stderr,"%s: decoding from text offset %llu (%s), dropping %llu bytes before the range\n",
+            tool, (unsigned long long)r->from, how[r->indexed], (unsigned long long)r->skip);
+}
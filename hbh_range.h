@@ -0,0 +1,74 @@
+/*
+    hbh_range.h - Picking a range out of text input for the hexbinhex tools.
+
+    Copyright (C) 2017  David Johnston
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    -----
+
+    Contact. David Johnston dj@deadhat.com
+*/
+
+/*
+ * --offset and --length on text input. Binary and oddball input take a
+ * fixed number of bytes per unit, so the tools skip straight to the
+ * first one wanted. Hex, ASCII binary and decimal don't: where a byte of
+ * the binary comes from depends on all the text before it.
+ *
+ * So the first ranged read of a text file decodes the whole of it once,
+ * noting at every step of text how much binary it has decoded to and the
+ * state the decoder is in there, and keeps the notes in <file>.hbhidx.
+ * Later reads of the file, as long as its size and time are unchanged,
+ * start decoding from the last checkpoint before the range and throw
+ * away at most a step's worth of binary. Input that isn't a named file
+ * is decoded from the start, throwing away everything before the range.
+ */
+
+#ifndef HBH_RANGE_H
+#define HBH_RANGE_H
+
+#include <stdint.h>
+
+#include "hexbinhex.h"
+#include "hbh_io.h"
+
+/* Text between checkpoints */
+#define HBH_RANGE_STEP (1024*1024)
+
+typedef struct {
+    hbh_converter conv;     /* text to binary */
+    uint64_t skip;          /* binary still to drop before the range */
+    uint64_t left;          /* binary still to give */
+    int indexed;            /* 0 none, 1 read from the cache, 2 built */
+    uint64_t from;          /* text offset decoding started from */
+} hbh_range;
+
+/* Set r up to decode count bytes (UINT64_MAX for all) of the binary that
+ * the text in in decodes to, from byte first on. in is positioned at the
+ * checkpoint to read from. filename is the input's name, or NULL if it
+ * is stdin. step is the text between checkpoints in a new index.
+ * Returns 0, or -1 with errno set. */
+int    hbh_range_open(hbh_range *r, hbh_input *in, const char *filename, const hbh_format *from,
+                      uint64_t first, uint64_t count, size_t step);
+size_t hbh_range_bound(const hbh_range *r, size_t len);
+size_t hbh_range_update(hbh_range *r, const unsigned char *in, size_t len, unsigned char *out);
+size_t hbh_range_finish(hbh_range *r, unsigned char *out);
+
+/* Write "<tool>: decoding from ..." with where decoding started and
+ * where the checkpoint came from to stderr */
+void   hbh_range_report(const char *tool, const hbh_range *r);
+
+#endif
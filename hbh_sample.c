@@ -0,0 +1,344 @@
+/*
+    hbh_sample.c - Bit selection and decimation around the oddball encoder.
+
+    Copyright (C) 2017  David Johnston
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    -----
+
+    Contact. David Johnston dj@deadhat.com
+*/
+
+#include <string.h>
+
+#include "hexbinhex.h"
+#include "hbh_internal.h"
+
+typedef void (*select_fn)(const hbh_sampler *s, const unsigned char *in, size_t groups, unsigned char *out);
+
+/* Every group of 8 input bytes keeps keep bytes of bits. The first byte's
+ * bits are lowest in acc, or highest when msb first, and go out in the
+ * order they are read. 8 bytes are stored whatever keep is. */
+static inline void store_kept(unsigned char *out, uint64_t acc, int keep, int msbfirst) {
+    if (msbfirst) acc = __builtin_bswap64(acc << (64 - 8*keep));
+    memcpy(out, &acc, 8);
+}
+
+static void select_lut(const hbh_sampler *s, const unsigned char *in, size_t groups, unsigned char *out) {
+    const int keep = s->keep;
+    uint64_t acc;
+    size_t g;
+    int i;
+
+    for (g=0;g<groups;g++) {
+        acc = 0;
+        if (s->msbfirst) {
+            for (i=0;i<8;i++) acc = (acc << keep) | s->compress[in[i]];
+        } else {
+            for (i=0;i<8;i++) acc |= (uint64_t)s->compress[in[i]] << (keep*i);
+        }
+        store_kept(out, acc, keep, s->msbfirst);
+        in += 8;
+        out += keep;
+    }
+}
+
+#ifdef HBH_X86
+
+/* pext with the mask in every byte does a whole group at once. Msb first
+ * the word is byte swapped so the first byte's bits come out on top. */
+__attribute__((target("bmi2")))
+static void select_pext(const hbh_sampler *s, const unsigned char *in, size_t groups, unsigned char *out) {
+    uint64_t acc;
+    size_t g;
+
+    for (g=0;g<groups;g++) {
+        if (s->msbfirst) acc = _pext_u64(__builtin_bswap64(load64(in)), s->mask);
+        else acc = _pext_u64(load64(in), s->mask);
+        store_kept(out, acc, s->keep, s->msbfirst);
+        in += 8;
+        out += s->keep;
+    }
+}
+
+/* With one bit kept, --lsb among them, shifting it up to each byte's sign
+ * bit lets pmovmskb gather a byte of output from every 8 bytes of input.
+ * Msb first the bytes of each group are reversed first, so the first
+ * byte's bit ends up on top. */
+__attribute__((target("ssse3")))
+static void select_bit_ssse3(const hbh_sampler *s, const unsigned char *in, size_t groups, unsigned char *out) {
+    const __m128i flip = _mm_setr_epi8(7,6,5,4,3,2,1,0,15,14,13,12,11,10,9,8);
+    const __m128i shift = _mm_cvtsi32_si128(7 - __builtin_ctzll(s->mask));
+    __m128i v;
+    uint16_t m;
+    size_t g;
+
+    for (g=0;g+2<=groups;g+=2) {
+        v = _mm_loadu_si128((const __m128i *)in);
+        if (s->msbfirst) v = _mm_shuffle_epi8(v, flip);
+        m = (uint16_t)_mm_movemask_epi8(_mm_sll_epi16(v, shift));
+        memcpy(out, &m, 2);
+        in += 16;
+        out += 2;
+    }
+    select_lut(s, in, groups - g, out);
+}
+
+__attribute__((target("avx2,bmi2")))
+static void select_bit_avx2(const hbh_sampler *s, const unsigned char *in, size_t groups, unsigned char *out) {
+    const __m256i flip = _mm256_setr_epi8(7,6,5,4,3,2,1,0,15,14,13,12,11,10,9,8,
+                                          7,6,5,4,3,2,1,0,15,14,13,12,11,10,9,8);
+    const __m128i shift = _mm_cvtsi32_si128(7 - __builtin_ctzll(s->mask));
+    __m256i v;
+    uint32_t m;
+    size_t g;
+
+    for (g=0;g+4<=groups;g+=4) {
+        v = _mm256_loadu_si256((const __m256i *)in);
+        if (s->msbfirst) v = _mm256_shuffle_epi8(v, flip);
+        m = (uint32_t)_mm256_movemask_epi8(_mm256_sll_epi16(v, shift));
+        memcpy(out, &m, 4);
+        in += 32;
+        out += 4;
+    }
+    select_pext(s, in, groups - g, out);
+}
+
+/* AVX-512 tests the bit where it is, straight into a mask register */
+__attribute__((target("avx512f,avx512bw,avx2,bmi2")))
+static void select_bit_avx512(const hbh_sampler *s, const unsigned char *in, size_t groups, unsigned char *out) {
+    const __m512i flip = _mm512_broadcast_i32x4(_mm_setr_epi8(7,6,5,4,3,2,1,0,15,14,13,12,11,10,9,8));
+    const __m512i bit = _mm512_set1_epi64((long long)s->mask);
+    __m512i v;
+    uint64_t m;
+    size_t g;
+
+    for (g=0;g+8<=groups;g+=8) {
+        v = _mm512_loadu_si512((const void *)in);
+        if (s->msbfirst) v = _mm512_shuffle_epi8(v, flip);
+        m = (uint64_t)_mm512_test_epi8_mask(v, bit);
+        memcpy(out, &m, 8);
+        in += 64;
+        out += 8;
+    }
+    select_bit_avx2(s, in, groups - g, out);
+}
+
+/* Decimation of symbols already in the buffer, in place. The kept symbols
+ * of 16 bytes are gathered to the front with pshufb. The store is never
+ * ahead of the load, so it only covers bytes already read. */
+__attribute__((target("ssse3")))
+static void decimate_ssse3(const hbh_sampler *s, unsigned char *buf, size_t len, size_t *from, size_t *to) {
+    const __m128i spread = _mm_loadu_si128((const __m128i *)s->spread);
+    const size_t size = (size_t)s->size;
+    const size_t step = 16/size;
+    const size_t kept = step/(size_t)s->stride;
+    size_t i = *from;
+    size_t j = *to;
+
+    for (;i*size+16<=len;i+=step) {
+        _mm_storeu_si128((__m128i *)(buf + j*size), _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(buf + i*size)), spread));
+        j += kept;
+    }
+    *from = i;
+    *to = j;
+}
+#endif
+
+static select_fn select_selector(const hbh_sampler *s) {
+#ifdef HBH_X86
+    if (s->keep == 1) {
+        switch (hbh_kernel_level()) {
+            case HBH_KERNEL_AVX512: return select_bit_avx512;
+            case HBH_KERNEL_AVX2:   return select_bit_avx2;
+            case HBH_KERNEL_SSE4:   return select_bit_ssse3;
+        }
+    }
+    if (hbh_kernel_level() >= HBH_KERNEL_AVX2) return select_pext;
+#endif
+    return select_lut;
+}
+
+static inline __attribute__((always_inline))
+size_t decimate_scalar(unsigned char *buf, size_t i, size_t count, size_t stride, size_t *to, const size_t size) {
+    unsigned char sym[4];
+    size_t j = *to;
+
+    for (;i<count;i+=stride) {
+        memcpy(sym, buf + i*size, size);
+        memcpy(buf + j*size, sym, size);
+        j++;
+    }
+    *to = j;
+    return i;
+}
+
+/* Keep every stride-th of the symbols in buf, carrying the place in the
+ * stride over to the next call. Returns the bytes kept. */
+static size_t decimate(hbh_sampler *s, unsigned char *buf, size_t len) {
+    const size_t count = len/(size_t)s->size;
+    const size_t stride = (size_t)s->stride;
+    size_t i = (size_t)s->phase;
+    size_t j = 0;
+
+    if (stride == 1) return len;
+#ifdef HBH_X86
+    if (s->spread[1] != 0) decimate_ssse3(s, buf, len, &i, &j);
+#endif
+    switch (s->size) {
+        case 1:  i = decimate_scalar(buf, i, count, stride, &j, 1); break;
+        case 2:  i = decimate_scalar(buf, i, count, stride, &j, 2); break;
+        default: i = decimate_scalar(buf, i, count, stride, &j, 4); break;
+    }
+    s->phase = i - count;
+    return j*(size_t)s->size;
+}
+
+int hbh_sample_init(hbh_sampler *s, int bps, int reverse, int littleendian, int bigwords, int mask, int stride) {
+    int order[8];
+    int n = 0;
+    int i;
+    int b;
+    int k;
+
+    if ((mask < 1) || (mask > 255) || (stride < 1)) return -1;
+    if (hbh_oddball_encode_init_words(&s->oddball, bps, reverse, littleendian, bigwords) != 0) return -1;
+
+    /* The kept bits in the order they are read. With 1 bit symbols a
+     * stride that divides them keeps the same bits of every byte. */
+    for (i=0;i<8;i++) {
+        b = (reverse==1) ? 7-i : i;
+        if (mask & (1 << b)) order[n++] = b;
+    }
+    if ((bps == 1) && (stride > 1) && (n % stride == 0)) {
+        mask = 0;
+        for (i=0;i<n;i+=stride) mask |= 1 << order[i];
+        n /= stride;
+        stride = 1;
+    }
+
+    s->mask = (uint64_t)mask * 0x0101010101010101ULL;
+    s->keep = n;
+    s->msbfirst = reverse;
+    s->stride = stride;
+    s->size = s->oddball.size;
+    s->phase = 0;
+    s->bits = 0;
+    s->symbols = 0;
+    s->ncarry = 0;
+    for (i=0;i<256;i++) {
+        s->compress[i] = 0;
+        for (b=0,k=0;b<8;b++) {
+            if (mask & (1 << b)) s->compress[i] |= ((i >> b) & 1) << k++;
+        }
+    }
+
+    /* pshufb can decimate when a whole number of strides fit in 16 bytes */
+    memset(s->spread, 0, sizeof(s->spread));
+#ifdef HBH_X86
+    if ((hbh_kernel_level() >= HBH_KERNEL_SSE4) && (stride > 1) && (16 % (s->size*stride) == 0)) {
+        memset(s->spread, 0x80, sizeof(s->spread));
+        for (i=0;i<16/(s->size*stride);i++) {
+            for (b=0;b<s->size;b++) s->spread[i*s->size + b] = (unsigned char)(i*stride*s->size + b);
+        }
+    }
+#endif
+    s->select = select_selector(s);
+    return 0;
+}
+
+size_t hbh_sample_bound(const hbh_sampler *s, size_t len) {
+    return hbh_oddball_encode_bound(&s->oddball, ((len + 7)/8)*(size_t)s->keep);
+}
+
+/* Kept bits of whole groups into the stage, with the carry completed first */
+static size_t select_bits(hbh_sampler *s, const unsigned char *in, size_t len) {
+    size_t n = 0;
+    size_t take;
+    size_t groups;
+
+    if (s->ncarry > 0) {
+        take = 8 - (size_t)s->ncarry;
+        if (take > len) take = len;
+        memcpy(s->carry + s->ncarry, in, take);
+        s->ncarry += (int)take;
+        in += take;
+        len -= take;
+        if (s->ncarry < 8) return 0;
+        s->select(s, s->carry, 1, s->stage);
+        n = (size_t)s->keep;
+        s->ncarry = 0;
+    }
+    groups = len/8;
+    s->select(s, in, groups, s->stage + n);
+    n += groups*(size_t)s->keep;
+    memcpy(s->carry, in + 8*groups, len - 8*groups);
+    s->ncarry = (int)(len - 8*groups);
+    return n;
+}
+
+size_t hbh_sample_update(hbh_sampler *s, const unsigned char *in, size_t len, unsigned char *out) {
+    size_t most;
+    size_t piece;
+    size_t total = 0;
+    size_t n;
+
+    /* The stage takes a piece's kept bits and a group carried in */
+    if (s->keep < 8) most = 8*(HBH_SAMPLE_PIECE/(size_t)s->keep - 1);
+    else if (s->stride > 1) most = HBH_SAMPLE_PIECE;
+    else most = len;
+
+    while (len > 0) {
+        piece = (len > most) ? most : len;
+        if (s->keep < 8) {
+            n = select_bits(s, in, piece);
+            s->bits += 8*(uint64_t)n;
+            n = hbh_oddball_encode_update(&s->oddball, s->stage, n, out + total);
+        } else {
+            s->bits += 8*(uint64_t)piece;
+            n = hbh_oddball_encode_update(&s->oddball, in, piece, out + total);
+        }
+        s->symbols += n/(size_t)s->size;
+        total += decimate(s, out + total, n);
+        in += piece;
+        len -= piece;
+    }
+    return total;
+}
+
+/* The bytes carried over are padded with zeros to a group, and so are the
+ * bits they keep to a byte. Symbols the padding made are taken off again. */
+size_t hbh_sample_finish(hbh_sampler *s, unsigned char *out) {
+    unsigned char last[16];
+    uint64_t want;
+    size_t n = 0;
+
+    if (s->ncarry > 0) {
+        memset(s->carry + s->ncarry, 0, 8 - (size_t)s->ncarry);
+        select_lut(s, s->carry, 1, last);
+        s->bits += (uint64_t)s->ncarry*(uint64_t)s->keep;
+        n = hbh_oddball_encode_update(&s->oddball, last, ((size_t)s->ncarry*(size_t)s->keep + 7)/8, out);
+        s->ncarry = 0;
+    }
+    n += hbh_oddball_encode_finish(&s->oddball, out + n);
+    s->symbols += n/(size_t)s->size;
+    want = s->bits/(uint64_t)s->oddball.bps;
+    if (s->symbols > want) {
+        n -= (size_t)(s->symbols - want)*(size_t)s->size;
+        s->symbols = want;
+    }
+    return decimate(s, out, n);
+}
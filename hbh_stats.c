@@ -0,0 +1,447 @@
+/*
+    hbh_stats.c - Symbol statistics for NIST one-symbol-per-byte data.
+
+    Copyright (C) 2017  David Johnston
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    -----
+
+    Contact. David Johnston dj@deadhat.com
+*/
+
+#include <math.h>
+#include <string.h>
+
+#include "hexbinhex.h"
+#include "hbh_internal.h"
+
+/* Partial counts are folded into the totals before they can overflow */
+#define FOLD_LIMIT (1UL << 30)
+
+/* Histogram of any symbols into four 32 bit tables in turn, so runs of
+ * the same symbol don't wait on each other's increments. */
+static void count_scalar(hbh_stats *s, const unsigned char *in, size_t len) {
+    size_t i;
+
+    for (i=0;i+4<=len;i+=4) {
+        s->partial[0][in[i]]++;
+        s->partial[1][in[i+1]]++;
+        s->partial[2][in[i+2]]++;
+        s->partial[3][in[i+3]]++;
+    }
+    for (;i<len;i++) s->partial[0][in[i]]++;
+}
+
+/* Runs and changes one symbol at a time, without branching on the data.
+ * The state is kept in locals because the symbols could alias it. */
+static void runs_scalar(hbh_stats *s, const unsigned char *in, size_t len) {
+    uint64_t run = s->run;
+    uint64_t longest = s->longest_run;
+    uint64_t changes = 0;
+    unsigned int last;
+    unsigned int eq;
+    size_t i = 0;
+
+    if (len == 0) return;
+    if (s->last < 0) {
+        run = 1;
+        last = in[0];
+        i = 1;
+    } else {
+        last = (unsigned int)s->last;
+    }
+    for (;i<len;i++) {
+        eq = (in[i] == last);
+        run = eq ? run + 1 : 1;
+        if (run > longest) longest = run;
+        changes += eq ^ 1;
+        last = in[i];
+    }
+    s->run = run;
+    s->longest_run = longest;
+    s->transitions += changes;
+    s->last = (int)last;
+}
+
+/* Does z hold a run of at least n one bits? Each step doubles the run
+ * length every remaining bit stands for. */
+static inline int has_ones_run(uint64_t z, uint64_t n) {
+    uint64_t have = 1;
+
+    while (have*2 <= n) {
+        z &= z >> have;
+        have *= 2;
+    }
+    if (have < n) z &= z >> (n - have);
+    return z != 0;
+}
+
+/* Low bit of each lane, for lanes of 1, 2, 4, 8, 16 and 32 bits */
+static const uint64_t lane_low[6] = {
+    0xFFFFFFFFFFFFFFFFULL, 0x5555555555555555ULL, 0x1111111111111111ULL,
+    0x0101010101010101ULL, 0x0001000100010001ULL, 0x0000000100000001ULL
+};
+
+/* The run state while a kernel has it in registers */
+typedef struct {
+    uint64_t run;
+    uint64_t longest;
+    uint64_t changes;
+    uint64_t low;               /* lanes a longer run would have to fill */
+    uint64_t high;
+} run_state;
+
+/* A stretch of n unchanged symbols has to fill a whole aligned lane of k
+ * bits of the change mask for any 2k-1 <= n. Pick the widest such lane
+ * for the longest run so far. Past 63 no run inside a word can beat it. */
+static inline void runs_lanes(run_state *r) {
+    int j = 0;
+
+    if (r->longest >= 64) {
+        r->low = r->high = 0;
+        return;
+    }
+    if (r->longest >= 3) j = 31 - __builtin_clz((unsigned int)(r->longest + 1) >> 1);
+    r->low = lane_low[j];
+    r->high = lane_low[j] << ((1 << j) - 1);
+}
+
+/* The slow path of runs_word(), for a word the lane test says may hold
+ * a new longest run between its first and last changes. Returns the
+ * longest run after the word. It works on values so the run state of
+ * the caller can stay in registers. */
+static uint64_t runs_inside(uint64_t c, int first, int last, uint64_t longest) {
+    uint64_t z;
+    uint64_t k;
+
+    if (last - first < 2) return longest;
+    z = ~c & ((1ULL << last) - 1) & ~((2ULL << first) - 1);
+    if (!has_ones_run(z, longest)) return longest;
+    for (k=0;z!=0;k++) z &= z >> 1;
+    return k + 1;
+}
+
+/* Fold 64 symbols into the run state. Bit i of c is set where symbol i
+ * differs from the one before it. A run is the distance from one change
+ * to the next: the one in progress gains the symbols up to the first
+ * change, and a new longest run between the first and last changes
+ * needs a clear lane in c. Finding one is the usual has-zero-byte test
+ * generalised to any lane width. */
+static inline __attribute__((always_inline)) void runs_word(run_state *r, uint64_t c) {
+    int first;
+    int last;
+
+    if (c == 0) {
+        r->run += 64;
+        return;
+    }
+    r->changes += (uint64_t)__builtin_popcountll(c);
+    first = __builtin_ctzll(c);
+    last = 63 - __builtin_clzll(c);
+
+    r->run += (uint64_t)first;
+    if (r->run > r->longest) {
+        r->longest = r->run;
+        runs_lanes(r);
+    }
+    if (((c - r->low) & ~c & r->high) != 0) {
+        r->longest = runs_inside(c, first, last, r->longest);
+        runs_lanes(r);
+    }
+    r->run = (uint64_t)(64 - last);
+}
+
+static inline void runs_load(const hbh_stats *s, run_state *r) {
+    r->run = s->run;
+    r->longest = s->longest_run;
+    r->changes = 0;
+    runs_lanes(r);
+}
+
+static inline void runs_store(hbh_stats *s, const run_state *r) {
+    s->run = r->run;
+    s->longest_run = r->longest;
+    s->transitions += r->changes;
+}
+
+/* Packed 1 bit symbols, a word at a time: the bits are the symbols in
+ * order once msb first bytes are reversed, so counting is a popcount and
+ * the change mask is each bit against the one before it. The tail is
+ * unpacked to a symbol per byte. */
+static inline __attribute__((always_inline))
+void bits_body(hbh_stats *s, const unsigned char *in, size_t len, int msbfirst) {
+    unsigned char sym[64];
+    uint64_t w;
+    uint64_t prev;
+    uint64_t ones = 0;
+    run_state r;
+    size_t i;
+    size_t j;
+
+    /* the first symbol of all continues a run of none */
+    if (s->last < 0) prev = msbfirst ? in[0] >> 7 : in[0] & 1;
+    else prev = (uint64_t)s->last;
+    runs_load(s, &r);
+    for (i=0;i+8<=len;i+=8) {
+        w = load64(in+i);
+        if (msbfirst) w = reverse_bits_in_bytes(w);
+        ones += (uint64_t)__builtin_popcountll(w);
+        runs_word(&r, w ^ ((w << 1) | prev));
+        prev = w >> 63;
+    }
+    runs_store(s, &r);
+    s->last = (int)prev;
+    s->count[1] += ones;
+    s->count[0] += (uint64_t)(i*8) - ones;
+    for (j=0;j<(len-i)*8;j++) sym[j] = msbfirst ? (in[i+j/8] >> (7 - j%8)) & 1 : (in[i+j/8] >> (j%8)) & 1;
+    count_scalar(s, sym, (len-i)*8);
+    runs_scalar(s, sym, (len-i)*8);
+}
+
+static void bits_scalar(hbh_stats *s, const unsigned char *in, size_t len, int msbfirst) {
+    bits_body(s, in, len, msbfirst);
+}
+
+#ifdef HBH_X86
+
+__attribute__((target("popcnt")))
+static void bits_popcnt(hbh_stats *s, const unsigned char *in, size_t len, int msbfirst) {
+    bits_body(s, in, len, msbfirst);
+}
+
+/* Compare every symbol with the one before by loading the block twice,
+ * one byte apart. The first symbol goes through the scalar code so there
+ * is always a symbol before. */
+__attribute__((target("avx2,popcnt,bmi")))
+static void runs_avx2(hbh_stats *s, const unsigned char *in, size_t len) {
+    __m256i a, b;
+    uint64_t eq;
+    run_state r;
+    size_t i = 1;
+
+    if (len == 0) return;
+    runs_scalar(s, in, 1);
+    runs_load(s, &r);
+    for (;i+64<=len;i+=64) {
+        a = _mm256_loadu_si256((const __m256i *)(in+i));
+        b = _mm256_loadu_si256((const __m256i *)(in+i-1));
+        eq = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b));
+        a = _mm256_loadu_si256((const __m256i *)(in+i+32));
+        b = _mm256_loadu_si256((const __m256i *)(in+i+31));
+        eq |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b)) << 32;
+        runs_word(&r, ~eq);
+    }
+    runs_store(s, &r);
+    s->last = in[i-1];
+    runs_scalar(s, in+i, len-i);
+}
+
+/* For up to 16 symbol values, count each value with a compare per vector,
+ * four values a pass. The byte counters are summed with psadbw before
+ * they can wrap. */
+__attribute__((target("avx2")))
+static void count_small_avx2(hbh_stats *s, const unsigned char *in, size_t len) {
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i x, v0, v1, v2, v3;
+    __m256i a0, a1, a2, a3;
+    __m256i t0, t1, t2, t3;
+    uint64_t t[4];
+    size_t i, end;
+    int nsym = 1 << s->bps;
+    int v, j;
+
+    for (v=0;v<nsym;v+=4) {
+        v0 = _mm256_set1_epi8((char)v);
+        v1 = _mm256_set1_epi8((char)(v+1));
+        v2 = _mm256_set1_epi8((char)(v+2));
+        v3 = _mm256_set1_epi8((char)(v+3));
+        t0 = t1 = t2 = t3 = zero;
+        i = 0;
+        while (i+32 <= len) {
+            end = ((len - i)/32 > 255) ? i + 255*32 : len - 31;
+            a0 = a1 = a2 = a3 = zero;
+            for (;i<end;i+=32) {
+                x = _mm256_loadu_si256((const __m256i *)(in+i));
+                a0 = _mm256_sub_epi8(a0, _mm256_cmpeq_epi8(x, v0));
+                a1 = _mm256_sub_epi8(a1, _mm256_cmpeq_epi8(x, v1));
+                a2 = _mm256_sub_epi8(a2, _mm256_cmpeq_epi8(x, v2));
+                a3 = _mm256_sub_epi8(a3, _mm256_cmpeq_epi8(x, v3));
+            }
+            t0 = _mm256_add_epi64(t0, _mm256_sad_epu8(a0, zero));
+            t1 = _mm256_add_epi64(t1, _mm256_sad_epu8(a1, zero));
+            t2 = _mm256_add_epi64(t2, _mm256_sad_epu8(a2, zero));
+            t3 = _mm256_add_epi64(t3, _mm256_sad_epu8(a3, zero));
+        }
+        /* sum the four 64 bit lanes of each total */
+        x = _mm256_add_epi64(_mm256_unpacklo_epi64(t0, t1), _mm256_unpackhi_epi64(t0, t1));
+        _mm_storeu_si128((__m128i *)t, _mm_add_epi64(_mm256_castsi256_si128(x), _mm256_extracti128_si256(x, 1)));
+        x = _mm256_add_epi64(_mm256_unpacklo_epi64(t2, t3), _mm256_unpackhi_epi64(t2, t3));
+        _mm_storeu_si128((__m128i *)(t+2), _mm_add_epi64(_mm256_castsi256_si128(x), _mm256_extracti128_si256(x, 1)));
+        for (j=0;(j<4) && (v+j<nsym);j++) s->count[v+j] += t[j];
+    }
+    count_scalar(s, in + (len & ~(size_t)31), len & 31);
+}
+
+/* Runs, and for nsym up to 4 counts too, in one pass. A compare gives a
+ * 64 bit mask directly, so each symbol value is counted with a compare
+ * and a popcount, and the last value is what the others leave. nsym is a
+ * constant in each caller so the compares unroll into registers. With
+ * nsym 0 the caller counts. */
+__attribute__((target("avx512f,avx512bw,avx2,popcnt,bmi"), always_inline))
+static inline void stats_avx512_n(hbh_stats *s, const unsigned char *in, size_t len, int nsym) {
+    __m512i a, b;
+    uint64_t count[4];
+    uint64_t rest;
+    run_state r;
+    int v;
+    size_t i = 1;
+
+    memset(count, 0, sizeof(count));
+    runs_scalar(s, in, 1);
+    runs_load(s, &r);
+    for (;i+64<=len;i+=64) {
+        a = _mm512_loadu_si512((const void *)(in+i));
+        b = _mm512_loadu_si512((const void *)(in+i-1));
+        runs_word(&r, _mm512_cmpneq_epi8_mask(a, b));
+        for (v=0;v<nsym-1;v++) {
+            count[v] += (uint64_t)__builtin_popcountll(_mm512_cmpeq_epi8_mask(a, _mm512_set1_epi8((char)v)));
+        }
+    }
+    runs_store(s, &r);
+    s->last = in[i-1];
+    runs_scalar(s, in+i, len-i);
+    if (nsym > 0) {
+        rest = i - 1;
+        for (v=0;v<nsym-1;v++) {
+            s->count[v] += count[v];
+            rest -= count[v];
+        }
+        s->count[nsym-1] += rest;
+        count_scalar(s, in, 1);
+        count_scalar(s, in+i, len-i);
+    }
+}
+
+/* Up to 4 symbol values are counted in the same pass as the runs. For
+ * more the separate count of count_small_avx2() is quicker than 16 masks
+ * a word. */
+__attribute__((target("avx512f,avx512bw,avx2,popcnt,bmi")))
+static void stats_avx512(hbh_stats *s, const unsigned char *in, size_t len) {
+    if (len == 0) return;
+    if (s->bps == 1) {
+        stats_avx512_n(s, in, len, 2);
+    } else if (s->bps == 2) {
+        stats_avx512_n(s, in, len, 4);
+    } else {
+        if (s->bps <= 4) count_small_avx2(s, in, len);
+        else count_scalar(s, in, len);
+        stats_avx512_n(s, in, len, 0);
+    }
+}
+#endif
+
+static void fold(hbh_stats *s) {
+    int i;
+    int j;
+
+    for (i=0;i<4;i++) {
+        for (j=0;j<256;j++) s->count[j] += s->partial[i][j];
+    }
+    memset(s->partial, 0, sizeof(s->partial));
+    s->unfolded = 0;
+}
+
+int hbh_stats_init(hbh_stats *s, int bps) {
+    if ((bps < 1) || (bps > 8)) return -1;
+    memset(s, 0, sizeof(*s));
+    s->bps = bps;
+    s->last = -1;
+    s->kernel = HBH_KERNEL_SCALAR;
+#ifdef HBH_X86
+    s->kernel = hbh_kernel_level();
+#endif
+    return 0;
+}
+
+void hbh_stats_update(hbh_stats *s, const unsigned char *in, size_t len) {
+    size_t n;
+
+    s->symbols += len;
+    while (len > 0) {
+        n = (len > FOLD_LIMIT) ? FOLD_LIMIT : len;
+#ifdef HBH_X86
+        if (s->kernel >= HBH_KERNEL_AVX512) {
+            stats_avx512(s, in, n);
+        } else if (s->kernel == HBH_KERNEL_AVX2) {
+            if (s->bps <= 4) count_small_avx2(s, in, n);
+            else count_scalar(s, in, n);
+            runs_avx2(s, in, n);
+        } else
+#endif
+        {
+            count_scalar(s, in, n);
+            runs_scalar(s, in, n);
+        }
+        s->unfolded += n;
+        if (s->unfolded >= FOLD_LIMIT) fold(s);
+        in += n;
+        len -= n;
+    }
+}
+
+void hbh_stats_update_bits(hbh_stats *s, const unsigned char *in, size_t len, int msbfirst) {
+    size_t n;
+
+    s->symbols += (uint64_t)len*8;
+    while (len > 0) {
+        n = (len > FOLD_LIMIT/8) ? FOLD_LIMIT/8 : len;
+#ifdef HBH_X86
+        if (s->kernel >= HBH_KERNEL_SSE4) bits_popcnt(s, in, n, msbfirst);
+        else
+#endif
+        bits_scalar(s, in, n, msbfirst);
+        s->unfolded += n*8;
+        if (s->unfolded >= FOLD_LIMIT) fold(s);
+        in += n;
+        len -= n;
+    }
+}
+
+/* Close the run in progress and total up. The MCV estimate is that of
+ * SP800-90B 6.3.1: the upper 99% confidence bound on the probability of
+ * the most common value. */
+void hbh_stats_finish(hbh_stats *s) {
+    double p;
+    double pu;
+    int i;
+
+    fold(s);
+    if (s->run > s->longest_run) s->longest_run = s->run;
+    s->run = 0;
+
+    s->most_common = 0;
+    for (i=1;i<(1 << s->bps);i++) {
+        if (s->count[i] > s->count[s->most_common]) s->most_common = i;
+    }
+
+    s->min_entropy = 0.0;
+    if (s->symbols > 1) {
+        p = (double)s->count[s->most_common] / (double)s->symbols;
+        pu = p + 2.576*sqrt(p*(1.0 - p)/(double)(s->symbols - 1));
+        if (pu > 1.0) pu = 1.0;
+        s->min_entropy = -log2(pu);
+    }
+}
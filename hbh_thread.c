@@ -0,0 +1,154 @@
+/*
+    hbh_thread.c - Worker threads for the parallel modes of the hexbinhex tools.
+
+    Copyright (C) 2017  David Johnston
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    -----
+
+    Contact. David Johnston dj@deadhat.com
+*/
+
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "hbh_thread.h"
+
+typedef struct {
+    void (*fn)(void *arg, int index);
+    void *arg;
+    int count;
+    int next;       /* next index to hand out */
+} work;
+
+/* Each thread takes the next index until there are none left */
+static void *worker(void *p) {
+    work *w = p;
+    int i;
+
+    while ((i = __atomic_fetch_add(&w->next, 1, __ATOMIC_RELAXED)) < w->count)
+        w->fn(w->arg, i);
+    return NULL;
+}
+
+void hbh_parallel_for(int threads, int count, void (*fn)(void *arg, int index), void *arg) {
+    pthread_t tids[HBH_MAX_THREADS];
+    work w;
+    int started = 0;
+    int i;
+
+    w.fn = fn;
+    w.arg = arg;
+    w.count = count;
+    w.next = 0;
+
+    if (threads > count) threads = count;
+    if (threads > HBH_MAX_THREADS) threads = HBH_MAX_THREADS;
+    for (i=1;i<threads;i++) {
+        if (pthread_create(&tids[started], NULL, worker, &w) != 0) break;
+        started++;
+    }
+    worker(&w);
+    for (i=0;i<started;i++) pthread_join(tids[i], NULL);
+}
+
+struct hbh_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t go;          /* workers wait here for a round */
+    pthread_cond_t idle;        /* hbh_pool_wait() waits here for them */
+    work w;
+    unsigned long round;        /* bumped as each round is posted */
+    int busy;                   /* workers not yet done with the round */
+    int stop;
+    int started;
+    pthread_t tids[HBH_MAX_THREADS];
+};
+
+/* Wait for each round, take indices until there are none left and check
+ * back in */
+static void *pool_worker(void *p) {
+    hbh_pool *pool = p;
+    unsigned long seen = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->stop && (pool->round == seen))
+            pthread_cond_wait(&pool->go, &pool->lock);
+        if (pool->stop) break;
+        seen = pool->round;
+        pthread_mutex_unlock(&pool->lock);
+        worker(&pool->w);
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->busy == 0) pthread_cond_signal(&pool->idle);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+hbh_pool *hbh_pool_start(int threads) {
+    hbh_pool *pool = calloc(1, sizeof(hbh_pool));
+    int i;
+
+    if (pool == NULL) return NULL;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->go, NULL);
+    pthread_cond_init(&pool->idle, NULL);
+    if (threads > HBH_MAX_THREADS) threads = HBH_MAX_THREADS;
+    for (i=1;i<threads;i++) {
+        if (pthread_create(&pool->tids[pool->started], NULL, pool_worker, pool) != 0) break;
+        pool->started++;
+    }
+    return pool;
+}
+
+void hbh_pool_post(hbh_pool *pool, int count, void (*fn)(void *arg, int index), void *arg) {
+    pthread_mutex_lock(&pool->lock);
+    pool->w.fn = fn;
+    pool->w.arg = arg;
+    pool->w.count = count;
+    pool->w.next = 0;
+    pool->busy = pool->started;
+    pool->round++;
+    pthread_cond_broadcast(&pool->go);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void hbh_pool_wait(hbh_pool *pool) {
+    worker(&pool->w);
+    pthread_mutex_lock(&pool->lock);
+    while (pool->busy > 0) pthread_cond_wait(&pool->idle, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void hbh_pool_run(hbh_pool *pool, int count, void (*fn)(void *arg, int index), void *arg) {
+    hbh_pool_post(pool, count, fn, arg);
+    hbh_pool_wait(pool);
+}
+
+void hbh_pool_stop(hbh_pool *pool) {
+    int i;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->go);
+    pthread_mutex_unlock(&pool->lock);
+    for (i=0;i<pool->started;i++) pthread_join(pool->tids[i], NULL);
+    pthread_cond_destroy(&pool->idle);
+    pthread_cond_destroy(&pool->go);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
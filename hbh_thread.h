@@ -0,0 +1,60 @@
+/*
+    hbh_thread.h - Worker threads for the parallel modes of the hexbinhex tools.
+
+    Copyright (C) 2017  David Johnston
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    -----
+
+    Contact. David Johnston dj@deadhat.com
+*/
+
+
+#ifndef HBH_THREAD_H
+#define HBH_THREAD_H
+
+/* Most threads hbh_parallel_for() runs, and so most a -j can ask for */
+#define HBH_MAX_THREADS 256
+
+/* Call fn(arg, i) for every i from 0 to count-1, spread over up to
+ * threads threads including the caller, and return once all the calls
+ * have finished. If threads can't be started the caller does the rest. */
+void hbh_parallel_for(int threads, int count, void (*fn)(void *arg, int index), void *arg);
+
+/* Threads kept running across the rounds of a -j conversion, so that
+ * none are started or joined per round. */
+typedef struct hbh_pool hbh_pool;
+
+/* Start a pool for threads threads, including the caller. If threads
+ * can't all be started the caller does the rest. NULL if out of memory. */
+hbh_pool *hbh_pool_start(int threads);
+
+/* Start calling fn(arg, i) for every i from 0 to count-1 on the pool and
+ * return at once, so the caller can get on with something else, such as
+ * writing out the last round. hbh_pool_wait() must come before the next
+ * hbh_pool_post(). */
+void hbh_pool_post(hbh_pool *pool, int count, void (*fn)(void *arg, int index), void *arg);
+
+/* Join in the calls posted and return once all of them have finished */
+void hbh_pool_wait(hbh_pool *pool);
+
+/* hbh_pool_post() then hbh_pool_wait() */
+void hbh_pool_run(hbh_pool *pool, int count, void (*fn)(void *arg, int index), void *arg);
+
+/* Stop the threads and free the pool */
+void hbh_pool_stop(hbh_pool *pool);
+
+#endif
@@ -29,48 +29,191 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <errno.h>
 #include <sys/stat.h>
 #include <stdint.h>
 #include <unistd.h>
 #include <getopt.h>
 
-#define BUFSIZE 2048
+#include "hexbinhex.h"
+#include "hbh_io.h"
+#include "hbh_batch.h"
+#include "hbh_range.h"
+#include "hbh_thread.h"
+
+/* Input is handed to the threads of -j in chunks of this size */
+#define CHUNK_SIZE (4*1024*1024)
 
 void display_usage() {
-fprintf(stderr,"Usage: hex2bin [-h][-s lines_to_skip][-o <out filename>][filename]\n");
+fprintf(stderr,"Usage: hex2bin [-h][-v][-K kernel][-j threads][-s lines_to_skip][--offset n][--length n][-o <out filename>][filename]\n");
 fprintf(stderr,"       -s n          Skip the first n lines of the input text\n");
+fprintf(stderr,"       -j n          Decode on n threads, 1 to 256\n");
+fprintf(stderr,"       --offset n    Start from byte n of the binary\n");
+fprintf(stderr,"       --length n    Convert n bytes at most\n");
 fprintf(stderr,"       -o filename   Output to file filename instead of stdout\n");
+fprintf(stderr,"       -v            Report throughput to stderr\n");
+fprintf(stderr,"       -K name       Use the scalar, sse4, avx2 or avx512 kernels\n");
+fprintf(stderr,"       --batch <glob|@list> Convert each matching or listed file to its own file\n");
+fprintf(stderr,"       --batch-out <template> Output path of each, default %%d/%%b.%%e\n");
+fprintf(stderr,"       --batch-jobs <n> Convert the batch on n threads (default one per CPU)\n");
 fprintf(stderr,"\n");
 fprintf(stderr,"Convert hexadecimal data to binary.\n");
 fprintf(stderr,"  Author: David Johnston, dj@deadhat.com\n");
 fprintf(stderr,"\n");
 }
 
-int ishex(char ch) {
-    if ((ch > 0x2f) && (ch < 0x3a)) return 1; /* digits */
-    if ((ch > 0x40) && (ch < 0x47)) return 1; /* A-F */
-    if ((ch > 0x60) && (ch < 0x67)) return 1; /* a-f */
-    return 0;
+/* One chunk of the input for -j. The nibble pending at its start and the
+ * offset of its output are worked out before it is decoded. */
+typedef struct {
+    const unsigned char *in;
+    size_t len;
+    hbh_hex_span span;
+    int pending;
+    size_t outlen;
+    off_t offset;
+    unsigned char *out;
+} chunk;
+
+typedef struct {
+    chunk *chunks;
+    int fd;         /* pwrite() target, or -1 to write in order afterwards */
+    int failed;     /* errno of a failed pwrite(), 0 if none */
+    int mismatch;   /* a chunk decoded to other than its scanned length */
+} job;
+
+static void scan_chunk(void *arg, int i) {
+    job *j = arg;
+    chunk *c = &j->chunks[i];
+
+    hbh_hex_decode_scan(c->in, c->len, &c->span);
 }
 
-int ishexorx(char ch) {
-    if ((ishex(ch)==1) || (ch=='x')) return 1; 
-    return 0;
+static void decode_chunk(void *arg, int i) {
+    job *j = arg;
+    chunk *c = &j->chunks[i];
+    hbh_hex_decoder state;
+    size_t n;
+
+    hbh_hex_decode_init_pending(&state, c->pending);
+    n = hbh_hex_decode_update(&state, c->in, c->len, c->out);
+    if (n != c->outlen) {
+        __atomic_store_n(&j->mismatch, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    if ((j->fd >= 0) && (hbh_pwrite_all(j->fd, c->out, n, c->offset) != 0))
+        __atomic_store_n(&j->failed, (errno != 0) ? errno : EIO, __ATOMIC_RELAXED);
 }
 
-int hextobyte(char *astr) {
-    char cha;
-    int result=0;
+/* Write out a round's chunks in order */
+static void write_chunks(hbh_output *out, const chunk *chunks, int count) {
     int i;
-    
-    for (i=0;i<2;i++){ 
-        cha = astr[i];
-        result = result << 4;
-        if ((cha > 0x2f) && (cha < 0x3a)) result += (cha - 0x30);
-        else if ((cha > 0x40) && (cha < 0x47)) result += (cha + 0x0A - 0x41);
-        else if ((cha > 0x60) && (cha < 0x67)) result += (cha + 0x0A - 0x61);
+
+    for (i=0;i<count;i++) {
+        if (hbh_output_write(out, chunks[i].out, chunks[i].outlen) != 0) {
+            perror("failed to write output");
+            exit(1);
+        }
     }
-    return result;  
+}
+
+/* Decode the input on threads threads. Each round takes a chunk per
+ * thread, scans the chunks in parallel, chains them to find where each
+ * one starts and then decodes them in parallel. Output to a regular file
+ * is written in place by the threads. Anything else is written in order
+ * by this thread while the next round decodes, so there are two sets of
+ * chunks, one being written while the other is decoded.
+ */
+static void decode_parallel(hbh_input *input, int threads, hbh_output *out) {
+    const unsigned char *data;
+    hbh_hex_decoder state;
+    hbh_pool *pool;
+    chunk *chunks;
+    chunk *set;
+    job j;
+    off_t base;
+    uint64_t total = 0;
+    size_t outsize;
+    long len;
+    int pending = -1;
+    int count;
+    int last = 0;   /* chunks in the round waiting to be written */
+    int round = 0;
+    int i;
+
+    fflush(out->fp);
+    j.fd = out->fd;
+    base = out->spliced ? -1 : hbh_output_offset(j.fd);
+    if (base < 0) j.fd = -1;
+
+    hbh_hex_decode_init(&state);
+    outsize = hbh_hex_decode_bound(&state, CHUNK_SIZE);
+    chunks = calloc((size_t)threads*2, sizeof(chunk));
+    pool = hbh_pool_start(threads);
+    if ((chunks == NULL) || (pool == NULL)) {
+        perror("failed to allocate chunks");
+        exit(1);
+    }
+    for (i=0;i<threads*2;i++) {
+        chunks[i].out = malloc(outsize);
+        if (chunks[i].out == NULL) {
+            perror("failed to allocate output buffer");
+            exit(1);
+        }
+    }
+    j.failed = 0;
+    j.mismatch = 0;
+
+    while ((len = hbh_input_next_block(input, &data, (size_t)threads*CHUNK_SIZE)) > 0) {
+        set = chunks + (round & 1)*threads;
+        j.chunks = set;
+        count = 0;
+        while (len > 0) {
+            set[count].in = data;
+            set[count].len = (len > CHUNK_SIZE) ? CHUNK_SIZE : (size_t)len;
+            data += set[count].len;
+            len -= (long)set[count].len;
+            count++;
+        }
+
+        hbh_pool_run(pool, count, scan_chunk, &j);
+        for (i=0;i<count;i++) {
+            set[i].pending = pending;
+            set[i].offset = base + (off_t)total;
+            set[i].outlen = 0;
+            pending = hbh_hex_span_chain(&set[i].span, pending, &set[i].outlen);
+            total += set[i].outlen;
+        }
+        hbh_pool_post(pool, count, decode_chunk, &j);
+        if (j.fd < 0) write_chunks(out, chunks + ((round + 1) & 1)*threads, last);
+        hbh_pool_wait(pool);
+
+        if (j.mismatch) {
+            fprintf(stderr,"Error: hex input decoded to a different length than scanned\n");
+            exit(1);
+        }
+        if (j.failed != 0) {
+            errno = j.failed;
+            perror("failed to write output");
+            exit(1);
+        }
+        last = count;
+        round++;
+    }
+    if (len < 0) {
+        perror("failed to read input");
+        exit(1);
+    }
+    if (j.fd < 0) write_chunks(out, chunks + ((round + 1) & 1)*threads, last);
+    hbh_pool_stop(pool);
+
+    /* Leave the file offset after the output, as writing serially would */
+    if (j.fd >= 0) {
+        lseek(j.fd, base + (off_t)total, SEEK_SET);
+        out->bytes_out += total;
+    }
+
+    for (i=0;i<threads*2;i++) free(chunks[i].out);
+    free(chunks);
 }
 
 /********
@@ -80,32 +223,47 @@ int hextobyte(char *astr) {
 int main(int argc, char** argv)
 {
     int opt;
-	int i;
-	size_t len;
+	long len;
         	
-	FILE *ifp;
-	FILE *ofp;
+	FILE *ofp = NULL;
 	int using_outfile;
 	int using_infile;
+	int verbose = 0;
 	char filename[1000];
 	char infilename[1000];
+    char batch[1000];
+    char batchout[1000];
+    int jobs = 0;
     int skiplines;
-    int abyte;
+    int threads;
+    uint64_t first = 0;
+    uint64_t count = UINT64_MAX;
     
 	/* Defaults */
 	using_outfile = 0;      /* use stdout instead of output file*/
     using_infile = 0;       /* use stdin instead of input file*/
     skiplines = 0;
+    threads = 1;
     
     filename[0] = (char)0;
 	infilename[0] = (char)0;
+    batch[0] = (char)0;
+    strcpy(batchout, HBH_BATCH_OUT);
 
 	/* get the options and arguments */
     int longIndex;
 
-    char optString[] = "o:k:w:h";
+    char optString[] = "o:k:w:s:j:K:vh";
     static const struct option longOpts[] = {
-    { "output", no_argument, NULL, 'o' },
+    { "output", required_argument, NULL, 'o' },
+    { "threads", required_argument, NULL, 'j' },
+    { "verbose", no_argument, NULL, 'v' },
+    { "kernel", required_argument, NULL, 'K' },
+    { "offset", required_argument, NULL, 'F' },
+    { "length", required_argument, NULL, 'N' },
+    { "batch", required_argument, NULL, 'A' },
+    { "batch-out", required_argument, NULL, 'O' },
+    { "batch-jobs", required_argument, NULL, 'J' },
     { "help", no_argument, NULL, 'h' },
     { NULL, no_argument, NULL, 0 }
     };
@@ -125,6 +283,53 @@ int main(int argc, char** argv)
                 skiplines = atoi(optarg);
                 if (skiplines < 1) skiplines = 0;
                 break;    
+            case 'j':
+                threads = atoi(optarg);
+                if ((threads < 1) || (threads > HBH_MAX_THREADS)) {
+                    fprintf(stderr,"Error: -j takes 1 to %d threads\n", HBH_MAX_THREADS);
+                    exit(1);
+                }
+                break;
+            case 'v':
+                verbose=1;
+                break;
+            case 'K':
+                if (hbh_kernel_set(hbh_kernel_parse(optarg)) != 0) {
+                    fprintf(stderr,"Error: kernel %s is unknown or not supported by this CPU\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'F':
+                if (hbh_parse_count(optarg, &first) != 0) {
+                    fprintf(stderr,"Error: --offset %s is not a byte count\n", optarg);
+                    display_usage();
+                    exit(1);
+                }
+                break;
+            case 'N':
+                if (hbh_parse_count(optarg, &count) != 0) {
+                    fprintf(stderr,"Error: --length %s is not a byte count\n", optarg);
+                    display_usage();
+                    exit(1);
+                }
+                break;
+            case 'A':
+                if (strlen(optarg) >= sizeof(batch)) {
+                    fprintf(stderr,"Error: batch file list too long\n");
+                    exit(1);
+                }
+                strcpy(batch,optarg);
+                break;
+            case 'O':
+                if (strlen(optarg) >= sizeof(batchout)) {
+                    fprintf(stderr,"Error: batch output template too long\n");
+                    exit(1);
+                }
+                strcpy(batchout,optarg);
+                break;
+            case 'J':
+                jobs = atoi(optarg);
+                break;
             case 'h':   /* fall-through is intentional */
             case '?':
                 display_usage();
@@ -143,6 +348,22 @@ int main(int argc, char** argv)
         using_infile = 1;
     }
 
+    /* Batch mode converts each listed file to a file of its own */
+    if (batch[0] != 0) {
+        hbh_format from = { HBH_HEX, 32 };
+        hbh_format to = { HBH_BIN };
+
+        if ((using_outfile==1) || (using_infile==1) || (first != 0) || (count != UINT64_MAX)) {
+            fprintf(stderr,"Error: --batch names its own files, so takes no -o, filename, --offset or --length\n");
+            exit(1);
+        }
+        if (threads != 1) {
+            fprintf(stderr,"Error: --batch converts a file per thread, so takes --batch-jobs rather than -j\n");
+            exit(1);
+        }
+        exit((hbh_batch_run("hex2bin", batch, batchout, &from, &to, skiplines, jobs, verbose) == 0) ? 0 : 1);
+    }
+
 	/* open the output file if needed */
 
 	if (using_outfile==1)
@@ -156,117 +377,101 @@ int main(int argc, char** argv)
     
     char errstring[1200];
     
-	/* open the input file if needed */
-	if (using_infile==1)
-	{
-        ifp =  fopen(infilename, "r");
-	    
-		if (ifp == NULL) {
-            sprintf(errstring,"failed to open input file %s for reading",infilename);
-			perror(errstring);
-			exit(1);
-		}
-	}
+    /* open the input, memory mapping it if it is a regular file */
+    hbh_input input;
+
+    if (hbh_input_open(&input, (using_infile==1) ? infilename : NULL) != 0) {
+        sprintf(errstring,"failed to open input file %s for reading",infilename);
+        perror(errstring);
+        exit(1);
+    }
+
+    const unsigned char *buffer;
+    unsigned char *outbuffer;
+    size_t outsize;
+    size_t outindex;
+    hbh_output output;
+    hbh_hex_decoder state;
+    hbh_range range;
+    int ranged = (first != 0) || (count != UINT64_MAX);
 
-    unsigned char buffer[BUFSIZE+1];
-    unsigned char outbuffer[BUFSIZE+1];
-    int outindex = 0;
-    int charcount = 0;
-    char hexchars[2];
-    
     /* Skip lines if requested */
     
-    buffer[BUFSIZE] = 0;
-    
-    if (skiplines>0) {
-        for (i=0;i<skiplines;i++) {
-            if (using_infile==1)
-                len = (size_t)fgets((char *)buffer,BUFSIZE, ifp);
-            else
-                len = (size_t)fgets((char *)buffer,BUFSIZE, stdin);
-            if (len==0) break;
+    if (skiplines>0) hbh_input_skip_lines(&input, skiplines);
+
+    /* A range starts from the checkpoint before it, whatever -j says */
+    if (ranged==1) {
+        hbh_format from = { HBH_HEX, 32 };
+
+        if (hbh_range_open(&range, &input, (using_infile==1) ? infilename : NULL, &from, first, count, HBH_RANGE_STEP) != 0) {
+            perror("failed to index input");
+            exit(1);
         }
+        if (verbose==1) hbh_range_report("hex2bin", &range);
+        threads = 1;
     }
-    
-    /* state to gather two characters */
-    hexchars[0] = ' ';
-    hexchars[1] = ' ';
-    charcount = 0;
-    char achar;
-    outindex = 0;
-    char hexstring[3];
-    int inindex;
-    
-    do {
-        /* Read in hex data from file */
-        if (using_infile==1)
-            len = fread(buffer, 1, BUFSIZE , ifp);
-        else
-            len = fread(buffer, 1, BUFSIZE , stdin);
-        
-        /* End when we reach EOF */
-        //fprintf(stderr,"len=%d\n",(int)len);
-        if (len == 0) break;
-        
-        /* Pick up hex char pairs and move to outbuffer until outbuffer is full
-         * or we reached end of inbuffer */
-        inindex=0;
-        outindex = 0;
+
+    if (hbh_hex_decode_init(&state) != 0) {
+        fprintf(stderr,"Error: invalid conversion parameters\n");
+        exit(1);
+    }
+    outsize = (ranged==1) ? hbh_range_bound(&range, HBH_SLAB_SIZE) : hbh_hex_decode_bound(&state, HBH_SLAB_SIZE);
+    if (outsize < HBH_FINISH_BOUND) outsize = HBH_FINISH_BOUND;
+    if (hbh_output_open(&output, (using_outfile==1) ? ofp : stdout, outsize) != 0) {
+        perror("failed to allocate output buffer");
+        exit(1);
+    }
+
+    if (ranged==1) {
         do {
-            /* Slide through the data picking up 2 hex characters, discarding trash */
-            
-            do {
-                if (charcount < 2) achar = buffer[inindex++];
-
-                if (ishex(achar)) {
-                    hexchars[charcount++]=achar;
-                    i++;
-                }
-                
-                /* Skip 0x */
-                    
-                /* we last got 0 and the next is x - hence 0x */
-                if ((hexchars[0]=='0') && (achar=='x') && (charcount==1)) {
-                    charcount = 0; /* skip 0x prefixes */
-                }
-                /* We have 2 hexchars in and the next is x, so discard it */
-                else if ((achar=='x') && (charcount==2)) {
-                    charcount = 0;
-                }
-                    
-                /* Use if we have two hex chars, turn into binary */
-                    
-                if (charcount == 2) {
-                    hexstring[0] = hexchars[0];
-                    hexstring[1] = hexchars[1];
-                    hexstring[2] = '0';
-                    abyte = hextobyte(hexstring);
-                    outbuffer[outindex++]=abyte;
-                }
-                
-                /* until we have two hexchars or we run out of input data */
-            } while ((charcount < 2) && (inindex < len));
-            if (charcount == 2) {
-                charcount = 0;
+            len = (range.left == 0) ? 0 : hbh_input_next(&input, &buffer, HBH_SLAB_SIZE);
+            if (len < 0) {
+                perror("failed to read input");
+                exit(1);
             }
-            /* until we run out of output buffer or run out of input data */
-            
-            //fprintf(stderr,"in index=%d",inindex);
-        } while ((outindex < BUFSIZE) && (inindex < len));
-
-        /* Now we have a binary buffer outbuffer with outindex chars.
-         * Output it.
-         */
-
-        if (using_outfile == 1)
-            fwrite(outbuffer, 1, outindex, ofp);
-        else
-            fwrite(outbuffer, 1, outindex, stdout);
-            
-        outindex = 0;
-        
-    } while (1==1);
-    
+
+            outbuffer = hbh_output_space(&output);
+            if (len == 0)
+                outindex = hbh_range_finish(&range, outbuffer);
+            else
+                outindex = hbh_range_update(&range, buffer, (size_t)len, outbuffer);
+
+            if (hbh_output_commit(&output, outindex) != 0) {
+                perror("failed to write output");
+                exit(1);
+            }
+
+        } while (len != 0);
+    } else if (threads > 1) {
+        decode_parallel(&input, threads, &output);
+    } else {
+        do {
+            len = hbh_input_next(&input, &buffer, HBH_SLAB_SIZE);
+            if (len < 0) {
+                perror("failed to read input");
+                exit(1);
+            }
+
+            outbuffer = hbh_output_space(&output);
+            if (len == 0)
+                outindex = hbh_hex_decode_finish(&state, outbuffer);
+            else
+                outindex = hbh_hex_decode_update(&state, buffer, (size_t)len, outbuffer);
+
+            if (hbh_output_commit(&output, outindex) != 0) {
+                perror("failed to write output");
+                exit(1);
+            }
+
+        } while (len != 0);
+    }
+
+    if (hbh_output_close(&output) != 0) {
+        perror("failed to write output");
+        exit(1);
+    }
+    if (verbose==1) hbh_report_throughput("hex2bin", &input, &output);
+    hbh_input_close(&input);
     if (using_outfile==1) fclose(ofp);
 
     return 0;    
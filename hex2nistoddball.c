@@ -0,0 +1,284 @@
+
+/*
+    hex2nistoddball - A utility to convert hex data straight to NIST oddball format.
+    
+    Copyright (C) 2024  David Johnston
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    -----
+    
+    Contact. David Johnston dj@deadhat.com
+*/
+/* make isnan() visible */
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "hexbinhex.h"
+#include "hbh_io.h"
+#include "hbh_batch.h"
+
+void display_usage() {
+fprintf(stderr,"Usage: hex2nistoddball [-l <bits_per_symbol 1-8>][-r][-B|-L][-v][-K kernel][-h][-o <out filename>] [filename]\n");
+fprintf(stderr,"       -l , --bits_per_symbol <1-8>        Set the number of bits to encode in each output byte\n");
+fprintf(stderr,"       -r , --reverse                      Interpret the bytes of the input hex as big endian (MSB first) (default is little endian)\n");
+fprintf(stderr,"       -B , --bigendian                    Unpack output multi-bit symbols as big-endian (msb first)\n");
+fprintf(stderr,"       -L , --littleendian                 Unpack output multi-bit symbols as little-endian (lsb first) (default)\n");
+fprintf(stderr,"       -v , --verbose                      Output information to stderr\n");
+fprintf(stderr,"       -K , --kernel <name>                Use the scalar, sse4, avx2 or avx512 kernels\n");
+fprintf(stderr,"            --batch <glob|@list>           Convert each matching or listed file to its own file\n");
+fprintf(stderr,"            --batch-out <template>         Output path of each, default %%d/%%b.%%e\n");
+fprintf(stderr,"            --batch-jobs <n>               Convert the batch on n threads (default one per CPU)\n");
+fprintf(stderr,"       -o , --output <filename>            Output to file filename instead of stdout\n");
+fprintf(stderr,"       -h , --help                         Output this information\n");
+fprintf(stderr,"\n");
+fprintf(stderr,"Convert hexadecimal data to NIST Oddball SP800-90B one-symbol-per-byte format.\n");
+fprintf(stderr,"  Author: David Johnston, dj@deadhat.com\n");
+fprintf(stderr,"\n");
+}
+
+/********
+* main() is mostly about parsing and qualifying the command line options.
+*/
+
+int main(int argc, char** argv)
+{
+    int opt;
+	
+	FILE *ofp = NULL;
+	int using_outfile = 0;  /* use stdout instead of outputfile*/
+	int using_infile = 0;
+	char filename[1000];
+	char infilename[1000];
+    char batch[1000];
+    char batchout[1000];
+    int jobs = 0;
+	
+    int bps = 1;   
+    
+    int littleendian=1;
+    int gotL=0;
+    int gotB=0;
+    int verbose = 0;
+    int reverse = 0;
+
+	/* Zero out the strings */    
+    filename[0] = (char)0;
+	infilename[0] = (char)0;
+    batch[0] = (char)0;
+    strcpy(batchout, HBH_BATCH_OUT);
+
+	/* get the options and arguments */
+    int longIndex;
+
+    char optString[] = "o:k:l:w:BLrK:vh";
+    static const struct option longOpts[] = {
+    { "output", required_argument, NULL, 'o' },
+    { "reverse", no_argument, NULL, 'r' },
+    { "bigendian", no_argument, NULL, 'B' },
+    { "littleendian", no_argument, NULL, 'L' },
+    { "bits_per_symbol", required_argument, NULL, 'l' },
+    { "verbose", no_argument, NULL, 'v' },
+    { "kernel", required_argument, NULL, 'K' },
+    { "batch", required_argument, NULL, 'A' },
+    { "batch-out", required_argument, NULL, 'O' },
+    { "batch-jobs", required_argument, NULL, 'J' },
+    { "help", no_argument, NULL, 'h' },
+    { NULL, no_argument, NULL, 0 }
+    };
+
+    opt = getopt_long( argc, argv, optString, longOpts, &longIndex );
+    while( opt != -1 ) {
+        switch( opt ) {
+            case 'o':
+                using_outfile = 1;
+                strcpy(filename,optarg);
+                break;
+            case 'l':
+                bps = atoi(optarg);
+                if ((bps < 1) || (bps > 8)) {
+                    perror("Error, bits per symbol bust be between 1 and 8");
+                    display_usage();
+                    exit(-1);
+                };
+                break;
+            case 'r':
+                reverse=1;
+                break;
+            case 'L':
+                littleendian=1;
+                gotL=1;
+                break;
+            case 'B':
+                littleendian=0;
+                gotB=1;
+                break;
+            case 'v':
+                verbose=1;
+                break;
+                                
+            case 'K':
+                if (hbh_kernel_set(hbh_kernel_parse(optarg)) != 0) {
+                    fprintf(stderr,"Error: kernel %s is unknown or not supported by this CPU\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'A':
+                if (strlen(optarg) >= sizeof(batch)) {
+                    fprintf(stderr,"Error: batch file list too long\n");
+                    exit(1);
+                }
+                strcpy(batch,optarg);
+                break;
+            case 'O':
+                if (strlen(optarg) >= sizeof(batchout)) {
+                    fprintf(stderr,"Error: batch output template too long\n");
+                    exit(1);
+                }
+                strcpy(batchout,optarg);
+                break;
+            case 'J':
+                jobs = atoi(optarg);
+                break;
+            case 'h':   /* fall-through is intentional */
+            case '?':
+                display_usage();
+                exit(0);
+                 
+            default:
+                /* You won't actually get here. */
+                break;
+        }
+         
+        opt = getopt_long( argc, argv, optString, longOpts, &longIndex );
+    } // end while
+    
+    if (gotB==1 && gotL==1) {
+        fprintf(stderr,"ERROR, Can't be both big endian (-B) and little endian (-L) at the same time\n");
+        exit(-1);
+    }
+
+    if (optind < argc) {
+        strcpy(infilename,argv[optind]);
+        using_infile = 1;
+    }
+        
+    if (verbose==1) {
+        fprintf(stderr,"Verbose mode enabled\n");
+        if (reverse==1) fprintf(stderr, "Input data interpreted as big-endian (msb first)\n");
+        if (littleendian==0) fprintf(stderr, "Output multi-bit symbols encoded as big endian (MSB first)\n");
+        if (littleendian==1) fprintf(stderr, "Output multi-bit symbols encoded as little endian (LSB first) (default)\n");
+        if (((gotB==1) || (gotL==1)) && (bps > 1)){
+            printf("Warning: -L and -B arguments have so effect with 1 bit output symbols\n"); 
+        }
+        if (using_infile==1) {
+            fprintf(stderr,"Reading hex data from file: %s\n", infilename);
+        }
+        if (using_outfile==1) {
+            fprintf(stderr,"Writing NIST 1 symbol per byte data to file: %s\n", filename);
+        }
+        fprintf(stderr,"Bits per symbol = %d\n",bps); 
+    }
+    
+
+	/* Range check the var args */
+
+    /* Batch mode converts each listed file to a file of its own */
+    if (batch[0] != 0) {
+        hbh_format from = { HBH_HEX, 32 };
+        hbh_format to = { HBH_ODDBALL, 0, bps, 0, reverse, !littleendian };
+
+        if ((using_outfile==1) || (using_infile==1)) {
+            fprintf(stderr,"Error: --batch names its own files, so takes no -o or filename\n");
+            exit(1);
+        }
+        exit((hbh_batch_run("hex2nistoddball", batch, batchout, &from, &to, 0, jobs, verbose) == 0) ? 0 : 1);
+    }
+
+	/* open the output file if needed */
+
+	if (using_outfile==1)
+	{
+		ofp = fopen(filename, "w");
+		if (ofp == NULL) {
+			perror("failed to open output file for writing");
+			exit(1);
+		}
+	}
+
+    /* open the input, memory mapping it if it is a regular file */
+    hbh_input input;
+
+    if (hbh_input_open(&input, (using_infile==1) ? infilename : NULL) != 0) {
+        perror("failed to open input file for reading");
+        exit(1);
+    }
+
+    const unsigned char *buffer;
+    unsigned char *outbuffer;
+    size_t outsize;
+    size_t outindex;
+    hbh_output output;
+    long len;
+    hbh_hex_oddball state;
+
+    if (hbh_hex_oddball_init(&state, bps, reverse, littleendian) != 0) {
+        fprintf(stderr,"Error: invalid conversion parameters\n");
+        exit(1);
+    }
+    outsize = hbh_hex_oddball_bound(&state, HBH_SLAB_SIZE);
+    if (outsize < HBH_FINISH_BOUND) outsize = HBH_FINISH_BOUND;
+    if (hbh_output_open(&output, (using_outfile==1) ? ofp : stdout, outsize) != 0) {
+        perror("failed to allocate output buffer");
+        exit(1);
+    }
+
+    do {
+        len = hbh_input_next(&input, &buffer, HBH_SLAB_SIZE);
+        if (len < 0) {
+            perror("failed to read input");
+            exit(1);
+        }
+
+        outbuffer = hbh_output_space(&output);
+        if (len == 0)
+            outindex = hbh_hex_oddball_finish(&state, outbuffer);
+        else
+            outindex = hbh_hex_oddball_update(&state, buffer, (size_t)len, outbuffer);
+
+        if (hbh_output_commit(&output, outindex) != 0) {
+            perror("failed to write output");
+            exit(1);
+        }
+
+    } while (len != 0);
+
+    if (hbh_output_close(&output) != 0) {
+        perror("failed to write output");
+        exit(1);
+    }
+    if (verbose==1) hbh_report_throughput("hex2nistoddball", &input, &output);
+    hbh_input_close(&input);
+    if (using_outfile==1) fclose(ofp);
+}
+
+
@@ -0,0 +1,87 @@
+/*
+    hexbinhex.c - Library wide parts of libhexbinhex.
+
+    Copyright (C) 2017  David Johnston
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    -----
+
+    Contact. David Johnston dj@deadhat.com
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "hexbinhex.h"
+#include "hbh_internal.h"
+
+int hbh_version(void) {
+    return (HBH_VERSION_MAJOR << 16) | HBH_VERSION_MINOR;
+}
+
+static const char *kernel_names[4] = { "scalar", "sse4", "avx2", "avx512" };
+
+/* The level in use, -1 until first asked for */
+static int kernel_level = -1;
+
+/* Each level needs everything the one below it does */
+int hbh_kernel_detect(void) {
+    int level = HBH_KERNEL_SCALAR;
+#ifdef HBH_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("ssse3") && __builtin_cpu_supports("sse4.1") && __builtin_cpu_supports("popcnt"))
+        level = HBH_KERNEL_SSE4;
+    if ((level == HBH_KERNEL_SSE4) && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi2"))
+        level = HBH_KERNEL_AVX2;
+    if ((level == HBH_KERNEL_AVX2) && __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+        level = HBH_KERNEL_AVX512;
+#endif
+    return level;
+}
+
+int hbh_kernel_parse(const char *name) {
+    int i;
+
+    if (strcmp(name, "auto") == 0) return hbh_kernel_detect();
+    for (i=0;i<4;i++) {
+        if (strcmp(name, kernel_names[i]) == 0) return i;
+    }
+    return -1;
+}
+
+const char *hbh_kernel_name(int level) {
+    if ((level < 0) || (level > HBH_KERNEL_AVX512)) return "unknown";
+    return kernel_names[level];
+}
+
+int hbh_kernel_set(int level) {
+    if ((level < 0) || (level > hbh_kernel_detect())) return -1;
+    kernel_level = level;
+    return 0;
+}
+
+/* An HBH_KERNEL the CPU can't run is ignored */
+HBH_CONSTRUCTOR static void init_kernel_level(void) {
+    const char *name = getenv("HBH_KERNEL");
+
+    kernel_level = hbh_kernel_detect();
+    if (name != NULL) hbh_kernel_set(hbh_kernel_parse(name));
+}
+
+int hbh_kernel_level(void) {
+    if (kernel_level < 0) init_kernel_level();
+    return kernel_level;
+}
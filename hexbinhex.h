@@ -0,0 +1,422 @@
+/*
+    hexbinhex.h - Streaming conversion library behind the hexbinhex tools.
+
+    Copyright (C) 2017  David Johnston
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    -----
+
+    Contact. David Johnston dj@deadhat.com
+*/
+
+/*
+ * Every format has an encoder (binary in, format out) and a decoder
+ * (format in, binary out) driven the same way:
+ *
+ *     hbh_<format>_<encode|decode>_init(&state, options...)
+ *     for each block of input:
+ *         n = hbh_<format>_<encode|decode>_update(&state, in, len, out)
+ *     n = hbh_<format>_<encode|decode>_finish(&state, out)
+ *
+ * update() converts as much as it can and keeps whatever is left over
+ * (half a hex pair, part of a symbol group, a number still being read)
+ * in the state for the next call, so blocks can be split anywhere.
+ * finish() writes out anything the end of the input completes.
+ * Both return the number of bytes written to out.
+ *
+ * The caller owns all buffers. out must have room for at least
+ * hbh_<format>_<encode|decode>_bound(&state, len) bytes for an update of
+ * len bytes, or HBH_FINISH_BOUND bytes for finish(). The bounds include
+ * a little slack that the vector kernels store into. Input is never read
+ * past len.
+ *
+ * The state structures are plain data and need no cleanup. Their fields
+ * are private to the library.
+ */
+
+#ifndef HEXBINHEX_H
+#define HEXBINHEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HBH_VERSION_MAJOR 1
+#define HBH_VERSION_MINOR 0
+
+/* Room out needs for any finish() call */
+#define HBH_FINISH_BOUND 64
+
+/* Library version as (major << 16) | minor */
+int hbh_version(void);
+
+/* Kernels. The inner loops are built once for each instruction set level
+ * below, whatever the compiler flags, and init() picks the version for
+ * the level in use. That starts as the best level the CPU supports, or
+ * the one named in the HBH_KERNEL environment variable. A converter with
+ * nothing specific to a level uses the one below it.
+ *
+ *     scalar   plain C
+ *     sse4     SSSE3, SSE4.1 and POPCNT
+ *     avx2     AVX2, BMI2 and POPCNT
+ *     avx512   avx2 plus AVX-512F and AVX-512BW
+ *
+ * hbh_kernel_set() changes the level for converters initialised after
+ * it, and fails if the CPU can't run it. hbh_kernel_parse() turns a
+ * name, or "auto" for the best supported, into a level, or -1. */
+
+enum { HBH_KERNEL_SCALAR, HBH_KERNEL_SSE4, HBH_KERNEL_AVX2, HBH_KERNEL_AVX512 };
+
+int    hbh_kernel_detect(void);
+int    hbh_kernel_level(void);
+int    hbh_kernel_set(int level);
+int    hbh_kernel_parse(const char *name);
+const char *hbh_kernel_name(int level);
+
+/* The encoders for hex and ASCII binary write a fixed amount of text per
+ * input byte, so each can start part way through its input. seek() sets
+ * an initialised encoder up as if it had already been given pos bytes and
+ * returns the number of bytes it would have written for them. Blocks of
+ * input can then be encoded in parallel straight to their place in the
+ * output. */
+
+/* Hex: bin2hex and hex2bin */
+
+typedef struct {
+    int width;          /* bytes per output line */
+    int bytecount;      /* bytes on the current line */
+    int lastcharnl;     /* last thing written was a newline */
+    void (*kernel)(const unsigned char *in, size_t len, unsigned char *out);
+} hbh_hex_encoder;
+
+int    hbh_hex_encode_init(hbh_hex_encoder *e, int width);
+size_t hbh_hex_encode_bound(const hbh_hex_encoder *e, size_t len);
+size_t hbh_hex_encode_update(hbh_hex_encoder *e, const unsigned char *in, size_t len, unsigned char *out);
+size_t hbh_hex_encode_finish(hbh_hex_encoder *e, unsigned char *out);
+uint64_t hbh_hex_encode_seek(hbh_hex_encoder *e, uint64_t pos);
+
+typedef struct {
+    int pending;        /* value of an unpaired nibble, or -1 */
+    size_t (*kernel)(const unsigned char *in, size_t len, unsigned char *out, int *pending);
+} hbh_hex_decoder;
+
+int    hbh_hex_decode_init(hbh_hex_decoder *d);
+size_t hbh_hex_decode_bound(const hbh_hex_decoder *d, size_t len);
+size_t hbh_hex_decode_update(hbh_hex_decoder *d, const unsigned char *in, size_t len, unsigned char *out);
+size_t hbh_hex_decode_finish(hbh_hex_decoder *d, unsigned char *out);
+
+/* Parallel hex decoding. What a block decodes to depends only on the
+ * nibble left pending by the text before it, so blocks can be scanned
+ * independently, chained together in order to find the pending nibble
+ * and output offset of each, then decoded independently.
+ *
+ * hbh_hex_decode_scan() summarises a block without decoding it.
+ * hbh_hex_span_chain() takes the nibble pending before the block, adds
+ * the bytes the block decodes to onto *bytes and returns the nibble
+ * pending after it. hbh_hex_decode_init_pending() starts a decoder with
+ * that nibble (-1 for none) pending. */
+
+typedef struct {
+    size_t bytes[3];
+    int pending[3];
+} hbh_hex_span;
+
+void   hbh_hex_decode_scan(const unsigned char *in, size_t len, hbh_hex_span *span);
+int    hbh_hex_span_chain(const hbh_hex_span *span, int pending, size_t *bytes);
+int    hbh_hex_decode_init_pending(hbh_hex_decoder *d, int pending);
+
+/* ASCII binary: bin201 and 012bin */
+
+typedef struct {
+    int width;          /* bits per output line */
+    int spaces;         /* space between every 8 bits */
+    int littleendian;   /* lsb of each byte first */
+    int bitcount;       /* bits on the current line */
+    int lastcharnl;
+    void (*kernel)(const unsigned char *in, size_t len, unsigned char *out, int littleendian);
+} hbh_bits_encoder;
+
+int    hbh_bits_encode_init(hbh_bits_encoder *e, int width, int spaces, int littleendian);
+size_t hbh_bits_encode_bound(const hbh_bits_encoder *e, size_t len);
+size_t hbh_bits_encode_update(hbh_bits_encoder *e, const unsigned char *in, size_t len, unsigned char *out);
+size_t hbh_bits_encode_finish(hbh_bits_encoder *e, unsigned char *out);
+uint64_t hbh_bits_encode_seek(hbh_bits_encoder *e, uint64_t pos);
+
+typedef struct {
+    int littleendian;   /* first bit of each byte is the lsb */
+    uint64_t acc;       /* bits short of a whole byte */
+    int nacc;
+    size_t (*kernel)(const unsigned char *in, size_t len, unsigned char *out,
+                     int littleendian, uint64_t *acc, int *nacc);
+} hbh_bits_decoder;
+
+int    hbh_bits_decode_init(hbh_bits_decoder *d, int littleendian);
+size_t hbh_bits_decode_bound(const hbh_bits_decoder *d, size_t len);
+size_t hbh_bits_decode_update(hbh_bits_decoder *d, const unsigned char *in, size_t len, unsigned char *out);
+size_t hbh_bits_decode_finish(hbh_bits_decoder *d, unsigned char *out);
+
+/* NIST SP800-90B one-symbol-per-byte: bin2nistoddball and nistoddball2bin.
+ * bps is 1 to 32. reverse takes the bits of binary bytes msb first.
+ * littleendian puts the first bit of a symbol in its lsb. Symbols of 9 to
+ * 16 bits take a 2 byte word and 17 to 32 bits a 4 byte word, little
+ * endian unless bigwords is set with the _words init. */
+
+typedef struct {
+    int bps;
+    int reverse;
+    int littleendian;
+    int bigwords;
+    int size;                   /* bytes per symbol */
+    unsigned char carry[32];    /* bytes short of a group of 8 symbols */
+    int ncarry;
+    void (*kernel)(const unsigned char *in, size_t groups, unsigned char *out);
+} hbh_oddball_encoder;
+
+int    hbh_oddball_encode_init(hbh_oddball_encoder *e, int bps, int reverse, int littleendian);
+int    hbh_oddball_encode_init_words(hbh_oddball_encoder *e, int bps, int reverse, int littleendian, int bigwords);
+size_t hbh_oddball_encode_bound(const hbh_oddball_encoder *e, size_t len);
+size_t hbh_oddball_encode_update(hbh_oddball_encoder *e, const unsigned char *in, size_t len, unsigned char *out);
+size_t hbh_oddball_encode_finish(hbh_oddball_encoder *e, unsigned char *out);
+
+typedef struct {
+    int bps;
+    int reverse;
+    int littleendian;
+    int bigwords;
+    int size;
+    unsigned char carry[32];    /* symbols short of a group of 8 */
+    int ncarry;
+    void (*kernel)(const unsigned char *in, size_t groups, unsigned char *out);
+} hbh_oddball_decoder;
+
+int    hbh_oddball_decode_init(hbh_oddball_decoder *d, int bps, int reverse, int littleendian);
+int    hbh_oddball_decode_init_words(hbh_oddball_decoder *d, int bps, int reverse, int littleendian, int bigwords);
+size_t hbh_oddball_decode_bound(const hbh_oddball_decoder *d, size_t len);
+size_t hbh_oddball_decode_update(hbh_oddball_decoder *d, const unsigned char *in, size_t len, unsigned char *out);
+size_t hbh_oddball_decode_finish(hbh_oddball_decoder *d, unsigned char *out);
+
+/* Statistics of one-symbol-per-byte data, as bin2nistoddball --stats
+ * reports them. Symbols must be below 2^bps. Counts, transitions and the
+ * longest run are totals once hbh_stats_finish() has been called, along
+ * with the most common value and its SP800-90B MCV min-entropy estimate
+ * in bits per symbol. With bps 1, hbh_stats_update_bits() takes the
+ * symbols packed 8 to a byte, lsb first unless msbfirst, which is much
+ * quicker than unpacking them first. */
+
+typedef struct {
+    int bps;
+    uint64_t symbols;
+    uint64_t count[256];
+    uint64_t transitions;       /* symbols that differ from the one before */
+    uint64_t longest_run;
+    int most_common;
+    double min_entropy;
+    int last;                   /* the previous symbol, -1 before the first */
+    uint64_t run;               /* length of the run it is in */
+    uint32_t partial[4][256];   /* counts not yet added to count */
+    size_t unfolded;
+    int kernel;                 /* the kernel level it was initialised at */
+} hbh_stats;
+
+int    hbh_stats_init(hbh_stats *s, int bps);
+void   hbh_stats_update(hbh_stats *s, const unsigned char *in, size_t len);
+void   hbh_stats_update_bits(hbh_stats *s, const unsigned char *in, size_t len, int msbfirst);
+void   hbh_stats_finish(hbh_stats *s);
+
+/* Sampling in front of and behind the oddball encoder, for
+ * bin2nistoddball --bits, --lsb and --stride. Only the bits of each input
+ * byte set in mask are kept, in the order reverse reads them, and those
+ * bits are made into symbols as the encoder would make them from binary.
+ * Of those symbols every stride-th is kept, starting with the first.
+ * Mask 0xFF and stride 1 is the plain encoder. The sampler works through
+ * its input HBH_SAMPLE_PIECE bytes of kept bits at a time, so each step
+ * reads what the one before wrote while it is still in cache. With 1 bit
+ * symbols a stride that divides the bits kept per byte becomes part of
+ * the mask. */
+
+#define HBH_SAMPLE_PIECE 4096
+
+typedef struct hbh_sampler {
+    hbh_oddball_encoder oddball;
+    uint64_t mask;              /* the bits kept, in every byte of a word */
+    int keep;                   /* how many of each byte's bits */
+    int msbfirst;
+    int stride;
+    int size;                   /* bytes per symbol */
+    uint64_t phase;             /* symbols to drop before the next one kept */
+    uint64_t bits;              /* bits kept so far */
+    uint64_t symbols;           /* symbols made from them so far */
+    unsigned char compress[256];    /* the kept bits of each byte value */
+    unsigned char spread[16];   /* pshufb pattern for the stride, or all 0 */
+    unsigned char carry[8];     /* bytes short of a group of 8 */
+    int ncarry;
+    unsigned char stage[HBH_SAMPLE_PIECE + 8];
+    void (*select)(const struct hbh_sampler *s, const unsigned char *in, size_t groups, unsigned char *out);
+} hbh_sampler;
+
+int    hbh_sample_init(hbh_sampler *s, int bps, int reverse, int littleendian, int bigwords, int mask, int stride);
+size_t hbh_sample_bound(const hbh_sampler *s, size_t len);
+size_t hbh_sample_update(hbh_sampler *s, const unsigned char *in, size_t len, unsigned char *out);
+size_t hbh_sample_finish(hbh_sampler *s, unsigned char *out);
+
+/* Packed oddball container, bin2nistoddball --packed. A 16 byte header,
+ *     "HBHPACK1", bps, flags (1 reverse, 2 symbols msb first,
+ *     4 big endian words), 6 zeros
+ * then the symbols packed bps bits at a time in the bit order reverse
+ * gives, which is the binary they were taken from. Every 8 symbols take
+ * bps bytes, so any symbol can be found without an index.
+ *
+ * The reader expands count symbols from first on (count UINT64_MAX for
+ * all of them) out of the payload, which is to be fed from byte
+ * hbh_pack_offset(bps, first) of the payload on. Once left is 0, any
+ * more input is ignored. */
+
+#define HBH_PACK_HEADER 16
+
+typedef struct {
+    hbh_oddball_encoder unpack;
+    int bps;
+    int reverse;
+    int littleendian;
+    int bigwords;
+    uint64_t skip;      /* symbols still to drop before the first */
+    uint64_t left;      /* symbols still to give */
+} hbh_pack_reader;
+
+void     hbh_pack_header(unsigned char *out, int bps, int reverse, int littleendian, int bigwords);
+int      hbh_pack_parse(const unsigned char *in, size_t len, int *bps, int *reverse, int *littleendian, int *bigwords);
+uint64_t hbh_pack_symbols(int bps, uint64_t payload);
+uint64_t hbh_pack_offset(int bps, uint64_t symbol);
+
+int    hbh_pack_reader_init(hbh_pack_reader *r, const unsigned char *header, uint64_t first, uint64_t count);
+size_t hbh_pack_reader_bound(const hbh_pack_reader *r, size_t len);
+size_t hbh_pack_reader_update(hbh_pack_reader *r, const unsigned char *in, size_t len, unsigned char *out);
+size_t hbh_pack_reader_finish(hbh_pack_reader *r, unsigned char *out);
+
+/* Decimal, one number per line: bin2dec and dec2bin.
+ * width is the size of the binary numbers, 1 to 8 bytes. */
+
+typedef struct {
+    int width;
+    int bigendian;
+    unsigned char carry[8];     /* bytes of a partial word */
+    int ncarry;
+    size_t (*kernel)(const unsigned char *in, size_t count, char *out);
+} hbh_dec_encoder;
+
+int    hbh_dec_encode_init(hbh_dec_encoder *e, int width, int bigendian);
+size_t hbh_dec_encode_bound(const hbh_dec_encoder *e, size_t len);
+size_t hbh_dec_encode_update(hbh_dec_encoder *e, const unsigned char *in, size_t len, unsigned char *out);
+size_t hbh_dec_encode_finish(hbh_dec_encoder *e, unsigned char *out);
+
+typedef struct {
+    int width;
+    int bigendian;
+    uint64_t value;     /* the number being collected */
+    int innumber;
+} hbh_dec_decoder;
+
+int    hbh_dec_decode_init(hbh_dec_decoder *d, int width, int bigendian);
+size_t hbh_dec_decode_bound(const hbh_dec_decoder *d, size_t len);
+size_t hbh_dec_decode_update(hbh_dec_decoder *d, const unsigned char *in, size_t len, unsigned char *out);
+size_t hbh_dec_decode_finish(hbh_dec_decoder *d, unsigned char *out);
+
+/* Fused conversions between hex and NIST one-symbol-per-byte:
+ * hex2nistoddball and nistoddball2hex. They chain the decoder of one
+ * format to the encoder of the other through a small buffer, with no
+ * binary stage in between. Options are as for the halves. */
+
+typedef struct {
+    hbh_hex_decoder hex;
+    hbh_oddball_encoder oddball;
+} hbh_hex_oddball;
+
+int    hbh_hex_oddball_init(hbh_hex_oddball *c, int bps, int reverse, int littleendian);
+size_t hbh_hex_oddball_bound(const hbh_hex_oddball *c, size_t len);
+size_t hbh_hex_oddball_update(hbh_hex_oddball *c, const unsigned char *in, size_t len, unsigned char *out);
+size_t hbh_hex_oddball_finish(hbh_hex_oddball *c, unsigned char *out);
+
+typedef struct {
+    hbh_oddball_decoder oddball;
+    hbh_hex_encoder hex;
+} hbh_oddball_hex;
+
+int    hbh_oddball_hex_init(hbh_oddball_hex *c, int bps, int reverse, int littleendian, int width);
+size_t hbh_oddball_hex_bound(const hbh_oddball_hex *c, size_t len);
+size_t hbh_oddball_hex_update(hbh_oddball_hex *c, const unsigned char *in, size_t len, unsigned char *out);
+size_t hbh_oddball_hex_finish(hbh_oddball_hex *c, unsigned char *out);
+
+/* Any format to any other: hbh. Formats are named as on the hbh command
+ * line and parsed by hbh_format_parse():
+ *
+ *     bin
+ *     hex[:width]                  width bytes per output line (32)
+ *     01[:width][:s][:be]          width bits per output line (32), spaces
+ *                                  every 8 bits, msb of each byte first
+ *     oddball:bps[:r][:be][:bw]    bps bits per symbol (1-32), bytes taken
+ *                                  msb first, symbols msb first, symbols
+ *                                  over 8 bits in big endian words
+ *     dec[:width][:be]             width bytes per number (4), big endian
+ *
+ * The converter decodes the input format and encodes the output format
+ * without a pass through binary in between. finish() needs room for
+ * hbh_convert_bound(c, 0) bytes. */
+
+enum { HBH_BIN, HBH_HEX, HBH_BITS, HBH_ODDBALL, HBH_DEC };
+
+typedef struct {
+    int format;
+    int width;
+    int bps;
+    int spaces;
+    int reverse;
+    int bigendian;
+    int bigwords;
+} hbh_format;
+
+int    hbh_format_parse(hbh_format *f, const char *name);
+
+typedef struct {
+    hbh_format from;
+    hbh_format to;
+    union {
+        hbh_hex_decoder hex;
+        hbh_bits_decoder bits;
+        hbh_oddball_decoder oddball;
+        hbh_dec_decoder dec;
+    } decoder;
+    union {
+        hbh_hex_encoder hex;
+        hbh_bits_encoder bits;
+        hbh_oddball_encoder oddball;
+        hbh_dec_encoder dec;
+    } encoder;
+    size_t block;       /* input decoded at a time */
+} hbh_converter;
+
+int    hbh_convert_init(hbh_converter *c, const hbh_format *from, const hbh_format *to);
+size_t hbh_convert_bound(const hbh_converter *c, size_t len);
+size_t hbh_convert_update(hbh_converter *c, const unsigned char *in, size_t len, unsigned char *out);
+size_t hbh_convert_finish(hbh_converter *c, unsigned char *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -33,25 +33,43 @@
 #include <unistd.h>
 #include <getopt.h>
 
+#include "hexbinhex.h"
+#include "hbh_io.h"
+#include "hbh_batch.h"
+
 void display_usage() {
-fprintf(stderr,"Usage: nistoddball2bin [-l <bits_per_symbol 1-8>][-B|-L][-v][-h][-o <out filename>] [filename]\n");
-fprintf(stderr,"       -l n          Set the number of symbol bits per byte encoded in the input data. Must be between 1 to 8\n");
+fprintf(stderr,"Usage: nistoddball2bin [-l <bits_per_symbol 1-32>][-r][-B|-L][-b][-v][-K kernel][--offset n][--length n][-h][-o <out filename>] [filename]\n");
+fprintf(stderr,"       -l n          Set the number of symbol bits per byte encoded in the input data. Must be between 1 to 32\n");
 fprintf(stderr,"       -B            Interpret the input symbols at being big endian (MSB first)\n");
 fprintf(stderr,"       -L            Interpret the input symbols at being little endian (LSB first) (default)\n");
+fprintf(stderr,"       -b            Read symbols over 8 bits from big-endian words (default little-endian)\n");
+fprintf(stderr,"       -r            Write the output binary data big endian (MSB first) (default is little endian)\n");
 fprintf(stderr,"       -v            Verbose mode. Outputs information to stderr\n");
+fprintf(stderr,"       -K name       Use the scalar, sse4, avx2 or avx512 kernels\n");
+fprintf(stderr,"       --offset n    Start from symbol n\n");
+fprintf(stderr,"       --length n    Convert n symbols at most\n");
+fprintf(stderr,"       --batch <glob|@list> Convert each matching or listed file to its own file\n");
+fprintf(stderr,"       --batch-out <template> Output path of each, default %%d/%%b.%%e\n");
+fprintf(stderr,"       --batch-jobs <n> Convert the batch on n threads (default one per CPU)\n");
 fprintf(stderr,"       -h            Display this information\n");
 fprintf(stderr,"       -o filename   Output to file filename instead of stdout\n");
 fprintf(stderr,"\n");
-fprintf(stderr,"Convert binary data to NIST Oddball SP800-90B one-symbol-per-byte format.\n");
+fprintf(stderr,"Convert NIST Oddball SP800-90B one-symbol-per-byte format to binary data.\n");
 fprintf(stderr,"  Author: David Johnston, dj@deadhat.com\n");
 fprintf(stderr,"\n");
 fprintf(stderr,"Notes:\n");
-fprintf(stderr,"      The NIST format for SP800-90B testing requires symbols to be as one symbol per bit.\n");
-fprintf(stderr,"      This means only symbols of sizes 1 through 8 bits can be supported.\n");
+fprintf(stderr,"      The NIST format for SP800-90B testing requires symbols to be as one symbol per byte.\n");
+fprintf(stderr,"      Symbols of 9 to 16 bits are read from 2 byte words and 17 to 32 bits from 4 byte words.\n");
 fprintf(stderr,"      The bit ordering of the bits within the symbols is not specified by NIST. The -L and -B options allow you to choose.\n");
 fprintf(stderr,"      The output binary data by default is in little endian format, with the lower order bits in bytes coming before higher order bits. This can be reversed with the -r option.\n");
+fprintf(stderr,"      Input written by bin2nistoddball --packed is recognised by its header, which gives the\n");
+fprintf(stderr,"      bits per symbol, -r, -B or -L and -b, so the bytes packed come back out. -r given here\n");
+fprintf(stderr,"      writes them bit reversed even so. Only the symbols asked for with --offset and --length are read.\n");
 }
 
+/* Packed symbols are expanded this many bytes at a time */
+#define PACK_PIECE (64*1024)
+
 /********
 * main() is mostly about parsing and qualifying the command line options.
 */
@@ -59,39 +77,54 @@ fprintf(stderr,"      The output binary data by default is in little endian form
 int main(int argc, char** argv)
 {
     int opt;
-	int i;
 	
-	FILE *ifp;          // Input file pointer
-	FILE *ofp;          // Output file pointer
+	FILE *ofp = NULL;   // Output file pointer
 	int using_outfile;      // True if -o <file> option used
-	int using_infile;       // True if input filename given
+	int using_infile = 0;   // True if input filename given
+	int verbose = 0;
 	char filename[1000];    // Let's hope the filename isn't bigger
 	char infilename[1000];
+    char batch[1000];
+    char batchout[1000];
+    int jobs = 0;
 	
     int bps;        // Bits per Symbol
-    int abyte;      // A Byte. Surprise.
 
     int littleendian=1;
+    int bigwords = 0;
     int reverse = 0;
+    int gotl = 0;
+    int gotr = 0;
+    uint64_t first = 0;
+    uint64_t count = UINT64_MAX;
     
 	/* Defaults */
 	using_outfile = 0;       /* use stdout instead of outputfile*/
     bps = 1;    
     filename[0] = (char)0;
 	infilename[0] = (char)0;
+    batch[0] = (char)0;
+    strcpy(batchout, HBH_BATCH_OUT);
 
 	/* get the options and arguments */
     int longIndex;
 
-    char optString[] = "o:k:l:BLrh";
+    char optString[] = "o:k:l:BLbrK:vh";
     static const struct option longOpts[] = {
-    { "output", no_argument, NULL, 'o' },
+    { "output", required_argument, NULL, 'o' },
     { "width", required_argument, NULL, 'w' },
     { "bits_per_symbol", required_argument, NULL, 'l' },
     { "littleendian", no_argument, NULL, 'L' },
     { "bigendian", no_argument, NULL, 'B' },
+    { "bigwords", no_argument, NULL, 'b' },
     { "reverse", no_argument, NULL, 'r' },
     { "verbose", no_argument, NULL, 'v' },
+    { "kernel", required_argument, NULL, 'K' },
+    { "offset", required_argument, NULL, 'F' },
+    { "length", required_argument, NULL, 'N' },
+    { "batch", required_argument, NULL, 'A' },
+    { "batch-out", required_argument, NULL, 'O' },
+    { "batch-jobs", required_argument, NULL, 'J' },
     { "help", no_argument, NULL, 'h' },
     { NULL, no_argument, NULL, 0 }
     };
@@ -105,11 +138,12 @@ int main(int argc, char** argv)
                 break;
             case 'l':
                 bps = atoi(optarg);
-                if ((bps < 1) || (bps > 8)) {
-                    perror("Error, bits per symbol bust be between 1 and 8");
+                if ((bps < 1) || (bps > 32)) {
+                    perror("Error, bits per symbol bust be between 1 and 32");
                     display_usage();
                     exit(-1);
                 };
+                gotl = 1;
                 break;
             case 'L':
                 littleendian=1;
@@ -119,12 +153,53 @@ int main(int argc, char** argv)
                 littleendian=0;
                 //gotB=1;
                 break;
+            case 'b':
+                bigwords=1;
+                break;
             case 'r':
                 reverse=1;
+                gotr=1;
+                break;
+            case 'v':
+                verbose=1;
+                break;
+            case 'K':
+                if (hbh_kernel_set(hbh_kernel_parse(optarg)) != 0) {
+                    fprintf(stderr,"Error: kernel %s is unknown or not supported by this CPU\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'F':
+                if (hbh_parse_count(optarg, &first) != 0) {
+                    fprintf(stderr,"Error: --offset %s is not a symbol count\n", optarg);
+                    display_usage();
+                    exit(1);
+                }
+                break;
+            case 'N':
+                if (hbh_parse_count(optarg, &count) != 0) {
+                    fprintf(stderr,"Error: --length %s is not a symbol count\n", optarg);
+                    display_usage();
+                    exit(1);
+                }
+                break;
+            case 'A':
+                if (strlen(optarg) >= sizeof(batch)) {
+                    fprintf(stderr,"Error: batch file list too long\n");
+                    exit(1);
+                }
+                strcpy(batch,optarg);
+                break;
+            case 'O':
+                if (strlen(optarg) >= sizeof(batchout)) {
+                    fprintf(stderr,"Error: batch output template too long\n");
+                    exit(1);
+                }
+                strcpy(batchout,optarg);
+                break;
+            case 'J':
+                jobs = atoi(optarg);
                 break;
-            //case 'v':
-            //    verbose=1;
-            //    break;
             case 'h':   /* fall-through is intentional */
             case '?':
                 display_usage();
@@ -145,6 +220,17 @@ int main(int argc, char** argv)
 
 	/* Range check the var args */
 
+    /* Batch mode converts each listed file to a file of its own */
+    if (batch[0] != 0) {
+        hbh_format from = { HBH_ODDBALL, 0, bps, 0, reverse, !littleendian, bigwords };
+        hbh_format to = { HBH_BIN };
+
+        if ((using_outfile==1) || (using_infile==1) || (first != 0) || (count != UINT64_MAX)) {
+            fprintf(stderr,"Error: --batch names its own files, so takes no -o, filename, --offset or --length\n");
+            exit(1);
+        }
+        exit((hbh_batch_run("nistoddball2bin", batch, batchout, &from, &to, 0, jobs, verbose) == 0) ? 0 : 1);
+    }
 
 	/* open the output file if needed */
 
@@ -157,111 +243,109 @@ int main(int argc, char** argv)
 		}
 	}
 
-	/* open the input file if needed */
-	if (using_infile==1)
-	{
-        ifp =  fopen(infilename, "rb");
-		    
-		if (ifp == NULL) {
-			perror("failed to open input file for reading");
-			exit(1);
-		}
-	}
+    /* open the input, memory mapping it if it is a regular file */
+    hbh_input input;
 
-    unsigned char buffer[2048];
+    if (hbh_input_open(&input, (using_infile==1) ? infilename : NULL) != 0) {
+        perror("failed to open input file for reading");
+        exit(1);
+    }
 
-    #define BITFIFO_SIZE 20000
-    unsigned char bitfifo[BITFIFO_SIZE];
-    int bitfifo_head = 0;
-    int bitfifo_tail = 0;
-    int bitfifo_entries = 0;
+    const unsigned char *buffer;
+    unsigned char *outbuffer;
+    size_t outsize;
+    size_t outindex;
+    hbh_output output;
+    long len;
+    hbh_oddball_decoder state;
+    hbh_pack_reader pack;
+    const unsigned char *head;
+    const unsigned char *symbols;
+    unsigned char *symbuffer = NULL;
+    int packed = 0;
+    uint64_t size;
+    size_t n;
 
-    unsigned char outbuffer[20000];
-    int outindex = 0;
-    int done=0;
-    size_t len;
-    unsigned char abit;
+    /* A packed file says how its symbols are packed, and the first one
+     * asked for can be gone straight to */
+    if ((hbh_input_peek(&input, &head, HBH_PACK_HEADER) == HBH_PACK_HEADER) &&
+        (hbh_pack_reader_init(&pack, head, first, count) == 0)) {
+        if ((gotl==1) && (bps != pack.bps)) {
+            fprintf(stderr,"Error: the input is packed with %d bits per symbol, not %d\n", pack.bps, bps);
+            exit(1);
+        }
+        /* -r is for the bytes written, so it follows the header unless
+         * given, when it reverses them whatever the header says */
+        if (gotr==0) reverse = pack.reverse;
+        packed = 1;
+        bps = pack.bps;
+        littleendian = pack.littleendian;
+        bigwords = pack.bigwords;
+        hbh_input_skip(&input, HBH_PACK_HEADER + hbh_pack_offset(bps, first));
+        symbuffer = malloc(hbh_pack_reader_bound(&pack, PACK_PIECE) + HBH_FINISH_BOUND);
+        if (symbuffer == NULL) {
+            perror("failed to allocate symbol buffer");
+            exit(1);
+        }
+        if (verbose==1) fprintf(stderr,"Packed input, %d bits per symbol, %s endian symbols\n",
+                                bps, (littleendian==1) ? "little" : "big");
+    } else {
+        /* Symbols over 8 bits are 2 or 4 bytes each */
+        size = (bps > 16) ? 4 : (bps > 8) ? 2 : 1;
+        hbh_input_skip(&input, (first > UINT64_MAX/size) ? UINT64_MAX : first*size);
+        hbh_input_limit(&input, (count > UINT64_MAX/size) ? UINT64_MAX : count*size);
+    }
 
-    int symbol_count;
-    int j;
-    int runcount = 0;
-    int last_abyte = -1;
-    int max_runcount = 0;
+    if (hbh_oddball_decode_init_words(&state, bps, reverse, littleendian, bigwords) != 0) {
+        fprintf(stderr,"Error: invalid conversion parameters\n");
+        exit(1);
+    }
+    outsize = hbh_oddball_decode_bound(&state, HBH_SLAB_SIZE);
+    if (outsize < HBH_FINISH_BOUND) outsize = HBH_FINISH_BOUND;
+    if (hbh_output_open(&output, (using_outfile==1) ? ofp : stdout, outsize) != 0) {
+        perror("failed to allocate output buffer");
+        exit(1);
+    }
 
     do {
-        if (using_infile==1)
-            len = fread(buffer, 1, 2048 , ifp);
+        if ((packed==1) && (pack.left == 0))
+            len = 0;
         else
-            len = fread(buffer, 1, 2048 , stdin);
-            
-        if (len == 0) break;
-
-        // Read in symbols into the FIFO of bits. bps bits per byte.        
-        for (i=0;i<len;i++) {
-            abyte = buffer[i];
-            
-            // If less that 8 bits per byte, and big endian, shift them
-            // to the left so that the MSB can be plucked off from the right.
-            if ((littleendian==0) && (bps < 8)) {
-                abyte = abyte << (8-bps);
-            }
-            
-            // Pluck off the bits and put into FIFO
-            for(j=0;j<bps;j++) {
-                if (littleendian==1) {
-                    abit = (abyte & 0x01);
-                    abyte = abyte >> 1;
-                } else {
-                    abit = (abyte & 0x80) >> 7;
-                    abyte = abyte << 1;
-                }
-                bitfifo_head = (bitfifo_head +1) % BITFIFO_SIZE;
-                bitfifo_entries++;
-                bitfifo[bitfifo_head] = abit;
-            }
+            len = hbh_input_next(&input, &buffer, (packed==1) ? PACK_PIECE : HBH_SLAB_SIZE);
+        if (len < 0) {
+            perror("failed to read input");
+            exit(1);
         }
 
-        // Work out how many full bytes are in the FIFO.
-        symbol_count = bitfifo_entries / 8;
-
-        //Pull bits from the FIFO and Write out bytes;
-        for (i=0;i<symbol_count;i++) {
-            abyte = 0;
-            // Read the bits of one byte and put into a byte
-            for (j=0;j<8;j++) {
-                bitfifo_tail = (bitfifo_tail +1) % BITFIFO_SIZE;
-                bitfifo_entries--;
-                abit = bitfifo[bitfifo_tail];
-                if (reverse==0) {
-                    abyte = abyte + (abit << j);
-                } else {
-                    abyte = (abyte << 1) | abit;
-                }
-            }
+        if (packed==1) {
+            if (len == 0)
+                n = hbh_pack_reader_finish(&pack, symbuffer);
+            else
+                n = hbh_pack_reader_update(&pack, buffer, (size_t)len, symbuffer);
+            symbols = symbuffer;
+        } else {
+            n = (size_t)len;
+            symbols = buffer;
+        }
 
-            outbuffer[outindex] = abyte;
-            outindex += 1;
+        outbuffer = hbh_output_space(&output);
+        outindex = hbh_oddball_decode_update(&state, symbols, n, outbuffer);
+        if (len == 0) outindex += hbh_oddball_decode_finish(&state, outbuffer + outindex);
 
-            if (abyte==last_abyte) {
-                runcount++;
-                if (runcount > max_runcount) {
-                    max_runcount = runcount;
-                }
-            } else {
-                runcount = 1;
-                last_abyte = abyte;
-            }
+        if (hbh_output_commit(&output, outindex) != 0) {
+            perror("failed to write output");
+            exit(1);
         }
-        
-        if (using_outfile)
-            fwrite(outbuffer, outindex,1,ofp);
-        else
-            fwrite(outbuffer, outindex,1,stdout);
-        
-        outindex = 0;
-        
-    } while (done==0);
-    
+
+    } while (len != 0);
+
+    if (hbh_output_close(&output) != 0) {
+        perror("failed to write output");
+        exit(1);
+    }
+    if (verbose==1) hbh_report_throughput("nistoddball2bin", &input, &output);
+    free(symbuffer);
+    hbh_input_close(&input);
     //if (using_outfile==1) fclose(ofp);
     //printf("max_runcount = %d\n",max_runcount);
 
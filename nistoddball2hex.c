@@ -0,0 +1,275 @@
+
+/*
+    nistoddball2hex - A utility to convert NIST oddball format straight to hex data.
+    
+    Copyright (C) 2024  David Johnston
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    -----
+    
+    Contact. David Johnston dj@deadhat.com
+*/
+/* make isnan() visible */
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "hexbinhex.h"
+#include "hbh_io.h"
+#include "hbh_batch.h"
+
+void display_usage() {
+fprintf(stderr,"Usage: nistoddball2hex [-l <bits_per_symbol 1-8>][-r][-B|-L][-w <width>][-v][-K kernel][-h][-o <out filename>] [filename]\n");
+fprintf(stderr,"       -l n          Set the number of symbol bits per byte encoded in the input data. Must be between 1 to 8\n");
+fprintf(stderr,"       -B            Interpret the input symbols at being big endian (MSB first)\n");
+fprintf(stderr,"       -L            Interpret the input symbols at being little endian (LSB first) (default)\n");
+fprintf(stderr,"       -r            Write the bytes of the output hex big endian (MSB first) (default is little endian)\n");
+fprintf(stderr,"       -w n          Set the number of bytes per line of hex output (default 32)\n");
+fprintf(stderr,"       -v            Verbose mode. Outputs information to stderr\n");
+fprintf(stderr,"       -K name       Use the scalar, sse4, avx2 or avx512 kernels\n");
+fprintf(stderr,"       --batch <glob|@list> Convert each matching or listed file to its own file\n");
+fprintf(stderr,"       --batch-out <template> Output path of each, default %%d/%%b.%%e\n");
+fprintf(stderr,"       --batch-jobs <n> Convert the batch on n threads (default one per CPU)\n");
+fprintf(stderr,"       -h            Display this information\n");
+fprintf(stderr,"       -o filename   Output to file filename instead of stdout\n");
+fprintf(stderr,"\n");
+fprintf(stderr,"Convert NIST Oddball SP800-90B one-symbol-per-byte format to hexadecimal.\n");
+fprintf(stderr,"  Author: David Johnston, dj@deadhat.com\n");
+fprintf(stderr,"\n");
+fprintf(stderr,"Notes:\n");
+fprintf(stderr,"      The NIST format for SP800-90B testing requires symbols to be as one symbol per byte.\n");
+fprintf(stderr,"      This means only symbols of sizes 1 through 8 bits can be supported.\n");
+fprintf(stderr,"      The bit ordering of the bits within the symbols is not specified by NIST. The -L and -B options allow you to choose.\n");
+fprintf(stderr,"      The bytes of the output hex by default is in little endian format, with the lower order bits in bytes coming before higher order bits. This can be reversed with the -r option.\n");
+}
+
+/********
+* main() is mostly about parsing and qualifying the command line options.
+*/
+
+int main(int argc, char** argv)
+{
+    int opt;
+	
+	FILE *ofp = NULL;   // Output file pointer
+	int using_outfile;      // True if -o <file> option used
+	int using_infile = 0;   // True if input filename given
+	int verbose = 0;
+	char filename[1000];    // Let's hope the filename isn't bigger
+	char infilename[1000];
+    char batch[1000];
+    char batchout[1000];
+    int jobs = 0;
+	
+    int bps;        // Bits per Symbol
+    int width = 32; // Bytes per line of hex
+
+    int littleendian=1;
+    int reverse = 0;
+    
+	/* Defaults */
+	using_outfile = 0;       /* use stdout instead of outputfile*/
+    bps = 1;    
+    filename[0] = (char)0;
+	infilename[0] = (char)0;
+    batch[0] = (char)0;
+    strcpy(batchout, HBH_BATCH_OUT);
+
+	/* get the options and arguments */
+    int longIndex;
+
+    char optString[] = "o:k:l:w:BLrK:vh";
+    static const struct option longOpts[] = {
+    { "output", required_argument, NULL, 'o' },
+    { "width", required_argument, NULL, 'w' },
+    { "bits_per_symbol", required_argument, NULL, 'l' },
+    { "littleendian", no_argument, NULL, 'L' },
+    { "bigendian", no_argument, NULL, 'B' },
+    { "reverse", no_argument, NULL, 'r' },
+    { "verbose", no_argument, NULL, 'v' },
+    { "kernel", required_argument, NULL, 'K' },
+    { "batch", required_argument, NULL, 'A' },
+    { "batch-out", required_argument, NULL, 'O' },
+    { "batch-jobs", required_argument, NULL, 'J' },
+    { "help", no_argument, NULL, 'h' },
+    { NULL, no_argument, NULL, 0 }
+    };
+
+    opt = getopt_long( argc, argv, optString, longOpts, &longIndex );
+    while( opt != -1 ) {
+        switch( opt ) {
+            case 'o':
+                using_outfile = 1;
+                strcpy(filename,optarg);
+                break;
+            case 'l':
+                bps = atoi(optarg);
+                if ((bps < 1) || (bps > 8)) {
+                    perror("Error, bits per symbol bust be between 1 and 8");
+                    display_usage();
+                    exit(-1);
+                };
+                break;
+            case 'w':
+                width=atoi(optarg);
+                if (width<1) width=32;
+                break;
+            case 'L':
+                littleendian=1;
+                //gotL=1;
+                break;
+            case 'B':
+                littleendian=0;
+                //gotB=1;
+                break;
+            case 'r':
+                reverse=1;
+                break;
+            case 'v':
+                verbose=1;
+                break;
+            case 'K':
+                if (hbh_kernel_set(hbh_kernel_parse(optarg)) != 0) {
+                    fprintf(stderr,"Error: kernel %s is unknown or not supported by this CPU\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'A':
+                if (strlen(optarg) >= sizeof(batch)) {
+                    fprintf(stderr,"Error: batch file list too long\n");
+                    exit(1);
+                }
+                strcpy(batch,optarg);
+                break;
+            case 'O':
+                if (strlen(optarg) >= sizeof(batchout)) {
+                    fprintf(stderr,"Error: batch output template too long\n");
+                    exit(1);
+                }
+                strcpy(batchout,optarg);
+                break;
+            case 'J':
+                jobs = atoi(optarg);
+                break;
+            case 'h':   /* fall-through is intentional */
+            case '?':
+                display_usage();
+                exit(0);
+                 
+            default:
+                /* You won't actually get here. */
+                break;
+        }
+         
+        opt = getopt_long( argc, argv, optString, longOpts, &longIndex );
+    } // end while
+    
+    if (optind < argc) {
+        strcpy(infilename,argv[optind]);
+        using_infile = 1;
+    }
+
+	/* Range check the var args */
+
+    /* Batch mode converts each listed file to a file of its own */
+    if (batch[0] != 0) {
+        hbh_format from = { HBH_ODDBALL, 0, bps, 0, reverse, !littleendian };
+        hbh_format to = { HBH_HEX, width };
+
+        if ((using_outfile==1) || (using_infile==1)) {
+            fprintf(stderr,"Error: --batch names its own files, so takes no -o or filename\n");
+            exit(1);
+        }
+        exit((hbh_batch_run("nistoddball2hex", batch, batchout, &from, &to, 0, jobs, verbose) == 0) ? 0 : 1);
+    }
+
+	/* open the output file if needed */
+
+	if (using_outfile==1)
+	{
+		ofp = fopen(filename, "w");
+		if (ofp == NULL) {
+			perror("failed to open output file for writing");
+			exit(1);
+		}
+	}
+
+    /* open the input, memory mapping it if it is a regular file */
+    hbh_input input;
+
+    if (hbh_input_open(&input, (using_infile==1) ? infilename : NULL) != 0) {
+        perror("failed to open input file for reading");
+        exit(1);
+    }
+
+    const unsigned char *buffer;
+    unsigned char *outbuffer;
+    size_t outsize;
+    size_t outindex;
+    hbh_output output;
+    long len;
+    hbh_oddball_hex state;
+
+    if (hbh_oddball_hex_init(&state, bps, reverse, littleendian, width) != 0) {
+        fprintf(stderr,"Error: invalid conversion parameters\n");
+        exit(1);
+    }
+    outsize = hbh_oddball_hex_bound(&state, HBH_SLAB_SIZE);
+    if (outsize < HBH_FINISH_BOUND) outsize = HBH_FINISH_BOUND;
+    if (hbh_output_open(&output, (using_outfile==1) ? ofp : stdout, outsize) != 0) {
+        perror("failed to allocate output buffer");
+        exit(1);
+    }
+
+    do {
+        len = hbh_input_next(&input, &buffer, HBH_SLAB_SIZE);
+        if (len < 0) {
+            perror("failed to read input");
+            exit(1);
+        }
+
+        outbuffer = hbh_output_space(&output);
+        if (len == 0)
+            outindex = hbh_oddball_hex_finish(&state, outbuffer);
+        else
+            outindex = hbh_oddball_hex_update(&state, buffer, (size_t)len, outbuffer);
+
+        if (hbh_output_commit(&output, outindex) != 0) {
+            perror("failed to write output");
+            exit(1);
+        }
+
+    } while (len != 0);
+
+    if (hbh_output_close(&output) != 0) {
+        perror("failed to write output");
+        exit(1);
+    }
+    if (verbose==1) hbh_report_throughput("nistoddball2hex", &input, &output);
+    hbh_input_close(&input);
+    //if (using_outfile==1) fclose(ofp);
+    //printf("max_runcount = %d\n",max_runcount);
+
+    return 0;
+}
+
+
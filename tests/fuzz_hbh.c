@@ -0,0 +1,136 @@
+/*
+    fuzz_hbh.c - Fuzz entry point for the hexbinhex parsers.
+
+    Copyright (C) 2017  David Johnston
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    -----
+
+    Contact. David Johnston dj@deadhat.com
+*/
+
+/*
+ * LLVMFuzzerTestOneInput() for libFuzzer, and for AFL and plain replay
+ * through fuzz_main.c. The first byte of the input picks what to fuzz:
+ *
+ *   0        the format strings: the rest of the input is "from>to",
+ *            parsed with hbh_format_parse() and, if both parse, used to
+ *            convert a short fixed input
+ *   1 to 4   the hex, ASCII binary, oddball and decimal decoders. The
+ *            second byte holds the options and the third how to split the
+ *            rest into pieces. The output is compared with the oracle.
+ *
+ * A mismatch abort()s, so the fuzzer keeps the input.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "hexbinhex.h"
+#include "oracle.h"
+
+static void fuzz_formats(const uint8_t *data, size_t size) {
+    static const unsigned char sample[] = "0123456789abcdef 0x10 10110 255\n";
+    char names[256];
+    char *to;
+    hbh_format from;
+    hbh_format tof;
+    hbh_converter c;
+    unsigned char *out;
+    size_t n;
+
+    if (size >= sizeof(names)) size = sizeof(names) - 1;
+    memcpy(names, data, size);
+    names[size] = 0;
+    to = strchr(names, '>');
+    if (to == NULL) return;
+    *to++ = 0;
+
+    if ((hbh_format_parse(&from, names) != 0) || (hbh_format_parse(&tof, to) != 0)) return;
+    if (hbh_convert_init(&c, &from, &tof) != 0) return;
+    out = malloc(hbh_convert_bound(&c, sizeof(sample)));
+    if (out == NULL) return;
+    n = hbh_convert_update(&c, sample, sizeof(sample), out);
+    hbh_convert_finish(&c, out + n);
+    free(out);
+}
+
+static void fuzz_decoder(int which, const uint8_t *data, size_t size) {
+    static const char *names[4] = { "hex", "01", "oddball", "dec" };
+    char name[32];
+    hbh_format from;
+    hbh_format to;
+    hbh_converter c;
+    unsigned char *want;
+    unsigned char *got;
+    size_t wantlen;
+    size_t gotlen = 0;
+    size_t piece;
+    size_t n;
+    int opts;
+
+    if (size < 2) return;
+    opts = data[0];
+    piece = 1 + data[1];
+    data += 2;
+    size -= 2;
+
+    switch (which) {
+        case 1:
+            snprintf(name, sizeof(name), "%s", names[0]);
+            break;
+        case 2:
+            snprintf(name, sizeof(name), "%s%s", names[1], (opts & 1) ? ":be" : "");
+            break;
+        case 3:
+            snprintf(name, sizeof(name), "%s:%d%s%s%s", names[2], 1 + (opts & 7) + 8*((opts >> 5) & 3),
+                     (opts & 8) ? ":r" : "", (opts & 16) ? ":be" : "", (opts & 128) ? ":bw" : "");
+            break;
+        default:
+            snprintf(name, sizeof(name), "%s:%d%s", names[3], 1 + (opts & 7), (opts & 8) ? ":be" : "");
+            break;
+    }
+    if ((hbh_format_parse(&from, name) != 0) || (hbh_format_parse(&to, "bin") != 0)) abort();
+
+    want = ref_convert(&from, &to, data, size, &wantlen);
+    if (hbh_convert_init(&c, &from, &to) != 0) abort();
+    got = malloc(hbh_convert_bound(&c, size));
+    if ((want == NULL) || (got == NULL)) abort();
+
+    while (size > 0) {
+        n = (size > piece) ? piece : size;
+        gotlen += hbh_convert_update(&c, data, n, got + gotlen);
+        data += n;
+        size -= n;
+    }
+    gotlen += hbh_convert_finish(&c, got + gotlen);
+
+    if ((gotlen != wantlen) || (memcmp(got, want, gotlen) != 0)) {
+        fprintf(stderr,"%s decoder differs from the oracle: %zu bytes, expected %zu\n", name, gotlen, wantlen);
+        abort();
+    }
+    free(want);
+    free(got);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    if (size < 1) return 0;
+    if ((data[0] % 5) == 0) fuzz_formats(data+1, size-1);
+    else fuzz_decoder(data[0] % 5, data+1, size-1);
+    return 0;
+}
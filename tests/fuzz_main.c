@@ -0,0 +1,109 @@
+/*
+    fuzz_main.c - Standalone driver for the hexbinhex fuzz entry point.
+
+    Copyright (C) 2017  David Johnston
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    -----
+
+    Contact. David Johnston dj@deadhat.com
+*/
+
+/*
+ * Runs LLVMFuzzerTestOneInput() without libFuzzer:
+ *
+ *     fuzz_hbh_run file...     each file once, e.g. a crash to replay
+ *     fuzz_hbh_run -n count    count pseudo-random inputs, for make check
+ *     fuzz_hbh_run < file      stdin once, as AFL runs it. Built with
+ *                              afl-clang-fast it loops in persistent mode.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#define MAX_INPUT (1024*1024)
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+static uint8_t buf[MAX_INPUT];
+
+static size_t read_all(FILE *fp) {
+    size_t len = 0;
+    size_t n;
+
+    while ((len < MAX_INPUT) && ((n = fread(buf + len, 1, MAX_INPUT - len, fp)) > 0)) len += n;
+    return len;
+}
+
+/* Short inputs built from the characters the parsers care about */
+static void run_random(long count) {
+    static const char alphabet[] = "0123456789abcdefABCDEFx \n:>rsbe01hexdecoddball";
+    uint64_t x = 0x9E3779B97F4A7C15ULL;
+    size_t len;
+    size_t i;
+    long k;
+
+    for (k=0;k<count;k++) {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        len = (size_t)(x % 300);
+        for (i=0;i<len;i++) {
+            x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+            buf[i] = (i < 3 || (x & 0x700) == 0) ? (uint8_t)(x >> 32) : (uint8_t)alphabet[(x >> 32) % (sizeof(alphabet) - 1)];
+        }
+        LLVMFuzzerTestOneInput(buf, len);
+    }
+    fprintf(stderr,"%ld random inputs passed\n", count);
+}
+
+int main(int argc, char **argv)
+{
+    FILE *fp;
+    size_t len;
+    int i;
+
+    if ((argc == 3) && (strcmp(argv[1], "-n") == 0)) {
+        run_random(atol(argv[2]));
+        return 0;
+    }
+
+    if (argc > 1) {
+        for (i=1;i<argc;i++) {
+            fp = fopen(argv[i], "rb");
+            if (fp == NULL) {
+                perror(argv[i]);
+                exit(1);
+            }
+            len = read_all(fp);
+            fclose(fp);
+            LLVMFuzzerTestOneInput(buf, len);
+        }
+        return 0;
+    }
+
+#ifdef __AFL_LOOP
+    while (__AFL_LOOP(10000)) {
+        len = (size_t)read(0, buf, MAX_INPUT);
+        if (len != (size_t)-1) LLVMFuzzerTestOneInput(buf, len);
+    }
+#else
+    len = read_all(stdin);
+    LLVMFuzzerTestOneInput(buf, len);
+#endif
+    return 0;
+}
@@ -0,0 +1,1443 @@
+/*
+    hbh_test - Randomised differential tests for the hexbinhex converters.
+
+    Copyright (C) 2017  David Johnston
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    -----
+
+    Contact. David Johnston dj@deadhat.com
+*/
+
+/*
+ * Each iteration picks a random pair of formats with random options and a
+ * random input in the first format, messy where the format allows it,
+ * and checks that everything which converts between them gives what the
+ * scalar oracle gives:
+ *
+ *   - hbh_convert_update() fed the input in randomly sized pieces
+ *   - the fused hex <-> oddball converters
+ *   - the scan/chain/decode path hex2bin -j takes, on random blocks
+ *   - the seek path bin2hex -j and bin201 -j take, on random blocks
+ *   - with -d, the tools themselves, reading a file, stdin or a pipe,
+ *     writing to a file and to a pipe, with and without the reader and
+ *     writer threads, and with -j where they have it
+ *   - with -d, the tools' batch mode over several files at once
+ *   - the packed oddball container's reader from random symbols on, and
+ *     with -d, bin2nistoddball --packed and nistoddball2bin --offset
+ *   - with one side binary, --offset and --length: hbh_range from
+ *     random checkpoint steps, building and then reading its index, and
+ *     with -d the tool itself, against a slice of the oracle's output
+ *   - for binary to oddball, hbh_stats against counts, transitions and
+ *     runs taken from the oracle's symbols one at a time
+ *
+ * The library routes are run with each kernel level the CPU supports and
+ * the tools with a random one.
+ *
+ * Binary in a format is also decoded back and checked against what the
+ * format keeps of it. Every iteration has its own seed, printed on
+ * failure, so hbh_test -s <seed> -n 1 repeats it.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "hexbinhex.h"
+#include "hbh_io.h"
+#include "hbh_range.h"
+#include "oracle.h"
+
+/* Big enough for -j to split the input between threads */
+#define LARGE_SIZE (9*1024*1024)
+
+static uint64_t rng;
+static int verbose = 0;
+static int failures = 0;
+static char tooldir[1000];
+static char tmpdir[64];
+
+static uint64_t rnd(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return rng;
+}
+
+static int rnd_below(int n) {
+    return (int)(rnd() % (uint64_t)n);
+}
+
+void display_usage() {
+    fprintf(stderr,"Usage: hbh_test [-n iterations][-s seed][-d tooldir][-v][-h]\n");
+    fprintf(stderr,"       -n n          Run n random cases (default 1000)\n");
+    fprintf(stderr,"       -s seed       Seed of the first case (default 1)\n");
+    fprintf(stderr,"       -d dir        Test the tools in dir as well as the library\n");
+    fprintf(stderr,"       -v            Print each case\n");
+    fprintf(stderr,"\n");
+    fprintf(stderr,"Check the library and tools against the scalar reference converters.\n");
+    fprintf(stderr,"\n");
+}
+
+/* Bytes per oddball symbol */
+static int oddball_size(const hbh_format *f) {
+    return (f->bps > 16) ? 4 : (f->bps > 8) ? 2 : 1;
+}
+
+/* A random format, as an hbh format string */
+static void random_format(char *name, size_t size, int allow_bin) {
+    int r = rnd_below(allow_bin ? 5 : 4) + (allow_bin ? 0 : 1);
+
+    switch (r) {
+        case 0:
+            snprintf(name, size, "bin");
+            break;
+        case 1:
+            snprintf(name, size, "hex:%d", 1 + rnd_below(rnd_below(4) ? 40 : 300));
+            break;
+        case 2:
+            snprintf(name, size, "01:%d%s%s", 1 + rnd_below(rnd_below(4) ? 72 : 600),
+                     rnd_below(2) ? ":s" : "", rnd_below(2) ? ":be" : "");
+            break;
+        case 3:
+            snprintf(name, size, "oddball:%d%s%s%s", 1 + rnd_below(rnd_below(2) ? 8 : 32),
+                     rnd_below(2) ? ":r" : "", rnd_below(2) ? ":be" : "", rnd_below(2) ? ":bw" : "");
+            break;
+        default:
+            snprintf(name, size, "dec:%d%s", 1 + rnd_below(8), rnd_below(2) ? ":be" : "");
+            break;
+    }
+}
+
+static const char hexdigits[] = "0123456789abcdefABCDEF";
+static const char separators[] = " \n\r\t,;:-";
+
+/* Input in the given format. Text formats get separators, stray
+ * characters and, now and then, 0x prefixes, leading zeros and numbers
+ * too big for 64 bits. */
+static void random_input(const hbh_format *f, unsigned char *buf, size_t len) {
+    size_t i = 0;
+    int noise = rnd_below(4);   /* 0 is clean */
+    int n;
+    int j;
+
+    switch (f->format) {
+        case HBH_HEX:
+            while (i < len) {
+                if (noise && (rnd_below(40) == 0) && (i+2 <= len)) {
+                    buf[i++] = '0';
+                    buf[i++] = 'x';
+                } else if (noise && (rnd_below(16) == 0)) {
+                    buf[i++] = (rnd_below(2)) ? separators[rnd_below(8)] : (unsigned char)rnd();
+                } else {
+                    buf[i++] = hexdigits[rnd_below(noise ? 22 : 16)];
+                }
+            }
+            break;
+        case HBH_BITS:
+            while (i < len) {
+                if (noise && (rnd_below(12) == 0))
+                    buf[i++] = (rnd_below(2)) ? separators[rnd_below(8)] : (unsigned char)rnd();
+                else
+                    buf[i++] = '0' + rnd_below(2);
+            }
+            break;
+        case HBH_ODDBALL:
+            /* Clean symbols have nothing above bps in their byte or word */
+            n = oddball_size(f);
+            for (i=0;i<len;i++) {
+                buf[i] = (unsigned char)rnd();
+                j = f->bps - 8*((f->bigwords) ? n-1-(int)(i % n) : (int)(i % n));
+                if ((noise == 0) && (j < 8)) buf[i] &= (unsigned char)((j > 0) ? (1 << j) - 1 : 0);
+            }
+            break;
+        case HBH_DEC:
+            while (i < len) {
+                n = 1 + rnd_below(20);
+                if (rnd_below(30) == 0) n = 20 + rnd_below(300);
+                for (j=0;(j<n) && (i<len);j++) {
+                    if ((j == 0) && (rnd_below(8) == 0)) buf[i++] = '0';
+                    else buf[i++] = '0' + rnd_below(10);
+                }
+                if (i < len) buf[i++] = noise ? separators[rnd_below(8)] : '\n';
+                while (noise && (i < len) && (rnd_below(4) == 0))
+                    buf[i++] = (unsigned char)rnd();
+            }
+            break;
+        default:
+            for (i=0;i<len;i++) buf[i] = (unsigned char)rnd();
+            break;
+    }
+}
+
+/* Mostly small, sometimes awkward, now and then bigger than a block */
+static size_t random_length(void) {
+    static const size_t awkward[] = { 0, 1, 2, 3, 7, 8, 9, 15, 16, 17, 31, 32, 33, 63, 64, 65 };
+
+    switch (rnd_below(8)) {
+        case 0:  return awkward[rnd_below(16)];
+        case 1:  return (size_t)rnd_below(200000);
+        default: return (size_t)rnd_below(5000);
+    }
+}
+
+static size_t random_piece(size_t left) {
+    static const size_t awkward[] = { 0, 1, 2, 3, 7, 8, 15, 16, 31, 32, 33, 63, 64, 65 };
+    size_t n;
+
+    switch (rnd_below(4)) {
+        case 0:  n = awkward[rnd_below(14)]; break;
+        case 1:  n = left; break;
+        default: n = (size_t)rnd_below(9000); break;
+    }
+    return (n > left) ? left : n;
+}
+
+static void fail(uint64_t seed, const char *what, const char *from, const char *to, size_t len,
+                 const unsigned char *got, size_t gotlen, const unsigned char *want, size_t wantlen) {
+    size_t i;
+
+    for (i=0;(i<gotlen) && (i<wantlen) && (got[i]==want[i]);i++);
+    fprintf(stderr,"FAIL seed %llu: %s %s -> %s, %zu bytes in: %zu bytes out, expected %zu, first difference at %zu\n",
+            (unsigned long long)seed, what, from, to, len, gotlen, wantlen, i);
+    failures++;
+}
+
+static void check(uint64_t seed, const char *what, const char *from, const char *to, size_t len,
+                  const unsigned char *got, size_t gotlen, const unsigned char *want, size_t wantlen) {
+    if ((gotlen != wantlen) || (memcmp(got, want, gotlen) != 0))
+        fail(seed, what, from, to, len, got, gotlen, want, wantlen);
+}
+
+static void *xmalloc(size_t size) {
+    void *p = malloc(size);
+    if (p == NULL) {
+        perror("failed to allocate memory");
+        exit(1);
+    }
+    return p;
+}
+
+/* hbh_convert_update() on random pieces */
+static unsigned char *run_converter(const hbh_format *from, const hbh_format *to, const unsigned char *in, size_t len, size_t *outlen) {
+    hbh_converter c;
+    unsigned char *out;
+    size_t total = 0;
+    size_t n;
+
+    if (hbh_convert_init(&c, from, to) != 0) return NULL;
+    out = xmalloc(hbh_convert_bound(&c, len));
+    while (len > 0) {
+        n = random_piece(len);
+        total += hbh_convert_update(&c, in, n, out + total);
+        in += n;
+        len -= n;
+    }
+    total += hbh_convert_finish(&c, out + total);
+    *outlen = total;
+    return out;
+}
+
+/* The fused converters, for hex <-> oddball. They take little endian
+ * words. NULL for anything else. */
+static unsigned char *run_fused(const hbh_format *from, const hbh_format *to, const unsigned char *in, size_t len, size_t *outlen) {
+    hbh_hex_oddball ho;
+    hbh_oddball_hex oh;
+    unsigned char *out;
+    size_t total = 0;
+    size_t n;
+
+    if ((from->format == HBH_HEX) && (to->format == HBH_ODDBALL) && !to->bigwords) {
+        hbh_hex_oddball_init(&ho, to->bps, to->reverse, !to->bigendian);
+        out = xmalloc(hbh_hex_oddball_bound(&ho, len) + HBH_FINISH_BOUND);
+        while (len > 0) {
+            n = random_piece(len);
+            total += hbh_hex_oddball_update(&ho, in, n, out + total);
+            in += n;
+            len -= n;
+        }
+        total += hbh_hex_oddball_finish(&ho, out + total);
+    } else if ((from->format == HBH_ODDBALL) && (to->format == HBH_HEX) && !from->bigwords) {
+        hbh_oddball_hex_init(&oh, from->bps, from->reverse, !from->bigendian, to->width);
+        out = xmalloc(hbh_oddball_hex_bound(&oh, len) + HBH_FINISH_BOUND);
+        while (len > 0) {
+            n = random_piece(len);
+            total += hbh_oddball_hex_update(&oh, in, n, out + total);
+            in += n;
+            len -= n;
+        }
+        total += hbh_oddball_hex_finish(&oh, out + total);
+    } else {
+        return NULL;
+    }
+    *outlen = total;
+    return out;
+}
+
+/* Hex decoded as hex2bin -j does it: scan random blocks, chain them, then
+ * decode each block on its own from its starting nibble. */
+static unsigned char *run_hex_chained(const unsigned char *in, size_t len, size_t *outlen) {
+    hbh_hex_decoder d;
+    hbh_hex_span span;
+    unsigned char *out;
+    size_t total = 0;
+    size_t expect;
+    size_t n;
+    int pending = -1;
+    int next;
+
+    hbh_hex_decode_init(&d);
+    out = xmalloc(hbh_hex_decode_bound(&d, len) + HBH_FINISH_BOUND);
+    while (len > 0) {
+        n = random_piece(len);
+        hbh_hex_decode_scan(in, n, &span);
+        expect = total;
+        next = hbh_hex_span_chain(&span, pending, &expect);
+        hbh_hex_decode_init_pending(&d, pending);
+        total += hbh_hex_decode_update(&d, in, n, out + total);
+        if ((total != expect) || (d.pending != next)) {
+            *outlen = 0;
+            return out;
+        }
+        pending = next;
+        in += n;
+        len -= n;
+    }
+    hbh_hex_decode_init_pending(&d, pending);
+    total += hbh_hex_decode_finish(&d, out + total);
+    *outlen = total;
+    return out;
+}
+
+/* Hex or ASCII binary encoded as bin2hex -j and bin201 -j do it: each
+ * random block by a fresh encoder seeked to its place. NULL for other
+ * formats. */
+static unsigned char *run_seeked(const hbh_format *to, const unsigned char *in, size_t len, size_t *outlen) {
+    hbh_hex_encoder he;
+    hbh_bits_encoder be;
+    unsigned char *out;
+    uint64_t pos = 0;
+    size_t total = 0;
+    size_t n;
+
+    if (to->format == HBH_HEX) {
+        hbh_hex_encode_init(&he, to->width);
+        out = xmalloc(hbh_hex_encode_bound(&he, len) + HBH_FINISH_BOUND);
+    } else if (to->format == HBH_BITS) {
+        hbh_bits_encode_init(&be, to->width, to->spaces, !to->bigendian);
+        out = xmalloc(hbh_bits_encode_bound(&be, len) + HBH_FINISH_BOUND);
+    } else {
+        return NULL;
+    }
+
+    while (len > 0) {
+        n = random_piece(len);
+        if (to->format == HBH_HEX) {
+            hbh_hex_encode_init(&he, to->width);
+            if (hbh_hex_encode_seek(&he, pos) != total) break;
+            total += hbh_hex_encode_update(&he, in, n, out + total);
+        } else {
+            hbh_bits_encode_init(&be, to->width, to->spaces, !to->bigendian);
+            if (hbh_bits_encode_seek(&be, pos) != total) break;
+            total += hbh_bits_encode_update(&be, in, n, out + total);
+        }
+        pos += n;
+        in += n;
+        len -= n;
+    }
+
+    if (to->format == HBH_HEX) {
+        hbh_hex_encode_init(&he, to->width);
+        if (hbh_hex_encode_seek(&he, pos) == total) total += hbh_hex_encode_finish(&he, out + total);
+    } else {
+        hbh_bits_encode_init(&be, to->width, to->spaces, !to->bigendian);
+        if (hbh_bits_encode_seek(&be, pos) == total) total += hbh_bits_encode_finish(&be, out + total);
+    }
+    *outlen = total;
+    return out;
+}
+
+/* The command line that does from -> to. Uses the dedicated tool where
+ * there is one unless use_hbh is set. Returns the argument count. */
+static int tool_command(const hbh_format *from, const hbh_format *to, const char *fromname, const char *toname,
+                        int use_hbh, int threads, int level, char args[][1100], char **argv) {
+    int argc = 0;
+    int f = from->format;
+    int t = to->format;
+    const hbh_format *o = (f == HBH_ODDBALL) ? from : to;
+
+#define ARG(...) do { snprintf(args[argc], sizeof(args[0]), __VA_ARGS__); argv[argc] = args[argc]; argc++; } while (0)
+    if ((f == HBH_HEX) && (t == HBH_BIN) && !use_hbh) {
+        ARG("%s/hex2bin", tooldir);
+    } else if ((f == HBH_BIN) && (t == HBH_HEX) && !use_hbh) {
+        ARG("%s/bin2hex", tooldir);
+        ARG("-w"); ARG("%d", to->width);
+    } else if ((f == HBH_BIN) && (t == HBH_BITS) && !use_hbh) {
+        ARG("%s/bin201", tooldir);
+        ARG("-w"); ARG("%d", to->width);
+        if (to->spaces) ARG("-s");
+        if (to->bigendian) ARG("-B");
+    } else if ((f == HBH_BITS) && (t == HBH_BIN) && !use_hbh) {
+        ARG("%s/012bin", tooldir);
+        if (from->bigendian) ARG("-B");
+    } else if ((((f == HBH_BIN) && (t == HBH_ODDBALL)) || ((f == HBH_ODDBALL) && (t == HBH_BIN)) ||
+                ((((f == HBH_HEX) && (t == HBH_ODDBALL)) || ((f == HBH_ODDBALL) && (t == HBH_HEX))) && (o->bps <= 8))) &&
+               !use_hbh) {
+        if (f == HBH_BIN) ARG("%s/bin2nistoddball", tooldir);
+        else if (t == HBH_BIN) ARG("%s/nistoddball2bin", tooldir);
+        else if (f == HBH_HEX) ARG("%s/hex2nistoddball", tooldir);
+        else ARG("%s/nistoddball2hex", tooldir);
+        ARG("-l"); ARG("%d", o->bps);
+        if (o->reverse) ARG("-r");
+        if (o->bigendian) ARG("-B");
+        if (o->bigwords && ((f == HBH_BIN) || (t == HBH_BIN))) ARG("-b");
+        if (t == HBH_HEX) {
+            ARG("-w"); ARG("%d", to->width);
+        }
+    } else if ((f == HBH_BIN) && (t == HBH_DEC) && !use_hbh) {
+        ARG("%s/bin2dec", tooldir);
+        ARG("-w"); ARG("%d", to->width);
+        if (to->bigendian) ARG("-b");
+    } else if ((f == HBH_DEC) && (t == HBH_BIN) && !use_hbh) {
+        ARG("%s/dec2bin", tooldir);
+        ARG("-w"); ARG("%d", from->width);
+        if (from->bigendian) ARG("-b");
+    } else {
+        ARG("%s/hbh", tooldir);
+        ARG("-f"); ARG("%s", fromname);
+        ARG("-t"); ARG("%s", toname);
+    }
+    if (threads > 0) {
+        ARG("-j"); ARG("%d", threads);
+    }
+    ARG("--kernel=%s", hbh_kernel_name(level));
+#undef ARG
+    argv[argc] = NULL;
+    return argc;
+}
+
+/* Feed infile into a pipe on stdin, from a child of the tool's process */
+static void pipe_stdin(const char *infile) {
+    unsigned char block[65536];
+    ssize_t n;
+    int pipefd[2];
+    int fd;
+
+    if (pipe(pipefd) != 0) _exit(127);
+    if (fork() == 0) {
+        close(pipefd[0]);
+        fd = open(infile, O_RDONLY);
+        while ((n = read(fd, block, sizeof(block))) > 0) {
+            if (write(pipefd[1], block, (size_t)n) != n) break;
+        }
+        _exit(0);
+    }
+    close(pipefd[1]);
+    dup2(pipefd[0], 0);
+    close(pipefd[0]);
+}
+
+/* Run a tool on infile, either naming it, on stdin (1) or piped to stdin
+ * (2), and collect what it writes to a regular file or to a pipe. sync
+ * turns the reader and writer threads off. */
+static unsigned char *run_tool(char **argv, const char *infile, int on_stdin, int to_pipe, int sync, size_t *outlen) {
+    char outfile[128];
+    unsigned char *out = NULL;
+    size_t size = 0;
+    size_t total = 0;
+    ssize_t n;
+    int pipefd[2];
+    int status;
+    int argc;
+    int fd;
+    pid_t pid;
+
+    for (argc=0;argv[argc]!=NULL;argc++);
+    if (!on_stdin) {
+        argv[argc] = (char *)infile;
+        argv[argc+1] = NULL;
+    }
+    snprintf(outfile, sizeof(outfile), "%s/out", tmpdir);
+
+    if (to_pipe && (pipe(pipefd) != 0)) {
+        perror("failed to make a pipe");
+        exit(1);
+    }
+
+    pid = fork();
+    if (pid < 0) {
+        perror("failed to fork");
+        exit(1);
+    }
+    if (pid == 0) {
+        if (sync) setenv("HBH_NO_ASYNC", "1", 1);
+        if (on_stdin == 2) {
+            pipe_stdin(infile);
+        } else if (on_stdin) {
+            fd = open(infile, O_RDONLY);
+            dup2(fd, 0);
+        }
+        if (to_pipe) {
+            close(pipefd[0]);
+            dup2(pipefd[1], 1);
+        } else {
+            fd = open(outfile, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+            dup2(fd, 1);
+        }
+        execv(argv[0], argv);
+        perror(argv[0]);
+        _exit(127);
+    }
+    argv[argc] = NULL;
+
+    if (to_pipe) {
+        close(pipefd[1]);
+        fd = pipefd[0];
+    }
+    else {
+        waitpid(pid, &status, 0);
+        fd = open(outfile, O_RDONLY);
+    }
+    do {
+        if (total + 65536 > size) {
+            size = 2*size + 65536;
+            out = realloc(out, size);
+            if (out == NULL) {
+                perror("failed to allocate memory");
+                exit(1);
+            }
+        }
+        n = read(fd, out + total, size - total);
+        if (n > 0) total += (size_t)n;
+    } while (n > 0);
+    close(fd);
+    if (to_pipe) waitpid(pid, &status, 0);
+
+    *outlen = total;
+    if (!WIFEXITED(status) || (WEXITSTATUS(status) != 0)) {
+        free(out);
+        return NULL;
+    }
+    return out;
+}
+
+static int write_file(const char *name, const unsigned char *data, size_t len) {
+    FILE *fp = fopen(name, "wb");
+    if (fp == NULL) return -1;
+    if ((len > 0) && (fwrite(data, 1, len, fp) != len)) {
+        fclose(fp);
+        return -1;
+    }
+    return fclose(fp);
+}
+
+static unsigned char *read_file(const char *name, size_t *len) {
+    unsigned char *data;
+    struct stat st;
+    FILE *fp = fopen(name, "rb");
+
+    if (fp == NULL) return NULL;
+    if (fstat(fileno(fp), &st) != 0) {
+        fclose(fp);
+        return NULL;
+    }
+    *len = (size_t)st.st_size;
+    data = xmalloc(*len + 1);
+    if (fread(data, 1, *len, fp) != *len) {
+        free(data);
+        data = NULL;
+    }
+    fclose(fp);
+    return data;
+}
+
+/* Every route from -> to for this input against the oracle */
+static void test_case(uint64_t seed, const char *fromname, const char *toname, const unsigned char *in, size_t len) {
+    hbh_format from;
+    hbh_format to;
+    unsigned char *want;
+    unsigned char *got;
+    size_t wantlen;
+    size_t gotlen;
+    char infile[128];
+    char args[16][1100];
+    char *argv[20];
+    char what[1200];
+    int use_hbh;
+    int threads;
+    int level;
+    int f = 0;
+    int t = 0;
+
+    if ((hbh_format_parse(&from, fromname) != 0) || (hbh_format_parse(&to, toname) != 0)) {
+        fprintf(stderr,"bad format %s or %s\n", fromname, toname);
+        exit(1);
+    }
+    if (verbose) fprintf(stderr,"seed %llu: %s -> %s, %zu bytes\n", (unsigned long long)seed, fromname, toname, len);
+
+    want = ref_convert(&from, &to, in, len, &wantlen);
+    if (want == NULL) {
+        perror("failed to allocate memory");
+        exit(1);
+    }
+
+    for (level=0;level<=hbh_kernel_detect();level++) {
+        hbh_kernel_set(level);
+
+        got = run_converter(&from, &to, in, len, &gotlen);
+        snprintf(what, sizeof(what), "hbh_convert (%s)", hbh_kernel_name(level));
+        if (got == NULL) fail(seed, what, fromname, toname, len, NULL, 0, want, wantlen);
+        else check(seed, what, fromname, toname, len, got, gotlen, want, wantlen);
+        free(got);
+
+        got = run_fused(&from, &to, in, len, &gotlen);
+        snprintf(what, sizeof(what), "fused (%s)", hbh_kernel_name(level));
+        if (got != NULL) check(seed, what, fromname, toname, len, got, gotlen, want, wantlen);
+        free(got);
+
+        if ((from.format == HBH_HEX) && (to.format == HBH_BIN)) {
+            got = run_hex_chained(in, len, &gotlen);
+            snprintf(what, sizeof(what), "hex scan/chain (%s)", hbh_kernel_name(level));
+            check(seed, what, fromname, toname, len, got, gotlen, want, wantlen);
+            free(got);
+        }
+        if (from.format == HBH_BIN) {
+            got = run_seeked(&to, in, len, &gotlen);
+            snprintf(what, sizeof(what), "encode seek (%s)", hbh_kernel_name(level));
+            if (got != NULL) check(seed, what, fromname, toname, len, got, gotlen, want, wantlen);
+            free(got);
+        }
+    }
+
+    if (tooldir[0] != 0) {
+        snprintf(infile, sizeof(infile), "%s/in", tmpdir);
+        if (write_file(infile, in, len) != 0) {
+            perror("failed to write test input");
+            exit(1);
+        }
+        f = from.format;
+        t = to.format;
+        for (use_hbh=0;use_hbh<2;use_hbh++) {
+            threads = 0;
+            if (!use_hbh && (((f == HBH_HEX) && (t == HBH_BIN)) || ((f == HBH_BIN) && ((t == HBH_HEX) || (t == HBH_BITS)))))
+                threads = rnd_below(2) ? 1 + rnd_below(4) : 0;
+            level = rnd_below(hbh_kernel_detect() + 1);
+            tool_command(&from, &to, fromname, toname, use_hbh, threads, level, args, argv);
+            got = run_tool(argv, infile, rnd_below(3), rnd_below(2), rnd_below(2), &gotlen);
+            snprintf(what, sizeof(what), "tool %s%s -K %s", argv[0], threads ? " -j" : "", hbh_kernel_name(level));
+            if (got == NULL) fail(seed, what, fromname, toname, len, NULL, 0, want, wantlen);
+            else check(seed, what, fromname, toname, len, got, gotlen, want, wantlen);
+            free(got);
+        }
+    }
+    free(want);
+}
+
+/* The symbol statistics of binary to oddball, fed in random pieces as
+ * symbols and, for 1 bit symbols, as the packed binary */
+static void test_stats(uint64_t seed, const char *name, const unsigned char *bin, size_t len) {
+    hbh_format f;
+    hbh_format b;
+    hbh_stats want;
+    hbh_stats got;
+    unsigned char *sym;
+    size_t symlen;
+    size_t off;
+    size_t n;
+    size_t i;
+    uint64_t run = 0;
+    char what[64];
+    int level;
+    int packed;
+
+    /* Statistics take symbols of up to 8 bits */
+    hbh_format_parse(&f, name);
+    if (f.bps > 8) return;
+    hbh_format_parse(&b, "bin");
+    sym = ref_convert(&b, &f, bin, len, &symlen);
+    if (sym == NULL) {
+        perror("failed to allocate memory");
+        exit(1);
+    }
+
+    memset(&want, 0, sizeof(want));
+    for (i=0;i<symlen;i++) {
+        want.count[sym[i]]++;
+        run = ((i > 0) && (sym[i] == sym[i-1])) ? run + 1 : 1;
+        if ((i > 0) && (sym[i] != sym[i-1])) want.transitions++;
+        if (run > want.longest_run) want.longest_run = run;
+    }
+
+    for (level=0;level<=hbh_kernel_detect();level++) {
+        hbh_kernel_set(level);
+        for (packed=0;packed<=(f.bps == 1);packed++) {
+            hbh_stats_init(&got, f.bps);
+            if (packed) {
+                for (off=0;off<len;off+=n) {
+                    n = random_piece(len - off);
+                    hbh_stats_update_bits(&got, bin+off, n, f.reverse);
+                }
+            } else {
+                for (off=0;off<symlen;off+=n) {
+                    n = random_piece(symlen - off);
+                    hbh_stats_update(&got, sym+off, n);
+                }
+            }
+            hbh_stats_finish(&got);
+            if ((got.symbols != symlen) || (memcmp(got.count, want.count, sizeof(want.count)) != 0) ||
+                (got.transitions != want.transitions) || (got.longest_run != want.longest_run)) {
+                snprintf(what, sizeof(what), "hbh_stats%s (%s)", packed ? "_update_bits" : "", hbh_kernel_name(level));
+                fprintf(stderr,"FAIL seed %llu: %s bin -> %s, %zu bytes in: %llu transitions, longest run %llu, expected %llu, %llu\n",
+                        (unsigned long long)seed, what, name, len, (unsigned long long)got.transitions,
+                        (unsigned long long)got.longest_run, (unsigned long long)want.transitions,
+                        (unsigned long long)want.longest_run);
+                failures++;
+            }
+        }
+    }
+    free(sym);
+}
+
+/* The packed container: the reader against the oracle's symbols from a
+ * random first symbol for a random count and, with -d, bin2nistoddball
+ * --packed and nistoddball2bin --offset --length on what it writes */
+static void test_packed(uint64_t seed, const char *name, const unsigned char *bin, size_t len) {
+    hbh_format f;
+    hbh_format b;
+    hbh_pack_reader r;
+    unsigned char *packed;
+    unsigned char *sym;
+    unsigned char *got;
+    unsigned char *want;
+    size_t symlen;
+    size_t gotlen;
+    size_t wantlen;
+    size_t size;
+    size_t from;
+    size_t off;
+    size_t n;
+    uint64_t first;
+    uint64_t count;
+    char infile[128];
+    char args[12][1100];
+    char *argv[16];
+    int argc = 0;
+    int rev;
+
+    hbh_format_parse(&f, name);
+    hbh_format_parse(&b, "bin");
+    sym = ref_convert(&b, &f, bin, len, &symlen);
+    packed = xmalloc(HBH_PACK_HEADER + len);
+    hbh_pack_header(packed, f.bps, f.reverse, !f.bigendian, f.bigwords);
+    memcpy(packed + HBH_PACK_HEADER, bin, len);
+
+    /* In symbols, then in bytes of the oracle's output */
+    size = (size_t)oddball_size(&f);
+    symlen = symlen/size;
+    first = (uint64_t)rnd_below((int)symlen + 2);
+    count = rnd_below(2) ? UINT64_MAX : (uint64_t)rnd_below((int)symlen + 2);
+    from = (first < symlen) ? (size_t)first : symlen;
+    wantlen = ((uint64_t)(symlen - from) < count) ? symlen - from : (size_t)count;
+    from *= size;
+    wantlen *= size;
+
+    if (hbh_pack_reader_init(&r, packed, first, count) != 0) {
+        fprintf(stderr,"FAIL seed %llu: hbh_pack_reader_init bin -> %s\n", (unsigned long long)seed, name);
+        failures++;
+    } else {
+        got = xmalloc(hbh_pack_reader_bound(&r, len) + HBH_FINISH_BOUND);
+        gotlen = 0;
+        off = (hbh_pack_offset(f.bps, first) < len) ? (size_t)hbh_pack_offset(f.bps, first) : len;
+        for (;off<len;off+=n) {
+            n = random_piece(len - off);
+            gotlen += hbh_pack_reader_update(&r, bin+off, n, got+gotlen);
+        }
+        gotlen += hbh_pack_reader_finish(&r, got+gotlen);
+        check(seed, "hbh_pack_reader", "packed", name, len, got, gotlen, sym+from, wantlen);
+        free(got);
+    }
+
+    if (tooldir[0] != 0) {
+        snprintf(infile, sizeof(infile), "%s/in", tmpdir);
+        if (write_file(infile, bin, len) != 0) {
+            perror("failed to write test input");
+            exit(1);
+        }
+#define ARG(...) do { snprintf(args[argc], sizeof(args[0]), __VA_ARGS__); argv[argc] = args[argc]; argc++; } while (0)
+        ARG("%s/bin2nistoddball", tooldir);
+        ARG("-l"); ARG("%d", f.bps);
+        if (f.reverse) ARG("-r");
+        if (f.bigendian) ARG("-B");
+        if (f.bigwords) ARG("-b");
+        ARG("--packed");
+        argv[argc] = NULL;
+        got = run_tool(argv, infile, rnd_below(3), rnd_below(2), rnd_below(2), &gotlen);
+        if (got == NULL) fail(seed, "tool bin2nistoddball --packed", "bin", name, len, NULL, 0, packed, HBH_PACK_HEADER + len);
+        else check(seed, "tool bin2nistoddball --packed", "bin", name, len, got, gotlen, packed, HBH_PACK_HEADER + len);
+        free(got);
+
+        /* Read back to binary, in the header's bit order unless -r is
+         * given */
+        rev = rnd_below(2);
+        if (rev) f.reverse = 1;
+        want = ref_convert(&f, &b, sym+from, wantlen, &n);
+        if (write_file(infile, packed, HBH_PACK_HEADER + len) != 0) {
+            perror("failed to write test input");
+            exit(1);
+        }
+        argc = 0;
+        ARG("%s/nistoddball2bin", tooldir);
+        ARG("--offset=%llu", (unsigned long long)first);
+        if (count != UINT64_MAX) ARG("--length=%llu", (unsigned long long)count);
+        if (rev) ARG("-r");
+#undef ARG
+        argv[argc] = NULL;
+        got = run_tool(argv, infile, rnd_below(3), rnd_below(2), rnd_below(2), &gotlen);
+        if (got == NULL) fail(seed, "tool nistoddball2bin --offset", "packed", name, len, NULL, 0, want, n);
+        else check(seed, "tool nistoddball2bin --offset", "packed", name, len, got, gotlen, want, n);
+        free(got);
+        free(want);
+    }
+    free(packed);
+    free(sym);
+}
+
+/* bin2nistoddball --bits, --lsb and --stride: hbh_sampler at every
+ * kernel level, in random pieces, and with -d the tool, against the
+ * oracle's loop that skips bits and symbols */
+static void test_sample(uint64_t seed, const char *name, const unsigned char *bin, size_t len) {
+    hbh_format f;
+    hbh_sampler s;
+    unsigned char *want;
+    unsigned char *got;
+    size_t wantlen;
+    size_t gotlen;
+    size_t off;
+    size_t n;
+    char infile[128];
+    char what[64];
+    char kernel[64];
+    char list[32];
+    char args[16][1100];
+    char *argv[20];
+    int argc = 0;
+    int level;
+    int mask;
+    int stride;
+    int b;
+
+    hbh_format_parse(&f, name);
+    switch (rnd_below(4)) {
+        case 0:  mask = 1 << rnd_below(8); break;
+        case 1:  mask = 0xFF; break;
+        default: mask = 1 + rnd_below(255); break;
+    }
+    stride = rnd_below(3) ? 1 + rnd_below(rnd_below(2) ? 4 : 20) : 1 << rnd_below(5);
+
+    want = xmalloc(ORACLE_BOUND(len));
+    wantlen = ref_sample(bin, len, want, f.bps, f.reverse, !f.bigendian, f.bigwords, mask, stride);
+    snprintf(what, sizeof(what), "%s, bits 0x%02X, stride %d", name, mask, stride);
+
+    for (level=0;level<=hbh_kernel_detect();level++) {
+        hbh_kernel_set(level);
+        hbh_sample_init(&s, f.bps, f.reverse, !f.bigendian, f.bigwords, mask, stride);
+        got = xmalloc(hbh_sample_bound(&s, len) + HBH_FINISH_BOUND);
+        gotlen = 0;
+        for (off=0;off<len;off+=n) {
+            n = random_piece(len - off);
+            gotlen += hbh_sample_update(&s, bin+off, n, got+gotlen);
+        }
+        gotlen += hbh_sample_finish(&s, got+gotlen);
+        snprintf(kernel, sizeof(kernel), "hbh_sampler (%s)", hbh_kernel_name(level));
+        check(seed, kernel, "bin", what, len, got, gotlen, want, wantlen);
+        free(got);
+    }
+
+    if (tooldir[0] != 0) {
+        snprintf(infile, sizeof(infile), "%s/in", tmpdir);
+        if (write_file(infile, bin, len) != 0) {
+            perror("failed to write test input");
+            exit(1);
+        }
+#define ARG(...) do { snprintf(args[argc], sizeof(args[0]), __VA_ARGS__); argv[argc] = args[argc]; argc++; } while (0)
+        ARG("%s/bin2nistoddball", tooldir);
+        ARG("-l"); ARG("%d", f.bps);
+        if (f.reverse) ARG("-r");
+        if (f.bigendian) ARG("-B");
+        if (f.bigwords) ARG("-b");
+        ARG("-K"); ARG("%s", hbh_kernel_name(rnd_below(hbh_kernel_detect() + 1)));
+        if ((mask == 1) && rnd_below(2)) {
+            ARG("--lsb");
+        } else if ((mask != 0xFF) || rnd_below(2)) {
+            list[0] = 0;
+            for (b=0;b<8;b++) {
+                if (mask & (1 << b)) snprintf(list + strlen(list), sizeof(list) - strlen(list), "%s%d", list[0] ? "," : "", b);
+            }
+            ARG("--bits=%s", list);
+        }
+        if ((stride != 1) || rnd_below(2)) ARG("--stride=%d", stride);
+#undef ARG
+        argv[argc] = NULL;
+        got = run_tool(argv, infile, rnd_below(3), rnd_below(2), rnd_below(2), &gotlen);
+        if (got == NULL) fail(seed, "tool bin2nistoddball", "bin", what, len, NULL, 0, want, wantlen);
+        else check(seed, "tool bin2nistoddball", "bin", what, len, got, gotlen, want, wantlen);
+        free(got);
+    }
+    free(want);
+}
+
+/* --offset and --length, which count bytes of binary, numbers of
+ * decimal or oddball symbols. Text to binary goes through hbh_range with
+ * a random checkpoint step, once building the index and once reading it
+ * back, and with -d the tools are run with a random range too. */
+static void test_range(uint64_t seed, const char *fromname, const char *toname, const unsigned char *in, size_t len) {
+    hbh_format from;
+    hbh_format to;
+    hbh_format bin;
+    const hbh_format *text;
+    hbh_input input;
+    hbh_range range;
+    const unsigned char *data;
+    unsigned char *full;
+    unsigned char *want;
+    unsigned char *got;
+    size_t fulllen;
+    size_t wantlen;
+    size_t gotlen;
+    size_t unit;
+    size_t units;
+    size_t start;
+    size_t step;
+    long n;
+    uint64_t first;
+    uint64_t count;
+    char path[128];
+    char idxpath[140];
+    char args[16][1100];
+    char *argv[20];
+    char what[1200];
+    int argc;
+    int threads = 0;
+    int pass;
+
+    hbh_format_parse(&from, fromname);
+    hbh_format_parse(&to, toname);
+    hbh_format_parse(&bin, "bin");
+    text = (from.format == HBH_BIN) ? &to : &from;
+    unit = (text->format == HBH_DEC) ? (size_t)text->width : (text->format == HBH_ODDBALL) ? (size_t)oddball_size(text) : 1;
+
+    full = ref_convert(&from, &to, in, len, &fulllen);
+    if (full == NULL) {
+        perror("failed to allocate memory");
+        exit(1);
+    }
+
+    /* What the range picks out of the oracle's output, or of the input
+     * before the oracle for binary in and for oddball, which can end part
+     * way through a number or symbol group */
+    if (text->format == HBH_ODDBALL) units = ((from.format == HBH_BIN) ? fulllen : len)/unit;
+    else units = ((from.format == HBH_BIN) ? len : fulllen)/unit + 1;
+    first = (uint64_t)rnd_below((int)units + 2);
+    count = rnd_below(2) ? UINT64_MAX : (uint64_t)rnd_below((int)units + 2);
+    if (((from.format == HBH_BIN) && (text->format != HBH_ODDBALL)) || (from.format == HBH_ODDBALL)) {
+        start = (first*unit < len) ? (size_t)first*unit : len;
+        n = (long)(((uint64_t)(len - start)/unit < count) ? len - start : (size_t)count*unit);
+        want = ref_convert(&from, &to, in + start, (size_t)n, &wantlen);
+    } else {
+        start = (first*unit < fulllen) ? (size_t)first*unit : fulllen;
+        wantlen = ((uint64_t)(fulllen - start)/unit < count) ? fulllen - start : (size_t)count*unit;
+        want = xmalloc(wantlen + 1);
+        memcpy(want, full + start, wantlen);
+    }
+
+    /* The index is kept next to the file, so it has to be a file */
+    if (tooldir[0] != 0) snprintf(path, sizeof(path), "%s/range", tmpdir);
+    else snprintf(path, sizeof(path), "/tmp/hbh_test_range.%d", (int)getpid());
+    snprintf(idxpath, sizeof(idxpath), "%s.hbhidx", path);
+    unlink(idxpath);
+    if (write_file(path, in, len) != 0) {
+        perror("failed to write test input");
+        exit(1);
+    }
+
+    if ((to.format == HBH_BIN) && (from.format != HBH_ODDBALL)) {
+        step = 1 + (size_t)rnd_below(rnd_below(2) ? 64 : 4096);
+        for (pass=0;pass<2;pass++) {
+            if (hbh_input_open(&input, path) != 0) {
+                perror("failed to open test input");
+                exit(1);
+            }
+            if (hbh_range_open(&range, &input, path, &from, first*unit,
+                               (count > UINT64_MAX/unit) ? UINT64_MAX : count*unit, step) != 0) {
+                fail(seed, "hbh_range_open", fromname, toname, len, NULL, 0, want, wantlen);
+                hbh_input_close(&input);
+                break;
+            }
+            got = xmalloc(fulllen + hbh_range_bound(&range, 9001) + HBH_FINISH_BOUND);
+            gotlen = 0;
+            do {
+                n = hbh_input_next(&input, &data, 1 + (size_t)rnd_below(9000));
+                if (n > 0) gotlen += hbh_range_update(&range, data, (size_t)n, got + gotlen);
+            } while (n > 0);
+            gotlen += hbh_range_finish(&range, got + gotlen);
+            snprintf(what, sizeof(what), "hbh_range step %zu, first %llu, %s", step,
+                     (unsigned long long)first, (pass == 0) ? "building" : "cached");
+            check(seed, what, fromname, toname, len, got, gotlen, want, wantlen);
+            if ((len > 0) && (first > 0) && (range.indexed != 2 - pass)) {
+                fprintf(stderr,"FAIL seed %llu: %s index %d\n", (unsigned long long)seed, what, range.indexed);
+                failures++;
+            }
+            free(got);
+            hbh_input_close(&input);
+        }
+        unlink(idxpath);
+    }
+
+    if (tooldir[0] != 0) {
+        if (((from.format == HBH_HEX) && (to.format == HBH_BIN)) ||
+            ((from.format == HBH_BIN) && ((to.format == HBH_HEX) || (to.format == HBH_BITS))))
+            threads = rnd_below(2) ? 1 + rnd_below(4) : 0;
+        argc = tool_command(&from, &to, fromname, toname, 0, threads, rnd_below(hbh_kernel_detect() + 1), args, argv);
+#define ARG(...) do { snprintf(args[argc], sizeof(args[0]), __VA_ARGS__); argv[argc] = args[argc]; argc++; } while (0)
+        ARG("--offset=%llu", (unsigned long long)first);
+        if (count != UINT64_MAX) ARG("--length=%llu", (unsigned long long)count);
+#undef ARG
+        argv[argc] = NULL;
+        for (pass=0;pass<2;pass++) {
+            got = run_tool(argv, path, (pass == 0) ? rnd_below(3) : 0, rnd_below(2), rnd_below(2), &gotlen);
+            snprintf(what, sizeof(what), "tool %s --offset %llu", argv[0], (unsigned long long)first);
+            if (got == NULL) fail(seed, what, fromname, toname, len, NULL, 0, want, wantlen);
+            else check(seed, what, fromname, toname, len, got, gotlen, want, wantlen);
+            free(got);
+        }
+        unlink(idxpath);
+    }
+    unlink(path);
+    free(want);
+    free(full);
+}
+
+/* Binary through a format and back keeps everything the format can hold */
+static void test_round_trip(uint64_t seed, const char *name, const unsigned char *bin, size_t len) {
+    hbh_format f;
+    hbh_format b;
+    unsigned char *text;
+    unsigned char *back;
+    size_t textlen;
+    size_t backlen;
+    size_t keep = len;
+
+    hbh_format_parse(&f, name);
+    hbh_format_parse(&b, "bin");
+    if (f.format == HBH_ODDBALL) keep = (((len*8)/f.bps)*f.bps)/8;
+    if (f.format == HBH_DEC) keep = (len/f.width)*f.width;
+
+    text = run_converter(&b, &f, bin, len, &textlen);
+    back = run_converter(&f, &b, text, textlen, &backlen);
+    check(seed, "round trip", name, "bin", len, back, backlen, bin, keep);
+    free(text);
+    free(back);
+}
+
+/* Batch mode over a handful of files, named by a glob or a manifest, on a
+ * random number of threads, each output against the oracle */
+static void test_batch(uint64_t seed) {
+    hbh_format from;
+    hbh_format to;
+    char fromname[64];
+    char toname[64];
+    char args[24][1100];
+    char *argv[30];
+    char path[1200];
+    char what[1200];
+    unsigned char *in;
+    unsigned char *want;
+    unsigned char *got;
+    size_t lens[8];
+    size_t wantlen;
+    size_t gotlen;
+    FILE *fp;
+    pid_t pid;
+    int status;
+    int files;
+    int argc;
+    int round;
+    int i;
+
+    in = xmalloc(8*200000);
+    for (round=0;round<8;round++) {
+        rng = (seed + (uint64_t)round) * 0x9E3779B97F4A7C15ULL + 7;
+        random_format(fromname, sizeof(fromname), 1);
+        random_format(toname, sizeof(toname), strcmp(fromname, "bin") != 0);
+        hbh_format_parse(&from, fromname);
+        hbh_format_parse(&to, toname);
+        files = 1 + rnd_below(8);
+
+        snprintf(path, sizeof(path), "%s/list", tmpdir);
+        fp = fopen(path, "w");
+        if (fp == NULL) {
+            perror("failed to write test input");
+            exit(1);
+        }
+        for (i=0;i<files;i++) {
+            lens[i] = random_length();
+            random_input(&from, in + (size_t)i*200000, lens[i]);
+            snprintf(path, sizeof(path), "%s/in%d.src", tmpdir, i);
+            if (write_file(path, in + (size_t)i*200000, lens[i]) != 0) {
+                perror("failed to write test input");
+                exit(1);
+            }
+            fprintf(fp, "%s\n", path);
+        }
+        fclose(fp);
+
+        argc = tool_command(&from, &to, fromname, toname, rnd_below(2), 0, rnd_below(hbh_kernel_detect() + 1), args, argv);
+#define ARG(...) do { snprintf(args[argc], sizeof(args[0]), __VA_ARGS__); argv[argc] = args[argc]; argc++; } while (0)
+        if (rnd_below(2)) ARG("--batch=%s/*.src", tmpdir);
+        else ARG("--batch=@%s/list", tmpdir);
+        ARG("--batch-out=%%d/batch/%%b.%%e");
+        ARG("--batch-jobs=%d", 1 + rnd_below(4));
+#undef ARG
+        argv[argc] = NULL;
+
+        pid = fork();
+        if (pid < 0) {
+            perror("failed to fork");
+            exit(1);
+        }
+        if (pid == 0) {
+            execv(argv[0], argv);
+            perror(argv[0]);
+            _exit(127);
+        }
+        waitpid(pid, &status, 0);
+        snprintf(what, sizeof(what), "batch %s", argv[0]);
+
+        for (i=0;i<files;i++) {
+            want = ref_convert(&from, &to, in + (size_t)i*200000, lens[i], &wantlen);
+            snprintf(path, sizeof(path), "%s/batch/in%d.%s", tmpdir, i,
+                     (to.format == HBH_BIN) ? "bin" : (to.format == HBH_HEX) ? "hex" :
+                     (to.format == HBH_BITS) ? "01" : (to.format == HBH_ODDBALL) ? "nist" : "dec");
+            got = read_file(path, &gotlen);
+            if ((got == NULL) || !WIFEXITED(status) || (WEXITSTATUS(status) != 0))
+                fail(seed + (uint64_t)round, what, fromname, toname, lens[i], NULL, 0, want, wantlen);
+            else check(seed + (uint64_t)round, what, fromname, toname, lens[i], got, gotlen, want, wantlen);
+            free(got);
+            free(want);
+            unlink(path);
+            snprintf(path, sizeof(path), "%s/in%d.src", tmpdir, i);
+            unlink(path);
+        }
+        snprintf(path, sizeof(path), "%s/batch", tmpdir);
+        rmdir(path);
+        snprintf(path, sizeof(path), "%s/list", tmpdir);
+        unlink(path);
+    }
+    free(in);
+}
+
+/* Two inputs with the same name in different directories give the same
+ * output with %b, so the batch must fail both and convert the rest */
+static void test_batch_clash(uint64_t seed) {
+    static const char *names[3] = { "c1/a.bin", "c2/a.bin", "c1/b.bin" };
+    hbh_format bin;
+    hbh_format hex;
+    unsigned char in[3][1000];
+    unsigned char *want;
+    unsigned char *got;
+    size_t wantlen;
+    size_t gotlen;
+    char path[1200];
+    char *argv[6];
+    char args[5][1100];
+    FILE *fp;
+    pid_t pid;
+    int status;
+    int i;
+
+    rng = seed * 0x9E3779B97F4A7C15ULL + 11;
+    hbh_format_parse(&bin, "bin");
+    hbh_format_parse(&hex, "hex");
+    snprintf(path, sizeof(path), "%s/c1", tmpdir);
+    mkdir(path, 0777);
+    snprintf(path, sizeof(path), "%s/c2", tmpdir);
+    mkdir(path, 0777);
+    snprintf(path, sizeof(path), "%s/list", tmpdir);
+    fp = fopen(path, "w");
+    if (fp == NULL) {
+        perror("failed to write test input");
+        exit(1);
+    }
+    for (i=0;i<3;i++) {
+        random_input(&bin, in[i], sizeof(in[i]));
+        snprintf(path, sizeof(path), "%s/%s", tmpdir, names[i]);
+        if (write_file(path, in[i], (i == 1) ? 5 : sizeof(in[i])) != 0) {
+            perror("failed to write test input");
+            exit(1);
+        }
+        fprintf(fp, "%s\n", path);
+    }
+    fclose(fp);
+
+    snprintf(args[0], sizeof(args[0]), "%s/bin2hex", tooldir);
+    snprintf(args[1], sizeof(args[1]), "--batch=@%s/list", tmpdir);
+    snprintf(args[2], sizeof(args[2]), "--batch-out=%s/clash/%%b.%%e", tmpdir);
+    snprintf(args[3], sizeof(args[3]), "--batch-jobs=2");
+    for (i=0;i<4;i++) argv[i] = args[i];
+    argv[4] = NULL;
+    pid = fork();
+    if (pid < 0) {
+        perror("failed to fork");
+        exit(1);
+    }
+    if (pid == 0) {
+        if (freopen("/dev/null", "w", stderr) == NULL) _exit(127);
+        execv(argv[0], argv);
+        _exit(127);
+    }
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || (WEXITSTATUS(status) != 1)) {
+        fprintf(stderr,"FAIL seed %llu: batch with two inputs to one output didn't fail\n", (unsigned long long)seed);
+        failures++;
+    }
+    snprintf(path, sizeof(path), "%s/clash/a.hex", tmpdir);
+    if (access(path, F_OK) == 0) {
+        fprintf(stderr,"FAIL seed %llu: batch wrote %s for two inputs\n", (unsigned long long)seed, path);
+        failures++;
+    }
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/clash/b.hex", tmpdir);
+    got = read_file(path, &gotlen);
+    want = ref_convert(&bin, &hex, in[2], sizeof(in[2]), &wantlen);
+    if (got == NULL) fail(seed, "batch clash", "bin", "hex", sizeof(in[2]), NULL, 0, want, wantlen);
+    else check(seed, "batch clash", "bin", "hex", sizeof(in[2]), got, gotlen, want, wantlen);
+    free(got);
+    free(want);
+    unlink(path);
+    for (i=0;i<3;i++) {
+        snprintf(path, sizeof(path), "%s/%s", tmpdir, names[i]);
+        unlink(path);
+    }
+    snprintf(path, sizeof(path), "%s/list", tmpdir);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/clash", tmpdir);
+    rmdir(path);
+    snprintf(path, sizeof(path), "%s/c1", tmpdir);
+    rmdir(path);
+    snprintf(path, sizeof(path), "%s/c2", tmpdir);
+    rmdir(path);
+}
+
+/* Run a tool on empty input with its output thrown away. Returns its
+ * exit status, or -1 if it didn't exit. */
+static int tool_status(char **argv) {
+    pid_t pid;
+    int status;
+
+    pid = fork();
+    if (pid < 0) {
+        perror("failed to fork");
+        exit(1);
+    }
+    if (pid == 0) {
+        if (freopen("/dev/null", "r", stdin) == NULL) _exit(127);
+        if (freopen("/dev/null", "w", stdout) == NULL) _exit(127);
+        if (freopen("/dev/null", "w", stderr) == NULL) _exit(127);
+        execv(argv[0], argv);
+        _exit(127);
+    }
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status)) return -1;
+    return WEXITSTATUS(status);
+}
+
+/* Option values the tools must refuse rather than run with */
+static void test_bad_args(uint64_t seed) {
+    static const char *tools[] = { "012bin", "bin201", "bin2dec", "bin2hex", "bin2nistoddball",
+                                   "dec2bin", "hex2bin", "nistoddball2bin" };
+    static const char *bad[] = { "--offset=-1", "--offset=12x", "--offset=", "--offset=0x10",
+                                 "--length=-5", "--length=99999999999999999999", "--length=1e3" };
+    static const char *threaded[] = { "bin201", "bin2hex", "hex2bin" };
+    static const char *badj[][2] = { { "-j", "0" }, { "-j", "257" }, { "-j", "-3" }, { "-j2", "--batch=none" } };
+    char tool[1100];
+    char *argv[4];
+    int status;
+    size_t i;
+    size_t j;
+
+    for (i=0;i<sizeof(tools)/sizeof(tools[0]);i++) {
+        snprintf(tool, sizeof(tool), "%s/%s", tooldir, tools[i]);
+        for (j=0;j<sizeof(bad)/sizeof(bad[0]);j++) {
+            argv[0] = tool;
+            argv[1] = (char *)bad[j];
+            argv[2] = NULL;
+            status = tool_status(argv);
+            if (status != 1) {
+                fprintf(stderr,"FAIL seed %llu: %s %s exited %d, not 1\n",
+                        (unsigned long long)seed, tools[i], bad[j], status);
+                failures++;
+            }
+        }
+    }
+    for (i=0;i<sizeof(threaded)/sizeof(threaded[0]);i++) {
+        snprintf(tool, sizeof(tool), "%s/%s", tooldir, threaded[i]);
+        for (j=0;j<sizeof(badj)/sizeof(badj[0]);j++) {
+            argv[0] = tool;
+            argv[1] = (char *)badj[j][0];
+            argv[2] = (char *)badj[j][1];
+            argv[3] = NULL;
+            status = tool_status(argv);
+            if (status != 1) {
+                fprintf(stderr,"FAIL seed %llu: %s %s %s exited %d, not 1\n",
+                        (unsigned long long)seed, threaded[i], badj[j][0], badj[j][1], status);
+                failures++;
+            }
+        }
+    }
+}
+
+/* The -j tools split input in 4MB chunks, so a few cases big enough to
+ * give every thread some */
+static void test_large(uint64_t seed) {
+    static const char *formats[][2] = { { "hex", "bin" }, { "bin", "hex:32" }, { "bin", "01:64:s" }, { "bin", "01:7:be" } };
+    hbh_format from;
+    unsigned char *in;
+    size_t len;
+    int i;
+
+    in = xmalloc(LARGE_SIZE);
+    for (i=0;i<4;i++) {
+        rng = (seed + (uint64_t)i) * 0x9E3779B97F4A7C15ULL + 1;
+        len = LARGE_SIZE - (size_t)rnd_below(4096);
+        hbh_format_parse(&from, formats[i][0]);
+        random_input(&from, in, len);
+        test_case(seed + (uint64_t)i, formats[i][0], formats[i][1], in, len);
+    }
+    free(in);
+}
+
+/********
+* main() is mostly about parsing and qualifying the command line options.
+*/
+
+int main(int argc, char** argv)
+{
+    int opt;
+    int longIndex;
+    long iterations = 1000;
+    uint64_t seed = 1;
+    long i;
+    unsigned char *in;
+    char fromname[32];
+    char toname[32];
+    char path[128];
+    hbh_format from;
+    size_t len;
+
+    tooldir[0] = (char)0;
+
+    char optString[] = "n:s:d:vh";
+    static const struct option longOpts[] = {
+    { "iterations", required_argument, NULL, 'n' },
+    { "seed", required_argument, NULL, 's' },
+    { "tools", required_argument, NULL, 'd' },
+    { "verbose", no_argument, NULL, 'v' },
+    { "help", no_argument, NULL, 'h' },
+    { NULL, no_argument, NULL, 0 }
+    };
+
+    opt = getopt_long( argc, argv, optString, longOpts, &longIndex );
+    while( opt != -1 ) {
+        switch( opt ) {
+            case 'n':
+                iterations = atol(optarg);
+                break;
+            case 's':
+                seed = strtoull(optarg, NULL, 0);
+                break;
+            case 'd':
+                snprintf(tooldir, sizeof(tooldir), "%s", optarg);
+                break;
+            case 'v':
+                verbose = 1;
+                break;
+            case 'h':   /* fall-through is intentional */
+            case '?':
+                display_usage();
+                exit(0);
+
+            default:
+                /* You won't actually get here. */
+                break;
+        }
+        opt = getopt_long( argc, argv, optString, longOpts, &longIndex );
+    }
+
+    if (tooldir[0] != 0) {
+        snprintf(tmpdir, sizeof(tmpdir), "/tmp/hbh_test.XXXXXX");
+        if (mkdtemp(tmpdir) == NULL) {
+            perror("failed to make a temporary directory");
+            exit(1);
+        }
+    }
+
+    in = xmalloc(200000);
+    for (i=0;i<iterations;i++) {
+        rng = (seed + (uint64_t)i) * 0x9E3779B97F4A7C15ULL + 1;
+        random_format(fromname, sizeof(fromname), 1);
+        random_format(toname, sizeof(toname), strcmp(fromname, "bin") != 0);
+        len = random_length();
+        hbh_format_parse(&from, fromname);
+        random_input(&from, in, len);
+        test_case(seed + (uint64_t)i, fromname, toname, in, len);
+
+        if (strcmp(fromname, "bin") == 0) test_round_trip(seed + (uint64_t)i, toname, in, len);
+        if ((strcmp(fromname, "bin") == 0) || (strcmp(toname, "bin") == 0)) test_range(seed + (uint64_t)i, fromname, toname, in, len);
+        if ((strcmp(fromname, "bin") == 0) && (strncmp(toname, "oddball", 7) == 0)) {
+            test_stats(seed + (uint64_t)i, toname, in, len);
+            test_packed(seed + (uint64_t)i, toname, in, len);
+            test_sample(seed + (uint64_t)i, toname, in, len);
+        }
+    }
+    free(in);
+
+    if (tooldir[0] != 0) {
+        test_large(seed);
+        test_batch(seed);
+        test_batch_clash(seed);
+        test_bad_args(seed);
+        snprintf(path, sizeof(path), "%s/in", tmpdir);
+        unlink(path);
+        snprintf(path, sizeof(path), "%s/out", tmpdir);
+        unlink(path);
+        rmdir(tmpdir);
+    }
+
+    if (failures > 0) {
+        fprintf(stderr,"%d failures in %ld cases\n", failures, iterations);
+        return 1;
+    }
+    fprintf(stderr,"All %ld cases passed\n", iterations);
+    return 0;
+}
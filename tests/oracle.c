@@ -0,0 +1,461 @@
+/*
+    oracle.c - Reference scalar converters for the hexbinhex tests.
+
+    Copyright (C) 2017  David Johnston
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    -----
+
+    Contact. David Johnston dj@deadhat.com
+*/
+
+/*
+ * These are the main() loops of the tools as they were before the
+ * library, with the reads and writes taken out. They are deliberately
+ * slow and simple. The only changes are where the originals could go
+ * wrong on input the tools now accept:
+ *
+ *   012bin reset its partial byte at every 512 character read, losing
+ *   the bits of a byte split across reads. Taking the input as one read
+ *   gives the intended result.
+ *
+ *   dec2bin kept the digits of a number in a 256 byte buffer. Leading
+ *   zeros are dropped here and digits past the 255th ignored, which
+ *   sscanf() would have saturated to UINT64_MAX anyway.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+#include "oracle.h"
+
+/* hex2bin */
+
+static int ishex(char ch) {
+    if ((ch > 0x2f) && (ch < 0x3a)) return 1; /* digits */
+    if ((ch > 0x40) && (ch < 0x47)) return 1; /* A-F */
+    if ((ch > 0x60) && (ch < 0x67)) return 1; /* a-f */
+    return 0;
+}
+
+static int hextobyte(char *astr) {
+    char cha;
+    int result=0;
+    int i;
+
+    for (i=0;i<2;i++){
+        cha = astr[i];
+        result = result << 4;
+        if ((cha > 0x2f) && (cha < 0x3a)) result += (cha - 0x30);
+        else if ((cha > 0x40) && (cha < 0x47)) result += (cha + 0x0A - 0x41);
+        else if ((cha > 0x60) && (cha < 0x67)) result += (cha + 0x0A - 0x61);
+    }
+    return result;
+}
+
+size_t ref_hex2bin(const unsigned char *in, size_t len, unsigned char *out) {
+    size_t outindex = 0;
+    size_t inindex;
+    int charcount = 0;
+    char hexchars[2];
+    char achar;
+
+    hexchars[0] = ' ';
+    hexchars[1] = ' ';
+
+    for (inindex=0;inindex<len;inindex++) {
+        achar = (char)in[inindex];
+
+        if (ishex(achar)) hexchars[charcount++]=achar;
+
+        /* we last got 0 and the next is x - hence 0x */
+        if ((hexchars[0]=='0') && (achar=='x') && (charcount==1)) {
+            charcount = 0; /* skip 0x prefixes */
+        }
+
+        if (charcount == 2) {
+            out[outindex++] = (unsigned char)hextobyte(hexchars);
+            charcount = 0;
+        }
+    }
+    return outindex;
+}
+
+/* bin2hex */
+
+size_t ref_bin2hex(const unsigned char *in, size_t len, unsigned char *out, int width) {
+    size_t outindex = 0;
+    size_t i;
+    int bytecount = 0;
+    int lastcharnl = 0;
+    char pair[3];
+
+    for (i=0;i<len;i++) {
+        bytecount++;
+
+        sprintf(pair,"%02X",in[i]);
+        out[outindex++] = pair[0];
+        out[outindex++] = pair[1];
+
+        if (bytecount==width) {
+            out[outindex++] = '\n';
+            bytecount=0;
+            lastcharnl = 1;
+        }
+        else {
+            lastcharnl = 0;
+        }
+    }
+
+    if (lastcharnl==0) out[outindex++] = '\n';
+    return outindex;
+}
+
+/* bin201 */
+
+size_t ref_bin201(const unsigned char *in, size_t len, unsigned char *out, int width, int spaces, int littleendian) {
+    size_t outindex = 0;
+    size_t i;
+    int j;
+    int abyte;
+    int bitcount = 0;
+    int lastcharnl = 0;
+    int first = 1;
+    char binch;
+
+    for (i=0;i<len;i++) {
+        abyte = in[i];
+        for (j=0;j<8;j++) {
+            if (littleendian == 1) {
+                binch = (((abyte >> j) & 0x01) == 0) ? '0' : '1';
+            } else {
+                binch = (((abyte >> (7-j)) & 0x01) == 0) ? '0' : '1';
+            }
+            bitcount++;
+
+            out[outindex++] = binch;
+
+            if (bitcount==width) {
+                out[outindex++] = '\n';
+                bitcount=0;
+                lastcharnl = 1;
+                first = 1;
+            }
+            else {
+                lastcharnl = 0;
+                if ((spaces==1) && ((bitcount % 8)==0) && (bitcount > 1) && (first==0)) {
+                    out[outindex++] = ' ';
+                }
+                else
+                {
+                    first = 0;
+                }
+            }
+        }
+    }
+
+    if (lastcharnl==0) out[outindex++] = '\n';
+    return outindex;
+}
+
+/* 012bin */
+
+size_t ref_012bin(const unsigned char *in, size_t len, unsigned char *out, int littleendian) {
+    size_t outindex = 0;
+    size_t i;
+    int bitcount = 0;
+    int abyte = 0;
+    int skip;
+    char binch;
+
+    /* We can't turn less than 8 bits into a byte. */
+    if (len < 8) return 0;
+
+    for (i=0;i<len;i++) {
+        binch = (char)in[i];
+        skip=0;
+
+        if (littleendian==1) {
+            if (binch=='0') abyte = (abyte >> 1) & 0xff;
+            else if (binch=='1') abyte = ((abyte >> 1) & 0xff) | 0x80;
+            else skip=1;
+        } else {
+            if (binch=='0') abyte = (abyte << 1) & 0xff;
+            else if (binch=='1') abyte = ((abyte << 1) & 0xff) | 0x01;
+            else skip=1;
+        }
+
+        if (skip==0) {
+            bitcount +=1;
+            if (bitcount == 8) {
+                out[outindex++] = (unsigned char)abyte;
+                bitcount = 0;
+            }
+        }
+    }
+    return outindex;
+}
+
+/* bin2nistoddball. The bit FIFO is only ever as deep as one symbol, so a
+ * shift register does the same job. Symbols over 8 bits go out as 2 or
+ * 4 byte words. */
+
+size_t ref_bin2nistoddball(const unsigned char *in, size_t len, unsigned char *out, int bps, int reverse, int littleendian,
+                           int bigwords) {
+    size_t outindex = 0;
+    size_t i;
+    int j;
+    int k;
+    int abyte;
+    uint32_t abit;
+    uint32_t symbol = 0;
+    int nbits = 0;
+    int size = (bps > 16) ? 4 : (bps > 8) ? 2 : 1;
+
+    for (i=0;i<len;i++) {
+        abyte = in[i];
+        for (j=0;j<8;j++) {
+            if (reverse==0) {
+                abit = (abyte & 0x01);
+                abyte = abyte >> 1;
+            } else {
+                abit = (abyte & 0x80) >> 7;
+                abyte = abyte << 1;
+            }
+
+            if (littleendian==1) {
+                symbol = symbol | (abit << nbits);
+            } else {
+                symbol = (symbol << 1) | abit;
+            }
+            nbits++;
+
+            if (nbits == bps) {
+                for (k=0;k<size;k++) {
+                    out[outindex + ((bigwords==1) ? size-1-k : k)] = (unsigned char)(symbol >> (8*k));
+                }
+                outindex += size;
+                symbol = 0;
+                nbits = 0;
+            }
+        }
+    }
+    return outindex;
+}
+
+/* bin2nistoddball --bits and --stride: the same loop, skipping the bits
+ * not in mask and writing only every stride-th symbol */
+
+size_t ref_sample(const unsigned char *in, size_t len, unsigned char *out, int bps, int reverse, int littleendian,
+                  int bigwords, int mask, int stride) {
+    size_t outindex = 0;
+    size_t i;
+    uint64_t made = 0;
+    int j;
+    int k;
+    int pos;
+    uint32_t abit;
+    uint32_t symbol = 0;
+    int nbits = 0;
+    int size = (bps > 16) ? 4 : (bps > 8) ? 2 : 1;
+
+    for (i=0;i<len;i++) {
+        for (j=0;j<8;j++) {
+            pos = (reverse==0) ? j : 7-j;
+            if ((mask & (1 << pos)) == 0) continue;
+            abit = (in[i] >> pos) & 0x01;
+
+            if (littleendian==1) {
+                symbol = symbol | (abit << nbits);
+            } else {
+                symbol = (symbol << 1) | abit;
+            }
+            nbits++;
+
+            if (nbits == bps) {
+                if (made % (uint64_t)stride == 0) {
+                    for (k=0;k<size;k++) {
+                        out[outindex + ((bigwords==1) ? size-1-k : k)] = (unsigned char)(symbol >> (8*k));
+                    }
+                    outindex += size;
+                }
+                made++;
+                symbol = 0;
+                nbits = 0;
+            }
+        }
+    }
+    return outindex;
+}
+
+/* nistoddball2bin */
+
+size_t ref_nistoddball2bin(const unsigned char *in, size_t len, unsigned char *out, int bps, int reverse, int littleendian,
+                           int bigwords) {
+    size_t outindex = 0;
+    size_t i;
+    int j;
+    int k;
+    uint32_t aword;
+    int abit;
+    int obyte = 0;
+    int nbits = 0;
+    int size = (bps > 16) ? 4 : (bps > 8) ? 2 : 1;
+
+    for (i=0;i+size<=len;i+=size) {
+        aword = 0;
+        for (k=0;k<size;k++) {
+            aword |= (uint32_t)in[i + ((bigwords==1) ? size-1-k : k)] << (8*k);
+        }
+
+        /* If big endian, shift the symbol to the top of the word so
+         * that the MSB can be plucked off from there. */
+        if (littleendian==0) {
+            aword = aword << (32-bps);
+        }
+
+        for (j=0;j<bps;j++) {
+            if (littleendian==1) {
+                abit = (int)(aword & 0x01);
+                aword = aword >> 1;
+            } else {
+                abit = (int)(aword >> 31);
+                aword = aword << 1;
+            }
+
+            if (reverse==0) {
+                obyte = obyte + (abit << nbits);
+            } else {
+                obyte = (obyte << 1) | abit;
+            }
+            nbits++;
+
+            if (nbits == 8) {
+                out[outindex++] = (unsigned char)obyte;
+                obyte = 0;
+                nbits = 0;
+            }
+        }
+    }
+    return outindex;
+}
+
+/* bin2dec. A partial word at the end is dropped. */
+
+size_t ref_bin2dec(const unsigned char *in, size_t len, unsigned char *out, int width, int bigendian) {
+    size_t outindex = 0;
+    size_t i;
+    int j;
+    uint64_t word;
+
+    for (i=0;i+width<=len;i+=width) {
+        word = 0;
+        for (j=0;j<width;j++) {
+            if (bigendian==0)
+                word |= (uint64_t)in[i+j] << (8*j);
+            else
+                word |= (uint64_t)in[i+j] << (8*(width-j-1));
+        }
+        outindex += sprintf((char *)out+outindex, "%" PRIu64 "\n", word);
+    }
+    return outindex;
+}
+
+/* dec2bin */
+
+static size_t finish_digits(char *digits, int *digitcount, unsigned char *out, int bwidth, int bigendian) {
+    uint64_t thenumber;
+    int i;
+
+    if (*digitcount == 0) return 0;
+    digits[*digitcount] = 0x00;
+    *digitcount = 0;
+    if (sscanf(digits,"%" SCNu64 ,&thenumber) != 1) return 0;
+
+    for (i=0;i<bwidth;i++) {
+        if (bigendian == 1)
+            out[i] = (unsigned char)(thenumber >> (8*(bwidth-i-1)));
+        else
+            out[i] = (unsigned char)(thenumber >> (8*i));
+    }
+    return (size_t)bwidth;
+}
+
+size_t ref_dec2bin(const unsigned char *in, size_t len, unsigned char *out, int width, int bigendian) {
+    size_t outindex = 0;
+    size_t i;
+    char digits[256];
+    int digitcount = 0;
+    char ch;
+
+    for (i=0;i<len;i++) {
+        ch = (char)in[i];
+
+        if ((ch > 0x2F) && (ch < 0x3a)) {
+            if ((digitcount == 1) && (digits[0] == '0')) digitcount = 0;
+            if (digitcount < 255) digits[digitcount++] = ch;
+        }
+        else {
+            outindex += finish_digits(digits, &digitcount, out+outindex, width, bigendian);
+        }
+    }
+    outindex += finish_digits(digits, &digitcount, out+outindex, width, bigendian);
+    return outindex;
+}
+
+/* Any to any, through binary */
+
+static size_t ref_decode(const hbh_format *f, const unsigned char *in, size_t len, unsigned char *out) {
+    switch (f->format) {
+        case HBH_HEX:     return ref_hex2bin(in, len, out);
+        case HBH_BITS:    return ref_012bin(in, len, out, !f->bigendian);
+        case HBH_ODDBALL: return ref_nistoddball2bin(in, len, out, f->bps, f->reverse, !f->bigendian, f->bigwords);
+        case HBH_DEC:     return ref_dec2bin(in, len, out, f->width, f->bigendian);
+        default:
+            memcpy(out, in, len);
+            return len;
+    }
+}
+
+static size_t ref_encode(const hbh_format *f, const unsigned char *in, size_t len, unsigned char *out) {
+    switch (f->format) {
+        case HBH_HEX:     return ref_bin2hex(in, len, out, f->width);
+        case HBH_BITS:    return ref_bin201(in, len, out, f->width, f->spaces, !f->bigendian);
+        case HBH_ODDBALL: return ref_bin2nistoddball(in, len, out, f->bps, f->reverse, !f->bigendian, f->bigwords);
+        case HBH_DEC:     return ref_bin2dec(in, len, out, f->width, f->bigendian);
+        default:
+            memcpy(out, in, len);
+            return len;
+    }
+}
+
+/* Decimal decodes to at most 4 bytes per input character */
+unsigned char *ref_convert(const hbh_format *from, const hbh_format *to, const unsigned char *in, size_t len, size_t *outlen) {
+    unsigned char *bin;
+    unsigned char *out;
+    size_t n;
+
+    bin = malloc(4*len + 64);
+    if (bin == NULL) return NULL;
+    n = ref_decode(from, in, len, bin);
+    out = malloc(ORACLE_BOUND(n));
+    if (out != NULL) *outlen = ref_encode(to, bin, n, out);
+    free(bin);
+    return out;
+}
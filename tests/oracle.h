@@ -0,0 +1,69 @@
+/*
+    oracle.h - Reference scalar converters for the hexbinhex tests.
+
+    Copyright (C) 2017  David Johnston
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    -----
+
+    Contact. David Johnston dj@deadhat.com
+*/
+
+/*
+ * The conversion loops of the original tools, a byte and a bit at a time,
+ * kept as the reference the library and the tools are tested against.
+ * Each takes the whole input as if it were one read and returns the
+ * number of bytes written to out, which must have room for
+ * ORACLE_BOUND(len) bytes. Options are as in the tools:
+ *
+ *     ref_bin2hex           width bytes per line
+ *     ref_bin201            width bits per line, spaces, littleendian (-L)
+ *     ref_012bin            littleendian (-L)
+ *     ref_bin2nistoddball   bps, reverse (-r), littleendian (-L), bigwords (-b)
+ *     ref_nistoddball2bin   bps, reverse (-r), littleendian (-L), bigwords (-b)
+ *     ref_bin2dec           width bytes per number, bigendian (-b)
+ *     ref_dec2bin           width bytes per number, bigendian (-b)
+ *
+ * ref_convert() chains them for any pair of hbh formats, through binary,
+ * and returns the output in a buffer the caller frees.
+ */
+
+#ifndef ORACLE_H
+#define ORACLE_H
+
+#include <stddef.h>
+
+#include "hexbinhex.h"
+
+/* Enough for any of them: bin201 -w 1 writes 2 characters per bit. */
+#define ORACLE_BOUND(len) (24*(len) + 64)
+
+size_t ref_hex2bin(const unsigned char *in, size_t len, unsigned char *out);
+size_t ref_bin2hex(const unsigned char *in, size_t len, unsigned char *out, int width);
+size_t ref_bin201(const unsigned char *in, size_t len, unsigned char *out, int width, int spaces, int littleendian);
+size_t ref_012bin(const unsigned char *in, size_t len, unsigned char *out, int littleendian);
+size_t ref_bin2nistoddball(const unsigned char *in, size_t len, unsigned char *out, int bps, int reverse, int littleendian,
+                           int bigwords);
+size_t ref_sample(const unsigned char *in, size_t len, unsigned char *out, int bps, int reverse, int littleendian,
+                  int bigwords, int mask, int stride);
+size_t ref_nistoddball2bin(const unsigned char *in, size_t len, unsigned char *out, int bps, int reverse, int littleendian,
+                           int bigwords);
+size_t ref_bin2dec(const unsigned char *in, size_t len, unsigned char *out, int width, int bigendian);
+size_t ref_dec2bin(const unsigned char *in, size_t len, unsigned char *out, int width, int bigendian);
+
+unsigned char *ref_convert(const hbh_format *from, const hbh_format *to, const unsigned char *in, size_t len, size_t *outlen);
+
+#endif